@@ -6,96 +6,125 @@
  */
 
 #include "aruco_calibration.h"
+#include "sam_inference.h"
 #include <opencv2/aruco.hpp>
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
+#include <condition_variable>
 #include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
-#include <map>
+
+// ============================================================
+// CONTEXT
+// ============================================================
+
+// Detector state kept across frames: the dictionary and parameters are
+// built once and every buffer is reused, so steady-state calibration
+// allocates nothing outside OpenCV's own detector scratch.
+struct ArucoContext {
+    cv::Ptr<cv::aruco::Dictionary> dictionary;
+    cv::Ptr<cv::aruco::DetectorParameters> parameters;
+    ArucoDetectorConfig config = {};
+    cv::Mat gray;                                    // Converted input (RGB/RGBA only)
+    cv::Mat level;                                   // Downscaled input (multi-scale)
+    cv::Mat level_gray;
+    cv::Mat patch;                                   // Gray corner ROI (RGB/RGBA only)
+    std::vector<int> ids;
+    std::vector<std::vector<cv::Point2f>> corners;
+    
+    ArucoContext()
+        : dictionary(cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250)),
+          parameters(cv::aruco::DetectorParameters::create()) {
+        ids.reserve(16);
+        corners.reserve(16);
+    }
+};
+
+static const float ARUCO_DEFAULT_TARGET_MARKER_PX = 64.0f;
+
+// Markers smaller than this at the detection level lose their bits
+static const float ARUCO_MIN_LEVEL_SCALE = 1.5f;
 
 // ============================================================
 // HELPER FUNCTIONS
 // ============================================================
 
-static cv::Point2f compute_center(const std::vector<cv::Point2f>& corners) {
+static Point2f compute_center(const std::vector<cv::Point2f>& corners) {
     cv::Point2f center(0, 0);
     for (const auto& corner : corners) {
         center += corner;
     }
-    return center / static_cast<float>(corners.size());
+    center /= static_cast<float>(corners.size());
+    return {center.x, center.y};
 }
 
-static float compute_distance(const cv::Point2f& p1, const cv::Point2f& p2) {
+static float compute_distance(const Point2f& p1, const Point2f& p2) {
     float dx = p2.x - p1.x;
     float dy = p2.y - p1.y;
     return std::sqrt(dx * dx + dy * dy);
 }
 
-// ============================================================
-// ARUCO DETECTION
-// ============================================================
+// Wrap the input without converting it
+static cv::Mat input_view(const uint8_t* data, int width, int height, int stride, int format) {
+    void* pixels = const_cast<uint8_t*>(data);
+    switch (format) {
+        case ARUCO_FORMAT_GRAY:
+            return cv::Mat(height, width, CV_8UC1, pixels, stride > 0 ? stride : width);
+        case ARUCO_FORMAT_RGB:
+            return cv::Mat(height, width, CV_8UC3, pixels, stride > 0 ? stride : width * 3);
+        case ARUCO_FORMAT_RGBA:
+            return cv::Mat(height, width, CV_8UC4, pixels, stride > 0 ? stride : width * 4);
+        default:
+            return cv::Mat();
+    }
+}
 
-extern "C" bool aruco_detect_l_board(
-    const uint8_t* rgb_data,
-    int width,
-    int height,
+// cvtColor code to gray (-1 for gray input)
+static int gray_conversion(int format) {
+    switch (format) {
+        case ARUCO_FORMAT_RGB: return cv::COLOR_RGB2GRAY;
+        case ARUCO_FORMAT_RGBA: return cv::COLOR_RGBA2GRAY;
+        default: return -1;
+    }
+}
+
+// Store detected L-board markers (ids 0-2) in result
+static void collect_markers(
+    const std::vector<int>& ids,
+    const std::vector<std::vector<cv::Point2f>>& corners,
     ArucoCalibrationResult* result
 ) {
-    // Initialize result
-    std::memset(result, 0, sizeof(ArucoCalibrationResult));
-    result->board_detected = false;
-    
-    // Create OpenCV Mat from RGB data
-    cv::Mat image(height, width, CV_8UC3, const_cast<uint8_t*>(rgb_data));
-    
-    // Convert RGB to BGR (OpenCV format)
-    cv::Mat bgr;
-    cv::cvtColor(image, bgr, cv::COLOR_RGB2BGR);
-    
-    // Get ArUco dictionary (DICT_6X6_250)
-    cv::Ptr<cv::aruco::Dictionary> dictionary = 
-        cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250);
-    
-    // Detector parameters
-    cv::Ptr<cv::aruco::DetectorParameters> parameters = 
-        cv::aruco::DetectorParameters::create();
-    
-    // Detect markers
-    std::vector<int> ids;
-    std::vector<std::vector<cv::Point2f>> corners;
-    cv::aruco::detectMarkers(bgr, dictionary, corners, ids, parameters);
-    
-    if (ids.empty()) {
-        return false;
-    }
-    
-    // Extract markers 0, 1, 2
-    std::map<int, std::vector<cv::Point2f>> marker_positions;
-    
     for (size_t i = 0; i < ids.size(); i++) {
         int marker_id = ids[i];
-        if (marker_id >= 0 && marker_id <= 2) {
-            marker_positions[marker_id] = corners[i];
-            
-            // Store in result
-            ArucoMarker& marker = result->markers[marker_id];
-            marker.id = marker_id;
-            marker.detected = true;
-            for (int j = 0; j < 4; j++) {
-                marker.corners[j].x = corners[i][j].x;
-                marker.corners[j].y = corners[i][j].y;
-            }
-            cv::Point2f center = compute_center(corners[i]);
-            marker.center.x = center.x;
-            marker.center.y = center.y;
-            
+        if (marker_id < 0 || marker_id > 2) continue;
+        
+        ArucoMarker& marker = result->markers[marker_id];
+        if (!marker.detected) {
             result->num_markers_detected++;
         }
+        marker.id = marker_id;
+        marker.detected = true;
+        for (int j = 0; j < 4; j++) {
+            marker.corners[j].x = corners[i][j].x;
+            marker.corners[j].y = corners[i][j].y;
+        }
+        marker.center = compute_center(corners[i]);
     }
+}
+
+// Pixel distance between the best available marker pair -> ratio
+static bool compute_ratio(ArucoCalibrationResult* result) {
+    const ArucoMarker* markers = result->markers;
     
     // Need at least 2 markers
-    if (marker_positions.size() < 2) {
+    if (result->num_markers_detected < 2) {
         return false;
     }
     
@@ -105,25 +134,19 @@ extern "C" bool aruco_detect_l_board(
     const char* used_pair = "";
     
     // Strategy: Try pairs in order of preference
-    if (marker_positions.count(0) && marker_positions.count(1)) {
+    if (markers[0].detected && markers[1].detected) {
         // Case 1: 0-1 (main axis)
-        cv::Point2f p0 = compute_center(marker_positions[0]);
-        cv::Point2f p1 = compute_center(marker_positions[1]);
-        distance_px = compute_distance(p0, p1);
+        distance_px = compute_distance(markers[0].center, markers[1].center);
         used_pair = "0-1";
     }
-    else if (marker_positions.count(0) && marker_positions.count(2)) {
+    else if (markers[0].detected && markers[2].detected) {
         // Case 2: 0-2 (secondary axis)
-        cv::Point2f p0 = compute_center(marker_positions[0]);
-        cv::Point2f p2 = compute_center(marker_positions[2]);
-        distance_px = compute_distance(p0, p2);
+        distance_px = compute_distance(markers[0].center, markers[2].center);
         used_pair = "0-2";
     }
-    else if (marker_positions.count(1) && marker_positions.count(2)) {
+    else if (markers[1].detected && markers[2].detected) {
         // Case 3: 1-2 (diagonal)
-        cv::Point2f p1 = compute_center(marker_positions[1]);
-        cv::Point2f p2 = compute_center(marker_positions[2]);
-        distance_px = compute_distance(p1, p2);
+        distance_px = compute_distance(markers[1].center, markers[2].center);
         known_distance_mm *= std::sqrt(2.0f);  // Diagonal distance
         used_pair = "1-2";
     }
@@ -144,6 +167,495 @@ extern "C" bool aruco_detect_l_board(
     return true;
 }
 
+// ============================================================
+// MULTI-SCALE DETECTION
+// ============================================================
+
+// Downscale factor so the expected marker measures target_marker_px
+static float level_scale(const ArucoDetectorConfig& config, int width, int height) {
+    float expected = config.expected_marker_px > 0
+        ? config.expected_marker_px
+        : std::min(width, height) / 12.0f;
+    float target = config.target_marker_px > 0 ? config.target_marker_px : ARUCO_DEFAULT_TARGET_MARKER_PX;
+    return expected / target;
+}
+
+// Sub-pixel refinement of one marker's corners in the full-resolution
+// frame. Only the marker's bounding ROI is converted to gray.
+static void refine_corners(
+    ArucoContext* ctx,
+    const cv::Mat& input,
+    int format,
+    std::vector<cv::Point2f>& corners,
+    int window
+) {
+    float min_x = corners[0].x, max_x = corners[0].x;
+    float min_y = corners[0].y, max_y = corners[0].y;
+    for (const auto& p : corners) {
+        min_x = std::min(min_x, p.x);
+        max_x = std::max(max_x, p.x);
+        min_y = std::min(min_y, p.y);
+        max_y = std::max(max_y, p.y);
+    }
+    int margin = window + 2;
+    int x0 = std::max(0, static_cast<int>(std::floor(min_x)) - margin);
+    int y0 = std::max(0, static_cast<int>(std::floor(min_y)) - margin);
+    int x1 = std::min(input.cols, static_cast<int>(std::ceil(max_x)) + margin + 1);
+    int y1 = std::min(input.rows, static_cast<int>(std::ceil(max_y)) + margin + 1);
+    if (x1 - x0 < 2 * window + 1 || y1 - y0 < 2 * window + 1) return;
+    cv::Rect roi(x0, y0, x1 - x0, y1 - y0);
+    
+    cv::Mat patch;
+    int code = gray_conversion(format);
+    if (code < 0) {
+        patch = input(roi);
+    } else {
+        ctx->patch.create(roi.height, roi.width, CV_8UC1);
+        cv::cvtColor(input(roi), ctx->patch, code);
+        patch = ctx->patch;
+    }
+    
+    for (auto& p : corners) {
+        p.x -= x0;
+        p.y -= y0;
+    }
+    cv::cornerSubPix(patch, corners, cv::Size(window, window), cv::Size(-1, -1),
+                     cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 30, 0.01));
+    for (auto& p : corners) {
+        p.x += x0;
+        p.y += y0;
+    }
+}
+
+// Detect on the downscaled level, then refine L-board corners at full
+// resolution. Returns false if the level yields no board.
+static bool detect_multi_scale(
+    ArucoContext* ctx,
+    const cv::Mat& input,
+    int format,
+    float scale,
+    ArucoCalibrationResult* result
+) {
+    int level_width = std::max(1, static_cast<int>(std::lround(input.cols / scale)));
+    int level_height = std::max(1, static_cast<int>(std::lround(input.rows / scale)));
+    cv::resize(input, ctx->level, cv::Size(level_width, level_height), 0, 0, cv::INTER_AREA);
+    
+    cv::Mat level_gray;
+    int code = gray_conversion(format);
+    if (code < 0) {
+        level_gray = ctx->level;
+    } else {
+        cv::cvtColor(ctx->level, ctx->level_gray, code);
+        level_gray = ctx->level_gray;
+    }
+    
+    ctx->ids.clear();
+    ctx->corners.clear();
+    cv::aruco::detectMarkers(level_gray, ctx->dictionary, ctx->corners, ctx->ids, ctx->parameters);
+    if (ctx->ids.empty()) {
+        return false;
+    }
+    
+    // Level pixel centres -> full-resolution pixel centres
+    float sx = static_cast<float>(input.cols) / level_width;
+    float sy = static_cast<float>(input.rows) / level_height;
+    int window = ctx->config.refine_window > 0
+        ? ctx->config.refine_window
+        : std::min(15, std::max(3, static_cast<int>(std::ceil(1.5f * scale))));
+    for (size_t i = 0; i < ctx->ids.size(); i++) {
+        if (ctx->ids[i] < 0 || ctx->ids[i] > 2) continue;
+        for (auto& p : ctx->corners[i]) {
+            p.x = (p.x + 0.5f) * sx - 0.5f;
+            p.y = (p.y + 0.5f) * sy - 0.5f;
+        }
+        refine_corners(ctx, input, format, ctx->corners[i], window);
+    }
+    
+    collect_markers(ctx->ids, ctx->corners, result);
+    return compute_ratio(result);
+}
+
+// Full-frame search, multi-scale when configured (throws on OpenCV errors)
+static bool detect_frame(ArucoContext* ctx, const cv::Mat& input, int format, ArucoCalibrationResult* result) {
+    if (ctx->config.multi_scale) {
+        float scale = level_scale(ctx->config, input.cols, input.rows);
+        if (scale >= ARUCO_MIN_LEVEL_SCALE) {
+            if (detect_multi_scale(ctx, input, format, scale, result)) {
+                return true;
+            }
+            // Fall back to a full-resolution search
+            std::memset(result, 0, sizeof(ArucoCalibrationResult));
+        }
+    }
+    
+    // Gray input is used in place; color is converted into the context buffer
+    cv::Mat gray;
+    int code = gray_conversion(format);
+    if (code < 0) {
+        gray = input;
+    } else {
+        ctx->gray.create(input.rows, input.cols, CV_8UC1);
+        cv::cvtColor(input, ctx->gray, code);
+        gray = ctx->gray;
+    }
+    
+    // Detect markers (ids/corners keep their capacity across frames)
+    ctx->ids.clear();
+    ctx->corners.clear();
+    cv::aruco::detectMarkers(gray, ctx->dictionary, ctx->corners, ctx->ids, ctx->parameters);
+    
+    if (ctx->ids.empty()) {
+        return false;
+    }
+    
+    collect_markers(ctx->ids, ctx->corners, result);
+    return compute_ratio(result);
+}
+
+// ============================================================
+// ARUCO DETECTION
+// ============================================================
+
+extern "C" ArucoContext* aruco_context_create(void) {
+    try {
+        return new ArucoContext();
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+extern "C" void aruco_context_free(ArucoContext* ctx) {
+    delete ctx;
+}
+
+extern "C" bool aruco_context_configure(ArucoContext* ctx, const ArucoDetectorConfig* config) {
+    if (!ctx) return false;
+    ctx->config = config ? *config : ArucoDetectorConfig{};
+    return true;
+}
+
+extern "C" bool aruco_detect_l_board_ex(
+    ArucoContext* ctx,
+    const uint8_t* data,
+    int width,
+    int height,
+    int stride,
+    int format,
+    ArucoCalibrationResult* result
+) {
+    if (!result) return false;
+    
+    // Initialize result
+    std::memset(result, 0, sizeof(ArucoCalibrationResult));
+    result->board_detected = false;
+    if (!ctx || !data || width <= 0 || height <= 0) return false;
+    
+    int64_t start_us = sam_stats_now_us();
+    bool detected = false;
+    try {
+        cv::Mat input = input_view(data, width, height, stride, format);
+        if (input.empty()) return false;
+        detected = detect_frame(ctx, input, format, result);
+    } catch (...) {
+        detected = false;
+    }
+    sam_stats_record(SAM_STAGE_ARUCO, start_us, sam_stats_now_us() - start_us);
+    return detected;
+}
+
+extern "C" bool aruco_detect_l_board(
+    const uint8_t* rgb_data,
+    int width,
+    int height,
+    ArucoCalibrationResult* result
+) {
+    // One detector per calling thread, created on first use
+    thread_local std::unique_ptr<ArucoContext> ctx;
+    if (!ctx) {
+        ctx.reset(aruco_context_create());
+    }
+    if (!ctx) {
+        if (result) std::memset(result, 0, sizeof(ArucoCalibrationResult));
+        return false;
+    }
+    return aruco_detect_l_board_ex(ctx.get(), rgb_data, width, height, 0, ARUCO_FORMAT_RGB, result);
+}
+
+// ============================================================
+// LIVE TRACKING
+// ============================================================
+
+static const float ARUCO_DEFAULT_SMOOTHING = 0.3f;
+static const float ARUCO_DEFAULT_OUTLIER_TOLERANCE = 0.1f;
+static const int ARUCO_DEFAULT_MAX_OUTLIERS = 3;
+static const float ARUCO_DEFAULT_ROI_MARGIN = 0.5f;
+
+// Streaming detector. Frames go through a lock-free triple buffer: the
+// producer fills its back slot and swaps it into the middle slot, the
+// worker swaps the middle slot out when it is marked fresh, so a slow
+// search only ever sees the newest frame and older ones are dropped.
+// The mutex only parks the idle worker.
+struct ArucoTracker {
+    static const uint8_t FRESH = 4;
+    static const uint8_t INDEX = 3;
+    
+    ArucoContext ctx;
+    ArucoTrackerConfig config = {};
+    
+    // Triple buffer of gray frames
+    std::array<cv::Mat, 3> frames;
+    std::array<int64_t, 3> timestamps = {};
+    std::atomic<uint8_t> middle{2};
+    uint8_t back = 0;   // Producer-owned
+    uint8_t front = 1;  // Worker-owned
+    std::atomic<uint64_t> frames_pushed{0};
+    std::atomic<uint64_t> frames_dropped{0};
+    
+    std::thread worker;
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    std::atomic<bool> stop{false};
+    std::atomic<bool> reset_requested{false};
+    
+    // Worker-only tracking state
+    ArucoMarker last[3] = {};
+    bool have_last = false;
+    float filtered_ratio = 0.0f;
+    int outliers = 0;
+    uint64_t frames_processed = 0;
+    uint64_t outliers_rejected = 0;
+    std::vector<int> roi_ids;
+    std::vector<std::vector<cv::Point2f>> roi_corners;
+    
+    // Published state
+    std::mutex state_mutex;
+    ArucoTrackerState state = {};
+};
+
+// Search ROIs around the markers of the previous frame; succeeds only
+// if every one of them is found again
+static bool track_rois(ArucoTracker* tracker, const cv::Mat& gray, ArucoCalibrationResult* result) {
+    float margin = tracker->config.roi_margin > 0 ? tracker->config.roi_margin : ARUCO_DEFAULT_ROI_MARGIN;
+    int expected = 0;
+    
+    for (const ArucoMarker& marker : tracker->last) {
+        if (!marker.detected) continue;
+        expected++;
+        
+        float min_x = marker.corners[0].x, max_x = marker.corners[0].x;
+        float min_y = marker.corners[0].y, max_y = marker.corners[0].y;
+        for (const Point2f& p : marker.corners) {
+            min_x = std::min(min_x, p.x);
+            max_x = std::max(max_x, p.x);
+            min_y = std::min(min_y, p.y);
+            max_y = std::max(max_y, p.y);
+        }
+        float grow = margin * std::max(max_x - min_x, max_y - min_y);
+        int x0 = std::max(0, static_cast<int>(min_x - grow));
+        int y0 = std::max(0, static_cast<int>(min_y - grow));
+        int x1 = std::min(gray.cols, static_cast<int>(max_x + grow) + 1);
+        int y1 = std::min(gray.rows, static_cast<int>(max_y + grow) + 1);
+        if (x1 <= x0 || y1 <= y0) return false;
+        
+        tracker->roi_ids.clear();
+        tracker->roi_corners.clear();
+        cv::aruco::detectMarkers(gray(cv::Rect(x0, y0, x1 - x0, y1 - y0)), tracker->ctx.dictionary,
+                                 tracker->roi_corners, tracker->roi_ids, tracker->ctx.parameters);
+        for (auto& corners : tracker->roi_corners) {
+            for (auto& p : corners) {
+                p.x += x0;
+                p.y += y0;
+            }
+        }
+        collect_markers(tracker->roi_ids, tracker->roi_corners, result);
+    }
+    
+    return expected > 0 && result->num_markers_detected >= expected && compute_ratio(result);
+}
+
+// Exponential smoothing with outlier rejection. A jump beyond the
+// tolerance is ignored until it persists for max_outliers frames (the
+// phone really moved), then the filter restarts at the new ratio.
+static void filter_ratio(ArucoTracker* tracker, float raw) {
+    const ArucoTrackerConfig& config = tracker->config;
+    float alpha = config.smoothing > 0 ? config.smoothing : ARUCO_DEFAULT_SMOOTHING;
+    float tolerance = config.outlier_tolerance > 0 ? config.outlier_tolerance : ARUCO_DEFAULT_OUTLIER_TOLERANCE;
+    int max_outliers = config.max_outliers > 0 ? config.max_outliers : ARUCO_DEFAULT_MAX_OUTLIERS;
+    
+    float& filtered = tracker->filtered_ratio;
+    if (filtered <= 0) {
+        filtered = raw;
+        tracker->outliers = 0;
+    } else if (std::fabs(raw - filtered) > tolerance * filtered) {
+        tracker->outliers_rejected++;
+        if (++tracker->outliers >= max_outliers) {
+            filtered = raw;
+            tracker->outliers = 0;
+        }
+    } else {
+        filtered += alpha * (raw - filtered);
+        tracker->outliers = 0;
+    }
+}
+
+static void track_frame(ArucoTracker* tracker, const cv::Mat& gray, int64_t timestamp_us) {
+    int64_t start_us = sam_stats_now_us();
+    
+    if (tracker->reset_requested.exchange(false)) {
+        tracker->have_last = false;
+        tracker->filtered_ratio = 0.0f;
+        tracker->outliers = 0;
+    }
+    
+    ArucoCalibrationResult result;
+    bool detected = false;
+    bool tracking = false;
+    try {
+        if (tracker->have_last) {
+            std::memset(&result, 0, sizeof(result));
+            tracking = detected = track_rois(tracker, gray, &result);
+        }
+        if (!detected) {
+            std::memset(&result, 0, sizeof(result));
+            detected = detect_frame(&tracker->ctx, gray, ARUCO_FORMAT_GRAY, &result);
+        }
+    } catch (...) {
+        detected = false;
+    }
+    
+    if (detected) {
+        std::memcpy(tracker->last, result.markers, sizeof(tracker->last));
+        tracker->have_last = true;
+        filter_ratio(tracker, result.ratio_px_mm);
+    } else {
+        // Next frame searches the whole frame again
+        tracker->have_last = false;
+        std::memset(&result, 0, sizeof(result));
+    }
+    tracker->frames_processed++;
+    
+    int64_t detect_us = sam_stats_now_us() - start_us;
+    sam_stats_record(SAM_STAGE_ARUCO, start_us, detect_us);
+    float detect_ms = detect_us / 1000.0f;
+    
+    std::lock_guard<std::mutex> lock(tracker->state_mutex);
+    ArucoTrackerState& state = tracker->state;
+    state.board_detected = detected;
+    state.tracking = tracking;
+    state.ratio_px_mm = tracker->filtered_ratio;
+    state.raw_ratio_px_mm = detected ? result.ratio_px_mm : 0.0f;
+    state.result = result;
+    state.frame_timestamp_us = timestamp_us;
+    state.detect_ms = detect_ms;
+    state.frames_processed = tracker->frames_processed;
+    state.outliers_rejected = tracker->outliers_rejected;
+}
+
+static void tracker_loop(ArucoTracker* tracker) {
+    while (true) {
+        {
+            // Producers notify under wake_mutex, so a frame or stop
+            // published after the predicate check cannot be missed
+            std::unique_lock<std::mutex> lock(tracker->wake_mutex);
+            tracker->wake.wait(lock, [tracker] {
+                return tracker->stop.load() || (tracker->middle.load(std::memory_order_acquire) & ArucoTracker::FRESH);
+            });
+        }
+        if (tracker->stop.load()) break;
+        if (!(tracker->middle.load(std::memory_order_acquire) & ArucoTracker::FRESH)) continue;
+        
+        uint8_t previous = tracker->middle.exchange(tracker->front, std::memory_order_acq_rel);
+        tracker->front = previous & ArucoTracker::INDEX;
+        track_frame(tracker, tracker->frames[tracker->front], tracker->timestamps[tracker->front]);
+    }
+}
+
+extern "C" ArucoTracker* aruco_tracker_create(const ArucoTrackerConfig* config) {
+    try {
+        auto* tracker = new ArucoTracker();
+        if (config) {
+            tracker->config = *config;
+        }
+        tracker->ctx.config = tracker->config.detector;
+        tracker->worker = std::thread(tracker_loop, tracker);
+        return tracker;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+extern "C" void aruco_tracker_free(ArucoTracker* tracker) {
+    if (!tracker) return;
+    {
+        std::lock_guard<std::mutex> lock(tracker->wake_mutex);
+        tracker->stop.store(true);
+        tracker->wake.notify_all();
+    }
+    if (tracker->worker.joinable()) {
+        tracker->worker.join();
+    }
+    delete tracker;
+}
+
+extern "C" bool aruco_tracker_push_frame(
+    ArucoTracker* tracker,
+    const uint8_t* data,
+    int width,
+    int height,
+    int stride,
+    int format,
+    int64_t timestamp_us
+) {
+    if (!tracker || !data || width <= 0 || height <= 0) return false;
+    
+    try {
+        cv::Mat input = input_view(data, width, height, stride, format);
+        if (input.empty()) return false;
+        
+        // Fill the back slot (buffers are reallocated only on size change)
+        cv::Mat& slot = tracker->frames[tracker->back];
+        int code = gray_conversion(format);
+        if (code < 0) {
+            input.copyTo(slot);
+        } else {
+            slot.create(height, width, CV_8UC1);
+            cv::cvtColor(input, slot, code);
+        }
+        tracker->timestamps[tracker->back] = timestamp_us;
+        
+        // Publish; an unconsumed frame in the middle slot is dropped
+        uint8_t previous = tracker->middle.exchange(tracker->back | ArucoTracker::FRESH, std::memory_order_acq_rel);
+        tracker->back = previous & ArucoTracker::INDEX;
+        if (previous & ArucoTracker::FRESH) {
+            tracker->frames_dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        tracker->frames_pushed.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(tracker->wake_mutex);
+            tracker->wake.notify_one();
+        }
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+extern "C" bool aruco_tracker_get_state(ArucoTracker* tracker, ArucoTrackerState* state) {
+    if (!tracker || !state) return false;
+    {
+        std::lock_guard<std::mutex> lock(tracker->state_mutex);
+        *state = tracker->state;
+    }
+    state->frames_pushed = tracker->frames_pushed.load(std::memory_order_relaxed);
+    state->frames_dropped = tracker->frames_dropped.load(std::memory_order_relaxed);
+    return true;
+}
+
+extern "C" void aruco_tracker_reset(ArucoTracker* tracker) {
+    if (!tracker) return;
+    tracker->reset_requested.store(true);
+}
+
 // ============================================================
 // UTILITY FUNCTIONS
 // ============================================================
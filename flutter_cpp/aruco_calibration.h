@@ -22,6 +22,11 @@ extern "C" {
 #define ARUCO_L_BOARD_SEPARATION_MM 12.0f
 #define ARUCO_DICT_ID 10  // DICT_6X6_250
 
+// Input pixel formats (aruco_detect_l_board_ex)
+#define ARUCO_FORMAT_RGB 0    // [H, W, 3]
+#define ARUCO_FORMAT_GRAY 1   // [H, W] 8-bit gray or the Y plane of YUV420 / NV21 camera frames
+#define ARUCO_FORMAT_RGBA 2   // [H, W, 4]
+
 // Marker IDs in L-board
 #define ARUCO_MARKER_CORNER 0
 #define ARUCO_MARKER_X_AXIS 1
@@ -53,12 +58,101 @@ typedef struct {
     int num_markers_detected;
 } ArucoCalibrationResult;
 
+// Reusable detector (dictionary, parameters and frame buffers)
+typedef struct ArucoContext ArucoContext;
+
+// Detector configuration (zero-initialized = full-resolution detection)
+typedef struct {
+    bool multi_scale;            // Detect on a downscaled level, refine corners at full resolution
+    float expected_marker_px;    // Marker side at full resolution (0 = shorter image side / 12)
+    float target_marker_px;      // Marker side at the detection level (0 = 64)
+    int refine_window;           // cornerSubPix half window in full-res pixels (0 = from the level scale)
+} ArucoDetectorConfig;
+
+// Live-preview tracker (aruco_tracker_create)
+typedef struct ArucoTracker ArucoTracker;
+
+// Tracker configuration (zero-initialized = defaults)
+typedef struct {
+    ArucoDetectorConfig detector;  // Full-frame search settings
+    float smoothing;               // Weight of a new ratio in the filtered one (0 = 0.3)
+    float outlier_tolerance;       // Relative ratio jump rejected as an outlier (0 = 0.1)
+    int max_outliers;              // Consecutive outliers accepted as a real change (0 = 3)
+    float roi_margin;              // ROI growth around each marker, in marker sizes (0 = 0.5)
+} ArucoTrackerConfig;
+
+// Latest tracker output (aruco_tracker_get_state)
+typedef struct {
+    bool board_detected;           // Board found in the latest processed frame
+    bool tracking;                 // Found by the ROI search (false = full-frame search)
+    float ratio_px_mm;             // Temporally filtered ratio (0 until the first detection)
+    float raw_ratio_px_mm;         // Latest frame's ratio (0 if not detected)
+    ArucoCalibrationResult result; // Latest frame's detection
+    int64_t frame_timestamp_us;    // Timestamp passed with the processed frame
+    float detect_ms;               // Search time of that frame
+    uint64_t frames_pushed;
+    uint64_t frames_processed;
+    uint64_t frames_dropped;       // Replaced by a newer frame before the worker got to them
+    uint64_t outliers_rejected;
+} ArucoTrackerState;
+
 // ============================================================
 // API FUNCTIONS
 // ============================================================
 
+/**
+ * Create a detector context
+ * Builds the DICT_6X6_250 dictionary and detector parameters once;
+ * reuse the context for every frame (one context per thread).
+ * @return Context handle, or NULL on failure
+ */
+ArucoContext* aruco_context_create(void);
+
+/**
+ * Free a detector context
+ */
+void aruco_context_free(ArucoContext* ctx);
+
+/**
+ * Configure a detector context
+ * With multi_scale, markers are found on a level where they measure
+ * about target_marker_px, and only their corners are refined (sub-pixel,
+ * in small ROIs) at full resolution, so cost follows the marker count
+ * rather than the megapixels. If the level finds no board the frame is
+ * searched at full resolution.
+ * @param config Configuration (NULL = defaults)
+ * @return true on success
+ */
+bool aruco_context_configure(ArucoContext* ctx, const ArucoDetectorConfig* config);
+
+/**
+ * Detect ArUco L-board with a reusable context
+ * Gray / luma input is used in place; RGB and RGBA are converted straight
+ * to gray in a context buffer, so steady-state calls do not allocate
+ * outside OpenCV's detector.
+ *
+ * @param ctx Detector context
+ * @param data Pixel data in the given format
+ * @param width Image width
+ * @param height Image height
+ * @param stride Bytes per row (0 = tightly packed)
+ * @param format ARUCO_FORMAT_*
+ * @param result Output calibration result
+ * @return true if calibration successful (at least 2 markers detected)
+ */
+bool aruco_detect_l_board_ex(
+    ArucoContext* ctx,
+    const uint8_t* data,
+    int width,
+    int height,
+    int stride,
+    int format,
+    ArucoCalibrationResult* result
+);
+
 /**
  * Detect ArUco L-board and calculate calibration ratio
+ * Uses a context owned by the calling thread (see aruco_context_create).
  * 
  * @param rgb_data RGB image bytes [H, W, 3]
  * @param width Image width
@@ -73,6 +167,59 @@ bool aruco_detect_l_board(
     ArucoCalibrationResult* result
 );
 
+// ============================================================
+// LIVE TRACKING
+// ============================================================
+
+/**
+ * Start a tracker for camera preview frames
+ * A worker thread searches ROIs around the markers' last positions and
+ * falls back to a full-frame search when any of them is lost.
+ * @param config Configuration (NULL = defaults)
+ * @return Tracker handle, or NULL on failure
+ */
+ArucoTracker* aruco_tracker_create(const ArucoTrackerConfig* config);
+
+/**
+ * Stop the worker and free the tracker
+ */
+void aruco_tracker_free(ArucoTracker* tracker);
+
+/**
+ * Hand a camera frame to the tracker without blocking
+ * The frame is copied (color is converted to gray), so the caller may
+ * reuse its buffer on return. If the worker is still busy, the frame
+ * waiting for it is replaced (latest frame wins). Call from one thread.
+ *
+ * @param data Pixel data (ARUCO_FORMAT_*; the Y plane for YUV frames)
+ * @param stride Bytes per row (0 = tightly packed)
+ * @param timestamp_us Caller timestamp, echoed in the state
+ * @return true if the frame was queued
+ */
+bool aruco_tracker_push_frame(
+    ArucoTracker* tracker,
+    const uint8_t* data,
+    int width,
+    int height,
+    int stride,
+    int format,
+    int64_t timestamp_us
+);
+
+/**
+ * Read the latest tracker output (never blocks on detection)
+ */
+bool aruco_tracker_get_state(ArucoTracker* tracker, ArucoTrackerState* state);
+
+/**
+ * Forget marker positions and the filtered ratio (e.g. new board)
+ */
+void aruco_tracker_reset(ArucoTracker* tracker);
+
+// ============================================================
+// UTILITY FUNCTIONS
+// ============================================================
+
 /**
  * Convert pixel measurement to millimeters
  */
@@ -0,0 +1,268 @@
+/**
+ * Foot Measurement Implementation
+ *
+ * Everything is computed from row runs: moments use closed-form sums
+ * per run and projections only need run endpoints, so the cost scales
+ * with the mask outline, not with the image size.
+ */
+
+#include "foot_measure.h"
+#include "sam_inference.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+// ============================================================
+// HELPER FUNCTIONS
+// ============================================================
+
+// Call fn(y, x_begin, x_end) for every foreground span, split at row
+// ends. Returns false if the runs cover more than width * height pixels.
+template <typename Fn>
+static bool for_each_span(const uint32_t* runs, int num_runs, int width, int height, Fn&& fn) {
+    const uint64_t total = static_cast<uint64_t>(width) * height;
+    uint64_t pos = 0;
+    for (int i = 0; i < num_runs; i++) {
+        uint64_t end = pos + runs[i];
+        if (end > total) return false;
+        if (i & 1) {
+            while (pos < end) {
+                int y = static_cast<int>(pos / width);
+                int x = static_cast<int>(pos - static_cast<uint64_t>(y) * width);
+                int x_end = static_cast<int>(std::min<uint64_t>(width, x + (end - pos)));
+                fn(y, x, x_end);
+                pos += x_end - x;
+            }
+        }
+        pos = end;
+    }
+    return true;
+}
+
+static const double FOOT_PI = 3.14159265358979323846;
+
+// Sum of k^2 for k in [0, n]
+static double sum_squares(double n) {
+    return n * (n + 1.0) * (2.0 * n + 1.0) / 6.0;
+}
+
+struct FootFrame {
+    double cx, cy;
+    double ax, ay;
+
+    double along(double x, double y) const { return (x - cx) * ax + (y - cy) * ay; }
+    double across(double x, double y) const { return -(x - cx) * ay + (y - cy) * ax; }
+
+    Point2f point(double u, double v) const {
+        return {static_cast<float>(cx + u * ax - v * ay), static_cast<float>(cy + u * ay + v * ax)};
+    }
+};
+
+// ============================================================
+// MEASUREMENT
+// ============================================================
+
+extern "C" bool foot_measure_runs(
+    const uint32_t* runs,
+    int num_runs,
+    int width,
+    int height,
+    const ArucoCalibrationResult* calibration,
+    FootMeasurement* result
+) {
+    if (!result) return false;
+    std::memset(result, 0, sizeof(FootMeasurement));
+    if (!runs || num_runs <= 0 || width <= 0 || height <= 0) return false;
+    const int64_t start_us = sam_stats_now_us();
+
+    // Pass 1: raw moments, relative to the image centre to keep the
+    // sums small
+    const double ox = 0.5 * width;
+    const double oy = 0.5 * height;
+    double m00 = 0, m10 = 0, m01 = 0, m20 = 0, m11 = 0, m02 = 0;
+    bool valid = for_each_span(runs, num_runs, width, height, [&](int y, int x0, int x1) {
+        double n = x1 - x0;
+        double sx = n * (x0 + x1 - 1) * 0.5;
+        double sxx = sum_squares(x1 - 1) - (x0 > 0 ? sum_squares(x0 - 1) : 0.0);
+        double dy = y - oy;
+        // Shift x sums to the origin: sum (x - ox) and sum (x - ox)^2
+        double su = sx - n * ox;
+        double suu = sxx - 2.0 * ox * sx + n * ox * ox;
+        m00 += n;
+        m10 += su;
+        m01 += n * dy;
+        m20 += suu;
+        m11 += dy * su;
+        m02 += n * dy * dy;
+    });
+    if (!valid || m00 < 2) return false;
+
+    FootFrame frame;
+    double mx = m10 / m00;
+    double my = m01 / m00;
+    frame.cx = ox + mx;
+    frame.cy = oy + my;
+    double mu20 = m20 / m00 - mx * mx;
+    double mu11 = m11 / m00 - mx * my;
+    double mu02 = m02 / m00 - my * my;
+    double theta = 0.5 * std::atan2(2.0 * mu11, mu20 - mu02);
+    frame.ax = std::cos(theta);
+    frame.ay = std::sin(theta);
+    if (frame.ax < 0 || (frame.ax == 0 && frame.ay < 0)) {
+        frame.ax = -frame.ax;
+        frame.ay = -frame.ay;
+    }
+
+    // Pass 2: extents along and across the axis. Both are linear along
+    // a run, so its end pixels bound them.
+    const double inf = std::numeric_limits<double>::infinity();
+    double u_min = inf, u_max = -inf, v_min = inf, v_max = -inf;
+    Point2f u_min_pt = {0, 0}, u_max_pt = {0, 0};
+    for_each_span(runs, num_runs, width, height, [&](int y, int x0, int x1) {
+        for (int x : {x0, x1 - 1}) {
+            double u = frame.along(x, y);
+            double v = frame.across(x, y);
+            if (u < u_min) { u_min = u; u_min_pt = {static_cast<float>(x), static_cast<float>(y)}; }
+            if (u > u_max) { u_max = u; u_max_pt = {static_cast<float>(x), static_cast<float>(y)}; }
+            v_min = std::min(v_min, v);
+            v_max = std::max(v_max, v);
+        }
+    });
+
+    // Pass 3: width profile. A run is a segment in (along, across)
+    // space; each slice it crosses gets the clipped segment's ends.
+    const double length = u_max - u_min;
+    const double bin_size = length > 0 ? length / FOOT_PROFILE_BINS : 1.0;
+    double bin_v_min[FOOT_PROFILE_BINS];
+    double bin_v_max[FOOT_PROFILE_BINS];
+    double bin_u_at_min[FOOT_PROFILE_BINS];
+    double bin_u_at_max[FOOT_PROFILE_BINS];
+    std::fill(bin_v_min, bin_v_min + FOOT_PROFILE_BINS, inf);
+    std::fill(bin_v_max, bin_v_max + FOOT_PROFILE_BINS, -inf);
+
+    auto bin_of = [&](double u) {
+        int k = static_cast<int>((u - u_min) / bin_size);
+        return std::min(std::max(k, 0), FOOT_PROFILE_BINS - 1);
+    };
+    auto add = [&](int k, double u, double v) {
+        if (v < bin_v_min[k]) { bin_v_min[k] = v; bin_u_at_min[k] = u; }
+        if (v > bin_v_max[k]) { bin_v_max[k] = v; bin_u_at_max[k] = u; }
+    };
+
+    for_each_span(runs, num_runs, width, height, [&](int y, int x0, int x1) {
+        double ua = frame.along(x0, y), va = frame.across(x0, y);
+        double ub = frame.along(x1 - 1, y), vb = frame.across(x1 - 1, y);
+        if (ua > ub) {
+            std::swap(ua, ub);
+            std::swap(va, vb);
+        }
+        int k0 = bin_of(ua);
+        int k1 = bin_of(ub);
+        if (k0 == k1) {
+            add(k0, ua, va);
+            add(k0, ub, vb);
+            return;
+        }
+        double dv_du = (vb - va) / (ub - ua);
+        for (int k = k0; k <= k1; k++) {
+            double lo = std::max(ua, u_min + k * bin_size);
+            double hi = std::min(ub, u_min + (k + 1) * bin_size);
+            add(k, lo, va + (lo - ua) * dv_du);
+            add(k, hi, va + (hi - ua) * dv_du);
+        }
+    });
+
+    // Fill result
+    result->centroid = {static_cast<float>(frame.cx), static_cast<float>(frame.cy)};
+    result->axis = {static_cast<float>(frame.ax), static_cast<float>(frame.ay)};
+    result->angle_deg = static_cast<float>(std::atan2(frame.ay, frame.ax) * 180.0 / FOOT_PI);
+
+    result->obb[0] = frame.point(u_min, v_min);
+    result->obb[1] = frame.point(u_max, v_min);
+    result->obb[2] = frame.point(u_max, v_max);
+    result->obb[3] = frame.point(u_min, v_max);
+    result->length_px = static_cast<float>(length);
+    result->obb_width_px = static_cast<float>(v_max - v_min);
+    result->length_ends[0] = u_min_pt;
+    result->length_ends[1] = u_max_pt;
+
+    int widest = -1;
+    for (int k = 0; k < FOOT_PROFILE_BINS; k++) {
+        if (bin_v_max[k] < bin_v_min[k]) continue;
+        result->profile_px[k] = static_cast<float>(bin_v_max[k] - bin_v_min[k]);
+        if (widest < 0 || result->profile_px[k] > result->profile_px[widest]) widest = k;
+    }
+    if (widest >= 0) {
+        result->width_px = result->profile_px[widest];
+        result->width_position = (widest + 0.5f) / FOOT_PROFILE_BINS;
+        result->width_ends[0] = frame.point(bin_u_at_min[widest], bin_v_min[widest]);
+        result->width_ends[1] = frame.point(bin_u_at_max[widest], bin_v_max[widest]);
+    }
+    result->area_px = static_cast<uint64_t>(m00);
+
+    if (calibration && calibration->board_detected && calibration->ratio_px_mm > 0) {
+        float ratio = calibration->ratio_px_mm;
+        result->ratio_px_mm = ratio;
+        result->calibrated = true;
+        result->length_mm = result->length_px / ratio;
+        result->width_mm = result->width_px / ratio;
+        result->obb_width_mm = result->obb_width_px / ratio;
+        result->area_mm2 = static_cast<float>(m00 / (static_cast<double>(ratio) * ratio));
+        for (int k = 0; k < FOOT_PROFILE_BINS; k++) {
+            result->profile_mm[k] = result->profile_px[k] / ratio;
+        }
+    }
+
+    sam_stats_record(SAM_STAGE_MEASURE, start_us, sam_stats_now_us() - start_us);
+    return true;
+}
+
+bool foot_measure_logits(
+    const float* mask,
+    int width,
+    int height,
+    float threshold,
+    const ArucoCalibrationResult* calibration,
+    FootMeasurement* result,
+    std::vector<uint32_t>* runs
+) {
+    if (runs) runs->clear();
+    if (!mask || !result || width <= 0 || height <= 0) return false;
+
+    try {
+        // A foot crosses most rows about twice; retry once at the
+        // reported size if not
+        std::vector<uint32_t> local;
+        std::vector<uint32_t>& buffer = runs ? *runs : local;
+        buffer.resize(4 * static_cast<size_t>(height) + 2);
+        SamCompactMask compact = {};
+        for (int attempt = 0; attempt < 2; attempt++) {
+            compact.runs = buffer.data();
+            compact.run_capacity = static_cast<int>(buffer.size());
+            if (sam_mask_to_runs(mask, width, height, threshold, &compact)) {
+                buffer.resize(compact.num_runs);
+                return foot_measure_runs(buffer.data(), compact.num_runs, width, height, calibration, result);
+            }
+            if (compact.num_runs <= compact.run_capacity) break;
+            buffer.resize(compact.num_runs);
+        }
+        buffer.clear();
+    } catch (...) {
+        if (runs) runs->clear();
+    }
+    std::memset(result, 0, sizeof(FootMeasurement));
+    return false;
+}
+
+extern "C" bool foot_measure_logits(
+    const float* mask,
+    int width,
+    int height,
+    float threshold,
+    const ArucoCalibrationResult* calibration,
+    FootMeasurement* result
+) {
+    return foot_measure_logits(mask, width, height, threshold, calibration, result, nullptr);
+}
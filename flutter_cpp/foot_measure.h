@@ -0,0 +1,130 @@
+/**
+ * Foot Measurement for Flutter C++ FFI
+ *
+ * Measures a segmented foot (SAM mask) in millimeters using the
+ * px/mm ratio from the ArUco L-board.
+ * Works on run-length masks, never on a full-resolution buffer.
+ */
+
+#ifndef FOOT_MEASURE_H
+#define FOOT_MEASURE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "aruco_calibration.h"
+
+// ============================================================
+// CONSTANTS
+// ============================================================
+#define FOOT_PROFILE_BINS 64  // Width samples along the foot axis
+
+// ============================================================
+// DATA STRUCTURES
+// ============================================================
+
+typedef struct {
+    // Principal axis (image moments). Distances are between pixel
+    // centres, in pixels unless suffixed _mm.
+    Point2f centroid;
+    Point2f axis;                      // Unit vector along the foot, axis.x >= 0
+    float angle_deg;                   // Axis angle from the image x axis, (-90, 90]
+
+    // Oriented bounding box (aligned with axis)
+    Point2f obb[4];                    // Corners, clockwise on screen from (min along, min across)
+    float length_px;                   // Extent along the axis
+    float obb_width_px;                // Extent across the axis
+    Point2f length_ends[2];            // Mask pixels at min / max along the axis (heel / toe candidates)
+
+    // Width profile across the axis, FOOT_PROFILE_BINS equal slices from
+    // length_ends[0] to length_ends[1]
+    float profile_px[FOOT_PROFILE_BINS];
+    float width_px;                    // Widest slice
+    float width_position;              // Where it is along the axis (0 = length_ends[0], 1 = length_ends[1])
+    Point2f width_ends[2];             // Mask pixels at both sides of the widest slice
+
+    uint64_t area_px;
+
+    // Millimeters (0 unless calibrated)
+    float length_mm;
+    float width_mm;
+    float obb_width_mm;
+    float area_mm2;
+    float profile_mm[FOOT_PROFILE_BINS];
+    float ratio_px_mm;                 // Ratio used (0 if not calibrated)
+    bool calibrated;
+} FootMeasurement;
+
+// ============================================================
+// API FUNCTIONS
+// ============================================================
+
+/**
+ * Measure a foot from a run-length mask
+ *
+ * @param runs Row-major run lengths, alternating background/foreground and
+ *             starting with background (SamCompactMask::runs)
+ * @param num_runs Number of runs
+ * @param width Mask width
+ * @param height Mask height
+ * @param calibration L-board result for mm values (NULL or not detected = pixels only)
+ * @param result Output measurement
+ * @return true if the mask has at least two foreground pixels
+ */
+bool foot_measure_runs(
+    const uint32_t* runs,
+    int num_runs,
+    int width,
+    int height,
+    const ArucoCalibrationResult* calibration,
+    FootMeasurement* result
+);
+
+/**
+ * Measure a foot from low-res SAM logits
+ * Same result as sam_postprocess_mask followed by a measurement of the
+ * full mask; the logits are run-length encoded row by row instead.
+ *
+ * @param mask Low-res mask logits [256, 256] (best SAM mask)
+ * @param width Original image width
+ * @param height Original image height
+ * @param threshold Binarization threshold (default 0.0)
+ * @param calibration L-board result for mm values (NULL or not detected = pixels only)
+ * @param result Output measurement
+ * @return true on success
+ */
+bool foot_measure_logits(
+    const float* mask,
+    int width,
+    int height,
+    float threshold,
+    const ArucoCalibrationResult* calibration,
+    FootMeasurement* result
+);
+
+#ifdef __cplusplus
+}
+
+#include <vector>
+
+/**
+ * foot_measure_logits that also hands back the run-length mask it
+ * measured, for callers that store it (sam_batch)
+ *
+ * @param runs Receives the runs; empty if the logits could not be encoded
+ */
+bool foot_measure_logits(
+    const float* mask,
+    int width,
+    int height,
+    float threshold,
+    const ArucoCalibrationResult* calibration,
+    FootMeasurement* result,
+    std::vector<uint32_t>* runs
+);
+#endif
+
+#endif // FOOT_MEASURE_H
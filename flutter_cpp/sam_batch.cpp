@@ -0,0 +1,1016 @@
+/**
+ * SAM Batch Reprocessing
+ *
+ * Re-runs calibration, segmentation and measurement over a directory of
+ * archived scans, e.g. after a model update. Images stream through
+ * bounded queues so every stage stays busy:
+ *
+ *   loaders (N threads)   read + decode, ArUco L-board, preprocess
+ *   encoders (--encoders) sam_encode_images, ORT's intra-op threads
+ *   decoder (1 thread)    sam_decode_mask, compact mask, foot measurement
+ *   writer  (1 thread)    columnar chunks with CRCs
+ *
+ * Encoders and the decoder each hold a context of one SamModel, so the
+ * weights are loaded once. While the encoder runs, the loaders prepare
+ * the next images on the remaining cores. Tensor and embedding buffers
+ * come from fixed pools, so memory stays flat however many images are
+ * queued.
+ *
+ * The output is appended in self-checking chunks (format below). An
+ * interrupted run (Ctrl-C, crash, power loss) continues with --resume:
+ * complete chunks are kept, a torn last chunk is cut off and images
+ * already recorded are skipped.
+ */
+
+#include "sam_inference.h"
+#include "foot_measure.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef SAM_BATCH_IMGCODECS
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+#endif
+
+// ============================================================
+// OUTPUT FILE FORMAT
+// ============================================================
+// All integers little-endian.
+//
+//   file    = "SAMBATCH" u32 version u32 reserved chunk*
+//   chunk   = u32 magic ("SBCK") u32 rows u32 payload_bytes u32 crc32(payload) payload
+//   payload = u32 num_columns column*
+//   column  = u8 name_len name u8 type u64 data_bytes data
+//
+// Fixed-width columns hold rows values. String and u32-list columns
+// hold u32 offsets[rows + 1] followed by the concatenated values.
+// Rows are in completion order; a name appears once per file.
+
+static const char BATCH_FILE_MAGIC[8] = {'S', 'A', 'M', 'B', 'A', 'T', 'C', 'H'};
+static const uint32_t BATCH_FILE_VERSION = 1;
+static const uint32_t BATCH_CHUNK_MAGIC = 0x4B434253;  // "SBCK"
+static const long BATCH_HEADER_BYTES = 16;
+
+enum BatchColumnType : uint8_t {
+    COLUMN_U8 = 0,
+    COLUMN_I32 = 1,
+    COLUMN_F32 = 2,
+    COLUMN_U64 = 3,
+    COLUMN_STRING = 4,
+    COLUMN_U32_LIST = 5,
+};
+
+// Per-image outcome (status column)
+enum BatchStatus : uint8_t {
+    BATCH_OK = 0,
+    BATCH_READ_FAILED = 1,     // File could not be read or decoded
+    BATCH_SEGMENT_FAILED = 2,  // Encoder or decoder error
+    BATCH_EMPTY_MASK = 3,      // Segmented, but nothing to measure
+};
+
+static const char* const BATCH_STATUS_NAMES[] = {"ok", "read_failed", "segment_failed", "empty_mask"};
+
+static uint32_t crc32(const uint8_t* data, size_t size) {
+    static uint32_t table[256];
+    static bool initialized = [] {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        return true;
+    }();
+    (void)initialized;
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// ============================================================
+// BOUNDED QUEUE
+// ============================================================
+
+// Blocking FIFO with a fixed capacity. pop() returns false once the
+// queue is closed and drained.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+    void push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return items_.size() < capacity_; });
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return !items_.empty() || closed_; });
+        if (items_.empty()) return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        not_empty_.notify_all();
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return items_.size();
+    }
+
+    size_t capacity() const { return capacity_; }
+
+private:
+    size_t capacity_;
+    bool closed_ = false;
+    std::deque<T> items_;
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+};
+
+// ============================================================
+// IMAGE LOADING
+// ============================================================
+
+static bool has_suffix(const std::string& name, const char* suffix) {
+    size_t n = std::strlen(suffix);
+    if (name.size() < n) return false;
+    for (size_t i = 0; i < n; i++) {
+        char c = name[name.size() - n + i];
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c - 'A' + 'a');
+        if (c != suffix[i]) return false;
+    }
+    return true;
+}
+
+static bool is_image_file(const std::string& name) {
+    static const char* const suffixes[] = {
+        ".ppm", ".pgm",
+#ifdef SAM_BATCH_IMGCODECS
+        ".jpg", ".jpeg", ".png", ".bmp", ".tif", ".tiff", ".webp",
+#endif
+    };
+    for (const char* suffix : suffixes) {
+        if (has_suffix(name, suffix)) return true;
+    }
+    return false;
+}
+
+// Binary PGM (P5) / PPM (P6) with maxval 255; gray is expanded to RGB
+static bool load_pnm(const std::string& path, std::vector<uint8_t>& rgb, int* width, int* height) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file) return false;
+    int values[3] = {0, 0, 0};
+    char magic[2] = {0, 0};
+    bool ok = std::fread(magic, 1, 2, file) == 2 && magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6');
+    for (int v = 0; ok && v < 3; v++) {
+        int c = std::fgetc(file);
+        while (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '#') {
+            if (c == '#') {
+                while (c != '\n' && c != EOF) c = std::fgetc(file);
+            }
+            c = std::fgetc(file);
+        }
+        if (c < '0' || c > '9') ok = false;
+        while (ok && c >= '0' && c <= '9' && values[v] < (1 << 20)) {
+            values[v] = values[v] * 10 + (c - '0');
+            c = std::fgetc(file);
+        }
+    }
+    ok = ok && values[0] > 0 && values[1] > 0 && values[2] == 255;
+    if (ok) {
+        int channels = magic[1] == '6' ? 3 : 1;
+        size_t pixels = static_cast<size_t>(values[0]) * values[1];
+        rgb.resize(pixels * 3);
+        ok = std::fread(rgb.data(), channels, pixels, file) == pixels;
+        if (ok && channels == 1) {
+            for (size_t i = pixels; i-- > 0;) {
+                rgb[i * 3] = rgb[i * 3 + 1] = rgb[i * 3 + 2] = rgb[i];
+            }
+        }
+    }
+    std::fclose(file);
+    *width = values[0];
+    *height = values[1];
+    return ok;
+}
+
+static bool load_image(const std::string& path, std::vector<uint8_t>& rgb, int* width, int* height) {
+    if (has_suffix(path, ".ppm") || has_suffix(path, ".pgm")) return load_pnm(path, rgb, width, height);
+#ifdef SAM_BATCH_IMGCODECS
+    cv::Mat bgr = cv::imread(path, cv::IMREAD_COLOR);
+    if (bgr.empty()) return false;
+    *width = bgr.cols;
+    *height = bgr.rows;
+    rgb.resize(static_cast<size_t>(bgr.cols) * bgr.rows * 3);
+    cv::Mat out(bgr.rows, bgr.cols, CV_8UC3, rgb.data());
+    cv::cvtColor(bgr, out, cv::COLOR_BGR2RGB);
+    return true;
+#else
+    return false;
+#endif
+}
+
+// Sorted image file names in dir (not recursive)
+static bool list_images(const std::string& dir, std::vector<std::string>& names) {
+    DIR* handle = opendir(dir.c_str());
+    if (!handle) return false;
+    while (dirent* entry = readdir(handle)) {
+        std::string name = entry->d_name;
+        if (name[0] != '.' && is_image_file(name)) names.push_back(name);
+    }
+    closedir(handle);
+    std::sort(names.begin(), names.end());
+    return true;
+}
+
+// ============================================================
+// RESULTS
+// ============================================================
+
+struct BatchItem {
+    std::string name;
+    uint8_t status = BATCH_OK;
+    int width = 0;
+    int height = 0;
+    float* tensor = nullptr;      // Preprocessed image (pool buffer)
+    float* embedding = nullptr;   // Encoder output (pool buffer)
+    ArucoCalibrationResult calibration = {};
+    float iou = 0.0f;
+    FootMeasurement measurement = {};
+    std::vector<uint32_t> runs;
+};
+
+// One chunk's worth of rows, column by column
+class ColumnChunk {
+public:
+    void add(const BatchItem& item) {
+        append_string(names_, name_offsets_, item.name);
+        status_.push_back(item.status);
+        width_.push_back(item.width);
+        height_.push_back(item.height);
+        iou_.push_back(item.iou);
+        board_detected_.push_back(item.calibration.board_detected ? 1 : 0);
+        ratio_px_mm_.push_back(item.calibration.ratio_px_mm);
+        const FootMeasurement& m = item.measurement;
+        length_px_.push_back(m.length_px);
+        width_px_.push_back(m.width_px);
+        length_mm_.push_back(m.length_mm);
+        width_mm_.push_back(m.width_mm);
+        angle_deg_.push_back(m.angle_deg);
+        area_px_.push_back(m.area_px);
+        run_offsets_.push_back(static_cast<uint32_t>(runs_.size()));
+        runs_.insert(runs_.end(), item.runs.begin(), item.runs.end());
+    }
+
+    uint32_t rows() const { return static_cast<uint32_t>(status_.size()); }
+
+    // Serialized chunk including its header
+    std::vector<uint8_t> encode() const {
+        std::vector<uint8_t> payload;
+        put<uint32_t>(payload, 14);
+        column(payload, "name", COLUMN_STRING, offsets_then(name_offsets_, names_.size()), names_.data(), names_.size());
+        fixed(payload, "status", COLUMN_U8, status_);
+        fixed(payload, "width", COLUMN_I32, width_);
+        fixed(payload, "height", COLUMN_I32, height_);
+        fixed(payload, "iou", COLUMN_F32, iou_);
+        fixed(payload, "board_detected", COLUMN_U8, board_detected_);
+        fixed(payload, "ratio_px_mm", COLUMN_F32, ratio_px_mm_);
+        fixed(payload, "length_px", COLUMN_F32, length_px_);
+        fixed(payload, "width_px", COLUMN_F32, width_px_);
+        fixed(payload, "length_mm", COLUMN_F32, length_mm_);
+        fixed(payload, "width_mm", COLUMN_F32, width_mm_);
+        fixed(payload, "angle_deg", COLUMN_F32, angle_deg_);
+        fixed(payload, "area_px", COLUMN_U64, area_px_);
+        column(payload, "runs", COLUMN_U32_LIST, offsets_then(run_offsets_, runs_.size()),
+               runs_.data(), runs_.size() * sizeof(uint32_t));
+
+        std::vector<uint8_t> chunk;
+        put<uint32_t>(chunk, BATCH_CHUNK_MAGIC);
+        put<uint32_t>(chunk, rows());
+        put<uint32_t>(chunk, static_cast<uint32_t>(payload.size()));
+        put<uint32_t>(chunk, crc32(payload.data(), payload.size()));
+        chunk.insert(chunk.end(), payload.begin(), payload.end());
+        return chunk;
+    }
+
+    void clear() { *this = ColumnChunk(); }
+
+private:
+    template <typename T>
+    static void put(std::vector<uint8_t>& out, T value) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    static void append_string(std::string& data, std::vector<uint32_t>& offsets, const std::string& value) {
+        offsets.push_back(static_cast<uint32_t>(data.size()));
+        data += value;
+    }
+
+    static std::vector<uint32_t> offsets_then(std::vector<uint32_t> offsets, size_t end) {
+        offsets.push_back(static_cast<uint32_t>(end));
+        return offsets;
+    }
+
+    static void column(std::vector<uint8_t>& out, const char* name, uint8_t type,
+                       const std::vector<uint32_t>& offsets, const void* data, size_t bytes) {
+        size_t name_len = std::strlen(name);
+        out.push_back(static_cast<uint8_t>(name_len));
+        out.insert(out.end(), name, name + name_len);
+        out.push_back(type);
+        put<uint64_t>(out, offsets.size() * sizeof(uint32_t) + bytes);
+        const uint8_t* o = reinterpret_cast<const uint8_t*>(offsets.data());
+        out.insert(out.end(), o, o + offsets.size() * sizeof(uint32_t));
+        const uint8_t* d = static_cast<const uint8_t*>(data);
+        out.insert(out.end(), d, d + bytes);
+    }
+
+    template <typename T>
+    static void fixed(std::vector<uint8_t>& out, const char* name, uint8_t type, const std::vector<T>& values) {
+        column(out, name, type, {}, values.data(), values.size() * sizeof(T));
+    }
+
+    std::string names_;
+    std::vector<uint32_t> name_offsets_;
+    std::vector<uint8_t> status_;
+    std::vector<int32_t> width_;
+    std::vector<int32_t> height_;
+    std::vector<float> iou_;
+    std::vector<uint8_t> board_detected_;
+    std::vector<float> ratio_px_mm_;
+    std::vector<float> length_px_;
+    std::vector<float> width_px_;
+    std::vector<float> length_mm_;
+    std::vector<float> width_mm_;
+    std::vector<float> angle_deg_;
+    std::vector<uint64_t> area_px_;
+    std::vector<uint32_t> run_offsets_;
+    std::vector<uint32_t> runs_;
+};
+
+// A decoded chunk: columns by name, as raw bytes
+struct ChunkColumns {
+    uint32_t rows = 0;
+    std::vector<std::string> names;
+    std::vector<uint8_t> types;
+    std::vector<std::vector<uint8_t>> data;
+
+    const std::vector<uint8_t>* find(const char* name, uint8_t type) const {
+        for (size_t i = 0; i < names.size(); i++) {
+            if (names[i] == name && types[i] == type) return &data[i];
+        }
+        return nullptr;
+    }
+
+    template <typename T>
+    T value(const char* name, uint8_t type, uint32_t row) const {
+        const std::vector<uint8_t>* column = find(name, type);
+        T v = T();
+        if (column && (row + 1) * sizeof(T) <= column->size()) std::memcpy(&v, column->data() + row * sizeof(T), sizeof(T));
+        return v;
+    }
+
+    std::string string(const char* name, uint32_t row) const {
+        const std::vector<uint8_t>* column = find(name, COLUMN_STRING);
+        if (!column || (rows + 1) * sizeof(uint32_t) > column->size()) return std::string();
+        uint32_t begin, end;
+        std::memcpy(&begin, column->data() + row * sizeof(uint32_t), sizeof(uint32_t));
+        std::memcpy(&end, column->data() + (row + 1) * sizeof(uint32_t), sizeof(uint32_t));
+        size_t base = (rows + 1) * sizeof(uint32_t);
+        if (begin > end || base + end > column->size()) return std::string();
+        return std::string(reinterpret_cast<const char*>(column->data() + base + begin), end - begin);
+    }
+};
+
+static bool parse_payload(const std::vector<uint8_t>& payload, uint32_t rows, ChunkColumns& out) {
+    out = ChunkColumns();
+    out.rows = rows;
+    size_t pos = 0;
+    auto take = [&](void* dst, size_t n) {
+        if (pos + n > payload.size()) return false;
+        std::memcpy(dst, payload.data() + pos, n);
+        pos += n;
+        return true;
+    };
+    uint32_t num_columns = 0;
+    if (!take(&num_columns, sizeof(num_columns))) return false;
+    for (uint32_t c = 0; c < num_columns; c++) {
+        uint8_t name_len = 0, type = 0;
+        uint64_t bytes = 0;
+        if (!take(&name_len, 1)) return false;
+        std::string name(name_len, '\0');
+        if (!take(&name[0], name_len) || !take(&type, 1) || !take(&bytes, sizeof(bytes))) return false;
+        if (bytes > payload.size() - pos) return false;
+        out.names.push_back(name);
+        out.types.push_back(type);
+        out.data.emplace_back(payload.begin() + pos, payload.begin() + pos + bytes);
+        pos += bytes;
+    }
+    return true;
+}
+
+// Reads chunks in order; stops at the end, or at the first torn or
+// corrupt chunk (valid_end() is then where it starts)
+class ChunkReader {
+public:
+    explicit ChunkReader(FILE* file) : file_(file) {
+        struct stat st;
+        if (fstat(fileno(file), &st) == 0) size_ = st.st_size;
+    }
+
+    bool read_header() {
+        char magic[8];
+        uint32_t version = 0, reserved = 0;
+        if (std::fread(magic, 1, 8, file_) != 8 || std::memcmp(magic, BATCH_FILE_MAGIC, 8) != 0) return false;
+        if (std::fread(&version, 4, 1, file_) != 1 || std::fread(&reserved, 4, 1, file_) != 1) return false;
+        valid_end_ = BATCH_HEADER_BYTES;
+        return version == BATCH_FILE_VERSION;
+    }
+
+    bool next(ChunkColumns& chunk) {
+        uint32_t header[4];
+        if (std::fread(header, sizeof(uint32_t), 4, file_) != 4 || header[0] != BATCH_CHUNK_MAGIC) return false;
+        // A garbage length in a torn tail must not become an allocation
+        long pos = std::ftell(file_);
+        if (pos < 0 || static_cast<long long>(header[2]) > static_cast<long long>(size_) - pos) return false;
+        std::vector<uint8_t> payload(header[2]);
+        if (std::fread(payload.data(), 1, payload.size(), file_) != payload.size()) return false;
+        if (crc32(payload.data(), payload.size()) != header[3]) return false;
+        if (!parse_payload(payload, header[1], chunk)) return false;
+        valid_end_ = std::ftell(file_);
+        return true;
+    }
+
+    long valid_end() const { return valid_end_; }
+
+private:
+    FILE* file_;
+    long size_ = 0;
+    long valid_end_ = 0;
+};
+
+// ============================================================
+// PIPELINE
+// ============================================================
+
+struct BatchOptions {
+    std::string input_dir;
+    std::string output_path;
+    std::string encoder_path;
+    std::string decoder_path;
+    std::string cache_dir;
+    int workers = 0;              // 0 = cores - 1
+    int encoders = 1;             // Concurrent encoder runs on the shared model
+    uint64_t encode_budget = 0;   // Bytes per encoder run (0 = library default)
+    int intra_op_threads = 0;     // 0 = library default
+    int chunk_rows = 64;
+    bool resume = false;
+    bool overwrite = false;
+    bool aruco = true;
+    std::vector<float> points = {0.5f, 0.6f};  // Prompt points as fractions of width / height
+};
+
+static std::atomic<bool> g_interrupted(false);
+
+static void on_interrupt(int) {
+    g_interrupted.store(true);
+    std::signal(SIGINT, SIG_DFL);  // A second Ctrl-C kills the run
+}
+
+class BatchPipeline {
+public:
+    BatchPipeline(SamModel* model, const BatchOptions& options, int encode_batch, std::vector<std::string> names,
+                  FILE* output)
+        : model_(model),
+          options_(options),
+          names_(std::move(names)),
+          output_(output),
+          workers_(std::max(1, options.workers)),
+          encode_batch_(std::max(1, encode_batch)),
+          encode_queue_(std::max(workers_ + 1, options.encoders * encode_batch_)),
+          decode_queue_(2),
+          write_queue_(2 * static_cast<size_t>(options.chunk_rows)),
+          free_tensors_(workers_ + options.encoders * encode_batch_ + 1),
+          free_embeddings_(options.encoders * encode_batch_ + 2) {
+        tensors_.resize(free_tensors_.capacity());
+        for (auto& tensor : tensors_) {
+            tensor.reset(new float[3 * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE]);
+            free_tensors_.push(tensor.get());
+        }
+        embeddings_.resize(free_embeddings_.capacity());
+        for (auto& embedding : embeddings_) {
+            embedding.reset(new float[SAM_EMBEDDING_DIM * SAM_EMBEDDING_SIZE * SAM_EMBEDDING_SIZE]);
+            free_embeddings_.push(embedding.get());
+        }
+    }
+
+    // Runs every image; returns false if writing the output failed
+    bool run() {
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> loaders;
+        for (int i = 0; i < workers_; i++) loaders.emplace_back([this] { load_loop(); });
+        std::vector<std::thread> encoders;
+        for (int i = 0; i < options_.encoders; i++) encoders.emplace_back([this] { encode_loop(); });
+        std::thread decoder([this] { decode_loop(); });
+        std::thread writer([this] { write_loop(); });
+
+        std::thread progress([this, start] {
+            std::unique_lock<std::mutex> lock(progress_mutex_);
+            while (!progress_done_.wait_for(lock, std::chrono::seconds(2), [this] { return finished_; })) {
+                report(start, false);
+            }
+        });
+
+        for (auto& loader : loaders) loader.join();
+        encode_queue_.close();
+        for (auto& encoder : encoders) encoder.join();
+        decode_queue_.close();
+        decoder.join();
+        write_queue_.close();
+        writer.join();
+        {
+            std::lock_guard<std::mutex> lock(progress_mutex_);
+            finished_ = true;
+        }
+        progress_done_.notify_all();
+        progress.join();
+        report(start, true);
+        return !write_failed_;
+    }
+
+    uint64_t written() const { return written_.load(); }
+    uint64_t failed() const { return failed_.load(); }
+
+private:
+    void load_loop() {
+#ifdef SAM_BATCH_ARUCO
+        ArucoContext* aruco = options_.aruco ? aruco_context_create() : nullptr;
+#endif
+        std::vector<uint8_t> rgb;
+        while (!g_interrupted.load()) {
+            size_t index = next_.fetch_add(1);
+            if (index >= names_.size()) break;
+
+            std::unique_ptr<BatchItem> item(new BatchItem());
+            item->name = names_[index];
+            if (!load_image(options_.input_dir + "/" + item->name, rgb, &item->width, &item->height)) {
+                item->status = BATCH_READ_FAILED;
+                item->width = item->height = 0;
+                write_queue_.push(std::move(item));
+                continue;
+            }
+#ifdef SAM_BATCH_ARUCO
+            if (aruco) {
+                aruco_detect_l_board_ex(aruco, rgb.data(), item->width, item->height, 0,
+                                        ARUCO_FORMAT_RGB, &item->calibration);
+            }
+#endif
+            float scale_x, scale_y;
+            free_tensors_.pop(item->tensor);
+            sam_preprocess_image(rgb.data(), item->width, item->height, item->tensor, &scale_x, &scale_y);
+            encode_queue_.push(std::move(item));
+        }
+#ifdef SAM_BATCH_ARUCO
+        if (aruco) aruco_context_free(aruco);
+#endif
+    }
+
+    // Each encoder and the decoder hold their own context of the model.
+    // Encoders take encode_batch_ images per run; only the last batch
+    // of the input is short.
+    void encode_loop() {
+        SamContext* ctx = sam_model_acquire(model_, -1);
+        std::vector<std::unique_ptr<BatchItem>> batch;
+        std::vector<const float*> tensors;
+        std::vector<SamEmbedding> embeddings;
+        std::unique_ptr<BatchItem> item;
+        bool open = true;
+        while (open) {
+            batch.clear();
+            while (static_cast<int>(batch.size()) < encode_batch_ && (open = encode_queue_.pop(item))) {
+                batch.push_back(std::move(item));
+            }
+            if (batch.empty()) break;
+
+            tensors.clear();
+            embeddings.clear();
+            for (auto& queued : batch) {
+                free_embeddings_.pop(queued->embedding);
+                tensors.push_back(queued->tensor);
+                embeddings.push_back(embedding_view(queued->embedding));
+            }
+            int encoded = ctx ? sam_encode_images(ctx, tensors.data(), static_cast<int>(batch.size()),
+                                                  embeddings.data()) : 0;
+            for (size_t i = 0; i < batch.size(); i++) {
+                std::unique_ptr<BatchItem>& done = batch[i];
+                free_tensors_.push(done->tensor);
+                done->tensor = nullptr;
+                if (static_cast<int>(i) >= encoded) {
+                    done->status = BATCH_SEGMENT_FAILED;
+                    free_embeddings_.push(done->embedding);
+                    done->embedding = nullptr;
+                    write_queue_.push(std::move(done));
+                    continue;
+                }
+                decode_queue_.push(std::move(done));
+            }
+        }
+        if (ctx) sam_model_release(model_, ctx);
+    }
+
+    void decode_loop() {
+        std::vector<float> masks(SAM_NUM_MASKS * SAM_MASK_SIZE * SAM_MASK_SIZE);
+        float iou_scores[SAM_NUM_MASKS];
+        int num_points = static_cast<int>(options_.points.size() / 2);
+        std::vector<float> coords(2 * num_points);
+        std::vector<int> labels(num_points, 1);
+        SamContext* ctx = sam_model_acquire(model_, -1);
+
+        std::unique_ptr<BatchItem> item;
+        while (decode_queue_.pop(item)) {
+            for (int i = 0; i < num_points; i++) {
+                sam_transform_coords(options_.points[2 * i] * item->width, options_.points[2 * i + 1] * item->height,
+                                     item->width, item->height, &coords[2 * i], &coords[2 * i + 1]);
+            }
+            SamEmbedding embedding = embedding_view(item->embedding);
+            SamPointPrompt prompt = {coords.data(), labels.data(), num_points};
+            SamMaskResult result = {masks.data(), iou_scores, 0};
+            bool decoded = ctx && sam_decode_mask(ctx, &embedding, &prompt, &result);
+            free_embeddings_.push(item->embedding);
+            item->embedding = nullptr;
+
+            if (!decoded) {
+                item->status = BATCH_SEGMENT_FAILED;
+            } else {
+                item->iou = iou_scores[result.best_mask_idx];
+                const float* best = masks.data() + result.best_mask_idx * SAM_MASK_SIZE * SAM_MASK_SIZE;
+                measure(*item, best);
+            }
+            write_queue_.push(std::move(item));
+        }
+        if (ctx) sam_model_release(model_, ctx);
+    }
+
+    // Compact runs of the best mask, then the measurement on them
+    static void measure(BatchItem& item, const float* best) {
+        const ArucoCalibrationResult* calibration = item.calibration.board_detected ? &item.calibration : nullptr;
+        if (!foot_measure_logits(best, item.width, item.height, 0.0f, calibration, &item.measurement, &item.runs)) {
+            item.status = BATCH_EMPTY_MASK;
+        }
+    }
+
+    void write_loop() {
+        ColumnChunk chunk;
+        std::unique_ptr<BatchItem> item;
+        while (write_queue_.pop(item)) {
+            if (item->status != BATCH_OK) failed_++;
+            chunk.add(*item);
+            if (static_cast<int>(chunk.rows()) >= options_.chunk_rows) flush(chunk);
+        }
+        if (chunk.rows() > 0) flush(chunk);
+    }
+
+    // A chunk only counts once it is on disk: flush, then fsync, so a
+    // resumed run never skips an image whose row was lost
+    void flush(ColumnChunk& chunk) {
+        std::vector<uint8_t> bytes = chunk.encode();
+        bool ok = !write_failed_ && std::fwrite(bytes.data(), 1, bytes.size(), output_) == bytes.size() &&
+                  std::fflush(output_) == 0 && fsync(fileno(output_)) == 0;
+        if (ok) {
+            written_ += chunk.rows();
+        } else if (!write_failed_) {
+            write_failed_ = true;
+            std::perror("sam_batch: write");
+            g_interrupted.store(true);
+        }
+        chunk.clear();
+    }
+
+    void report(std::chrono::steady_clock::time_point start, bool final) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        uint64_t done = written_.load();
+        std::fprintf(stderr, "%s[%llu/%zu] %.2f img/s  queues: encode %zu/%zu decode %zu/%zu write %zu/%zu%s",
+                     final ? "" : "\r", static_cast<unsigned long long>(done), names_.size(),
+                     seconds > 0 ? done / seconds : 0.0,
+                     encode_queue_.size(), encode_queue_.capacity(), decode_queue_.size(), decode_queue_.capacity(),
+                     write_queue_.size(), write_queue_.capacity(), final ? "\n" : "");
+        if (final) {
+            std::fprintf(stderr, "%llu images in %.1f s (%.2f img/s), %llu not measured\n",
+                         static_cast<unsigned long long>(done), seconds, seconds > 0 ? done / seconds : 0.0,
+                         static_cast<unsigned long long>(failed_.load()));
+        }
+    }
+
+    static SamEmbedding embedding_view(float* data) {
+        SamEmbedding embedding = {};
+        embedding.data = data;
+        embedding.batch_size = 1;
+        embedding.channels = SAM_EMBEDDING_DIM;
+        embedding.height = SAM_EMBEDDING_SIZE;
+        embedding.width = SAM_EMBEDDING_SIZE;
+        return embedding;
+    }
+
+    SamModel* model_;
+    const BatchOptions& options_;
+    std::vector<std::string> names_;
+    FILE* output_;
+    int workers_;
+    int encode_batch_;
+
+    std::atomic<size_t> next_{0};
+    BoundedQueue<std::unique_ptr<BatchItem>> encode_queue_;
+    BoundedQueue<std::unique_ptr<BatchItem>> decode_queue_;
+    BoundedQueue<std::unique_ptr<BatchItem>> write_queue_;
+    BoundedQueue<float*> free_tensors_;
+    BoundedQueue<float*> free_embeddings_;
+    std::vector<std::unique_ptr<float[]>> tensors_;
+    std::vector<std::unique_ptr<float[]>> embeddings_;
+
+    std::atomic<uint64_t> written_{0};
+    std::atomic<uint64_t> failed_{0};
+    bool write_failed_ = false;  // Writer thread only
+
+    std::mutex progress_mutex_;
+    std::condition_variable progress_done_;
+    bool finished_ = false;
+};
+
+// ============================================================
+// OUTPUT FILE HANDLING
+// ============================================================
+
+// Opens the output for appending. With resume, records the names of
+// rows already written and cuts off a torn last chunk.
+static FILE* open_output(const BatchOptions& options, std::unordered_set<std::string>& done) {
+    struct stat st;
+    bool exists = stat(options.output_path.c_str(), &st) == 0;
+    if (exists && !options.resume && !options.overwrite) {
+        std::fprintf(stderr, "%s exists; pass --resume to continue it or --overwrite\n", options.output_path.c_str());
+        return nullptr;
+    }
+
+    if (exists && options.resume) {
+        FILE* file = std::fopen(options.output_path.c_str(), "rb");
+        if (!file) {
+            std::perror(options.output_path.c_str());
+            return nullptr;
+        }
+        ChunkReader reader(file);
+        if (!reader.read_header()) {
+            std::fclose(file);
+            std::fprintf(stderr, "%s is not a sam_batch file\n", options.output_path.c_str());
+            return nullptr;
+        }
+        ChunkColumns chunk;
+        while (reader.next(chunk)) {
+            for (uint32_t row = 0; row < chunk.rows; row++) done.insert(chunk.string("name", row));
+        }
+        long valid_end = reader.valid_end();
+        std::fclose(file);
+        if (valid_end < st.st_size) {
+            std::fprintf(stderr, "Dropping %lld bytes of an incomplete chunk\n",
+                         static_cast<long long>(st.st_size - valid_end));
+            if (truncate(options.output_path.c_str(), valid_end) != 0) {
+                std::perror("truncate");
+                return nullptr;
+            }
+        }
+        FILE* output = std::fopen(options.output_path.c_str(), "ab");
+        if (!output) std::perror(options.output_path.c_str());
+        return output;
+    }
+
+    FILE* output = std::fopen(options.output_path.c_str(), "wb");
+    if (!output) {
+        std::perror(options.output_path.c_str());
+        return nullptr;
+    }
+    uint32_t header[2] = {BATCH_FILE_VERSION, 0};
+    if (std::fwrite(BATCH_FILE_MAGIC, 1, 8, output) != 8 || std::fwrite(header, 4, 2, output) != 2 ||
+        std::fflush(output) != 0) {
+        std::perror(options.output_path.c_str());
+        std::fclose(output);
+        return nullptr;
+    }
+    return output;
+}
+
+// Prints the measurement columns as CSV (runs are left out)
+static int dump_output(const char* path) {
+    FILE* file = std::fopen(path, "rb");
+    if (!file) {
+        std::perror(path);
+        return 1;
+    }
+    ChunkReader reader(file);
+    if (!reader.read_header()) {
+        std::fclose(file);
+        std::fprintf(stderr, "%s is not a sam_batch file\n", path);
+        return 1;
+    }
+    std::printf("name,status,width,height,iou,board_detected,ratio_px_mm,length_px,width_px,"
+                "length_mm,width_mm,angle_deg,area_px,num_runs\n");
+    ChunkColumns chunk;
+    while (reader.next(chunk)) {
+        const std::vector<uint8_t>* runs = chunk.find("runs", COLUMN_U32_LIST);
+        for (uint32_t row = 0; row < chunk.rows; row++) {
+            uint8_t status = chunk.value<uint8_t>("status", COLUMN_U8, row);
+            uint32_t run_begin = 0, run_end = 0;
+            if (runs && (chunk.rows + 1) * sizeof(uint32_t) <= runs->size()) {
+                std::memcpy(&run_begin, runs->data() + row * sizeof(uint32_t), sizeof(uint32_t));
+                std::memcpy(&run_end, runs->data() + (row + 1) * sizeof(uint32_t), sizeof(uint32_t));
+            }
+            std::printf("%s,%s,%d,%d,%.4f,%d,%.4f,%.2f,%.2f,%.2f,%.2f,%.2f,%llu,%u\n",
+                        chunk.string("name", row).c_str(),
+                        status < 4 ? BATCH_STATUS_NAMES[status] : "unknown",
+                        chunk.value<int32_t>("width", COLUMN_I32, row),
+                        chunk.value<int32_t>("height", COLUMN_I32, row),
+                        chunk.value<float>("iou", COLUMN_F32, row),
+                        chunk.value<uint8_t>("board_detected", COLUMN_U8, row),
+                        chunk.value<float>("ratio_px_mm", COLUMN_F32, row),
+                        chunk.value<float>("length_px", COLUMN_F32, row),
+                        chunk.value<float>("width_px", COLUMN_F32, row),
+                        chunk.value<float>("length_mm", COLUMN_F32, row),
+                        chunk.value<float>("width_mm", COLUMN_F32, row),
+                        chunk.value<float>("angle_deg", COLUMN_F32, row),
+                        static_cast<unsigned long long>(chunk.value<uint64_t>("area_px", COLUMN_U64, row)),
+                        run_end - run_begin);
+        }
+    }
+    struct stat st;
+    bool complete = stat(path, &st) == 0 && reader.valid_end() == st.st_size;
+    std::fclose(file);
+    if (!complete) std::fprintf(stderr, "warning: %s ends with an incomplete or corrupt chunk\n", path);
+    return 0;
+}
+
+// ============================================================
+// MAIN
+// ============================================================
+
+static void print_usage() {
+    std::printf(
+        "Usage: sam_batch --input DIR --output FILE --encoder PATH --decoder PATH [options]\n"
+        "       sam_batch --dump FILE\n"
+        "  --input DIR         Images to process (.ppm/.pgm%s)\n"
+        "  --output FILE       Columnar results file\n"
+        "  --resume            Continue an interrupted run, skipping images already in FILE\n"
+        "  --overwrite         Replace FILE if it exists\n"
+        "  --workers N         Load / ArUco / preprocess threads (default: cores - 1)\n"
+        "  --threads N         Encoder / decoder intra-op threads (default 4)\n"
+        "  --encoders N        Concurrent encoder runs sharing one model (default 1)\n"
+        "  --encode-budget MB  Memory per encoder run; sets the images per run\n"
+        "                      (see sam_set_encode_budget)\n"
+        "  --chunk N           Rows per output chunk (default 64)\n"
+        "  --point FX,FY       Foreground prompt as a fraction of the image size\n"
+        "                      (repeatable, default 0.5,0.6)\n"
+        "  --cache-dir DIR     Optimized-graph cache (see SamStartupOptions)\n"
+        "  --no-aruco          Skip L-board detection (pixels only)\n"
+        "  --dump FILE         Print a results file as CSV and exit\n",
+#ifdef SAM_BATCH_IMGCODECS
+        ", or anything OpenCV reads"
+#else
+        ""
+#endif
+    );
+}
+
+int main(int argc, char** argv) {
+    BatchOptions options;
+    bool default_points = true;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--dump" && has_value) return dump_output(argv[++i]);
+        else if (arg == "--input" && has_value) options.input_dir = argv[++i];
+        else if (arg == "--output" && has_value) options.output_path = argv[++i];
+        else if (arg == "--encoder" && has_value) options.encoder_path = argv[++i];
+        else if (arg == "--decoder" && has_value) options.decoder_path = argv[++i];
+        else if (arg == "--cache-dir" && has_value) options.cache_dir = argv[++i];
+        else if (arg == "--workers" && has_value) options.workers = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--threads" && has_value) options.intra_op_threads = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--encoders" && has_value) options.encoders = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--encode-budget" && has_value) {
+            options.encode_budget = static_cast<uint64_t>(std::max(0, std::atoi(argv[++i]))) << 20;
+        }
+        else if (arg == "--chunk" && has_value) options.chunk_rows = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--point" && has_value) {
+            float fx, fy;
+            if (std::sscanf(argv[++i], "%f,%f", &fx, &fy) != 2 || fx < 0 || fx > 1 || fy < 0 || fy > 1) {
+                std::fprintf(stderr, "--point takes FX,FY fractions in [0, 1]\n");
+                return 2;
+            }
+            if (default_points) options.points.clear();
+            default_points = false;
+            options.points.push_back(fx);
+            options.points.push_back(fy);
+        }
+        else if (arg == "--resume") options.resume = true;
+        else if (arg == "--overwrite") options.overwrite = true;
+        else if (arg == "--no-aruco") options.aruco = false;
+        else {
+            print_usage();
+            return arg == "--help" || arg == "-h" ? 0 : 2;
+        }
+    }
+    if (options.input_dir.empty() || options.output_path.empty() ||
+        options.encoder_path.empty() || options.decoder_path.empty()) {
+        print_usage();
+        return 2;
+    }
+    if (options.workers == 0) {
+        options.workers = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    }
+
+    std::vector<std::string> all_names;
+    if (!list_images(options.input_dir, all_names)) {
+        std::perror(options.input_dir.c_str());
+        return 1;
+    }
+
+    std::unordered_set<std::string> done;
+    FILE* output = open_output(options, done);
+    if (!output) return 1;
+    std::vector<std::string> names;
+    for (const std::string& name : all_names) {
+        if (!done.count(name)) names.push_back(name);
+    }
+    std::fprintf(stderr, "%zu images, %zu already done, %zu to process\n",
+                 all_names.size(), all_names.size() - names.size(), names.size());
+    if (names.empty()) {
+        std::fclose(output);
+        return 0;
+    }
+
+    SamConfig config = {};
+    config.intra_op_threads = options.intra_op_threads;
+    config.startup.cache_dir = options.cache_dir.empty() ? nullptr : options.cache_dir.c_str();
+    // One copy of the weights however many encoders run
+    SamModel* model = sam_model_create(options.encoder_path.c_str(), options.decoder_path.c_str(), &config,
+                                       options.encoders + 1);
+    if (!model) {
+        std::fprintf(stderr, "Failed to load %s / %s\n", options.encoder_path.c_str(), options.decoder_path.c_str());
+        std::fclose(output);
+        return 1;
+    }
+
+    // The first context owns the sessions; later ones copy its budget
+    SamContext* ctx = sam_model_acquire(model, 0);
+    if (options.encode_budget > 0) sam_set_encode_budget(ctx, options.encode_budget, 0);
+    int encode_batch = sam_get_encode_batch_size(ctx);
+    sam_model_release(model, ctx);
+    std::fprintf(stderr, "%d encoder(s), %d image(s) per encoder run\n", options.encoders, encode_batch);
+
+    std::signal(SIGINT, on_interrupt);
+    sam_reset_stats();
+    BatchPipeline pipeline(model, options, encode_batch, std::move(names), output);
+    bool ok = pipeline.run();
+    ok = std::fclose(output) == 0 && ok;
+    sam_model_free(model);
+
+    // Where the time went, per stage
+    SamStats stats;
+    if (sam_get_stats(&stats)) {
+        std::fprintf(stderr, "%-12s %8s %10s %10s %10s\n", "stage", "calls", "mean ms", "p50 ms", "p99 ms");
+        for (int s = 0; s < SAM_STAGE_COUNT; s++) {
+            const SamStageStats& stage = stats.stages[s];
+            if (stage.count == 0) continue;
+            std::fprintf(stderr, "%-12s %8llu %10.2f %10.2f %10.2f\n", sam_stage_name(s),
+                         static_cast<unsigned long long>(stage.count), stage.mean_ms, stage.p50_ms, stage.p99_ms);
+        }
+    }
+
+    if (!ok) return 1;
+    if (g_interrupted.load()) {
+        std::fprintf(stderr, "Interrupted; rerun with --resume to continue\n");
+        return 130;
+    }
+    return 0;
+}
@@ -0,0 +1,1043 @@
+/**
+ * SAM Microbenchmarks
+ *
+ * Times the flutter_cpp hot paths on synthetic inputs: preprocessing at
+ * several photo sizes, mask postprocessing at phone resolutions, compact
+ * masks and foot measurement, ArUco detection on rendered L-boards
+ * (when built with OpenCV) and encoder / decoder calls.
+ *
+ * Model benchmarks use tiny stand-in ONNX graphs written at startup with
+ * the exported SAM input / output names and shapes, so a run needs no
+ * model files or network and measures the library's own overhead
+ * (binding, caching, pre/post) rather than network FLOPs. Pass
+ * --encoder / --decoder to time real models instead.
+ *
+ * Every case reports latency percentiles, throughput and heap
+ * allocations per call (operator new, including the library's); --json
+ * writes the same numbers for comparing releases.
+ *
+ * verify/... cases check the optimized paths against reference
+ * implementations and the tolerances documented in sam_inference.h;
+ * any failure makes the run exit with status 1.
+ */
+
+#include "sam_inference.h"
+#include "foot_measure.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#ifdef SAM_BENCH_ARUCO
+#include "aruco_calibration.h"
+#include <opencv2/aruco.hpp>
+#include <opencv2/imgproc.hpp>
+#endif
+
+// ============================================================
+// ALLOCATION COUNTING
+// ============================================================
+// The executable's operator new also serves the shared library on
+// ELF platforms, so library allocations are counted too.
+
+static std::atomic<uint64_t> g_alloc_count(0);
+static std::atomic<uint64_t> g_alloc_bytes(0);
+
+void* operator new(size_t size) {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* ptr = std::malloc(size ? size : 1);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+    return operator new(size, tag);
+}
+
+// Kept out of line: once inlined, GCC flags free() on operator new
+// memory as a mismatch
+__attribute__((noinline)) void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+
+// ============================================================
+// BENCHMARK RUNNER
+// ============================================================
+
+struct BenchOptions {
+    int iterations = 20;
+    int warmup = 2;
+    std::string filter;
+    std::string json_path;
+    std::string label;
+    std::string encoder_path;
+    std::string decoder_path;
+    std::string batch_encoder_path;  // Stand-in with a dynamic batch (empty = encoder_path)
+    bool standin_models = false;
+    bool list_only = false;
+};
+
+struct BenchResult {
+    std::string name;
+    int iterations;
+    double min_ms, p50_ms, p90_ms, p99_ms, max_ms, mean_ms;
+    double throughput;
+    std::string throughput_unit;
+    double allocs_per_op;
+    double alloc_bytes_per_op;
+};
+
+struct CheckResult {
+    std::string name;
+    double value;
+    double limit;
+    bool upper;  // value must be <= limit (else >= limit)
+    bool passed;
+};
+
+class BenchSuite {
+public:
+    explicit BenchSuite(const BenchOptions& options) : options_(options) {}
+
+    bool listing() const { return options_.list_only; }
+
+    bool enabled(const std::string& name) const {
+        return options_.filter.empty() || name.find(options_.filter) != std::string::npos;
+    }
+
+    // Time fn() and record it; units_per_op / seconds gives throughput
+    template <typename Fn>
+    void run(const std::string& name, double units_per_op, const char* unit, Fn&& fn) {
+        if (!enabled(name)) return;
+        if (options_.list_only) {
+            std::printf("%s\n", name.c_str());
+            return;
+        }
+
+        for (int i = 0; i < options_.warmup; i++) fn();
+
+        std::vector<double> samples(options_.iterations);
+        uint64_t count_before = g_alloc_count.load();
+        uint64_t bytes_before = g_alloc_bytes.load();
+        for (int i = 0; i < options_.iterations; i++) {
+            auto start = std::chrono::steady_clock::now();
+            fn();
+            samples[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        uint64_t count = g_alloc_count.load() - count_before;
+        uint64_t bytes = g_alloc_bytes.load() - bytes_before;
+
+        BenchResult r;
+        r.name = name;
+        r.iterations = options_.iterations;
+        std::vector<double> sorted = samples;
+        std::sort(sorted.begin(), sorted.end());
+        r.min_ms = sorted.front();
+        r.max_ms = sorted.back();
+        r.p50_ms = percentile(sorted, 50);
+        r.p90_ms = percentile(sorted, 90);
+        r.p99_ms = percentile(sorted, 99);
+        double total = 0;
+        for (double s : samples) total += s;
+        r.mean_ms = total / samples.size();
+        r.throughput = r.mean_ms > 0 ? units_per_op / (r.mean_ms / 1000.0) : 0;
+        r.throughput_unit = unit;
+        r.allocs_per_op = static_cast<double>(count) / options_.iterations;
+        r.alloc_bytes_per_op = static_cast<double>(bytes) / options_.iterations;
+
+        std::fprintf(report(), "%-40s %9.3f %9.3f %9.3f %9.3f %11.1f %-6s %8.1f %10.0f\n",
+                     r.name.c_str(), r.min_ms, r.p50_ms, r.p90_ms, r.p99_ms,
+                     r.throughput, unit, r.allocs_per_op, r.alloc_bytes_per_op);
+        std::fflush(report());
+        results_.push_back(r);
+    }
+
+    // Accuracy checks run next to the timings: measure() returns the
+    // value compared against limit. Failures make sam_bench exit 1.
+    template <typename Fn>
+    void check_max(const std::string& name, double limit, Fn&& measure) {
+        check(name, limit, true, measure);
+    }
+
+    template <typename Fn>
+    void check_min(const std::string& name, double limit, Fn&& measure) {
+        check(name, limit, false, measure);
+    }
+
+    bool checks_passed() const {
+        for (const CheckResult& c : checks_) {
+            if (!c.passed) return false;
+        }
+        return true;
+    }
+
+    void print_header() const {
+        if (options_.list_only) return;
+        std::fprintf(report(), "%-40s %9s %9s %9s %9s %18s %8s %10s\n",
+                     "benchmark", "min ms", "p50 ms", "p90 ms", "p99 ms", "throughput", "allocs", "bytes");
+    }
+
+    bool write_json(const char* path) const;
+
+private:
+    // Human-readable table; stderr when the JSON goes to stdout
+    FILE* report() const { return options_.json_path == "-" ? stderr : stdout; }
+
+    // Nearest-rank percentile of sorted samples
+    static double percentile(const std::vector<double>& sorted, int p) {
+        size_t rank = (p * sorted.size() + 99) / 100;
+        return sorted[std::min(sorted.size(), std::max<size_t>(rank, 1)) - 1];
+    }
+
+    template <typename Fn>
+    void check(const std::string& name, double limit, bool upper, Fn& measure) {
+        if (!enabled(name)) return;
+        if (options_.list_only) {
+            std::printf("%s\n", name.c_str());
+            return;
+        }
+        CheckResult c;
+        c.name = name;
+        c.value = measure();
+        c.limit = limit;
+        c.upper = upper;
+        c.passed = upper ? c.value <= limit : c.value >= limit;
+        std::fprintf(report(), "%-40s %9.3g %s %-9.3g %s\n", name.c_str(), c.value, upper ? "<=" : ">=", limit,
+                     c.passed ? "ok" : "FAILED");
+        std::fflush(report());
+        checks_.push_back(c);
+    }
+
+    const BenchOptions& options_;
+    std::vector<BenchResult> results_;
+    std::vector<CheckResult> checks_;
+};
+
+// Names, labels and paths only need quotes and backslashes escaped
+static std::string json_string(const std::string& value) {
+    std::string out = "\"";
+    for (char c : value) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (static_cast<unsigned char>(c) >= 0x20) out += c;
+    }
+    return out + "\"";
+}
+
+bool BenchSuite::write_json(const char* path) const {
+    FILE* file = std::strcmp(path, "-") == 0 ? stdout : std::fopen(path, "w");
+    if (!file) return false;
+
+    std::fprintf(file, "{\n  \"schema\": 1,\n  \"label\": %s,\n", json_string(options_.label).c_str());
+    std::fprintf(file, "  \"timestamp\": %lld,\n",
+                 static_cast<long long>(std::chrono::duration_cast<std::chrono::seconds>(
+                     std::chrono::system_clock::now().time_since_epoch()).count()));
+    std::fprintf(file, "  \"host\": {\"hardware_threads\": %u, \"compiler\": %s},\n",
+                 std::thread::hardware_concurrency(), json_string(__VERSION__).c_str());
+    std::fprintf(file, "  \"models\": %s,\n",
+                 options_.standin_models ? "\"stand-in\"" : json_string(options_.encoder_path).c_str());
+    std::fprintf(file, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results_.size(); i++) {
+        const BenchResult& r = results_[i];
+        std::fprintf(file,
+                     "    {\"name\": %s, \"iterations\": %d, "
+                     "\"ms\": {\"min\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f}, "
+                     "\"throughput\": %.3f, \"throughput_unit\": %s, "
+                     "\"allocs_per_op\": %.2f, \"alloc_bytes_per_op\": %.0f}%s\n",
+                     json_string(r.name).c_str(), r.iterations,
+                     r.min_ms, r.p50_ms, r.p90_ms, r.p99_ms, r.max_ms, r.mean_ms,
+                     r.throughput, json_string(r.throughput_unit).c_str(),
+                     r.allocs_per_op, r.alloc_bytes_per_op,
+                     i + 1 < results_.size() ? "," : "");
+    }
+    std::fprintf(file, "  ],\n  \"checks\": [\n");
+    for (size_t i = 0; i < checks_.size(); i++) {
+        const CheckResult& c = checks_[i];
+        std::fprintf(file, "    {\"name\": %s, \"value\": %.9g, \"%s\": %.9g, \"passed\": %s}%s\n",
+                     json_string(c.name).c_str(), c.value, c.upper ? "max" : "min", c.limit,
+                     c.passed ? "true" : "false", i + 1 < checks_.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    if (file != stdout) std::fclose(file);
+    return true;
+}
+
+// ============================================================
+// STAND-IN MODELS
+// ============================================================
+// Minimal protobuf writer for ONNX ModelProto (IR 8, opset 13)
+
+class ProtoWriter {
+public:
+    const std::string& bytes() const { return buf_; }
+
+    void varint(int field, uint64_t value) {
+        key(field, 0);
+        put_varint(value);
+    }
+
+    void fixed32(int field, float value) {
+        key(field, 5);
+        char raw[4];
+        std::memcpy(raw, &value, 4);
+        buf_.append(raw, 4);
+    }
+
+    void bytes(int field, const std::string& value) {
+        key(field, 2);
+        put_varint(value.size());
+        buf_ += value;
+    }
+
+    void message(int field, const ProtoWriter& value) { bytes(field, value.buf_); }
+
+private:
+    void key(int field, int wire_type) { put_varint((static_cast<uint64_t>(field) << 3) | wire_type); }
+
+    void put_varint(uint64_t value) {
+        while (value >= 0x80) {
+            buf_ += static_cast<char>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        buf_ += static_cast<char>(value);
+    }
+
+    std::string buf_;
+};
+
+static const int ONNX_FLOAT = 1;
+static const int ONNX_INT64 = 7;
+
+// ValueInfoProto; negative dims become symbolic
+static ProtoWriter onnx_value_info(const char* name, int elem_type, const std::vector<int64_t>& dims) {
+    ProtoWriter shape;
+    for (size_t i = 0; i < dims.size(); i++) {
+        ProtoWriter dim;
+        if (dims[i] >= 0) {
+            dim.varint(1, static_cast<uint64_t>(dims[i]));
+        } else {
+            dim.bytes(2, "d" + std::to_string(i));
+        }
+        shape.message(1, dim);
+    }
+    ProtoWriter tensor_type;
+    tensor_type.varint(1, elem_type);
+    tensor_type.message(2, shape);
+    ProtoWriter type;
+    type.message(1, tensor_type);
+    ProtoWriter info;
+    info.bytes(1, name);
+    info.message(2, type);
+    return info;
+}
+
+// Float initializer filled with a fixed pseudo-random pattern
+static ProtoWriter onnx_initializer(const char* name, const std::vector<int64_t>& dims, float scale) {
+    size_t count = 1;
+    ProtoWriter tensor;
+    for (int64_t dim : dims) {
+        tensor.varint(1, static_cast<uint64_t>(dim));
+        count *= static_cast<size_t>(dim);
+    }
+    std::vector<float> values(count);
+    uint32_t state = 0x9E3779B9u;
+    for (float& v : values) {
+        state = state * 1664525u + 1013904223u;
+        v = scale * (static_cast<float>(state >> 8) / 16777216.0f - 0.5f);
+    }
+    tensor.varint(2, ONNX_FLOAT);
+    tensor.bytes(8, name);
+    tensor.bytes(9, std::string(reinterpret_cast<const char*>(values.data()), count * sizeof(float)));
+    return tensor;
+}
+
+static ProtoWriter onnx_ints_attribute(const char* name, const std::vector<int64_t>& values) {
+    ProtoWriter attr;
+    attr.bytes(1, name);
+    for (int64_t v : values) attr.varint(8, static_cast<uint64_t>(v));
+    attr.varint(20, 7);  // INTS
+    return attr;
+}
+
+static ProtoWriter onnx_int_attribute(const char* name, int64_t value) {
+    ProtoWriter attr;
+    attr.bytes(1, name);
+    attr.varint(3, static_cast<uint64_t>(value));
+    attr.varint(20, 2);  // INT
+    return attr;
+}
+
+static ProtoWriter onnx_node(const char* op_type,
+                             const std::vector<const char*>& inputs,
+                             const std::vector<const char*>& outputs,
+                             const std::vector<ProtoWriter>& attributes = {}) {
+    ProtoWriter node;
+    for (const char* input : inputs) node.bytes(1, input);
+    for (const char* output : outputs) node.bytes(2, output);
+    node.bytes(4, op_type);
+    for (const ProtoWriter& attr : attributes) node.message(5, attr);
+    return node;
+}
+
+static bool write_onnx_model(const std::string& path, const ProtoWriter& graph) {
+    ProtoWriter opset;
+    opset.bytes(1, "");
+    opset.varint(2, 13);
+    ProtoWriter model;
+    model.varint(1, 8);
+    model.bytes(2, "sam_bench");
+    model.message(7, graph);
+    model.message(8, opset);
+
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) return false;
+    bool ok = std::fwrite(model.bytes().data(), 1, model.bytes().size(), file) == model.bytes().size();
+    return std::fclose(file) == 0 && ok;
+}
+
+// image [N,3,1024,1024] -> 16x16 average pool -> 1x1 conv -> image_embeddings [N,256,64,64];
+// N is 1, or symbolic when batch < 0
+static bool write_standin_encoder(const std::string& path, int64_t batch) {
+    const int64_t pool = SAM_IMAGE_SIZE / SAM_EMBEDDING_SIZE;
+    ProtoWriter graph;
+    graph.message(1, onnx_node("AveragePool", {"image"}, {"pooled"},
+                               {onnx_ints_attribute("kernel_shape", {pool, pool}),
+                                onnx_ints_attribute("strides", {pool, pool})}));
+    graph.message(1, onnx_node("Conv", {"pooled", "embed_w", "embed_b"}, {"image_embeddings"}));
+    graph.bytes(2, "sam_encoder_standin");
+    graph.message(5, onnx_initializer("embed_w", {SAM_EMBEDDING_DIM, 3, 1, 1}, 1.0f));
+    graph.message(5, onnx_initializer("embed_b", {SAM_EMBEDDING_DIM}, 0.1f));
+    graph.message(11, onnx_value_info("image", ONNX_FLOAT, {batch, 3, SAM_IMAGE_SIZE, SAM_IMAGE_SIZE}));
+    graph.message(12, onnx_value_info("image_embeddings", ONNX_FLOAT,
+                                      {batch, SAM_EMBEDDING_DIM, SAM_EMBEDDING_SIZE, SAM_EMBEDDING_SIZE}));
+    return write_onnx_model(path, graph);
+}
+
+// image_embeddings -> 1x1 conv (4 masks) -> 4x transposed conv -> masks [1,4,256,256];
+// iou_predictions = sigmoid(mean mask logit). Point inputs are declared
+// (batch of 1, any point count) so prompts bind as with the real decoder.
+static bool write_standin_decoder(const std::string& path) {
+    const int64_t up = SAM_MASK_SIZE / SAM_EMBEDDING_SIZE;
+    ProtoWriter graph;
+    graph.message(1, onnx_node("Conv", {"image_embeddings", "head_w", "head_b"}, {"low_res"}));
+    graph.message(1, onnx_node("ConvTranspose", {"low_res", "up_w"}, {"masks"},
+                               {onnx_int_attribute("group", SAM_NUM_MASKS),
+                                onnx_ints_attribute("kernel_shape", {up, up}),
+                                onnx_ints_attribute("strides", {up, up})}));
+    graph.message(1, onnx_node("ReduceMean", {"masks"}, {"mask_mean"},
+                               {onnx_ints_attribute("axes", {2, 3}), onnx_int_attribute("keepdims", 0)}));
+    graph.message(1, onnx_node("Sigmoid", {"mask_mean"}, {"iou_predictions"}));
+    graph.bytes(2, "sam_decoder_standin");
+    graph.message(5, onnx_initializer("head_w", {SAM_NUM_MASKS, SAM_EMBEDDING_DIM, 1, 1}, 0.2f));
+    graph.message(5, onnx_initializer("head_b", {SAM_NUM_MASKS}, 0.1f));
+    graph.message(5, onnx_initializer("up_w", {SAM_NUM_MASKS, 1, up, up}, 2.0f));
+    graph.message(11, onnx_value_info("image_embeddings", ONNX_FLOAT,
+                                      {1, SAM_EMBEDDING_DIM, SAM_EMBEDDING_SIZE, SAM_EMBEDDING_SIZE}));
+    graph.message(11, onnx_value_info("point_coords", ONNX_FLOAT, {1, -1, 2}));
+    graph.message(11, onnx_value_info("point_labels", ONNX_INT64, {1, -1}));
+    graph.message(12, onnx_value_info("masks", ONNX_FLOAT, {1, SAM_NUM_MASKS, SAM_MASK_SIZE, SAM_MASK_SIZE}));
+    graph.message(12, onnx_value_info("iou_predictions", ONNX_FLOAT, {1, SAM_NUM_MASKS}));
+    return write_onnx_model(path, graph);
+}
+
+// ============================================================
+// SYNTHETIC INPUTS
+// ============================================================
+
+struct BenchSize {
+    int width;
+    int height;
+    const char* name;
+};
+
+// Camera preview, full HD and a 12 MP photo
+static const BenchSize PHOTO_SIZES[] = {
+    {640, 480, "640x480"},
+    {1920, 1080, "1920x1080"},
+    {4032, 3024, "4032x3024"},
+};
+
+static const BenchSize PHONE_SIZES[] = {
+    {1280, 720, "1280x720"},
+    {1920, 1080, "1920x1080"},
+    {4032, 3024, "4032x3024"},
+};
+
+// Smooth colour gradients with noise, closer to a photo than pure noise
+static std::vector<uint8_t> synthetic_rgb(int width, int height) {
+    std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+    uint32_t state = 12345;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            state = state * 1664525u + 1013904223u;
+            int noise = static_cast<int>(state >> 28) - 8;
+            uint8_t* p = &rgb[(static_cast<size_t>(y) * width + x) * 3];
+            p[0] = static_cast<uint8_t>(std::min(255, std::max(0, x * 255 / width + noise)));
+            p[1] = static_cast<uint8_t>(std::min(255, std::max(0, y * 255 / height + noise)));
+            p[2] = static_cast<uint8_t>(std::min(255, std::max(0, 128 + noise * 4)));
+        }
+    }
+    return rgb;
+}
+
+// Foot-like low-res logits: a tilted ellipse with a wavy outline
+static std::vector<float> synthetic_logits() {
+    std::vector<float> mask(SAM_MASK_SIZE * SAM_MASK_SIZE);
+    const float c = SAM_MASK_SIZE * 0.5f;
+    const float angle = 0.4f;
+    for (int y = 0; y < SAM_MASK_SIZE; y++) {
+        for (int x = 0; x < SAM_MASK_SIZE; x++) {
+            float dx = x - c, dy = y - c;
+            float u = (dx * std::cos(angle) + dy * std::sin(angle)) / (SAM_MASK_SIZE * 0.42f);
+            float v = (-dx * std::sin(angle) + dy * std::cos(angle)) / (SAM_MASK_SIZE * 0.17f);
+            float wave = 0.05f * std::sin(8.0f * std::atan2(v, u));
+            mask[y * SAM_MASK_SIZE + x] = 12.0f * (1.0f + wave - std::sqrt(u * u + v * v));
+        }
+    }
+    return mask;
+}
+
+// Low-res logits that stress the boundary-band upsampler: a smooth
+// disc, uniform noise, denormals, plateaus sitting exactly on the
+// thresholds, and a smooth disc with NaN cells
+enum LogitKind { LOGITS_SMOOTH, LOGITS_NOISY, LOGITS_DENORMAL, LOGITS_PLATEAU, LOGITS_NAN, LOGITS_KINDS };
+static const char* const LOGIT_KIND_NAMES[LOGITS_KINDS] = {"smooth", "noisy", "denormal", "plateau", "nan"};
+
+static std::vector<float> stress_logits(LogitKind kind) {
+    std::vector<float> mask(SAM_MASK_SIZE * SAM_MASK_SIZE);
+    uint32_t state = 777u + kind;
+    auto next = [&] {
+        state = state * 1664525u + 1013904223u;
+        return state >> 8;
+    };
+    const float cx = 97.0f, cy = 141.0f, radius = 63.0f;
+    for (int y = 0; y < SAM_MASK_SIZE; y++) {
+        for (int x = 0; x < SAM_MASK_SIZE; x++) {
+            float d = radius - std::sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy));
+            float v;
+            switch (kind) {
+                case LOGITS_NOISY: v = next() / 8388608.0f - 1.0f; break;
+                case LOGITS_DENORMAL: v = (d > 0 ? 1e-38f : -1e-38f) * static_cast<float>(next() % 3); break;
+                case LOGITS_PLATEAU: v = static_cast<float>(static_cast<int>(d) % 3 - 1) * 0.25f; break;
+                default: v = d * 0.3f; break;
+            }
+            mask[y * SAM_MASK_SIZE + x] = v;
+        }
+    }
+    if (kind == LOGITS_NAN) {
+        for (int i = 0; i < 64; i++) mask[next() % mask.size()] = NAN;
+    }
+    return mask;
+}
+
+// ============================================================
+// REFERENCE IMPLEMENTATIONS
+// ============================================================
+// Straightforward versions of the optimized paths, for the verify/*
+// checks
+
+// Textbook preprocessing: bilinear resize with the same src = dst /
+// scale mapping, then (v / 255 - mean) / std into a zeroed NCHW buffer
+static void reference_preprocess(const uint8_t* rgb, int width, int height, float* output) {
+    const size_t plane = static_cast<size_t>(SAM_IMAGE_SIZE) * SAM_IMAGE_SIZE;
+    std::fill(output, output + 3 * plane, 0.0f);
+    float scale = static_cast<float>(SAM_IMAGE_SIZE) / std::max(width, height);
+    int new_width = static_cast<int>(width * scale);
+    int new_height = static_cast<int>(height * scale);
+    for (int y = 0; y < new_height; y++) {
+        for (int x = 0; x < new_width; x++) {
+            float src_x = x / scale;
+            float src_y = y / scale;
+            int x0 = static_cast<int>(src_x);
+            int y0 = static_cast<int>(src_y);
+            int x1 = std::min(x0 + 1, width - 1);
+            int y1 = std::min(y0 + 1, height - 1);
+            float wx = src_x - x0;
+            float wy = src_y - y0;
+            for (int c = 0; c < 3; c++) {
+                float v00 = rgb[(static_cast<size_t>(y0) * width + x0) * 3 + c];
+                float v01 = rgb[(static_cast<size_t>(y0) * width + x1) * 3 + c];
+                float v10 = rgb[(static_cast<size_t>(y1) * width + x0) * 3 + c];
+                float v11 = rgb[(static_cast<size_t>(y1) * width + x1) * 3 + c];
+                float v = (1 - wx) * (1 - wy) * v00 + wx * (1 - wy) * v01 +
+                          (1 - wx) * wy * v10 + wx * wy * v11;
+                output[c * plane + static_cast<size_t>(y) * SAM_IMAGE_SIZE + x] =
+                    (v / 255.0f - SAM_MEAN[c]) / SAM_STD[c];
+            }
+        }
+    }
+}
+
+static double max_abs_diff(const std::vector<float>& a, const std::vector<float>& b) {
+    double worst = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        worst = std::max(worst, std::fabs(static_cast<double>(a[i]) - b[i]));
+    }
+    return worst;
+}
+
+// ============================================================
+// BENCHMARK CASES
+// ============================================================
+
+static void bench_preprocess(BenchSuite& suite, SamContext* ctx) {
+    std::vector<float> output(3 * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE);
+    float scale_x, scale_y;
+
+    for (const BenchSize& size : PHOTO_SIZES) {
+        std::string suffix = std::string("/") + size.name;
+        bool any = suite.enabled("preprocess/serial" + suffix) ||
+                   suite.enabled("preprocess/parallel" + suffix) ||
+                   suite.enabled("preprocess/nv21" + suffix);
+        if (!any) continue;
+
+        std::vector<uint8_t> rgb = synthetic_rgb(size.width, size.height);
+        double mpix = size.width * static_cast<double>(size.height) / 1e6;
+
+        suite.run("preprocess/serial" + suffix, mpix, "MP/s", [&] {
+            sam_preprocess_image(rgb.data(), size.width, size.height, output.data(), &scale_x, &scale_y);
+        });
+        if (ctx || suite.listing()) {
+            suite.run("preprocess/parallel" + suffix, mpix, "MP/s", [&] {
+                sam_preprocess_image_parallel(ctx, rgb.data(), size.width, size.height,
+                                              output.data(), &scale_x, &scale_y);
+            });
+        }
+
+        // NV21 camera frame of the same size (luma from the green channel)
+        int chroma_width = (size.width + 1) / 2;
+        int chroma_height = (size.height + 1) / 2;
+        std::vector<uint8_t> luma(static_cast<size_t>(size.width) * size.height);
+        std::vector<uint8_t> chroma(static_cast<size_t>(chroma_width) * 2 * chroma_height, 128);
+        for (size_t i = 0; i < luma.size(); i++) luma[i] = rgb[i * 3 + 1];
+        SamImage frame = {};
+        frame.format = SAM_PIXEL_NV21;
+        frame.width = size.width;
+        frame.height = size.height;
+        frame.planes[0] = luma.data();
+        frame.planes[1] = chroma.data();
+        suite.run("preprocess/nv21" + suffix, mpix, "MP/s", [&] {
+            sam_preprocess_frame_parallel(ctx, &frame, output.data(), &scale_x, &scale_y);
+        });
+    }
+}
+
+// Fused preprocessing (whichever SIMD path this build uses, plus the
+// scalar tails) against the textbook formula; sam_inference.h documents
+// 1e-5. Also portrait, square and tiny inputs.
+static void verify_preprocess(BenchSuite& suite, SamContext* ctx) {
+    static const BenchSize EXTRA_SIZES[] = {
+        {3024, 4032, "3024x4032"},
+        {1000, 1000, "1000x1000"},
+        {7, 5, "7x5"},
+    };
+    std::vector<BenchSize> sizes(std::begin(PHOTO_SIZES), std::end(PHOTO_SIZES));
+    sizes.insert(sizes.end(), std::begin(EXTRA_SIZES), std::end(EXTRA_SIZES));
+    std::vector<float> expected(3 * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE);
+    std::vector<float> output(expected.size());
+    float scale_x, scale_y;
+
+    for (const BenchSize& size : sizes) {
+        std::string suffix = std::string("/") + size.name;
+        std::vector<uint8_t> rgb;
+        auto prepare = [&] {
+            if (!rgb.empty()) return;
+            rgb = synthetic_rgb(size.width, size.height);
+            reference_preprocess(rgb.data(), size.width, size.height, expected.data());
+        };
+        suite.check_max("verify/preprocess/serial" + suffix, 1e-5, [&] {
+            prepare();
+            sam_preprocess_image(rgb.data(), size.width, size.height, output.data(), &scale_x, &scale_y);
+            return max_abs_diff(output, expected);
+        });
+        if (ctx || suite.listing()) {
+            suite.check_max("verify/preprocess/parallel" + suffix, 1e-5, [&] {
+                prepare();
+                sam_preprocess_image_parallel(ctx, rgb.data(), size.width, size.height,
+                                              output.data(), &scale_x, &scale_y);
+                return max_abs_diff(output, expected);
+            });
+        }
+    }
+}
+
+// Boundary-band upsampling (serial and pooled) must match the dense
+// per-pixel reference bit for bit, as sam_inference.h promises; the
+// value is the number of differing pixels over all sizes and thresholds
+static void verify_postprocess(BenchSuite& suite, SamContext* ctx) {
+    static const BenchSize SIZES[] = {
+        {1, 1, "1x1"}, {3, 7, "3x7"}, {255, 257, "255x257"}, {256, 256, "256x256"}, {512, 384, "512x384"},
+        {1000, 1333, "1000x1333"}, {1512, 2016, "1512x2016"}, {100, 3000, "100x3000"}, {4000, 120, "4000x120"},
+    };
+    static const float THRESHOLDS[] = {0.0f, 0.5f, -0.25f};
+
+    for (int kind = 0; kind < LOGITS_KINDS; kind++) {
+        suite.check_max(std::string("verify/postprocess/") + LOGIT_KIND_NAMES[kind], 0, [&] {
+            std::vector<float> logits = stress_logits(static_cast<LogitKind>(kind));
+            double differing = 0;
+            for (const BenchSize& size : SIZES) {
+                size_t pixels = static_cast<size_t>(size.width) * size.height;
+                std::vector<uint8_t> dense(pixels), band(pixels), pooled(pixels);
+                for (float threshold : THRESHOLDS) {
+                    sam_postprocess_mask_dense(logits.data(), size.width, size.height, dense.data(), threshold);
+                    sam_postprocess_mask(logits.data(), size.width, size.height, band.data(), threshold);
+                    sam_postprocess_mask_parallel(ctx, logits.data(), size.width, size.height, pooled.data(), threshold);
+                    for (size_t i = 0; i < pixels; i++) {
+                        differing += (band[i] != dense[i]) + (pooled[i] != dense[i]);
+                    }
+                }
+            }
+            return differing;
+        });
+    }
+}
+
+static void bench_postprocess(BenchSuite& suite, SamContext* ctx) {
+    std::vector<float> logits = synthetic_logits();
+
+    for (const BenchSize& size : PHONE_SIZES) {
+        std::string suffix = std::string("/") + size.name;
+        double mpix = size.width * static_cast<double>(size.height) / 1e6;
+        std::vector<uint8_t> mask(static_cast<size_t>(size.width) * size.height);
+
+        suite.run("postprocess/serial" + suffix, mpix, "MP/s", [&] {
+            sam_postprocess_mask(logits.data(), size.width, size.height, mask.data(), 0.0f);
+        });
+        if (ctx || suite.listing()) {
+            suite.run("postprocess/parallel" + suffix, mpix, "MP/s", [&] {
+                sam_postprocess_mask_parallel(ctx, logits.data(), size.width, size.height, mask.data(), 0.0f);
+            });
+        }
+
+        std::vector<uint32_t> runs(4 * static_cast<size_t>(size.height) + 2);
+        std::vector<float> contour(2 * 4096);
+        SamCompactMask compact = {};
+        compact.runs = runs.data();
+        compact.run_capacity = static_cast<int>(runs.size());
+        compact.contour = contour.data();
+        compact.contour_capacity = 4096;
+        suite.run("compact/rle+contour" + suffix, mpix, "MP/s", [&] {
+            sam_mask_to_compact(logits.data(), size.width, size.height, 0.0f, 1.0f, &compact);
+        });
+
+        FootMeasurement measurement;
+        suite.run("foot/measure_logits" + suffix, mpix, "MP/s", [&] {
+            foot_measure_logits(logits.data(), size.width, size.height, 0.0f, nullptr, &measurement);
+        });
+    }
+}
+
+#ifdef SAM_BENCH_ARUCO
+// White photo with an L-board: marker 0 at the corner, 1 along x, 2
+// along y, centres ARUCO_L_BOARD_SIZE_MM + SEPARATION apart
+static cv::Mat render_l_board(int width, int height, float* px_per_mm) {
+    const float pitch_mm = ARUCO_L_BOARD_SIZE_MM + ARUCO_L_BOARD_SEPARATION_MM;
+    const float board_mm = pitch_mm + ARUCO_L_BOARD_SIZE_MM;
+    *px_per_mm = 0.5f * std::min(width, height) / board_mm;
+    int side = static_cast<int>(ARUCO_L_BOARD_SIZE_MM * *px_per_mm);
+    int pitch = static_cast<int>(pitch_mm * *px_per_mm);
+    *px_per_mm = pitch / pitch_mm;
+
+    cv::Mat gray(height, width, CV_8UC1, cv::Scalar(255));
+    cv::Ptr<cv::aruco::Dictionary> dictionary = cv::aruco::getPredefinedDictionary(cv::aruco::DICT_6X6_250);
+    int x0 = width / 4;
+    int y0 = height / 4;
+    const int offsets[3][2] = {{0, 0}, {pitch, 0}, {0, pitch}};
+    for (int id = 0; id < 3; id++) {
+        cv::Mat marker;
+        cv::aruco::drawMarker(dictionary, id, side, marker, 1);
+        marker.copyTo(gray(cv::Rect(x0 + offsets[id][0], y0 + offsets[id][1], side, side)));
+    }
+
+    cv::Mat rgb;
+    cv::cvtColor(gray, rgb, cv::COLOR_GRAY2RGB);
+    return rgb;
+}
+
+static void bench_aruco(BenchSuite& suite) {
+    ArucoContext* ctx = aruco_context_create();
+    ArucoContext* multi_scale = aruco_context_create();
+    ArucoDetectorConfig config = {};
+    config.multi_scale = true;
+    aruco_context_configure(multi_scale, &config);
+    ArucoCalibrationResult result;
+
+    for (const BenchSize& size : PHONE_SIZES) {
+        std::string suffix = std::string("/") + size.name;
+        bool any = suite.enabled("aruco/legacy_rgb" + suffix) ||
+                   suite.enabled("aruco/context_gray" + suffix) ||
+                   suite.enabled("aruco/multi_scale_gray" + suffix);
+        if (!any) continue;
+
+        double mpix = size.width * static_cast<double>(size.height) / 1e6;
+        float px_per_mm = 0;
+        cv::Mat rgb = render_l_board(size.width, size.height, &px_per_mm);
+        cv::Mat gray;
+        cv::cvtColor(rgb, gray, cv::COLOR_RGB2GRAY);
+
+        if (!aruco_detect_l_board(rgb.data, size.width, size.height, &result) ||
+            std::fabs(result.ratio_px_mm - px_per_mm) > 0.02f * px_per_mm) {
+            std::fprintf(stderr, "warning: rendered board %s not measured (ratio %.3f, expected %.3f)\n",
+                         size.name, result.ratio_px_mm, px_per_mm);
+        }
+
+        suite.run("aruco/legacy_rgb" + suffix, mpix, "MP/s", [&] {
+            aruco_detect_l_board(rgb.data, size.width, size.height, &result);
+        });
+        suite.run("aruco/context_gray" + suffix, mpix, "MP/s", [&] {
+            aruco_detect_l_board_ex(ctx, gray.data, size.width, size.height, 0, ARUCO_FORMAT_GRAY, &result);
+        });
+        suite.run("aruco/multi_scale_gray" + suffix, mpix, "MP/s", [&] {
+            aruco_detect_l_board_ex(multi_scale, gray.data, size.width, size.height, 0, ARUCO_FORMAT_GRAY, &result);
+        });
+    }
+
+    aruco_context_free(multi_scale);
+    aruco_context_free(ctx);
+}
+#endif
+
+// Worst IoU between the best fp32 mask and the same mask decoded from a
+// FLOAT16 embedding of the image, over the photo sizes and a 3x3 grid
+// of single clicks (0 if a call fails)
+static double fp16_mask_iou(SamContext* ctx) {
+    const size_t embedding_floats = static_cast<size_t>(SAM_EMBEDDING_DIM) * SAM_EMBEDDING_SIZE * SAM_EMBEDDING_SIZE;
+    const size_t plane = static_cast<size_t>(SAM_MASK_SIZE) * SAM_MASK_SIZE;
+    std::vector<float> image(3 * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE);
+    std::vector<float> data32(embedding_floats);
+    std::vector<uint16_t> data16(embedding_floats);
+    SamEmbedding emb32 = {};
+    emb32.data = data32.data();
+    emb32.batch_size = 1;
+    emb32.channels = SAM_EMBEDDING_DIM;
+    emb32.height = SAM_EMBEDDING_SIZE;
+    emb32.width = SAM_EMBEDDING_SIZE;
+    SamEmbedding emb16 = emb32;
+    emb16.data = nullptr;
+    emb16.dtype = SAM_DTYPE_FLOAT16;
+    emb16.half_data = data16.data();
+
+    std::vector<float> masks32(SAM_NUM_MASKS * plane), masks16(SAM_NUM_MASKS * plane);
+    float iou32[SAM_NUM_MASKS], iou16[SAM_NUM_MASKS];
+    SamMaskResult result32 = {masks32.data(), iou32, 0};
+    SamMaskResult result16 = {masks16.data(), iou16, 0};
+    double worst = 1.0;
+
+    for (const BenchSize& size : PHOTO_SIZES) {
+        std::vector<uint8_t> rgb = synthetic_rgb(size.width, size.height);
+        float scale_x, scale_y;
+        sam_preprocess_image(rgb.data(), size.width, size.height, image.data(), &scale_x, &scale_y);
+        if (!sam_encode_image(ctx, image.data(), &emb32) || !sam_encode_image(ctx, image.data(), &emb16)) return 0;
+
+        for (int gy = 1; gy <= 3; gy++) {
+            for (int gx = 1; gx <= 3; gx++) {
+                float coords[2] = {gx * size.width * scale_x / 4, gy * size.height * scale_y / 4};
+                int label = 1;
+                SamPointPrompt prompt = {coords, &label, 1};
+                sam_reset_mask_input(ctx, nullptr);
+                if (!sam_decode_mask(ctx, &emb32, &prompt, &result32) ||
+                    !sam_decode_mask(ctx, &emb16, &prompt, &result16)) {
+                    return 0;
+                }
+                size_t best = result32.best_mask_idx * plane;
+                worst = std::min<double>(worst, sam_mask_iou(&masks32[best], &masks16[best],
+                                                             static_cast<int>(plane), 0.0f));
+            }
+        }
+    }
+    return worst;
+}
+
+static void bench_models(BenchSuite& suite, SamContext* ctx, const BenchOptions& options) {
+    std::vector<float> image(3 * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE);
+    std::vector<uint8_t> rgb = synthetic_rgb(1920, 1080);
+    float scale_x, scale_y;
+    sam_preprocess_image(rgb.data(), 1920, 1080, image.data(), &scale_x, &scale_y);
+
+    suite.run("model/init", 1, "ops/s", [&] {
+        SamContext* fresh = sam_init(options.encoder_path.c_str(), options.decoder_path.c_str());
+        sam_free(fresh);
+    });
+
+    std::vector<float> embedding_data(SAM_EMBEDDING_DIM * SAM_EMBEDDING_SIZE * SAM_EMBEDDING_SIZE);
+    SamEmbedding embedding = {};
+    embedding.data = embedding_data.data();
+    embedding.batch_size = 1;
+    embedding.channels = SAM_EMBEDDING_DIM;
+    embedding.height = SAM_EMBEDDING_SIZE;
+    embedding.width = SAM_EMBEDDING_SIZE;
+
+    suite.run("model/encode", 1, "ops/s", [&] {
+        sam_encode_image(ctx, image.data(), &embedding);
+    });
+    if (ctx && !sam_encode_image(ctx, image.data(), &embedding)) {
+        std::fprintf(stderr, "warning: encoder failed, skipping decoder benchmarks\n");
+        return;
+    }
+
+    std::vector<float> masks(SAM_NUM_MASKS * SAM_MASK_SIZE * SAM_MASK_SIZE);
+    float iou[SAM_NUM_MASKS];
+    SamMaskResult result = {masks.data(), iou, 0};
+    float coords[6] = {512, 400, 480, 380, 560, 430};
+    int labels[3] = {1, 1, 0};
+    for (int num_points : {1, 3}) {
+        SamPointPrompt prompt = {coords, labels, num_points};
+        suite.run("model/decode/" + std::to_string(num_points) + "pt", 1, "ops/s", [&] {
+            sam_decode_mask(ctx, &embedding, &prompt, &result);
+        });
+    }
+
+    // Bound documented on sam_set_cache_dtype; run with --encoder /
+    // --decoder to measure the shipped models
+    suite.check_min("verify/fp16_embedding/mask_iou", 0.99, [&] { return fp16_mask_iou(ctx); });
+
+    // Several images per encoder run against one per run, same model
+    // and images (the stand-in encoder for this has a dynamic batch)
+    SamContext* batch_ctx = ctx;
+    if (!options.batch_encoder_path.empty()) {
+        batch_ctx = sam_init(options.batch_encoder_path.c_str(), options.decoder_path.c_str());
+    }
+    if (batch_ctx || options.list_only) {
+        const int num_images = 8;
+        const size_t image_floats = image.size();
+        std::vector<float> images(num_images * image_floats);
+        std::vector<const float*> image_ptrs(num_images);
+        std::vector<float> embeddings_data(num_images * embedding_data.size());
+        std::vector<SamEmbedding> embeddings(num_images, embedding);
+        for (int i = 0; i < num_images; i++) {
+            std::memcpy(&images[i * image_floats], image.data(), image_floats * sizeof(float));
+            image_ptrs[i] = &images[i * image_floats];
+            embeddings[i].data = &embeddings_data[i * embedding_data.size()];
+        }
+        sam_set_encode_budget(batch_ctx, SAM_ENCODE_IMAGE_BYTES, SAM_ENCODE_IMAGE_BYTES);
+        suite.run("model/encode_images/single", num_images, "img/s", [&] {
+            sam_encode_images(batch_ctx, image_ptrs.data(), num_images, embeddings.data());
+        });
+        sam_set_encode_budget(batch_ctx, 0, 0);
+        suite.run("model/encode_images/batched", num_images, "img/s", [&] {
+            sam_encode_images(batch_ctx, image_ptrs.data(), num_images, embeddings.data());
+        });
+        if (batch_ctx != ctx) sam_free(batch_ctx);
+    }
+
+    // Repeat taps on one photo: cache hit, decoder and postprocess only
+    float points_x[1] = {960};
+    float points_y[1] = {540};
+    int point_labels[1] = {1};
+    std::vector<uint8_t> mask(1920 * 1080);
+    suite.run("model/segment_cached/1920x1080", 1, "ops/s", [&] {
+        sam_segment(ctx, rgb.data(), 1920, 1080, points_x, points_y, point_labels, 1, mask.data());
+    });
+}
+
+// ============================================================
+// MAIN
+// ============================================================
+
+static void print_usage() {
+    std::printf(
+        "Usage: sam_bench [options]\n"
+        "  --filter TEXT       Only run benchmarks whose name contains TEXT\n"
+        "  --iterations N      Timed iterations per benchmark (default 20)\n"
+        "  --warmup N          Untimed iterations first (default 2)\n"
+        "  --json FILE         Write results as JSON (- for stdout)\n"
+        "  --label TEXT        Tag stored in the JSON (release, device, ...)\n"
+        "  --encoder PATH      Real encoder model instead of the stand-in\n"
+        "  --decoder PATH      Real decoder model instead of the stand-in\n"
+        "  --list              Print benchmark names and exit\n");
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--filter" && has_value) options.filter = argv[++i];
+        else if (arg == "--iterations" && has_value) options.iterations = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--warmup" && has_value) options.warmup = std::max(0, std::atoi(argv[++i]));
+        else if (arg == "--json" && has_value) options.json_path = argv[++i];
+        else if (arg == "--label" && has_value) options.label = argv[++i];
+        else if (arg == "--encoder" && has_value) options.encoder_path = argv[++i];
+        else if (arg == "--decoder" && has_value) options.decoder_path = argv[++i];
+        else if (arg == "--list") options.list_only = true;
+        else {
+            print_usage();
+            return arg == "--help" || arg == "-h" ? 0 : 2;
+        }
+    }
+    if (options.encoder_path.empty() != options.decoder_path.empty()) {
+        std::fprintf(stderr, "--encoder and --decoder must be given together\n");
+        return 2;
+    }
+
+    // Stand-in models in a private temp directory
+    std::string model_dir;
+    if (options.encoder_path.empty() && !options.list_only) {
+        char dir_template[] = "/tmp/sam_bench_XXXXXX";
+        if (!mkdtemp(dir_template)) {
+            std::perror("mkdtemp");
+            return 1;
+        }
+        model_dir = dir_template;
+        options.standin_models = true;
+        options.encoder_path = model_dir + "/sam_encoder_standin.onnx";
+        options.decoder_path = model_dir + "/sam_decoder_standin.onnx";
+        options.batch_encoder_path = model_dir + "/sam_encoder_standin_batch.onnx";
+        if (!write_standin_encoder(options.encoder_path, 1) || !write_standin_encoder(options.batch_encoder_path, -1) ||
+            !write_standin_decoder(options.decoder_path)) {
+            std::fprintf(stderr, "Failed to write stand-in models to %s\n", model_dir.c_str());
+            return 1;
+        }
+    }
+
+    SamContext* ctx = nullptr;
+    if (!options.list_only) {
+        ctx = sam_init(options.encoder_path.c_str(), options.decoder_path.c_str());
+        if (!ctx) {
+            std::fprintf(stderr, "warning: models failed to load, running without a context\n");
+        }
+    }
+
+    BenchSuite suite(options);
+    suite.print_header();
+    bench_preprocess(suite, ctx);
+    verify_preprocess(suite, ctx);
+    bench_postprocess(suite, ctx);
+    verify_postprocess(suite, ctx);
+#ifdef SAM_BENCH_ARUCO
+    bench_aruco(suite);
+#endif
+    if (ctx || options.list_only) bench_models(suite, ctx, options);
+
+    if (ctx) sam_free(ctx);
+    if (!model_dir.empty()) {
+        std::remove(options.encoder_path.c_str());
+        std::remove(options.batch_encoder_path.c_str());
+        std::remove(options.decoder_path.c_str());
+        rmdir(model_dir.c_str());
+    }
+
+    if (!options.json_path.empty() && !suite.write_json(options.json_path.c_str())) {
+        std::fprintf(stderr, "Failed to write %s\n", options.json_path.c_str());
+        return 1;
+    }
+    return suite.checks_passed() ? 0 : 1;
+}
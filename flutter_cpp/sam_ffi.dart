@@ -7,7 +7,17 @@
 /// final mask = await sam.segment(imageBytes, width, height, points, labels);
 /// sam.dispose();
 /// ```
+/// 
+/// Without blocking the isolate (encoder and decoder run on a native
+/// worker thread; a retaken photo cancels the encode in flight):
+/// ```dart
+/// final embedding = await sam.encodeImage(imageBytes, width, height);
+/// if (embedding == null) return;  // Superseded by a newer photo
+/// final result = await sam.decode(embedding, pointsX, pointsY, labels);
+/// embedding.dispose();
+/// ```
 
+import 'dart:async';
 import 'dart:ffi';
 import 'dart:io';
 import 'dart:math' as math;
@@ -23,6 +33,36 @@ const int SAM_EMBEDDING_SIZE = 64;
 const int SAM_MASK_SIZE = 256;
 const int SAM_NUM_MASKS = 4;
 
+const int SAM_PROVIDER_CPU = 0;
+const int SAM_PROVIDER_XNNPACK = 1;
+
+const int SAM_SPIN_DEFAULT = 0;
+const int SAM_SPIN_ENABLED = 1;
+const int SAM_SPIN_DISABLED = 2;
+
+const int SAM_PIXEL_RGB = 0;
+const int SAM_PIXEL_RGBA = 1;
+const int SAM_PIXEL_BGRA = 2;     // iOS camera
+const int SAM_PIXEL_YUV420 = 3;   // Android YUV_420_888 (Y, U, V planes)
+const int SAM_PIXEL_NV21 = 4;     // Y plane + interleaved VU plane
+
+const int SAM_JOB_UNKNOWN = -1;
+const int SAM_JOB_PENDING = 0;
+const int SAM_JOB_RUNNING = 1;
+const int SAM_JOB_DONE = 2;
+const int SAM_JOB_FAILED = 3;
+const int SAM_JOB_CANCELLED = 4;
+
+const int SAM_STAGE_PREPROCESS = 0;
+const int SAM_STAGE_ENCODE = 1;
+const int SAM_STAGE_DECODE = 2;
+const int SAM_STAGE_POSTPROCESS = 3;
+const int SAM_STAGE_ARUCO = 4;
+const int SAM_STAGE_MEASURE = 5;
+const int SAM_STAGE_SEGMENT = 6;
+const int SAM_STAGE_COUNT = 7;
+const int SAM_STATS_BUCKETS = 96;
+
 // ============================================================
 // NATIVE STRUCT DEFINITIONS
 // ============================================================
@@ -38,6 +78,9 @@ final class SamEmbedding extends Struct {
   external int height;
   @Int32()
   external int width;
+  @Int32()
+  external int dtype;
+  external Pointer<Uint16> halfData;
 }
 
 /// SamPointPrompt struct
@@ -56,6 +99,160 @@ final class SamMaskResult extends Struct {
   external int bestMaskIdx;
 }
 
+/// SamImage struct (camera frame planes)
+final class SamImage extends Struct {
+  @Int32()
+  external int format;
+  @Int32()
+  external int width;
+  @Int32()
+  external int height;
+  @Array(3)
+  external Array<Pointer<Uint8>> planes;
+  @Array(3)
+  external Array<Int32> rowStrides;
+  @Array(3)
+  external Array<Int32> pixelStrides;
+}
+
+/// SamCompactMask struct
+final class SamCompactMask extends Struct {
+  external Pointer<Uint32> runs;
+  @Int32()
+  external int runCapacity;
+  @Int32()
+  external int numRuns;
+  external Pointer<Float> contour;
+  @Int32()
+  external int contourCapacity;
+  @Int32()
+  external int numPoints;
+  @Int32()
+  external int width;
+  @Int32()
+  external int height;
+  @Uint64()
+  external int area;
+}
+
+/// SamCacheStats struct
+final class SamCacheStats extends Struct {
+  @Uint64()
+  external int hits;
+  @Uint64()
+  external int misses;
+  @Uint64()
+  external int evictions;
+  @Uint64()
+  external int entries;
+  @Uint64()
+  external int bytesUsed;
+  @Uint64()
+  external int byteBudget;
+}
+
+/// SamStartupOptions struct
+final class SamStartupOptions extends Struct {
+  external Pointer<Utf8> cacheDir;
+  @Bool()
+  external bool disableMemoryMap;
+  @Bool()
+  external bool warmUp;
+}
+
+/// SamConfig struct
+final class SamConfig extends Struct {
+  @Int32()
+  external int intraOpThreads;
+  @Int32()
+  external int interOpThreads;
+  @Int32()
+  external int spinWait;
+  external Pointer<Utf8> intraOpAffinity;
+  @Bool()
+  external bool disableMemoryArena;
+  @Bool()
+  external bool disableMemoryPattern;
+  @Int32()
+  external int executionProvider;
+  external SamStartupOptions startup;
+  external Pointer<Utf8> profilePrefix;
+}
+
+/// SamStartupStats struct
+final class SamStartupStats extends Struct {
+  @Float()
+  external double encoderMapMs;
+  @Float()
+  external double encoderSessionMs;
+  @Float()
+  external double decoderMapMs;
+  @Float()
+  external double decoderSessionMs;
+  @Float()
+  external double warmUpEncoderMs;
+  @Float()
+  external double warmUpDecoderMs;
+  @Float()
+  external double totalMs;
+  @Bool()
+  external bool encoderFromCache;
+  @Bool()
+  external bool decoderFromCache;
+  @Bool()
+  external bool memoryMapped;
+}
+
+/// SamEncoderVariantInfo struct
+final class SamEncoderVariantInfo extends Struct {
+  @Array(32)
+  external Array<Uint8> name;
+  @Uint64()
+  external int fileBytes;
+  @Bool()
+  external bool quantized;
+  @Bool()
+  external bool active;
+  @Float()
+  external double latencyMs;
+  @Float()
+  external double minIou;
+}
+
+/// SamStageStats struct
+final class SamStageStats extends Struct {
+  @Uint64()
+  external int count;
+  @Uint64()
+  external int totalUs;
+  @Uint64()
+  external int minUs;
+  @Uint64()
+  external int maxUs;
+  @Float()
+  external double meanMs;
+  @Float()
+  external double p50Ms;
+  @Float()
+  external double p90Ms;
+  @Float()
+  external double p99Ms;
+  @Array(SAM_STATS_BUCKETS)
+  external Array<Uint32> histogram;
+}
+
+/// SamStats struct
+final class SamStats extends Struct {
+  @Array(SAM_STAGE_COUNT)
+  external Array<SamStageStats> stages;
+  @Uint64()
+  external int traceEvents;
+  @Uint64()
+  external int traceDropped;
+  @Bool()
+  external bool tracing;
+}
+
 /// SamContext struct (opaque)
 final class SamContext extends Opaque {}
 
@@ -72,6 +269,32 @@ typedef SamInitDart = Pointer<SamContext> Function(
   Pointer<Utf8> decoderPath,
 );
 
+typedef SamInitWithConfigNative = Pointer<SamContext> Function(
+  Pointer<Utf8> encoderPath,
+  Pointer<Utf8> decoderPath,
+  Pointer<SamConfig> config,
+);
+typedef SamInitWithConfigDart = Pointer<SamContext> Function(
+  Pointer<Utf8> encoderPath,
+  Pointer<Utf8> decoderPath,
+  Pointer<SamConfig> config,
+);
+
+typedef SamInitWithManifestNative = Pointer<SamContext> Function(
+  Pointer<Utf8> manifestPath,
+  Pointer<SamConfig> config,
+);
+typedef SamInitWithManifestDart = Pointer<SamContext> Function(
+  Pointer<Utf8> manifestPath,
+  Pointer<SamConfig> config,
+);
+
+typedef SamGetEffectiveConfigNative = Bool Function(Pointer<SamContext> ctx, Pointer<SamConfig> config);
+typedef SamGetEffectiveConfigDart = bool Function(Pointer<SamContext> ctx, Pointer<SamConfig> config);
+
+typedef SamGetStartupStatsNative = Bool Function(Pointer<SamContext> ctx, Pointer<SamStartupStats> stats);
+typedef SamGetStartupStatsDart = bool Function(Pointer<SamContext> ctx, Pointer<SamStartupStats> stats);
+
 typedef SamFreeNative = Void Function(Pointer<SamContext> ctx);
 typedef SamFreeDart = void Function(Pointer<SamContext> ctx);
 
@@ -92,6 +315,21 @@ typedef SamPreprocessImageDart = void Function(
   Pointer<Float> scaleY,
 );
 
+typedef SamPreprocessFrameNative = Bool Function(
+  Pointer<SamContext> ctx,
+  Pointer<SamImage> image,
+  Pointer<Float> output,
+  Pointer<Float> scaleX,
+  Pointer<Float> scaleY,
+);
+typedef SamPreprocessFrameDart = bool Function(
+  Pointer<SamContext> ctx,
+  Pointer<SamImage> image,
+  Pointer<Float> output,
+  Pointer<Float> scaleX,
+  Pointer<Float> scaleY,
+);
+
 typedef SamEncodeImageNative = Bool Function(
   Pointer<SamContext> ctx,
   Pointer<Float> preprocessedImage,
@@ -116,6 +354,54 @@ typedef SamDecodeMaskDart = bool Function(
   Pointer<SamMaskResult> result,
 );
 
+typedef SamJobCallbackNative = Void Function(Int64 jobId, Int32 status, Pointer<Void> userData);
+
+typedef SamEncodeAsyncNative = Int64 Function(
+  Pointer<SamContext> ctx,
+  Pointer<Float> preprocessedImage,
+  Pointer<SamEmbedding> embedding,
+  Bool supersede,
+  Pointer<NativeFunction<SamJobCallbackNative>> callback,
+  Pointer<Void> userData,
+);
+typedef SamEncodeAsyncDart = int Function(
+  Pointer<SamContext> ctx,
+  Pointer<Float> preprocessedImage,
+  Pointer<SamEmbedding> embedding,
+  bool supersede,
+  Pointer<NativeFunction<SamJobCallbackNative>> callback,
+  Pointer<Void> userData,
+);
+
+typedef SamDecodeAsyncNative = Int64 Function(
+  Pointer<SamContext> ctx,
+  Pointer<SamEmbedding> embedding,
+  Pointer<SamPointPrompt> prompt,
+  Pointer<SamMaskResult> result,
+  Pointer<NativeFunction<SamJobCallbackNative>> callback,
+  Pointer<Void> userData,
+);
+typedef SamDecodeAsyncDart = int Function(
+  Pointer<SamContext> ctx,
+  Pointer<SamEmbedding> embedding,
+  Pointer<SamPointPrompt> prompt,
+  Pointer<SamMaskResult> result,
+  Pointer<NativeFunction<SamJobCallbackNative>> callback,
+  Pointer<Void> userData,
+);
+
+typedef SamJobPollNative = Int32 Function(Pointer<SamContext> ctx, Int64 jobId);
+typedef SamJobPollDart = int Function(Pointer<SamContext> ctx, int jobId);
+
+typedef SamJobWaitNative = Int32 Function(Pointer<SamContext> ctx, Int64 jobId, Int32 timeoutMs);
+typedef SamJobWaitDart = int Function(Pointer<SamContext> ctx, int jobId, int timeoutMs);
+
+typedef SamCancelNative = Bool Function(Pointer<SamContext> ctx, Int64 jobId);
+typedef SamCancelDart = bool Function(Pointer<SamContext> ctx, int jobId);
+
+typedef SamJobReleaseNative = Void Function(Pointer<SamContext> ctx, Int64 jobId);
+typedef SamJobReleaseDart = void Function(Pointer<SamContext> ctx, int jobId);
+
 typedef SamPostprocessMaskNative = Void Function(
   Pointer<Float> mask,
   Int32 outputWidth,
@@ -154,6 +440,103 @@ typedef SamSegmentDart = double Function(
   Pointer<Uint8> outputMask,
 );
 
+typedef SamSegmentCompactNative = Float Function(
+  Pointer<SamContext> ctx,
+  Pointer<Uint8> rgbData,
+  Int32 width,
+  Int32 height,
+  Pointer<Float> pointsX,
+  Pointer<Float> pointsY,
+  Pointer<Int32> labels,
+  Int32 numPoints,
+  Float epsilon,
+  Pointer<SamCompactMask> out,
+);
+typedef SamSegmentCompactDart = double Function(
+  Pointer<SamContext> ctx,
+  Pointer<Uint8> rgbData,
+  int width,
+  int height,
+  Pointer<Float> pointsX,
+  Pointer<Float> pointsY,
+  Pointer<Int32> labels,
+  int numPoints,
+  double epsilon,
+  Pointer<SamCompactMask> out,
+);
+
+typedef SamHasMaskInputNative = Bool Function(Pointer<SamContext> ctx);
+typedef SamHasMaskInputDart = bool Function(Pointer<SamContext> ctx);
+
+typedef SamResetMaskInputNative = Void Function(Pointer<SamContext> ctx, Pointer<SamEmbedding> embedding);
+typedef SamResetMaskInputDart = void Function(Pointer<SamContext> ctx, Pointer<SamEmbedding> embedding);
+
+typedef SamSetCacheBudgetNative = Void Function(Pointer<SamContext> ctx, Uint64 maxBytes);
+typedef SamSetCacheBudgetDart = void Function(Pointer<SamContext> ctx, int maxBytes);
+
+typedef SamClearCacheNative = Void Function(Pointer<SamContext> ctx);
+typedef SamClearCacheDart = void Function(Pointer<SamContext> ctx);
+
+typedef SamSetCacheDtypeNative = Bool Function(Pointer<SamContext> ctx, Int32 dtype);
+typedef SamSetCacheDtypeDart = bool Function(Pointer<SamContext> ctx, int dtype);
+
+typedef SamGetCacheStatsNative = Bool Function(
+  Pointer<SamContext> ctx,
+  Pointer<SamCacheStats> stats,
+);
+typedef SamGetCacheStatsDart = bool Function(
+  Pointer<SamContext> ctx,
+  Pointer<SamCacheStats> stats,
+);
+
+typedef SamGetEncoderVariantCountNative = Int32 Function(Pointer<SamContext> ctx);
+typedef SamGetEncoderVariantCountDart = int Function(Pointer<SamContext> ctx);
+
+typedef SamGetEncoderVariantNative = Bool Function(
+  Pointer<SamContext> ctx,
+  Int32 index,
+  Pointer<SamEncoderVariantInfo> info,
+);
+typedef SamGetEncoderVariantDart = bool Function(
+  Pointer<SamContext> ctx,
+  int index,
+  Pointer<SamEncoderVariantInfo> info,
+);
+
+typedef SamSetEncoderVariantNative = Bool Function(Pointer<SamContext> ctx, Int32 index);
+typedef SamSetEncoderVariantDart = bool Function(Pointer<SamContext> ctx, int index);
+
+typedef SamSelectEncoderNative = Int32 Function(
+  Pointer<SamContext> ctx,
+  Pointer<Pointer<Uint8>> images,
+  Pointer<Int32> widths,
+  Pointer<Int32> heights,
+  Pointer<Float> pointsXY,
+  Int32 numImages,
+  Float minIou,
+);
+typedef SamSelectEncoderDart = int Function(
+  Pointer<SamContext> ctx,
+  Pointer<Pointer<Uint8>> images,
+  Pointer<Int32> widths,
+  Pointer<Int32> heights,
+  Pointer<Float> pointsXY,
+  int numImages,
+  double minIou,
+);
+
+typedef SamGetStatsNative = Bool Function(Pointer<SamStats> stats);
+typedef SamGetStatsDart = bool Function(Pointer<SamStats> stats);
+
+typedef SamResetStatsNative = Void Function();
+typedef SamResetStatsDart = void Function();
+
+typedef SamTraceStartNative = Bool Function(Int32 maxEvents);
+typedef SamTraceStartDart = bool Function(int maxEvents);
+
+typedef SamTraceStopNative = Bool Function(Pointer<SamContext> ctx, Pointer<Utf8> path);
+typedef SamTraceStopDart = bool Function(Pointer<SamContext> ctx, Pointer<Utf8> path);
+
 // ============================================================
 // SAM INFERENCE CLASS
 // ============================================================
@@ -164,16 +547,44 @@ class SamInference {
   
   // Cached native functions
   late SamInitDart _samInit;
+  late SamInitWithConfigDart _samInitWithConfig;
+  late SamInitWithManifestDart _samInitWithManifest;
+  late SamGetEffectiveConfigDart _samGetEffectiveConfig;
+  late SamGetStartupStatsDart _samGetStartupStats;
   late SamFreeDart _samFree;
   late SamPreprocessImageDart _samPreprocessImage;
+  late SamPreprocessFrameDart _samPreprocessFrame;
   late SamEncodeImageDart _samEncodeImage;
   late SamDecodeMaskDart _samDecodeMask;
+  late SamEncodeAsyncDart _samEncodeAsync;
+  late SamDecodeAsyncDart _samDecodeAsync;
+  late SamJobPollDart _samJobPoll;
+  late SamJobWaitDart _samJobWait;
+  late SamCancelDart _samCancel;
+  late SamJobReleaseDart _samJobRelease;
   late SamPostprocessMaskDart _samPostprocessMask;
   late SamSegmentDart _samSegment;
+  late SamSegmentCompactDart _samSegmentCompact;
+  late SamHasMaskInputDart _samHasMaskInput;
+  late SamResetMaskInputDart _samResetMaskInput;
+  late SamSetCacheBudgetDart _samSetCacheBudget;
+  late SamClearCacheDart _samClearCache;
+  late SamSetCacheDtypeDart _samSetCacheDtype;
+  late SamGetCacheStatsDart _samGetCacheStats;
+  late SamGetEncoderVariantCountDart _samGetEncoderVariantCount;
+  late SamGetEncoderVariantDart _samGetEncoderVariant;
+  late SamSetEncoderVariantDart _samSetEncoderVariant;
+  late SamSelectEncoderDart _samSelectEncoder;
+  late SamGetStatsDart _samGetStats;
+  late SamResetStatsDart _samResetStats;
+  late SamTraceStartDart _samTraceStart;
+  late SamTraceStopDart _samTraceStop;
   
-  // Cached embedding for reuse
-  Pointer<Float>? _cachedEmbedding;
-  int _cachedImageHash = 0;
+  // Async jobs: one listener callable serves every job; completions
+  // arrive on this isolate's event loop and are matched by job id
+  NativeCallable<SamJobCallbackNative>? _jobCallback;
+  final Map<int, Completer<int>> _jobs = {};
+  int _encodeJob = 0;  // Latest encodeImage job while it is in flight
   
   bool get isInitialized => _ctx != null;
   
@@ -198,30 +609,157 @@ class SamInference {
   
   void _bindFunctions() {
     _samInit = _lib.lookupFunction<SamInitNative, SamInitDart>('sam_init');
+    _samInitWithConfig = _lib.lookupFunction<SamInitWithConfigNative, SamInitWithConfigDart>('sam_init_with_config');
+    _samGetEffectiveConfig = _lib.lookupFunction<SamGetEffectiveConfigNative, SamGetEffectiveConfigDart>('sam_get_effective_config');
+    _samGetStartupStats = _lib.lookupFunction<SamGetStartupStatsNative, SamGetStartupStatsDart>('sam_get_startup_stats');
+    _samInitWithManifest = _lib.lookupFunction<SamInitWithManifestNative, SamInitWithManifestDart>('sam_init_with_manifest');
     _samFree = _lib.lookupFunction<SamFreeNative, SamFreeDart>('sam_free');
     _samPreprocessImage = _lib.lookupFunction<SamPreprocessImageNative, SamPreprocessImageDart>('sam_preprocess_image');
+    _samPreprocessFrame = _lib.lookupFunction<SamPreprocessFrameNative, SamPreprocessFrameDart>('sam_preprocess_frame_parallel');
     _samEncodeImage = _lib.lookupFunction<SamEncodeImageNative, SamEncodeImageDart>('sam_encode_image');
     _samDecodeMask = _lib.lookupFunction<SamDecodeMaskNative, SamDecodeMaskDart>('sam_decode_mask');
+    _samEncodeAsync = _lib.lookupFunction<SamEncodeAsyncNative, SamEncodeAsyncDart>('sam_encode_async');
+    _samDecodeAsync = _lib.lookupFunction<SamDecodeAsyncNative, SamDecodeAsyncDart>('sam_decode_async');
+    _samJobPoll = _lib.lookupFunction<SamJobPollNative, SamJobPollDart>('sam_job_poll');
+    _samJobWait = _lib.lookupFunction<SamJobWaitNative, SamJobWaitDart>('sam_job_wait');
+    _samCancel = _lib.lookupFunction<SamCancelNative, SamCancelDart>('sam_cancel');
+    _samJobRelease = _lib.lookupFunction<SamJobReleaseNative, SamJobReleaseDart>('sam_job_release');
     _samPostprocessMask = _lib.lookupFunction<SamPostprocessMaskNative, SamPostprocessMaskDart>('sam_postprocess_mask');
     _samSegment = _lib.lookupFunction<SamSegmentNative, SamSegmentDart>('sam_segment');
+    _samSegmentCompact = _lib.lookupFunction<SamSegmentCompactNative, SamSegmentCompactDart>('sam_segment_compact');
+    _samHasMaskInput = _lib.lookupFunction<SamHasMaskInputNative, SamHasMaskInputDart>('sam_has_mask_input');
+    _samResetMaskInput = _lib.lookupFunction<SamResetMaskInputNative, SamResetMaskInputDart>('sam_reset_mask_input');
+    _samSetCacheBudget = _lib.lookupFunction<SamSetCacheBudgetNative, SamSetCacheBudgetDart>('sam_set_cache_budget');
+    _samClearCache = _lib.lookupFunction<SamClearCacheNative, SamClearCacheDart>('sam_clear_cache');
+    _samSetCacheDtype = _lib.lookupFunction<SamSetCacheDtypeNative, SamSetCacheDtypeDart>('sam_set_cache_dtype');
+    _samGetCacheStats = _lib.lookupFunction<SamGetCacheStatsNative, SamGetCacheStatsDart>('sam_get_cache_stats');
+    _samGetEncoderVariantCount = _lib.lookupFunction<SamGetEncoderVariantCountNative, SamGetEncoderVariantCountDart>('sam_get_encoder_variant_count');
+    _samGetEncoderVariant = _lib.lookupFunction<SamGetEncoderVariantNative, SamGetEncoderVariantDart>('sam_get_encoder_variant');
+    _samSetEncoderVariant = _lib.lookupFunction<SamSetEncoderVariantNative, SamSetEncoderVariantDart>('sam_set_encoder_variant');
+    _samSelectEncoder = _lib.lookupFunction<SamSelectEncoderNative, SamSelectEncoderDart>('sam_select_encoder');
+    _samGetStats = _lib.lookupFunction<SamGetStatsNative, SamGetStatsDart>('sam_get_stats');
+    _samResetStats = _lib.lookupFunction<SamResetStatsNative, SamResetStatsDart>('sam_reset_stats');
+    _samTraceStart = _lib.lookupFunction<SamTraceStartNative, SamTraceStartDart>('sam_trace_start');
+    _samTraceStop = _lib.lookupFunction<SamTraceStopNative, SamTraceStopDart>('sam_trace_stop');
   }
   
   /// Initialize SAM with ONNX model paths
-  Future<bool> initialize(String encoderPath, String decoderPath) async {
+  /// 
+  /// [config] - Threads, spinning, affinity, arenas and execution provider
+  /// [cacheDir] - Writable directory (e.g. app support dir) where optimized
+  /// graphs are kept so later launches skip graph optimization
+  /// [warmUp] - Run both models once during init so the first real
+  /// segmentation does not pay for arena growth
+  Future<bool> initialize(
+    String encoderPath,
+    String decoderPath, {
+    SessionConfig config = const SessionConfig(),
+    String? cacheDir,
+    bool warmUp = false,
+  }) async {
     final encoderPathPtr = encoderPath.toNativeUtf8();
     final decoderPathPtr = decoderPath.toNativeUtf8();
+    final configPtr = _nativeConfig(config, cacheDir, warmUp);
     
     try {
-      _ctx = _samInit(encoderPathPtr, decoderPathPtr);
+      _ctx = _samInitWithConfig(encoderPathPtr, decoderPathPtr, configPtr);
       return _ctx != null && _ctx != nullptr;
     } finally {
       calloc.free(encoderPathPtr);
       calloc.free(decoderPathPtr);
+      _freeNativeConfig(configPtr);
+    }
+  }
+  
+  /// Initialize SAM from a model manifest listing fp32/int8 encoders
+  Future<bool> initializeWithManifest(
+    String manifestPath, {
+    SessionConfig config = const SessionConfig(),
+    String? cacheDir,
+    bool warmUp = false,
+  }) async {
+    final manifestPathPtr = manifestPath.toNativeUtf8();
+    final configPtr = _nativeConfig(config, cacheDir, warmUp);
+    
+    try {
+      _ctx = _samInitWithManifest(manifestPathPtr, configPtr);
+      return _ctx != null && _ctx != nullptr;
+    } finally {
+      calloc.free(manifestPathPtr);
+      _freeNativeConfig(configPtr);
+    }
+  }
+  
+  Pointer<SamConfig> _nativeConfig(SessionConfig config, String? cacheDir, bool warmUp) {
+    final configPtr = calloc<SamConfig>();
+    final native = configPtr.ref;
+    native.intraOpThreads = config.intraOpThreads;
+    native.interOpThreads = config.interOpThreads;
+    native.spinWait = config.spinWait;
+    native.intraOpAffinity = config.intraOpAffinity == null ? nullptr : config.intraOpAffinity!.toNativeUtf8();
+    native.disableMemoryArena = config.disableMemoryArena;
+    native.disableMemoryPattern = config.disableMemoryPattern;
+    native.executionProvider = config.useXnnpack ? SAM_PROVIDER_XNNPACK : SAM_PROVIDER_CPU;
+    native.startup.cacheDir = cacheDir == null ? nullptr : cacheDir.toNativeUtf8();
+    native.startup.warmUp = warmUp;
+    native.profilePrefix = config.profilePrefix == null ? nullptr : config.profilePrefix!.toNativeUtf8();
+    return configPtr;
+  }
+  
+  void _freeNativeConfig(Pointer<SamConfig> configPtr) {
+    if (configPtr.ref.intraOpAffinity != nullptr) calloc.free(configPtr.ref.intraOpAffinity);
+    if (configPtr.ref.startup.cacheDir != nullptr) calloc.free(configPtr.ref.startup.cacheDir);
+    if (configPtr.ref.profilePrefix != nullptr) calloc.free(configPtr.ref.profilePrefix);
+    calloc.free(configPtr);
+  }
+  
+  /// Settings that actually took effect (defaults filled in, rejected
+  /// affinity or unavailable providers dropped)
+  SessionConfig? effectiveConfig() {
+    if (_ctx == null) return null;
+    final configPtr = calloc<SamConfig>();
+    try {
+      if (!_samGetEffectiveConfig(_ctx!, configPtr)) return null;
+      final native = configPtr.ref;
+      return SessionConfig(
+        intraOpThreads: native.intraOpThreads,
+        interOpThreads: native.interOpThreads,
+        spinWait: native.spinWait,
+        intraOpAffinity: native.intraOpAffinity == nullptr ? null : native.intraOpAffinity.toDartString(),
+        disableMemoryArena: native.disableMemoryArena,
+        disableMemoryPattern: native.disableMemoryPattern,
+        useXnnpack: native.executionProvider == SAM_PROVIDER_XNNPACK,
+        profilePrefix: native.profilePrefix == nullptr ? null : native.profilePrefix.toDartString(),
+      );
+    } finally {
+      calloc.free(configPtr);
+    }
+  }
+  
+  /// Time spent in each startup phase
+  StartupStats? startupStats() {
+    if (_ctx == null) return null;
+    final statsPtr = calloc<SamStartupStats>();
+    try {
+      if (!_samGetStartupStats(_ctx!, statsPtr)) return null;
+      final stats = statsPtr.ref;
+      return StartupStats(
+        encoderLoadMs: stats.encoderMapMs + stats.encoderSessionMs,
+        decoderLoadMs: stats.decoderMapMs + stats.decoderSessionMs,
+        warmUpMs: stats.warmUpEncoderMs + stats.warmUpDecoderMs,
+        totalMs: stats.totalMs,
+        fromCache: stats.encoderFromCache && stats.decoderFromCache,
+      );
+    } finally {
+      calloc.free(statsPtr);
     }
   }
   
   /// Segment image with point prompts (all-in-one)
   /// 
+  /// Runs the encoder (on a cache miss) and decoder on the calling
+  /// isolate; use [encodeImage] and [decode] to keep the UI isolate free.
+  /// 
   /// [rgbBytes] - RGB image data (H * W * 3)
   /// [width] - Image width
   /// [height] - Image height
@@ -275,7 +813,8 @@ class SamInference {
         maskPtr,
       );
       
-      if (iou < 0) {
+      // Exactly -1 is the failure value; predicted IoUs can be negative
+      if (iou == -1.0) {
         throw Exception('Segmentation failed');
       }
       
@@ -292,83 +831,773 @@ class SamInference {
     }
   }
   
-  /// Dispose resources
-  void dispose() {
-    if (_ctx != null) {
-      _samFree(_ctx!);
-      _ctx = null;
+  /// Encode a photo on the context's worker thread without blocking this
+  /// isolate (the encoder takes ~500 ms on phones). Keep the result for
+  /// every [decode] on this photo, then dispose it.
+  /// 
+  /// Starting another encode cancels one still in flight - a retaken
+  /// photo supersedes the old one - and the superseded (or
+  /// [cancelPending]) call completes with null.
+  Future<ImageEmbedding?> encodeImage(Uint8List rgbBytes, int width, int height) async {
+    if (_ctx == null) {
+      throw StateError('SAM not initialized. Call initialize() first.');
     }
-    if (_cachedEmbedding != null) {
-      calloc.free(_cachedEmbedding!);
-      _cachedEmbedding = null;
+    
+    final rgbPtr = calloc<Uint8>(rgbBytes.length);
+    final imagePtr = calloc<Float>(3 * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE);
+    final scalePtr = calloc<Float>(2);
+    final embedding = ImageEmbedding._allocate(width, height);
+    var status = SAM_JOB_FAILED;
+    
+    try {
+      rgbPtr.asTypedList(rgbBytes.length).setAll(0, rgbBytes);
+      _samPreprocessImage(rgbPtr, width, height, imagePtr, scalePtr, scalePtr + 1);
+      
+      // The worker reads imagePtr and writes the embedding until the job ends
+      final jobId = _samEncodeAsync(_ctx!, imagePtr, embedding._native, true, _jobCallbackPointer, nullptr);
+      _encodeJob = jobId;
+      status = await _awaitJob(jobId);
+      if (_encodeJob == jobId) _encodeJob = 0;
+    } finally {
+      calloc.free(rgbPtr);
+      calloc.free(imagePtr);
+      calloc.free(scalePtr);
+      if (status != SAM_JOB_DONE) embedding.dispose();
     }
+    
+    if (status == SAM_JOB_CANCELLED) return null;
+    if (status != SAM_JOB_DONE) throw Exception('Encoding failed');
+    return embedding;
   }
-}
-
-/// Result of segmentation
-class SegmentResult {
-  final Uint8List mask;
-  final double iouScore;
   
-  SegmentResult({required this.mask, required this.iouScore});
-}
-
-// ============================================================
-// ARUCO CALIBRATION
-// ============================================================
-
-// ArUco constants
-const double ARUCO_L_BOARD_SIZE_MM = 60.0;
-const double ARUCO_L_BOARD_SEPARATION_MM = 12.0;
-
-/// Point2f struct
-final class Point2f extends Struct {
-  @Float()
-  external double x;
-  @Float()
-  external double y;
-}
-
-/// ArucoMarker struct
-final class ArucoMarker extends Struct {
-  @Array(4)
-  external Array<Point2f> corners;
-  external Point2f center;
-  @Int32()
-  external int id;
-  @Bool()
-  external bool detected;
-}
-
-/// ArucoCalibrationResult struct
-final class ArucoCalibrationResult extends Struct {
-  @Float()
-  external double ratioPxMm;
-  @Float()
-  external double distancePx;
-  @Float()
-  external double knownDistanceMm;
-  @Array(8)
-  external Array<Uint8> usedPair;
-  @Bool()
-  external bool boardDetected;
-  @Array(3)
+  /// Decode point prompts against [embedding] on the worker thread and
+  /// upsample the best mask to the photo size. Completes with null if
+  /// cancelled by [cancelPending]. Do not dispose [embedding] before the
+  /// returned future completes.
+  Future<SegmentResult?> decode(
+    ImageEmbedding embedding,
+    List<double> pointsX,
+    List<double> pointsY,
+    List<int> labels,
+  ) async {
+    if (_ctx == null) {
+      throw StateError('SAM not initialized. Call initialize() first.');
+    }
+    
+    if (pointsX.length != pointsY.length || pointsX.length != labels.length) {
+      throw ArgumentError('Points and labels must have same length');
+    }
+    
+    final numPoints = pointsX.length;
+    final width = embedding.width;
+    final height = embedding.height;
+    final scale = SAM_IMAGE_SIZE / math.max(width, height);
+    
+    final coordsPtr = calloc<Float>(numPoints * 2);
+    final labelsPtr = calloc<Int32>(numPoints);
+    final promptPtr = calloc<SamPointPrompt>();
+    final masksPtr = calloc<Float>(SAM_NUM_MASKS * SAM_MASK_SIZE * SAM_MASK_SIZE);
+    final iouPtr = calloc<Float>(SAM_NUM_MASKS);
+    final resultPtr = calloc<SamMaskResult>();
+    final maskPtr = calloc<Uint8>(width * height);
+    
+    try {
+      for (var i = 0; i < numPoints; i++) {
+        coordsPtr[i * 2] = pointsX[i] * scale;
+        coordsPtr[i * 2 + 1] = pointsY[i] * scale;
+      }
+      labelsPtr.asTypedList(numPoints).setAll(0, labels);
+      promptPtr.ref
+        ..coords = coordsPtr
+        ..labels = labelsPtr
+        ..numPoints = numPoints;
+      resultPtr.ref
+        ..masks = masksPtr
+        ..iouScores = iouPtr;
+      
+      final status = await _awaitJob(
+        _samDecodeAsync(_ctx!, embedding._native, promptPtr, resultPtr, _jobCallbackPointer, nullptr),
+      );
+      if (status == SAM_JOB_CANCELLED) return null;
+      if (status != SAM_JOB_DONE) throw Exception('Decoding failed');
+      
+      final best = resultPtr.ref.bestMaskIdx;
+      _samPostprocessMask(masksPtr + best * SAM_MASK_SIZE * SAM_MASK_SIZE, width, height, maskPtr, 0.0);
+      return SegmentResult(
+        mask: Uint8List.fromList(maskPtr.asTypedList(width * height)),
+        iouScore: iouPtr[best],
+      );
+    } finally {
+      calloc.free(coordsPtr);
+      calloc.free(labelsPtr);
+      calloc.free(promptPtr);
+      calloc.free(masksPtr);
+      calloc.free(iouPtr);
+      calloc.free(resultPtr);
+      calloc.free(maskPtr);
+    }
+  }
+  
+  /// Cancel every encode and decode in flight (e.g. the photo was
+  /// retaken or the screen closed); their futures complete with null
+  void cancelPending() {
+    if (_ctx == null) return;
+    for (final jobId in _jobs.keys) {
+      _samCancel(_ctx!, jobId);
+    }
+  }
+  
+  /// Status of the latest [encodeImage] (SAM_JOB_PENDING while queued,
+  /// SAM_JOB_RUNNING once the encoder started), SAM_JOB_UNKNOWN if none
+  /// is in flight. Never blocks.
+  int get encodeStatus =>
+      _ctx == null || _encodeJob == 0 ? SAM_JOB_UNKNOWN : _samJobPoll(_ctx!, _encodeJob);
+  
+  /// Block until the latest [encodeImage] finishes or [timeoutMs] passes,
+  /// returning its SAM_JOB_* status. Only for isolates that may block
+  /// (e.g. a background worker); the UI isolate awaits the future instead.
+  int waitForEncode({int timeoutMs = -1}) =>
+      _ctx == null || _encodeJob == 0 ? SAM_JOB_UNKNOWN : _samJobWait(_ctx!, _encodeJob, timeoutMs);
+  
+  Pointer<NativeFunction<SamJobCallbackNative>> get _jobCallbackPointer {
+    _jobCallback ??= NativeCallable<SamJobCallbackNative>.listener(_onJobFinished);
+    return _jobCallback!.nativeFunction;
+  }
+  
+  void _onJobFinished(int jobId, int status, Pointer<Void> userData) {
+    _jobs.remove(jobId)?.complete(status);
+  }
+  
+  /// Wait for a job submitted just before (0 = submission failed) and
+  /// release its id. The completer is registered before this returns to
+  /// the event loop, so the listener cannot run first.
+  Future<int> _awaitJob(int jobId) async {
+    if (jobId == 0) return SAM_JOB_FAILED;
+    final completer = Completer<int>();
+    _jobs[jobId] = completer;
+    final status = await completer.future;
+    if (_ctx != null) _samJobRelease(_ctx!, jobId);
+    return status;
+  }
+  
+  /// Run segmentation and return the best mask as run lengths plus a
+  /// simplified outline in image pixels (kilobytes instead of H * W bytes)
+  /// 
+  /// [epsilon] - Outline simplification tolerance in pixels (0 = keep all points)
+  Future<CompactSegmentResult> segmentCompact(
+    Uint8List rgbBytes,
+    int width,
+    int height,
+    List<double> pointsX,
+    List<double> pointsY,
+    List<int> labels, {
+    double epsilon = 1.0,
+  }) async {
+    if (_ctx == null) {
+      throw StateError('SAM not initialized. Call initialize() first.');
+    }
+    
+    if (pointsX.length != pointsY.length || pointsX.length != labels.length) {
+      throw ArgumentError('Points and labels must have same length');
+    }
+    
+    final numPoints = pointsX.length;
+    
+    final rgbPtr = calloc<Uint8>(rgbBytes.length);
+    final pointsXPtr = calloc<Float>(numPoints);
+    final pointsYPtr = calloc<Float>(numPoints);
+    final labelsPtr = calloc<Int32>(numPoints);
+    final outPtr = calloc<SamCompactMask>();
+    
+    // A foot crosses most rows about twice; the native call reports the
+    // required sizes if that is not enough and we retry once
+    var runCapacity = 4 * height + 2;
+    var contourCapacity = 4096;
+    
+    try {
+      rgbPtr.asTypedList(rgbBytes.length).setAll(0, rgbBytes);
+      pointsXPtr.asTypedList(numPoints).setAll(0, pointsX);
+      pointsYPtr.asTypedList(numPoints).setAll(0, pointsY);
+      labelsPtr.asTypedList(numPoints).setAll(0, labels);
+      
+      for (var attempt = 0; attempt < 2; attempt++) {
+        final runsPtr = calloc<Uint32>(runCapacity);
+        final contourPtr = calloc<Float>(contourCapacity * 2);
+        try {
+          outPtr.ref
+            ..runs = runsPtr
+            ..runCapacity = runCapacity
+            ..contour = contourPtr
+            ..contourCapacity = contourCapacity;
+          
+          final iou = _samSegmentCompact(
+            _ctx!, rgbPtr, width, height,
+            pointsXPtr, pointsYPtr, labelsPtr, numPoints,
+            epsilon, outPtr,
+          );
+          
+          final out = outPtr.ref;
+          if (iou != -1.0) {
+            return CompactSegmentResult(
+              mask: CompactMask(
+                width: out.width,
+                height: out.height,
+                area: out.area,
+                runs: Uint32List.fromList(runsPtr.asTypedList(out.numRuns)),
+                contour: Float32List.fromList(contourPtr.asTypedList(out.numPoints * 2)),
+              ),
+              iouScore: iou,
+            );
+          }
+          if (out.numRuns <= runCapacity && out.numPoints <= contourCapacity) break;
+          runCapacity = out.numRuns;
+          contourCapacity = out.numPoints;
+        } finally {
+          calloc.free(runsPtr);
+          calloc.free(contourPtr);
+        }
+      }
+      throw Exception('Segmentation failed');
+    } finally {
+      calloc.free(rgbPtr);
+      calloc.free(pointsXPtr);
+      calloc.free(pointsYPtr);
+      calloc.free(labelsPtr);
+      calloc.free(outPtr);
+    }
+  }
+  
+  /// Preprocess a camera frame straight from its planes into [output]
+  /// ([1, 3, 1024, 1024] floats), without converting it to RGB in Dart.
+  /// Pass `CameraImage.planes` as is: YUV420 takes Y, U, V (with the U/V
+  /// pixel stride), NV21 takes Y and VU, BGRA / RGBA / RGB a single plane.
+  /// 
+  /// Returns the resize scale, or null if the format or planes are invalid.
+  double? preprocessFrame(
+    int format,
+    int width,
+    int height,
+    List<FramePlane> planes,
+    Pointer<Float> output,
+  ) {
+    if (planes.isEmpty || planes.length > 3) {
+      throw ArgumentError('Expected 1 to 3 planes');
+    }
+    
+    final imagePtr = calloc<SamImage>();
+    final scalePtr = calloc<Float>(2);
+    final planePtrs = <Pointer<Uint8>>[];
+    
+    try {
+      final image = imagePtr.ref
+        ..format = format
+        ..width = width
+        ..height = height;
+      for (var i = 0; i < planes.length; i++) {
+        final bytes = planes[i].bytes;
+        final ptr = calloc<Uint8>(bytes.length);
+        planePtrs.add(ptr);
+        ptr.asTypedList(bytes.length).setAll(0, bytes);
+        image.planes[i] = ptr;
+        image.rowStrides[i] = planes[i].rowStride;
+        image.pixelStrides[i] = planes[i].pixelStride;
+      }
+      
+      final ok = _samPreprocessFrame(_ctx ?? nullptr, imagePtr, output, scalePtr, scalePtr + 1);
+      return ok ? scalePtr[0] : null;
+    } finally {
+      for (final ptr in planePtrs) {
+        calloc.free(ptr);
+      }
+      calloc.free(imagePtr);
+      calloc.free(scalePtr);
+    }
+  }
+  
+  /// Whether follow-up clicks refine the previous mask (the decoder was
+  /// exported with mask_input / has_mask_input). Pass the previous
+  /// points plus the new one to [segment] to get the refinement.
+  bool get hasMaskInput => _ctx != null && _samHasMaskInput(_ctx!);
+  
+  /// Forget previous masks, so the next [segment] starts from its points
+  /// alone (e.g. when the user clears the clicks)
+  void resetMaskInput() {
+    if (_ctx == null) return;
+    _samResetMaskInput(_ctx!, nullptr);
+  }
+  
+  /// Set the native embedding cache budget in bytes (0 disables it)
+  void setCacheBudget(int maxBytes) {
+    if (_ctx == null) return;
+    _samSetCacheBudget(_ctx!, maxBytes);
+  }
+  
+  /// Drop cached embeddings (e.g. when the patient session ends)
+  void clearCache() {
+    if (_ctx == null) return;
+    _samClearCache(_ctx!);
+  }
+  
+  /// Store cached embeddings as fp16 (twice the images per budget)
+  bool setCacheHalfPrecision(bool enabled) {
+    if (_ctx == null) return false;
+    return _samSetCacheDtype(_ctx!, enabled ? 1 : 0);
+  }
+  
+  /// Native embedding cache counters
+  CacheStats? cacheStats() {
+    if (_ctx == null) return null;
+    final statsPtr = calloc<SamCacheStats>();
+    try {
+      if (!_samGetCacheStats(_ctx!, statsPtr)) return null;
+      final stats = statsPtr.ref;
+      return CacheStats(
+        hits: stats.hits,
+        misses: stats.misses,
+        entries: stats.entries,
+        bytesUsed: stats.bytesUsed,
+      );
+    } finally {
+      calloc.free(statsPtr);
+    }
+  }
+  
+  /// Per-stage latency since start or [resetStats] (process-wide,
+  /// indexed by SAM_STAGE_*)
+  List<StageStats> stats() {
+    final statsPtr = calloc<SamStats>();
+    try {
+      if (!_samGetStats(statsPtr)) return const [];
+      return [
+        for (var s = 0; s < SAM_STAGE_COUNT; s++) StageStats._fromNative(s, statsPtr.ref.stages[s]),
+      ];
+    } finally {
+      calloc.free(statsPtr);
+    }
+  }
+  
+  void resetStats() => _samResetStats();
+  
+  /// Buffer Chrome trace events until [stopTrace] (0 = 1M events)
+  bool startTrace({int maxEvents = 0}) => _samTraceStart(maxEvents);
+  
+  /// Write the trace to [path] (open in ui.perfetto.dev); ORT's operator
+  /// events are merged in when [SessionConfig.profilePrefix] was set
+  bool stopTrace(String path) {
+    final pathPtr = path.toNativeUtf8();
+    try {
+      return _samTraceStop(_ctx ?? nullptr, pathPtr);
+    } finally {
+      calloc.free(pathPtr);
+    }
+  }
+  
+  /// Encoder variants from the manifest (one for [initialize])
+  List<EncoderVariant> encoderVariants() {
+    if (_ctx == null) return const [];
+    final infoPtr = calloc<SamEncoderVariantInfo>();
+    try {
+      final variants = <EncoderVariant>[];
+      final count = _samGetEncoderVariantCount(_ctx!);
+      for (var i = 0; i < count; i++) {
+        if (!_samGetEncoderVariant(_ctx!, i, infoPtr)) continue;
+        final info = infoPtr.ref;
+        final nameBytes = <int>[];
+        for (var j = 0; j < 32 && info.name[j] != 0; j++) {
+          nameBytes.add(info.name[j]);
+        }
+        variants.add(EncoderVariant(
+          name: String.fromCharCodes(nameBytes),
+          fileBytes: info.fileBytes,
+          quantized: info.quantized,
+          active: info.active,
+          latencyMs: info.latencyMs,
+          minIou: info.minIou,
+        ));
+      }
+      return variants;
+    } finally {
+      calloc.free(infoPtr);
+    }
+  }
+  
+  /// Activate an encoder variant by index
+  bool setEncoderVariant(int index) {
+    if (_ctx == null) return false;
+    return _samSetEncoderVariant(_ctx!, index);
+  }
+  
+  /// Pick the fastest encoder whose masks stay within [minIou] of the
+  /// reference on these images (one foreground click each). Slow: run it
+  /// once per device and persist the chosen index.
+  int selectEncoder(
+    List<Uint8List> rgbImages,
+    List<int> widths,
+    List<int> heights,
+    List<double> pointsXY,
+    {double minIou = 0.9}
+  ) {
+    if (_ctx == null) return -1;
+    final count = rgbImages.length;
+    if (widths.length != count || heights.length != count || pointsXY.length != count * 2) {
+      throw ArgumentError('One width, height and click per image');
+    }
+    
+    final imagesPtr = calloc<Pointer<Uint8>>(count);
+    final widthsPtr = calloc<Int32>(count);
+    final heightsPtr = calloc<Int32>(count);
+    final pointsPtr = calloc<Float>(count * 2);
+    
+    try {
+      for (var i = 0; i < count; i++) {
+        imagesPtr[i] = calloc<Uint8>(rgbImages[i].length);
+        imagesPtr[i].asTypedList(rgbImages[i].length).setAll(0, rgbImages[i]);
+      }
+      widthsPtr.asTypedList(count).setAll(0, widths);
+      heightsPtr.asTypedList(count).setAll(0, heights);
+      pointsPtr.asTypedList(count * 2).setAll(0, pointsXY);
+      
+      return _samSelectEncoder(_ctx!, imagesPtr, widthsPtr, heightsPtr, pointsPtr, count, minIou);
+    } finally {
+      for (var i = 0; i < count; i++) {
+        if (imagesPtr[i] != nullptr) calloc.free(imagesPtr[i]);
+      }
+      calloc.free(imagesPtr);
+      calloc.free(widthsPtr);
+      calloc.free(heightsPtr);
+      calloc.free(pointsPtr);
+    }
+  }
+  
+  /// Dispose resources
+  void dispose() {
+    if (_ctx != null) {
+      // Cancels and drains the job worker, so no callback fires after this
+      _samFree(_ctx!);
+      _ctx = null;
+    }
+    _jobCallback?.close();
+    _jobCallback = null;
+    // Listener messages still queued are dropped by close()
+    for (final completer in _jobs.values) {
+      completer.complete(SAM_JOB_CANCELLED);
+    }
+    _jobs.clear();
+  }
+}
+
+/// Image embedding in native memory (from [SamInference.encodeImage]),
+/// reused for every prompt on the same photo
+class ImageEmbedding {
+  final int width;
+  final int height;
+  final Pointer<SamEmbedding> _native;
+  bool _disposed = false;
+  
+  ImageEmbedding._allocate(this.width, this.height) : _native = calloc<SamEmbedding>() {
+    _native.ref
+      ..data = calloc<Float>(SAM_EMBEDDING_DIM * SAM_EMBEDDING_SIZE * SAM_EMBEDDING_SIZE)
+      ..batchSize = 1
+      ..channels = SAM_EMBEDDING_DIM
+      ..height = SAM_EMBEDDING_SIZE
+      ..width = SAM_EMBEDDING_SIZE
+      ..dtype = 0
+      ..halfData = nullptr;
+  }
+  
+  /// Free the native buffers (no decode on it may be pending)
+  void dispose() {
+    if (_disposed) return;
+    _disposed = true;
+    calloc.free(_native.ref.data);
+    calloc.free(_native);
+  }
+}
+
+/// One plane of a camera frame (mirrors `CameraImage.planes[i]`)
+class FramePlane {
+  final Uint8List bytes;
+  final int rowStride;     // Bytes per row (0 = tightly packed)
+  final int pixelStride;   // Bytes between chroma samples (YUV420 U/V; 0 = 1)
+  
+  const FramePlane(this.bytes, {this.rowStride = 0, this.pixelStride = 0});
+}
+
+/// Embedding cache counters
+class CacheStats {
+  final int hits;
+  final int misses;
+  final int entries;
+  final int bytesUsed;
+  
+  CacheStats({
+    required this.hits,
+    required this.misses,
+    required this.entries,
+    required this.bytesUsed,
+  });
+  
+  @override
+  String toString() => 'CacheStats(hits: $hits, misses: $misses, entries: $entries)';
+}
+
+/// Session configuration (see SamConfig in sam_inference.h)
+class SessionConfig {
+  final int intraOpThreads;      // 0 = 4
+  final int interOpThreads;      // >1 = parallel graph branches
+  final int spinWait;            // SAM_SPIN_*
+  final String? intraOpAffinity; // e.g. '1;2;3' for 4 threads
+  final bool disableMemoryArena;
+  final bool disableMemoryPattern;
+  final bool useXnnpack;
+  final String? profilePrefix;   // ORT profiling file prefix, merged by stopTrace
+  
+  const SessionConfig({
+    this.intraOpThreads = 0,
+    this.interOpThreads = 0,
+    this.spinWait = SAM_SPIN_DEFAULT,
+    this.intraOpAffinity,
+    this.disableMemoryArena = false,
+    this.disableMemoryPattern = false,
+    this.useXnnpack = false,
+    this.profilePrefix,
+  });
+  
+  @override
+  String toString() => 'SessionConfig(intra: $intraOpThreads, inter: $interOpThreads, spin: $spinWait, '
+      'affinity: $intraOpAffinity, xnnpack: $useXnnpack)';
+}
+
+/// Latency of one instrumented stage
+class StageStats {
+  static const names = ['preprocess', 'encode', 'decode', 'postprocess', 'aruco', 'measure', 'segment'];
+  
+  final int stage;       // SAM_STAGE_*
+  final int count;
+  final double meanMs;
+  final double minMs;
+  final double maxMs;
+  final double p50Ms;
+  final double p90Ms;
+  final double p99Ms;
+  
+  StageStats({
+    required this.stage,
+    required this.count,
+    required this.meanMs,
+    required this.minMs,
+    required this.maxMs,
+    required this.p50Ms,
+    required this.p90Ms,
+    required this.p99Ms,
+  });
+  
+  StageStats._fromNative(this.stage, SamStageStats native)
+      : count = native.count,
+        meanMs = native.meanMs,
+        minMs = native.minUs / 1000.0,
+        maxMs = native.maxUs / 1000.0,
+        p50Ms = native.p50Ms,
+        p90Ms = native.p90Ms,
+        p99Ms = native.p99Ms;
+  
+  String get name => names[stage];
+  
+  @override
+  String toString() => 'StageStats($name: n=$count, p50: ${p50Ms.toStringAsFixed(2)} ms, '
+      'p90: ${p90Ms.toStringAsFixed(2)} ms, p99: ${p99Ms.toStringAsFixed(2)} ms)';
+}
+
+/// Startup phase timings
+class StartupStats {
+  final double encoderLoadMs;
+  final double decoderLoadMs;
+  final double warmUpMs;
+  final double totalMs;
+  final bool fromCache;
+  
+  StartupStats({
+    required this.encoderLoadMs,
+    required this.decoderLoadMs,
+    required this.warmUpMs,
+    required this.totalMs,
+    required this.fromCache,
+  });
+  
+  @override
+  String toString() => 'StartupStats(encoder: ${encoderLoadMs.toStringAsFixed(0)} ms, '
+      'decoder: ${decoderLoadMs.toStringAsFixed(0)} ms, warm-up: ${warmUpMs.toStringAsFixed(0)} ms, '
+      'total: ${totalMs.toStringAsFixed(0)} ms, cached: $fromCache)';
+}
+
+/// Encoder variant description and last selection measurements
+class EncoderVariant {
+  final String name;
+  final int fileBytes;
+  final bool quantized;
+  final bool active;
+  final double latencyMs;
+  final double minIou;
+  
+  EncoderVariant({
+    required this.name,
+    required this.fileBytes,
+    required this.quantized,
+    required this.active,
+    required this.latencyMs,
+    required this.minIou,
+  });
+  
+  @override
+  String toString() => 'EncoderVariant($name, quantized: $quantized, active: $active, '
+      'latency: ${latencyMs.toStringAsFixed(1)} ms, minIou: ${minIou.toStringAsFixed(3)})';
+}
+
+/// Result of segmentation
+class SegmentResult {
+  final Uint8List mask;
+  final double iouScore;
+  
+  SegmentResult({required this.mask, required this.iouScore});
+}
+
+/// Mask as row-major run lengths (background first, alternating) plus
+/// the outline of the largest component as (x, y) pairs
+class CompactMask {
+  final int width;
+  final int height;
+  final int area;
+  final Uint32List runs;
+  final Float32List contour;
+  
+  CompactMask({
+    required this.width,
+    required this.height,
+    required this.area,
+    required this.runs,
+    required this.contour,
+  });
+  
+  int get numContourPoints => contour.length ~/ 2;
+  
+  /// Expand to the H * W byte mask sam_segment returns (0 or 255)
+  Uint8List toMask() {
+    final mask = Uint8List(width * height);
+    var pos = 0;
+    for (var i = 0; i < runs.length; i++) {
+      final end = pos + runs[i];
+      if (i.isOdd) mask.fillRange(pos, end, 255);
+      pos = end;
+    }
+    return mask;
+  }
+}
+
+/// Result of compact segmentation
+class CompactSegmentResult {
+  final CompactMask mask;
+  final double iouScore;
+  
+  CompactSegmentResult({required this.mask, required this.iouScore});
+}
+
+// ============================================================
+// ARUCO CALIBRATION
+// ============================================================
+
+// ArUco constants
+const double ARUCO_L_BOARD_SIZE_MM = 60.0;
+const double ARUCO_L_BOARD_SEPARATION_MM = 12.0;
+
+/// Point2f struct
+final class Point2f extends Struct {
+  @Float()
+  external double x;
+  @Float()
+  external double y;
+}
+
+/// ArucoMarker struct
+final class ArucoMarker extends Struct {
+  @Array(4)
+  external Array<Point2f> corners;
+  external Point2f center;
+  @Int32()
+  external int id;
+  @Bool()
+  external bool detected;
+}
+
+/// ArucoCalibrationResult struct
+final class ArucoCalibrationResult extends Struct {
+  @Float()
+  external double ratioPxMm;
+  @Float()
+  external double distancePx;
+  @Float()
+  external double knownDistanceMm;
+  @Array(8)
+  external Array<Uint8> usedPair;
+  @Bool()
+  external bool boardDetected;
+  @Array(3)
   external Array<ArucoMarker> markers;
   @Int32()
   external int numMarkersDetected;
 }
 
+// ArUco input formats
+const int ARUCO_FORMAT_RGB = 0;
+const int ARUCO_FORMAT_GRAY = 1;  // 8-bit gray or the Y plane of a YUV camera frame
+const int ARUCO_FORMAT_RGBA = 2;
+
+/// ArucoContext (opaque)
+final class ArucoContext extends Opaque {}
+
+/// ArucoDetectorConfig struct
+final class ArucoDetectorConfig extends Struct {
+  @Bool()
+  external bool multiScale;
+  @Float()
+  external double expectedMarkerPx;
+  @Float()
+  external double targetMarkerPx;
+  @Int32()
+  external int refineWindow;
+}
+
 // ArUco native function signatures
-typedef ArucoDetectNative = Bool Function(
-  Pointer<Uint8> rgbData,
+typedef ArucoContextCreateNative = Pointer<ArucoContext> Function();
+typedef ArucoContextCreateDart = Pointer<ArucoContext> Function();
+
+typedef ArucoContextFreeNative = Void Function(Pointer<ArucoContext> ctx);
+typedef ArucoContextFreeDart = void Function(Pointer<ArucoContext> ctx);
+
+typedef ArucoContextConfigureNative = Bool Function(
+  Pointer<ArucoContext> ctx,
+  Pointer<ArucoDetectorConfig> config,
+);
+typedef ArucoContextConfigureDart = bool Function(
+  Pointer<ArucoContext> ctx,
+  Pointer<ArucoDetectorConfig> config,
+);
+
+typedef ArucoDetectExNative = Bool Function(
+  Pointer<ArucoContext> ctx,
+  Pointer<Uint8> data,
   Int32 width,
   Int32 height,
+  Int32 stride,
+  Int32 format,
   Pointer<ArucoCalibrationResult> result,
 );
-typedef ArucoDetectDart = bool Function(
-  Pointer<Uint8> rgbData,
+typedef ArucoDetectExDart = bool Function(
+  Pointer<ArucoContext> ctx,
+  Pointer<Uint8> data,
   int width,
   int height,
+  int stride,
+  int format,
   Pointer<ArucoCalibrationResult> result,
 );
 
@@ -378,41 +1607,111 @@ typedef ArucoPxToMmDart = double Function(double px, double ratio);
 /// ArUco calibration class
 class ArucoCalibration {
   late DynamicLibrary _lib;
-  late ArucoDetectDart _arucoDetect;
+  late ArucoContextFreeDart _arucoContextFree;
+  late ArucoContextConfigureDart _arucoContextConfigure;
+  late ArucoDetectExDart _arucoDetectEx;
   late ArucoPxToMmDart _arucoPxToMm;
   
+  // Detector and native buffers are reused across frames
+  Pointer<ArucoContext>? _ctx;
+  Pointer<Uint8> _frame = nullptr;
+  int _frameBytes = 0;
+  final Pointer<ArucoCalibrationResult> _result = calloc<ArucoCalibrationResult>();
+  
   ArucoCalibration(DynamicLibrary lib) {
     _lib = lib;
-    _arucoDetect = _lib.lookupFunction<ArucoDetectNative, ArucoDetectDart>('aruco_detect_l_board');
+    final create = _lib.lookupFunction<ArucoContextCreateNative, ArucoContextCreateDart>('aruco_context_create');
+    _arucoContextFree = _lib.lookupFunction<ArucoContextFreeNative, ArucoContextFreeDart>('aruco_context_free');
+    _arucoContextConfigure = _lib.lookupFunction<ArucoContextConfigureNative, ArucoContextConfigureDart>('aruco_context_configure');
+    _arucoDetectEx = _lib.lookupFunction<ArucoDetectExNative, ArucoDetectExDart>('aruco_detect_l_board_ex');
     _arucoPxToMm = _lib.lookupFunction<ArucoPxToMmNative, ArucoPxToMmDart>('aruco_px_to_mm');
+    
+    final ctx = create();
+    if (ctx == nullptr) {
+      calloc.free(_result);
+      throw StateError('Failed to create ArUco detector');
+    }
+    _ctx = ctx;
+  }
+  
+  /// Detect on a downscaled level and refine corners at full resolution
+  /// (much faster on 12 MP photos; falls back to full resolution on a miss)
+  /// 
+  /// [expectedMarkerPx] - Marker side in the full photo (0 = shorter side / 12)
+  /// [targetMarkerPx] - Marker side at the detection level (0 = 64)
+  bool configure({
+    bool multiScale = true,
+    double expectedMarkerPx = 0,
+    double targetMarkerPx = 0,
+    int refineWindow = 0,
+  }) {
+    if (_ctx == null) return false;
+    final config = calloc<ArucoDetectorConfig>();
+    try {
+      config.ref
+        ..multiScale = multiScale
+        ..expectedMarkerPx = expectedMarkerPx
+        ..targetMarkerPx = targetMarkerPx
+        ..refineWindow = refineWindow;
+      return _arucoContextConfigure(_ctx!, config);
+    } finally {
+      calloc.free(config);
+    }
   }
   
   /// Detect ArUco L-board and get calibration ratio
   CalibrationResult? detectLBoard(Uint8List rgbBytes, int width, int height) {
-    final rgbPtr = calloc<Uint8>(rgbBytes.length);
-    final resultPtr = calloc<ArucoCalibrationResult>();
+    return detectLBoardFrame(rgbBytes, width, height, format: ARUCO_FORMAT_RGB);
+  }
+  
+  /// Detect on a camera frame: RGB, RGBA, or a gray / luminance (Y) plane
+  /// 
+  /// [stride] - Bytes per row (0 = tightly packed)
+  CalibrationResult? detectLBoardFrame(
+    Uint8List bytes,
+    int width,
+    int height, {
+    int stride = 0,
+    int format = ARUCO_FORMAT_GRAY,
+  }) {
+    if (_ctx == null) {
+      throw StateError('ArucoCalibration disposed');
+    }
     
-    try {
-      rgbPtr.asTypedList(rgbBytes.length).setAll(0, rgbBytes);
-      
-      final success = _arucoDetect(rgbPtr, width, height, resultPtr);
-      
-      if (!success) return null;
-      
-      final result = resultPtr.ref;
-      return CalibrationResult(
-        ratioPxMm: result.ratioPxMm,
-        distancePx: result.distancePx,
-        knownDistanceMm: result.knownDistanceMm,
-        usedPair: String.fromCharCodes(
-          result.usedPair.asTypedList(8).takeWhile((c) => c != 0)
-        ),
-        numMarkersDetected: result.numMarkersDetected,
-      );
-    } finally {
-      calloc.free(rgbPtr);
-      calloc.free(resultPtr);
+    if (bytes.length > _frameBytes) {
+      if (_frame != nullptr) calloc.free(_frame);
+      _frame = calloc<Uint8>(bytes.length);
+      _frameBytes = bytes.length;
+    }
+    _frame.asTypedList(bytes.length).setAll(0, bytes);
+    
+    final success = _arucoDetectEx(_ctx!, _frame, width, height, stride, format, _result);
+    
+    if (!success) return null;
+    
+    final result = _result.ref;
+    return CalibrationResult(
+      ratioPxMm: result.ratioPxMm,
+      distancePx: result.distancePx,
+      knownDistanceMm: result.knownDistanceMm,
+      usedPair: String.fromCharCodes(
+        result.usedPair.asTypedList(8).takeWhile((c) => c != 0)
+      ),
+      numMarkersDetected: result.numMarkersDetected,
+    );
+  }
+  
+  /// Release the native detector and buffers
+  void dispose() {
+    if (_ctx == null) return;
+    _arucoContextFree(_ctx!);
+    _ctx = null;
+    if (_frame != nullptr) {
+      calloc.free(_frame);
+      _frame = nullptr;
+      _frameBytes = 0;
     }
+    calloc.free(_result);
   }
   
   /// Convert pixels to millimeters
@@ -426,6 +1725,214 @@ class ArucoCalibration {
   }
 }
 
+/// ArucoTracker (opaque)
+final class ArucoTrackerHandle extends Opaque {}
+
+/// ArucoTrackerConfig struct
+final class ArucoTrackerConfig extends Struct {
+  external ArucoDetectorConfig detector;
+  @Float()
+  external double smoothing;
+  @Float()
+  external double outlierTolerance;
+  @Int32()
+  external int maxOutliers;
+  @Float()
+  external double roiMargin;
+}
+
+/// ArucoTrackerState struct
+final class ArucoTrackerState extends Struct {
+  @Bool()
+  external bool boardDetected;
+  @Bool()
+  external bool tracking;
+  @Float()
+  external double ratioPxMm;
+  @Float()
+  external double rawRatioPxMm;
+  external ArucoCalibrationResult result;
+  @Int64()
+  external int frameTimestampUs;
+  @Float()
+  external double detectMs;
+  @Uint64()
+  external int framesPushed;
+  @Uint64()
+  external int framesProcessed;
+  @Uint64()
+  external int framesDropped;
+  @Uint64()
+  external int outliersRejected;
+}
+
+typedef ArucoTrackerCreateNative = Pointer<ArucoTrackerHandle> Function(Pointer<ArucoTrackerConfig> config);
+typedef ArucoTrackerCreateDart = Pointer<ArucoTrackerHandle> Function(Pointer<ArucoTrackerConfig> config);
+
+typedef ArucoTrackerFreeNative = Void Function(Pointer<ArucoTrackerHandle> tracker);
+typedef ArucoTrackerFreeDart = void Function(Pointer<ArucoTrackerHandle> tracker);
+
+typedef ArucoTrackerPushFrameNative = Bool Function(
+  Pointer<ArucoTrackerHandle> tracker,
+  Pointer<Uint8> data,
+  Int32 width,
+  Int32 height,
+  Int32 stride,
+  Int32 format,
+  Int64 timestampUs,
+);
+typedef ArucoTrackerPushFrameDart = bool Function(
+  Pointer<ArucoTrackerHandle> tracker,
+  Pointer<Uint8> data,
+  int width,
+  int height,
+  int stride,
+  int format,
+  int timestampUs,
+);
+
+typedef ArucoTrackerGetStateNative = Bool Function(
+  Pointer<ArucoTrackerHandle> tracker,
+  Pointer<ArucoTrackerState> state,
+);
+typedef ArucoTrackerGetStateDart = bool Function(
+  Pointer<ArucoTrackerHandle> tracker,
+  Pointer<ArucoTrackerState> state,
+);
+
+typedef ArucoTrackerResetNative = Void Function(Pointer<ArucoTrackerHandle> tracker);
+typedef ArucoTrackerResetDart = void Function(Pointer<ArucoTrackerHandle> tracker);
+
+/// Live-preview L-board tracking
+/// 
+/// Push every camera frame (e.g. the Y plane of a `CameraImage`); a native
+/// worker searches around the last marker positions and always works on the
+/// newest frame. Poll [state] from the UI for "board detected / ratio".
+class ArucoTracker {
+  late ArucoTrackerFreeDart _free;
+  late ArucoTrackerPushFrameDart _pushFrame;
+  late ArucoTrackerGetStateDart _getState;
+  late ArucoTrackerResetDart _reset;
+  
+  Pointer<ArucoTrackerHandle>? _tracker;
+  Pointer<Uint8> _frame = nullptr;
+  int _frameBytes = 0;
+  final Pointer<ArucoTrackerState> _state = calloc<ArucoTrackerState>();
+  
+  ArucoTracker(
+    DynamicLibrary lib, {
+    bool multiScale = false,
+    double smoothing = 0,
+    double outlierTolerance = 0,
+    int maxOutliers = 0,
+  }) {
+    final create = lib.lookupFunction<ArucoTrackerCreateNative, ArucoTrackerCreateDart>('aruco_tracker_create');
+    _free = lib.lookupFunction<ArucoTrackerFreeNative, ArucoTrackerFreeDart>('aruco_tracker_free');
+    _pushFrame = lib.lookupFunction<ArucoTrackerPushFrameNative, ArucoTrackerPushFrameDart>('aruco_tracker_push_frame');
+    _getState = lib.lookupFunction<ArucoTrackerGetStateNative, ArucoTrackerGetStateDart>('aruco_tracker_get_state');
+    _reset = lib.lookupFunction<ArucoTrackerResetNative, ArucoTrackerResetDart>('aruco_tracker_reset');
+    
+    final config = calloc<ArucoTrackerConfig>();
+    try {
+      config.ref
+        ..detector.multiScale = multiScale
+        ..smoothing = smoothing
+        ..outlierTolerance = outlierTolerance
+        ..maxOutliers = maxOutliers;
+      final tracker = create(config);
+      if (tracker == nullptr) {
+        calloc.free(_state);
+        throw StateError('Failed to create ArUco tracker');
+      }
+      _tracker = tracker;
+    } finally {
+      calloc.free(config);
+    }
+  }
+  
+  /// Queue a frame; returns immediately (older unprocessed frames are dropped)
+  bool pushFrame(
+    Uint8List bytes,
+    int width,
+    int height, {
+    int stride = 0,
+    int format = ARUCO_FORMAT_GRAY,
+    int timestampUs = 0,
+  }) {
+    if (_tracker == null) return false;
+    if (bytes.length > _frameBytes) {
+      if (_frame != nullptr) calloc.free(_frame);
+      _frame = calloc<Uint8>(bytes.length);
+      _frameBytes = bytes.length;
+    }
+    _frame.asTypedList(bytes.length).setAll(0, bytes);
+    return _pushFrame(_tracker!, _frame, width, height, stride, format, timestampUs);
+  }
+  
+  /// Latest tracking output
+  TrackerState? get state {
+    if (_tracker == null || !_getState(_tracker!, _state)) return null;
+    final s = _state.ref;
+    return TrackerState(
+      boardDetected: s.boardDetected,
+      tracking: s.tracking,
+      ratioPxMm: s.ratioPxMm,
+      rawRatioPxMm: s.rawRatioPxMm,
+      numMarkersDetected: s.result.numMarkersDetected,
+      frameTimestampUs: s.frameTimestampUs,
+      detectMs: s.detectMs,
+      framesProcessed: s.framesProcessed,
+      framesDropped: s.framesDropped,
+    );
+  }
+  
+  /// Forget marker positions and the filtered ratio
+  void reset() {
+    if (_tracker != null) _reset(_tracker!);
+  }
+  
+  void dispose() {
+    if (_tracker == null) return;
+    _free(_tracker!);
+    _tracker = null;
+    if (_frame != nullptr) {
+      calloc.free(_frame);
+      _frame = nullptr;
+      _frameBytes = 0;
+    }
+    calloc.free(_state);
+  }
+}
+
+/// Live tracker output
+class TrackerState {
+  final bool boardDetected;
+  final bool tracking;
+  final double ratioPxMm;
+  final double rawRatioPxMm;
+  final int numMarkersDetected;
+  final int frameTimestampUs;
+  final double detectMs;
+  final int framesProcessed;
+  final int framesDropped;
+  
+  TrackerState({
+    required this.boardDetected,
+    required this.tracking,
+    required this.ratioPxMm,
+    required this.rawRatioPxMm,
+    required this.numMarkersDetected,
+    required this.frameTimestampUs,
+    required this.detectMs,
+    required this.framesProcessed,
+    required this.framesDropped,
+  });
+  
+  @override
+  String toString() => 'TrackerState(detected: $boardDetected, ratio: ${ratioPxMm.toStringAsFixed(3)} px/mm, '
+      '${detectMs.toStringAsFixed(1)} ms)';
+}
+
 /// Calibration result
 class CalibrationResult {
   final double ratioPxMm;
@@ -446,6 +1953,162 @@ class CalibrationResult {
   String toString() => 'CalibrationResult(ratio: $ratioPxMm px/mm, pair: $usedPair)';
 }
 
+// ============================================================
+// FOOT MEASUREMENT
+// ============================================================
+
+const int FOOT_PROFILE_BINS = 64;
+
+/// FootMeasurement struct
+final class FootMeasurement extends Struct {
+  external Point2f centroid;
+  external Point2f axis;
+  @Float()
+  external double angleDeg;
+  @Array(4)
+  external Array<Point2f> obb;
+  @Float()
+  external double lengthPx;
+  @Float()
+  external double obbWidthPx;
+  @Array(2)
+  external Array<Point2f> lengthEnds;
+  @Array(FOOT_PROFILE_BINS)
+  external Array<Float> profilePx;
+  @Float()
+  external double widthPx;
+  @Float()
+  external double widthPosition;
+  @Array(2)
+  external Array<Point2f> widthEnds;
+  @Uint64()
+  external int areaPx;
+  @Float()
+  external double lengthMm;
+  @Float()
+  external double widthMm;
+  @Float()
+  external double obbWidthMm;
+  @Float()
+  external double areaMm2;
+  @Array(FOOT_PROFILE_BINS)
+  external Array<Float> profileMm;
+  @Float()
+  external double ratioPxMm;
+  @Bool()
+  external bool calibrated;
+}
+
+typedef FootMeasureRunsNative = Bool Function(
+  Pointer<Uint32> runs,
+  Int32 numRuns,
+  Int32 width,
+  Int32 height,
+  Pointer<ArucoCalibrationResult> calibration,
+  Pointer<FootMeasurement> result,
+);
+typedef FootMeasureRunsDart = bool Function(
+  Pointer<Uint32> runs,
+  int numRuns,
+  int width,
+  int height,
+  Pointer<ArucoCalibrationResult> calibration,
+  Pointer<FootMeasurement> result,
+);
+
+/// Native foot measurement on compact masks
+class FootMeasure {
+  late FootMeasureRunsDart _footMeasureRuns;
+  
+  FootMeasure(DynamicLibrary lib) {
+    _footMeasureRuns = lib.lookupFunction<FootMeasureRunsNative, FootMeasureRunsDart>('foot_measure_runs');
+  }
+  
+  /// Measure a segmented foot; mm values need [calibration]
+  /// 
+  /// Returns null if the mask is empty
+  FootMeasurementResult? measure(CompactMask mask, {CalibrationResult? calibration}) {
+    final runsPtr = calloc<Uint32>(mask.runs.length);
+    final calibrationPtr = calloc<ArucoCalibrationResult>();
+    final resultPtr = calloc<FootMeasurement>();
+    
+    try {
+      runsPtr.asTypedList(mask.runs.length).setAll(0, mask.runs);
+      if (calibration != null) {
+        calibrationPtr.ref
+          ..ratioPxMm = calibration.ratioPxMm
+          ..distancePx = calibration.distancePx
+          ..knownDistanceMm = calibration.knownDistanceMm
+          ..numMarkersDetected = calibration.numMarkersDetected
+          ..boardDetected = true;
+      }
+      
+      final ok = _footMeasureRuns(
+        runsPtr, mask.runs.length, mask.width, mask.height,
+        calibration != null ? calibrationPtr : nullptr,
+        resultPtr,
+      );
+      if (!ok) return null;
+      
+      return FootMeasurementResult._fromNative(resultPtr.ref);
+    } finally {
+      calloc.free(runsPtr);
+      calloc.free(calibrationPtr);
+      calloc.free(resultPtr);
+    }
+  }
+}
+
+/// Foot measurement (pixels, plus mm when calibrated)
+class FootMeasurementResult {
+  final Point centroid;
+  final Point axis;
+  final double angleDeg;
+  final List<Point> obb;
+  final double lengthPx;
+  final double obbWidthPx;
+  final List<Point> lengthEnds;
+  final List<double> profilePx;
+  final double widthPx;
+  final double widthPosition;
+  final List<Point> widthEnds;
+  final int areaPx;
+  final double lengthMm;
+  final double widthMm;
+  final double obbWidthMm;
+  final double areaMm2;
+  final List<double> profileMm;
+  final double ratioPxMm;
+  final bool calibrated;
+  
+  FootMeasurementResult._fromNative(FootMeasurement m)
+      : centroid = _point(m.centroid),
+        axis = _point(m.axis),
+        angleDeg = m.angleDeg,
+        obb = List.generate(4, (i) => _point(m.obb[i])),
+        lengthPx = m.lengthPx,
+        obbWidthPx = m.obbWidthPx,
+        lengthEnds = List.generate(2, (i) => _point(m.lengthEnds[i])),
+        profilePx = List.generate(FOOT_PROFILE_BINS, (i) => m.profilePx[i]),
+        widthPx = m.widthPx,
+        widthPosition = m.widthPosition,
+        widthEnds = List.generate(2, (i) => _point(m.widthEnds[i])),
+        areaPx = m.areaPx,
+        lengthMm = m.lengthMm,
+        widthMm = m.widthMm,
+        obbWidthMm = m.obbWidthMm,
+        areaMm2 = m.areaMm2,
+        profileMm = List.generate(FOOT_PROFILE_BINS, (i) => m.profileMm[i]),
+        ratioPxMm = m.ratioPxMm,
+        calibrated = m.calibrated;
+  
+  static Point _point(Point2f p) => Point(p.x, p.y);
+  
+  @override
+  String toString() => 'FootMeasurement(length: ${lengthMm.toStringAsFixed(1)} mm, '
+      'width: ${widthMm.toStringAsFixed(1)} mm, angle: ${angleDeg.toStringAsFixed(1)})';
+}
+
 // ============================================================
 // COMPLETE PODIATRY PIPELINE
 // ============================================================
@@ -454,9 +2117,11 @@ class CalibrationResult {
 class PodiatryPipeline {
   final SamInference _sam;
   late ArucoCalibration _aruco;
+  late FootMeasure _measure;
   
   PodiatryPipeline() : _sam = SamInference() {
     _aruco = ArucoCalibration(_sam._lib);
+    _measure = FootMeasure(_sam._lib);
   }
   
   /// Initialize with ONNX model paths
@@ -482,26 +2147,28 @@ class PodiatryPipeline {
     final pointsY = [height * 0.6];
     final labels = [1];
     
-    final segResult = await _sam.segment(
+    final segResult = await _sam.segmentCompact(
       rgbBytes, width, height,
       pointsX, pointsY, labels,
     );
     
-    // 3. Find heel and toe from mask
-    final heelToe = _findHeelAndToe(segResult.mask, width, height, footSide);
-    if (heelToe == null) return null;
+    // 3. Measure along the foot's principal axis (native, on mask runs)
+    final measurement = _measure.measure(segResult.mask, calibration: calibration);
+    if (measurement == null || measurement.lengthPx <= 0) return null;
     
-    // 4. Calculate length
-    final lengthPx = _distance(heelToe.heel, heelToe.toe);
-    final lengthMm = _aruco.pxToMm(lengthPx, calibration.ratioPxMm);
-    final lengthCm = lengthMm / 10.0;
+    // 4. Heel and toe: axis ends run left to right in the image.
+    // Left foot: toe at min X, heel at max X
+    // Right foot: heel at min X, toe at max X
+    final ends = measurement.lengthEnds;
+    final isLeft = footSide.toLowerCase() == "left";
     
     return SideViewResult(
-      lengthCm: lengthCm,
-      heelPoint: heelToe.heel,
-      toePoint: heelToe.toe,
+      lengthCm: measurement.lengthMm / 10.0,
+      heelPoint: isLeft ? ends[1] : ends[0],
+      toePoint: isLeft ? ends[0] : ends[1],
       calibration: calibration,
-      mask: segResult.mask,
+      measurement: measurement,
+      compactMask: segResult.mask,
     );
   }
   
@@ -522,100 +2189,29 @@ class PodiatryPipeline {
     final pointsY = [height * 0.5];
     final labels = [1];
     
-    final segResult = await _sam.segment(
+    final segResult = await _sam.segmentCompact(
       rgbBytes, width, height,
       pointsX, pointsY, labels,
     );
     
-    // 3. Find max width from mask
-    final widthPoints = _findMaxWidth(segResult.mask, width, height);
-    if (widthPoints == null) return null;
-    
-    // 4. Calculate width
-    final widthPx = _distance(widthPoints.left, widthPoints.right);
-    final widthMm = _aruco.pxToMm(widthPx, calibration.ratioPxMm);
-    final widthCm = widthMm / 10.0;
+    // 3. Widest slice across the foot axis (native, on mask runs)
+    final measurement = _measure.measure(segResult.mask, calibration: calibration);
+    if (measurement == null || measurement.widthPx <= 0) return null;
     
     return TopViewResult(
-      widthCm: widthCm,
-      leftPoint: widthPoints.left,
-      rightPoint: widthPoints.right,
+      widthCm: measurement.widthMm / 10.0,
+      leftPoint: measurement.widthEnds[0],
+      rightPoint: measurement.widthEnds[1],
       calibration: calibration,
-      mask: segResult.mask,
-    );
-  }
-  
-  // Helper: Find heel and toe points from mask
-  _HeelToe? _findHeelAndToe(Uint8List mask, int w, int h, String footSide) {
-    int minX = w, maxX = 0;
-    int minXY = 0, maxXY = 0;
-    
-    for (int y = 0; y < h; y++) {
-      for (int x = 0; x < w; x++) {
-        if (mask[y * w + x] > 0) {
-          if (x < minX) { minX = x; minXY = y; }
-          if (x > maxX) { maxX = x; maxXY = y; }
-        }
-      }
-    }
-    
-    if (minX >= maxX) return null;
-    
-    // Left foot: toe at min X, heel at max X
-    // Right foot: heel at min X, toe at max X
-    if (footSide.toLowerCase() == "left") {
-      return _HeelToe(
-        heel: Point(maxX.toDouble(), maxXY.toDouble()),
-        toe: Point(minX.toDouble(), minXY.toDouble()),
-      );
-    } else {
-      return _HeelToe(
-        heel: Point(minX.toDouble(), minXY.toDouble()),
-        toe: Point(maxX.toDouble(), maxXY.toDouble()),
-      );
-    }
-  }
-  
-  // Helper: Find max width points from mask
-  _WidthPoints? _findMaxWidth(Uint8List mask, int w, int h) {
-    double maxWidth = 0;
-    int bestY = 0;
-    int bestLeft = 0, bestRight = 0;
-    
-    for (int y = 0; y < h; y++) {
-      int left = -1, right = -1;
-      for (int x = 0; x < w; x++) {
-        if (mask[y * w + x] > 0) {
-          if (left < 0) left = x;
-          right = x;
-        }
-      }
-      if (left >= 0 && right > left) {
-        double width = (right - left).toDouble();
-        if (width > maxWidth) {
-          maxWidth = width;
-          bestY = y;
-          bestLeft = left;
-          bestRight = right;
-        }
-      }
-    }
-    
-    if (maxWidth == 0) return null;
-    
-    return _WidthPoints(
-      left: Point(bestLeft.toDouble(), bestY.toDouble()),
-      right: Point(bestRight.toDouble(), bestY.toDouble()),
+      measurement: measurement,
+      compactMask: segResult.mask,
     );
   }
   
-  double _distance(Point p1, Point p2) {
-    final dx = p2.x - p1.x;
-    final dy = p2.y - p1.y;
-    return math.sqrt(dx * dx + dy * dy);
+  void dispose() {
+    _aruco.dispose();
+    _sam.dispose();
   }
-  
-  void dispose() => _sam.dispose();
 }
 
 // Helper classes
@@ -624,29 +2220,24 @@ class Point {
   Point(this.x, this.y);
 }
 
-class _HeelToe {
-  final Point heel, toe;
-  _HeelToe({required this.heel, required this.toe});
-}
-
-class _WidthPoints {
-  final Point left, right;
-  _WidthPoints({required this.left, required this.right});
-}
-
 class SideViewResult {
   final double lengthCm;
   final Point heelPoint;
   final Point toePoint;
   final CalibrationResult calibration;
-  final Uint8List mask;
+  final FootMeasurementResult measurement;
+  final CompactMask compactMask;
+  
+  /// Full-resolution mask, expanded on demand
+  Uint8List get mask => compactMask.toMask();
   
   SideViewResult({
     required this.lengthCm,
     required this.heelPoint,
     required this.toePoint,
     required this.calibration,
-    required this.mask,
+    required this.measurement,
+    required this.compactMask,
   });
 }
 
@@ -655,14 +2246,19 @@ class TopViewResult {
   final Point leftPoint;
   final Point rightPoint;
   final CalibrationResult calibration;
-  final Uint8List mask;
+  final FootMeasurementResult measurement;
+  final CompactMask compactMask;
+  
+  /// Full-resolution mask, expanded on demand
+  Uint8List get mask => compactMask.toMask();
   
   TopViewResult({
     required this.widthCm,
     required this.leftPoint,
     required this.rightPoint,
     required this.calibration,
-    required this.mask,
+    required this.measurement,
+    required this.compactMask,
   });
 }
 
@@ -11,338 +11,4136 @@
 #include "sam_inference.h"
 #include <onnxruntime_cxx_api.h>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// ============================================================
+// HALF PRECISION CONVERSION
+// ============================================================
+
+// IEEE binary32 -> binary16, round to nearest even
+static inline uint16_t float_to_half(float value) {
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t exp = (x >> 23) & 0xFF;
+    uint32_t mant = x & 0x7FFFFF;
+    
+    if (exp == 0xFF) {
+        return static_cast<uint16_t>(sign | 0x7C00 | (mant ? 0x200 | (mant >> 13) : 0));
+    }
+    int e = static_cast<int>(exp) - 127 + 15;
+    if (e >= 0x1F) {
+        return static_cast<uint16_t>(sign | 0x7C00);
+    }
+    if (e <= 0) {
+        // Subnormal half (or zero)
+        if (e < -10) return static_cast<uint16_t>(sign);
+        mant |= 0x800000;
+        int shift = 14 - e;
+        uint32_t half_mant = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (half_mant & 1))) half_mant++;
+        return static_cast<uint16_t>(sign | half_mant);
+    }
+    uint32_t half = sign | (static_cast<uint32_t>(e) << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1FFF;
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) half++;
+    return static_cast<uint16_t>(half);
+}
+
+static inline float half_to_float(uint16_t h) {
+    uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FF;
+    uint32_t x;
+    
+    if (exp == 0) {
+        if (mant == 0) {
+            x = sign;
+        } else {
+            // Renormalize subnormal
+            int e = -1;
+            do {
+                e++;
+                mant <<= 1;
+            } while (!(mant & 0x400));
+            x = sign | (static_cast<uint32_t>(127 - 15 - e) << 23) | ((mant & 0x3FF) << 13);
+        }
+    } else if (exp == 0x1F) {
+        x = sign | 0x7F800000 | (mant << 13) | (mant ? 0x400000 : 0);  // Quiet NaNs
+    } else {
+        x = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    float value;
+    std::memcpy(&value, &x, sizeof(value));
+    return value;
+}
+
+static void convert_f32_to_f16(const float* src, uint16_t* dst, size_t n) {
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+        float16x4_t h = vcvt_f16_f32(vld1q_f32(src + i));
+        vst1_u16(dst + i, vreinterpret_u16_f16(h));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = float_to_half(src[i]);
+    }
+}
+
+static void convert_f16_to_f32(const uint16_t* src, float* dst, size_t n) {
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4) {
+        float16x4_t h = vreinterpret_f16_u16(vld1_u16(src + i));
+        vst1q_f32(dst + i, vcvt_f32_f16(h));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = half_to_float(src[i]);
+    }
+}
+
+// ============================================================
+// INSTRUMENTATION
+// ============================================================
+
+static const char* const SAM_STAGE_NAMES[SAM_STAGE_COUNT] = {
+    "preprocess", "encode", "decode", "postprocess", "aruco", "measure", "segment"
+};
+static const int SAM_DEFAULT_TRACE_EVENTS = 1 << 20;
+
+static int64_t steady_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Histogram bucket: octave of us plus the two bits below its top bit
+static int stats_bucket(uint64_t us) {
+    if (us == 0) return 0;
+    int octave = 0;
+    while (octave < 63 && (us >> (octave + 1)) != 0) octave++;
+    int quarter = octave >= 2 ? static_cast<int>((us >> (octave - 2)) & 3)
+                              : static_cast<int>((us << (2 - octave)) & 3);
+    return std::min(octave * 4 + quarter, SAM_STATS_BUCKETS - 1);
+}
+
+static double stats_bucket_start_us(int bucket) {
+    return std::ldexp(1.0, bucket / 4) * (4 + bucket % 4) / 4.0;
+}
+
+struct SamStageCounters {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> total_us{0};
+    std::atomic<uint64_t> min_us{UINT64_MAX};
+    std::atomic<uint64_t> max_us{0};
+    std::atomic<uint32_t> histogram[SAM_STATS_BUCKETS] = {};
+};
+
+struct SamTraceEvent {
+    int stage;
+    uint32_t tid;
+    int64_t start_us;
+    int64_t duration_us;
+};
+
+// Events of the active trace; timestamps are steady_now_us values,
+// system_origin_us lines them up with ORT's wall-clock profiler
+struct SamTraceBuffer {
+    std::mutex mutex;
+    std::vector<SamTraceEvent> events;
+    size_t capacity = 0;
+    uint64_t dropped = 0;
+    int64_t steady_origin_us = 0;
+    int64_t system_origin_us = 0;
+};
+
+static SamStageCounters g_stage_counters[SAM_STAGE_COUNT];
+static SamTraceBuffer g_trace;
+static std::atomic<bool> g_tracing{false};
+
+// Small per-thread ids for trace rows
+static uint32_t trace_thread_id() {
+    static std::atomic<uint32_t> next_id{1};
+    thread_local uint32_t id = next_id.fetch_add(1);
+    return id;
+}
+
+static void stats_record(int stage, int64_t start_us, int64_t duration_us) {
+    if (stage < 0 || stage >= SAM_STAGE_COUNT) return;
+    uint64_t us = duration_us > 0 ? static_cast<uint64_t>(duration_us) : 0;
+    SamStageCounters& counters = g_stage_counters[stage];
+    counters.count.fetch_add(1, std::memory_order_relaxed);
+    counters.total_us.fetch_add(us, std::memory_order_relaxed);
+    counters.histogram[stats_bucket(us)].fetch_add(1, std::memory_order_relaxed);
+    uint64_t seen = counters.min_us.load(std::memory_order_relaxed);
+    while (us < seen && !counters.min_us.compare_exchange_weak(seen, us, std::memory_order_relaxed)) {}
+    seen = counters.max_us.load(std::memory_order_relaxed);
+    while (us > seen && !counters.max_us.compare_exchange_weak(seen, us, std::memory_order_relaxed)) {}
+    
+    if (g_tracing.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(g_trace.mutex);
+        if (!g_tracing.load(std::memory_order_relaxed)) return;
+        if (g_trace.events.size() < g_trace.capacity) {
+            g_trace.events.push_back({stage, trace_thread_id(), start_us, static_cast<int64_t>(us)});
+        } else {
+            g_trace.dropped++;
+        }
+    }
+}
+
+// Times its scope as one call of a stage
+class SamStageTimer {
+public:
+    explicit SamStageTimer(int stage) : stage_(stage), start_us_(steady_now_us()) {}
+    ~SamStageTimer() { stats_record(stage_, start_us_, steady_now_us() - start_us_); }
+    
+    SamStageTimer(const SamStageTimer&) = delete;
+    SamStageTimer& operator=(const SamStageTimer&) = delete;
+    
+private:
+    int stage_;
+    int64_t start_us_;
+};
+
+// ============================================================
+// INTERNAL STRUCTURES
+// ============================================================
+
+static const size_t SAM_EMBEDDING_FLOATS = SAM_EMBEDDING_DIM * SAM_EMBEDDING_SIZE * SAM_EMBEDDING_SIZE;
+static const int SAM_DEFAULT_INTRA_OP_THREADS = 4;
+static const int SAM_MIN_ROWS_PER_BAND = 16;
+static const int SAM_MAX_POINTS = 64;  // Prompt size the arena is sized for
+
+// Fixed worker pool for pre/postprocessing row bands. The calling
+// thread runs band 0; parallel_for returns once every band is done.
+class SamThreadPool {
+public:
+    using BandFn = std::function<void(int band, int begin, int end)>;
+    
+    explicit SamThreadPool(int num_threads) { start(num_threads); }
+    ~SamThreadPool() { stop(); }
+    
+    int size() const { return static_cast<int>(workers_.size()) + 1; }
+    
+    void resize(int num_threads) {
+        stop();
+        start(num_threads);
+    }
+    
+    // Number of bands parallel_for will use for a range of n rows
+    int bands_for(int n) const {
+        return std::max(1, std::min(size(), n / SAM_MIN_ROWS_PER_BAND));
+    }
+    
+    void parallel_for(int begin, int end, const BandFn& fn) {
+        int bands = bands_for(end - begin);
+        if (bands == 1) {
+            fn(0, begin, end);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job_ = &fn;
+            begin_ = begin;
+            end_ = end;
+            bands_ = bands;
+            pending_ = static_cast<int>(workers_.size());
+            generation_++;
+        }
+        wake_.notify_all();
+        run_band(fn, 0);
+        
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return pending_ == 0; });
+        job_ = nullptr;
+    }
+    
+private:
+    void run_band(const BandFn& fn, int band) {
+        int len = end_ - begin_;
+        int band_begin = begin_ + static_cast<int>(static_cast<int64_t>(len) * band / bands_);
+        int band_end = begin_ + static_cast<int>(static_cast<int64_t>(len) * (band + 1) / bands_);
+        fn(band, band_begin, band_end);
+    }
+    
+    // seen: generation_ when the worker started, so a worker added by
+    // resize() waits for the next job instead of counting the last one
+    void worker_loop(int band, uint64_t seen) {
+        for (;;) {
+            const BandFn* fn;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+                if (stopping_) return;
+                seen = generation_;
+                fn = band < bands_ ? job_ : nullptr;
+            }
+            if (fn) run_band(*fn, band);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--pending_ == 0) done_.notify_one();
+            }
+        }
+    }
+    
+    void start(int num_threads) {
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = false;
+            generation = generation_;
+        }
+        for (int i = 1; i < std::max(1, num_threads); i++) {
+            workers_.emplace_back(&SamThreadPool::worker_loop, this, i, generation);
+        }
+    }
+    
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto& worker : workers_) worker.join();
+        workers_.clear();
+    }
+    
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const BandFn* job_ = nullptr;
+    int begin_ = 0;
+    int end_ = 0;
+    int bands_ = 1;
+    int pending_ = 0;
+    uint64_t generation_ = 0;
+    bool stopping_ = false;
+};
+
+static size_t embedding_bytes(int dtype) {
+    return SAM_EMBEDDING_FLOATS * (dtype == SAM_DTYPE_FLOAT16 ? sizeof(uint16_t) : sizeof(float));
+}
+
+static const std::array<int64_t, 4> SAM_EMBEDDING_SHAPE = {1, SAM_EMBEDDING_DIM, SAM_EMBEDDING_SIZE, SAM_EMBEDDING_SIZE};
+
+struct SamCacheEntry {
+    uint64_t key;
+    int width;
+    int height;
+    float scale_x;
+    float scale_y;
+    std::vector<float> embedding;         // [1, 256, 64, 64], FLOAT32 cache
+    std::vector<uint16_t> half_embedding; // [1, 256, 64, 64], FLOAT16 cache
+    
+    SamEmbedding view(int dtype) {
+        bool half = dtype == SAM_DTYPE_FLOAT16;
+        return {half ? nullptr : embedding.data(), 1, SAM_EMBEDDING_DIM, SAM_EMBEDDING_SIZE, SAM_EMBEDDING_SIZE,
+                dtype, half ? half_embedding.data() : nullptr};
+    }
+};
+
+// 64-byte aligned bump allocator for per-call buffers. Sized once at
+// sam_init; requests that do not fit fall back to the heap and the
+// arena grows to the high-water mark on the next reset, so steady-state
+// calls never allocate.
+class SamScratchArena {
+public:
+    static const size_t ALIGNMENT = 64;
+    
+    struct Mark {
+        size_t offset;
+        size_t used;
+        size_t overflow_blocks;
+    };
+    
+    explicit SamScratchArena(size_t capacity) { reserve(capacity); }
+    ~SamScratchArena() {
+        release_overflow();
+        std::free(raw_);
+    }
+    SamScratchArena(const SamScratchArena&) = delete;
+    SamScratchArena& operator=(const SamScratchArena&) = delete;
+    
+    static size_t aligned(size_t bytes) { return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1); }
+    
+    template <typename T>
+    T* alloc(size_t count) {
+        size_t bytes = aligned(count * sizeof(T));
+        used_ += bytes;
+        high_water_ = std::max(high_water_, used_);
+        if (offset_ + bytes <= capacity_) {
+            T* p = reinterpret_cast<T*>(base_ + offset_);
+            offset_ += bytes;
+            return p;
+        }
+        void* raw = std::malloc(bytes + ALIGNMENT);
+        if (!raw) throw std::bad_alloc();
+        overflow_.push_back(raw);
+        overflow_count_++;
+        return reinterpret_cast<T*>(align_ptr(raw));
+    }
+    
+    Mark mark() const { return {offset_, used_, overflow_.size()}; }
+    
+    // Release everything allocated since m
+    void rewind(Mark m) {
+        while (overflow_.size() > m.overflow_blocks) {
+            std::free(overflow_.back());
+            overflow_.pop_back();
+        }
+        offset_ = m.offset;
+        used_ = m.used;
+    }
+    
+    void reset() {
+        release_overflow();
+        offset_ = 0;
+        used_ = 0;
+        if (high_water_ > capacity_) reserve(high_water_);
+    }
+    
+    size_t capacity() const { return capacity_; }
+    size_t high_water() const { return high_water_; }
+    uint64_t overflow_count() const { return overflow_count_; }
+    
+private:
+    static uint8_t* align_ptr(void* p) {
+        auto addr = reinterpret_cast<uintptr_t>(p);
+        return reinterpret_cast<uint8_t*>((addr + ALIGNMENT - 1) & ~static_cast<uintptr_t>(ALIGNMENT - 1));
+    }
+    
+    void reserve(size_t capacity) {
+        std::free(raw_);
+        raw_ = std::malloc(capacity + ALIGNMENT);
+        if (!raw_) throw std::bad_alloc();
+        base_ = align_ptr(raw_);
+        capacity_ = capacity;
+    }
+    
+    void release_overflow() {
+        for (void* p : overflow_) std::free(p);
+        overflow_.clear();
+    }
+    
+    void* raw_ = nullptr;
+    uint8_t* base_ = nullptr;
+    size_t capacity_ = 0;
+    size_t offset_ = 0;
+    size_t used_ = 0;
+    size_t high_water_ = 0;
+    uint64_t overflow_count_ = 0;
+    std::vector<void*> overflow_;
+};
+
+// Tap rows are padded by a cache line so the 12 rows read together do
+// not alias the same cache sets when the width is a power of two
+static int tap_row_stride(int new_width) {
+    return ((new_width + 15) & ~15) + 16;
+}
+
+// Arena bytes preprocess_image needs for its taps and per-band rows
+static size_t preprocess_scratch_bytes(int new_width, int new_height, int bands) {
+    return 3 * SamScratchArena::aligned(new_width * sizeof(float)) +
+           3 * SamScratchArena::aligned(new_height * sizeof(float)) +
+           SamScratchArena::aligned(12 * tap_row_stride(new_width) * bands * sizeof(float));
+}
+
+// Arena bytes for one sam_segment call (preprocessed image, embedding,
+// masks, scores, prompt and preprocess scratch)
+static size_t segment_scratch_bytes(int bands) {
+    return SamScratchArena::aligned(3 * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE * sizeof(float)) +
+           SamScratchArena::aligned(SAM_EMBEDDING_FLOATS * sizeof(float)) +
+           SamScratchArena::aligned(SAM_NUM_MASKS * SAM_MASK_SIZE * SAM_MASK_SIZE * sizeof(float)) +
+           SamScratchArena::aligned(SAM_NUM_MASKS * sizeof(float)) +
+           SamScratchArena::aligned(SAM_MAX_POINTS * 2 * sizeof(float)) +
+           preprocess_scratch_bytes(SAM_IMAGE_SIZE, SAM_IMAGE_SIZE, bands);
+}
+
+// LRU cache of image embeddings (front = most recently used)
+struct SamEmbeddingCache {
+    std::list<SamCacheEntry> entries;
+    std::unordered_map<uint64_t, std::list<SamCacheEntry>::iterator> index;
+    uint64_t byte_budget = SAM_DEFAULT_CACHE_BUDGET;
+    uint64_t bytes_used = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    int dtype = SAM_DTYPE_FLOAT32;
+    
+    uint64_t entry_bytes() const { return embedding_bytes(dtype); }
+    
+    bool admits() const { return byte_budget >= entry_bytes(); }
+    
+    SamCacheEntry* find(uint64_t key, int width, int height) {
+        auto it = index.find(key);
+        if (it == index.end() || it->second->width != width || it->second->height != height) {
+            misses++;
+            return nullptr;
+        }
+        entries.splice(entries.begin(), entries, it->second);
+        hits++;
+        return &entries.front();
+    }
+    
+    void evict_to(uint64_t budget) {
+        while (!entries.empty() && bytes_used > budget) {
+            index.erase(entries.back().key);
+            entries.pop_back();
+            bytes_used -= entry_bytes();
+            evictions++;
+        }
+    }
+    
+    // Slot to encode a new image into. When the cache is full the least
+    // recently used entry (list node, index node and buffer) is recycled,
+    // so a warm cache never allocates.
+    SamCacheEntry* prepare(uint64_t key, int width, int height) {
+        // Recycled slots already hold storage of the current dtype
+        auto it = index.find(key);
+        if (it != index.end()) {
+            entries.splice(entries.begin(), entries, it->second);
+        } else if (!entries.empty() && bytes_used + entry_bytes() > byte_budget) {
+            entries.splice(entries.begin(), entries, std::prev(entries.end()));
+            auto node = index.extract(entries.front().key);
+            node.key() = key;
+            index.insert(std::move(node));
+            evictions++;
+        } else {
+            entries.emplace_front();
+            if (dtype == SAM_DTYPE_FLOAT16) {
+                entries.front().half_embedding.resize(SAM_EMBEDDING_FLOATS);
+            } else {
+                entries.front().embedding.resize(SAM_EMBEDDING_FLOATS);
+            }
+            index[key] = entries.begin();
+            bytes_used += entry_bytes();
+        }
+        SamCacheEntry& entry = entries.front();
+        entry.key = key;
+        entry.width = width;
+        entry.height = height;
+        return &entry;
+    }
+    
+    // Drop a slot whose encode failed
+    void discard(SamCacheEntry* entry) {
+        index.erase(entry->key);
+        entries.pop_front();
+        bytes_used -= entry_bytes();
+    }
+    
+    void clear() {
+        entries.clear();
+        index.clear();
+        bytes_used = 0;
+    }
+};
+
+enum SamBatchSupport {
+    SAM_BATCH_UNKNOWN,
+    SAM_BATCH_SUPPORTED,
+    SAM_BATCH_UNSUPPORTED
+};
+
+enum SamJobKind {
+    SAM_JOB_ENCODE,
+    SAM_JOB_DECODE
+};
+
+struct SamJob {
+    int64_t id;
+    SamJobKind kind;
+    int status = SAM_JOB_PENDING;  // Guarded by SamJobQueue::mutex
+    bool cancel_requested = false;
+    Ort::RunOptions run_options;
+    SamJobCallback callback;
+    void* user_data;
+    
+    // Encode: caller buffers
+    const float* image = nullptr;
+    SamEmbedding* embedding = nullptr;
+    
+    // Decode: prompt is copied, embedding/result are caller buffers
+    const SamEmbedding* source = nullptr;
+    std::vector<float> coords;
+    std::vector<int> labels;
+    SamMaskResult* result = nullptr;
+};
+
+// Background worker running encode/decode jobs in submission order.
+// The thread starts with the first async call.
+struct SamJobQueue {
+    std::mutex mutex;
+    std::condition_variable work;
+    std::condition_variable done;
+    std::deque<std::shared_ptr<SamJob>> pending;
+    std::unordered_map<int64_t, std::shared_ptr<SamJob>> jobs;
+    std::shared_ptr<SamJob> running;
+    std::thread worker;
+    int64_t next_id = 1;
+    bool stopping = false;
+};
+
+// Decoder I/O stays bound across calls; each slot is rebound only when
+// the caller hands over a different buffer
+struct SamDecoderBinding {
+    std::unique_ptr<Ort::IoBinding> binding;
+    const void* embedding = nullptr;      // data or half_data last bound
+    uint64_t embedding_content = 0;       // Its fingerprint, when bound as a converted copy
+    const float* coords = nullptr;
+    const int64_t* labels = nullptr;
+    int num_points = 0;
+    float* masks = nullptr;
+    float* iou_scores = nullptr;
+    bool ort_outputs = false;  // Outputs bound to ORT-allocated memory
+    std::vector<int64_t> labels_i64;
+    
+    // Embedding converted to the decoder's input dtype when they differ
+    std::vector<float> widened;
+    std::vector<uint16_t> narrowed;
+    
+    // mask_input / has_mask_input, bound once; Run reads them in place
+    std::vector<float> mask_input;
+    float has_mask_input = 0.0f;
+    bool mask_input_bound = false;
+};
+
+// Best low-res mask of the last decode on one embedding, with the
+// points that produced it
+struct SamMaskFeedback {
+    uint64_t key = 0;
+    std::vector<float> coords;
+    std::vector<int> labels;
+    std::vector<float> logits;
+};
+
+// Embeddings whose previous mask is kept for refinement
+static const size_t SAM_MASK_FEEDBACK_ENTRIES = 4;
+
+// Read-only memory mapping of a model file
+class SamMappedFile {
+public:
+    static std::shared_ptr<SamMappedFile> open(const std::string& path) {
+        std::shared_ptr<SamMappedFile> file(new SamMappedFile());
+#ifdef _WIN32
+        file->handle_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                    FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file->handle_ == INVALID_HANDLE_VALUE) return nullptr;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file->handle_, &size) || size.QuadPart == 0) return nullptr;
+        file->size_ = static_cast<size_t>(size.QuadPart);
+        file->mapping_ = CreateFileMappingA(file->handle_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!file->mapping_) return nullptr;
+        file->data_ = MapViewOfFile(file->mapping_, FILE_MAP_READ, 0, 0, 0);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            file->size_ = static_cast<size_t>(info.st_size);
+            void* data = mmap(nullptr, file->size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            file->data_ = data == MAP_FAILED ? nullptr : data;
+        }
+        close(fd);
+#endif
+        return file->data_ ? file : nullptr;
+    }
+    
+    ~SamMappedFile() {
+#ifdef _WIN32
+        if (data_) UnmapViewOfFile(data_);
+        if (mapping_) CloseHandle(mapping_);
+        if (handle_ != INVALID_HANDLE_VALUE) CloseHandle(handle_);
+#else
+        if (data_) munmap(data_, size_);
+#endif
+    }
+    
+    SamMappedFile(const SamMappedFile&) = delete;
+    SamMappedFile& operator=(const SamMappedFile&) = delete;
+    
+    const void* data() const { return data_; }
+    size_t size() const { return size_; }
+    
+private:
+    SamMappedFile() = default;
+    
+    void* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    HANDLE handle_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#endif
+};
+
+// Session created by load_session, with how it was obtained
+struct SamLoadedModel {
+    std::unique_ptr<Ort::Session> session;
+    std::shared_ptr<SamMappedFile> mapping;  // Backs ORT-format sessions, keep alive with them
+    bool from_cache = false;
+    float map_ms = 0.0f;
+    float session_ms = 0.0f;
+};
+
+// Encoder session plus what run_encoder needs to know about its output
+struct SamEncoderModel {
+    Ort::Session* session = nullptr;
+    std::shared_ptr<SamMappedFile> mapping;
+    std::vector<int64_t> embedding_shape;  // Empty when dynamic
+    ONNXTensorElementDataType output_type = ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT;
+    int max_batch = SAM_MAX_ENCODE_BATCH;  // 1 when exported with a static batch
+};
+
+// One encoder listed in a model manifest (or the single sam_init encoder)
+struct SamEncoderVariant {
+    std::string name;
+    std::string path;
+    uint64_t file_bytes = 0;
+    bool quantized = false;
+    float latency_ms = 0.0f;  // Median from the last sam_select_encoder
+    float min_iou = -1.0f;    // Worst reference IoU from the last sam_select_encoder
+    uint64_t model_hash = 0;  // Content hash of the file, computed on first use
+};
+
+struct SamContextInternal {
+    Ort::Env env;
+    SamEncoderModel encoder;
+    Ort::Session* decoder_session = nullptr;
+    std::shared_ptr<SamMappedFile> decoder_mapping;
+    Ort::AllocatorWithDefaultOptions allocator;
+    Ort::SessionOptions session_options;
+    SamEmbeddingCache cache;
+    std::atomic<int> decoder_batch{SAM_BATCH_UNKNOWN};  // SamBatchSupport, probed outside decoder_mutex
+    SamThreadPool pool;
+    SamScratchArena arena;
+    SamDecoderBinding decoder_io;
+    std::mutex decoder_mutex;
+    SamJobQueue jobs;
+    
+    // Encoder variants; encodes hold encoder_mutex shared, switching the
+    // active variant holds it exclusively
+    std::vector<SamEncoderVariant> encoder_variants;
+    int active_encoder = 0;
+    std::shared_mutex encoder_mutex;
+    std::mutex model_hash_mutex;  // Guards SamEncoderVariant::model_hash
+    
+    // Effective configuration (strings owned below, config points at them)
+    SamConfig config = {};
+    std::string intra_op_affinity;
+    std::string profile_prefix;
+    bool profiling_merged = false;  // ORT profiling already ended by sam_trace_stop
+    
+    // Contexts of a SamModel: all but the first borrow sessions_owner's
+    // sessions and leave them to it on unload
+    SamModel* model = nullptr;
+    SamContextInternal* sessions_owner = nullptr;
+    
+    // Startup: optimized-graph cache directory (empty = off), mapping
+    std::string model_cache_dir;
+    bool memory_map = true;
+    SamStartupStats startup_stats = {};
+    
+    // Static output shapes bound straight to caller buffers (empty when
+    // the model declares dynamic dims; ORT then allocates and we copy)
+    std::vector<int64_t> masks_shape;
+    std::vector<int64_t> iou_shape;
+    
+    // Element type the decoder declares for the embedding tensor
+    ONNXTensorElementDataType decoder_embedding_type = ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT;
+    
+    // Refinement: the decoder takes mask_input, and the previous masks
+    // per embedding (front = most recent, guarded by decoder_mutex)
+    bool decoder_mask_input = false;
+    std::list<SamMaskFeedback> mask_feedback;
+    
+    // sam_encode_images: memory budget per run, and the largest batch
+    // the active encoder has not failed at (starts at its max_batch)
+    std::atomic<uint64_t> encode_budget{SAM_DEFAULT_ENCODE_BUDGET};
+    std::atomic<uint64_t> encode_image_bytes{SAM_ENCODE_IMAGE_BYTES};
+    std::atomic<int> encode_batch_limit{SAM_MAX_ENCODE_BATCH};
+    
+    // Pre/postprocessing run while ORT's intra-op threads are idle, so
+    // the pool is sized to the same thread budget
+    SamContextInternal()
+        : env(ORT_LOGGING_LEVEL_WARNING, "SAM"),
+          pool(SAM_DEFAULT_INTRA_OP_THREADS),
+          arena(segment_scratch_bytes(SAM_DEFAULT_INTRA_OP_THREADS)) {
+        decoder_io.labels_i64.reserve(SAM_MAX_POINTS);
+    }
+};
+
+// ============================================================
+// HELPER FUNCTIONS
+// ============================================================
+
+// Leading (batch) dimension of a named session input, 0 if not found
+static int64_t input_batch_dim(Ort::Session* session, Ort::AllocatorWithDefaultOptions& allocator,
+                               const char* name) {
+    for (size_t i = 0; i < session->GetInputCount(); i++) {
+        auto input_name = session->GetInputNameAllocated(i, allocator);
+        if (std::strcmp(input_name.get(), name) != 0) continue;
+        auto shape = session->GetInputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+        return shape.empty() ? 0 : shape[0];
+    }
+    return 0;
+}
+
+// Whether a session declares a named input
+static bool has_session_input(Ort::Session* session, Ort::AllocatorWithDefaultOptions& allocator, const char* name) {
+    for (size_t i = 0; i < session->GetInputCount(); i++) {
+        if (std::strcmp(session->GetInputNameAllocated(i, allocator).get(), name) == 0) return true;
+    }
+    return false;
+}
+
+// Element type of a named session input or output (FLOAT if not found)
+static ONNXTensorElementDataType tensor_element_type(Ort::Session* session, Ort::AllocatorWithDefaultOptions& allocator,
+                                                     const char* name, bool input) {
+    size_t count = input ? session->GetInputCount() : session->GetOutputCount();
+    for (size_t i = 0; i < count; i++) {
+        auto tensor_name = input ? session->GetInputNameAllocated(i, allocator)
+                                 : session->GetOutputNameAllocated(i, allocator);
+        if (std::strcmp(tensor_name.get(), name) != 0) continue;
+        Ort::TypeInfo info = input ? session->GetInputTypeInfo(i) : session->GetOutputTypeInfo(i);
+        return info.GetTensorTypeAndShapeInfo().GetElementType();
+    }
+    return ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT;
+}
+
+// Declared shape of a named session output, empty unless every dim is
+// static and the element count matches
+static std::vector<int64_t> static_output_shape(Ort::Session* session, Ort::AllocatorWithDefaultOptions& allocator,
+                                                const char* name, size_t expected_elements) {
+    for (size_t i = 0; i < session->GetOutputCount(); i++) {
+        auto output_name = session->GetOutputNameAllocated(i, allocator);
+        if (std::strcmp(output_name.get(), name) != 0) continue;
+        auto shape = session->GetOutputTypeInfo(i).GetTensorTypeAndShapeInfo().GetShape();
+        size_t count = 1;
+        for (int64_t dim : shape) {
+            if (dim <= 0) return {};
+            count *= static_cast<size_t>(dim);
+        }
+        if (count != expected_elements) return {};
+        return shape;
+    }
+    return {};
+}
+
+static void stop_job_worker(SamContextInternal* internal);
+static uint64_t hash_bytes(const uint8_t* data, size_t len, uint64_t seed);
+
+// ============================================================
+// INITIALIZATION
+// ============================================================
+
+static float elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Optimized-graph cache file for a model. The name hashes the source
+// path, size and mtime, the ORT version and the execution provider
+// (which decides how the graph is partitioned), so a model update or an
+// ORT upgrade misses instead of loading a stale graph.
+static std::string optimized_cache_path(const std::string& cache_dir, const std::string& model_path,
+                                        const char* provider) {
+    struct stat info;
+    if (stat(model_path.c_str(), &info) != 0) return {};
+    
+    std::string key = model_path + '|' + std::to_string(static_cast<long long>(info.st_size)) + '|' +
+                      std::to_string(static_cast<long long>(info.st_mtime)) + '|' + Ort::GetVersionString() +
+                      '|' + provider;
+    uint64_t hash = 14695981039346656037ULL;  // FNV-1a
+    for (unsigned char c : key) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    
+    char name[32];
+    std::snprintf(name, sizeof(name), "sam_%016llx.ort", static_cast<unsigned long long>(hash));
+    bool has_separator = cache_dir.back() == '/' || cache_dir.back() == '\\';
+    return cache_dir + (has_separator ? "" : "/") + name;
+}
+
+// Create a session for a model. With a cache directory the optimized
+// graph is saved in ORT format on first load and reused afterwards
+// (no protobuf parsing, no optimization passes); with memory mapping
+// ORT reads the cached graph and its initializers in place.
+static SamLoadedModel load_session(SamContextInternal* internal, const std::string& path) {
+    SamLoadedModel loaded;
+    std::string cached = internal->model_cache_dir.empty()
+        ? std::string()
+        : optimized_cache_path(internal->model_cache_dir, path,
+                               internal->config.execution_provider == SAM_PROVIDER_XNNPACK ? "xnnpack" : "cpu");
+    
+    if (!cached.empty()) {
+        auto start = std::chrono::steady_clock::now();
+        std::shared_ptr<SamMappedFile> mapping = internal->memory_map ? SamMappedFile::open(cached) : nullptr;
+        loaded.map_ms = elapsed_ms(start);
+        
+        struct stat info;
+        if (mapping || (!internal->memory_map && stat(cached.c_str(), &info) == 0)) {
+            start = std::chrono::steady_clock::now();
+            try {
+                Ort::SessionOptions options = internal->session_options.Clone();
+                options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_DISABLE_ALL);
+                options.AddConfigEntry("session.load_model_format", "ORT");
+                if (mapping) {
+                    options.AddConfigEntry("session.use_ort_model_bytes_directly", "1");
+                    options.AddConfigEntry("session.use_ort_model_bytes_for_initializers", "1");
+                    loaded.session.reset(new Ort::Session(internal->env, mapping->data(), mapping->size(), options));
+                    loaded.mapping = mapping;
+                } else {
+                    loaded.session.reset(new Ort::Session(internal->env, cached.c_str(), options));
+                }
+                loaded.session_ms = elapsed_ms(start);
+                loaded.from_cache = true;
+                return loaded;
+            } catch (...) {
+                // Truncated or incompatible cache file: rebuild it below
+                mapping.reset();
+                std::remove(cached.c_str());
+            }
+        }
+    }
+    
+    std::string pending = cached.empty() ? std::string() : cached + ".tmp";
+    
+    // ONNX protobufs are copied while parsing, so the mapping only lives
+    // through session creation. Models with external data need the
+    // file path to resolve it; those fall back to loading by path.
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<SamMappedFile> mapping = internal->memory_map ? SamMappedFile::open(path) : nullptr;
+    loaded.map_ms += elapsed_ms(start);
+    
+    auto create = [&](bool save) {
+        Ort::SessionOptions options = internal->session_options.Clone();
+        if (save) {
+            options.SetOptimizedModelFilePath(pending.c_str());
+            options.AddConfigEntry("session.save_model_format", "ORT");
+        }
+        if (mapping) {
+            try {
+                return new Ort::Session(internal->env, mapping->data(), mapping->size(), options);
+            } catch (...) {
+            }
+        }
+        return new Ort::Session(internal->env, path.c_str(), options);
+    };
+    
+    start = std::chrono::steady_clock::now();
+    try {
+        loaded.session.reset(create(!pending.empty()));
+    } catch (...) {
+        // Some partitions (e.g. compiled EP nodes) cannot be serialized;
+        // run uncached rather than fail
+        if (pending.empty()) throw;
+        std::remove(pending.c_str());
+        pending.clear();
+        loaded.session.reset(create(false));
+    }
+    loaded.session_ms = elapsed_ms(start);
+    
+    // Publish the cache only once complete
+    if (!pending.empty() && std::rename(pending.c_str(), cached.c_str()) != 0) {
+        std::remove(pending.c_str());
+    }
+    return loaded;
+}
+
+// Output shape and element type of a loaded encoder
+static SamEncoderModel encoder_model(SamContextInternal* internal, Ort::Session* session) {
+    SamEncoderModel model;
+    model.session = session;
+    model.embedding_shape = static_output_shape(
+        session, internal->allocator, "image_embeddings", SAM_EMBEDDING_FLOATS);
+    model.output_type = tensor_element_type(session, internal->allocator, "image_embeddings", false);
+    if (input_batch_dim(session, internal->allocator, "image") == 1) model.max_batch = 1;
+    return model;
+}
+
+static SamEncoderModel load_encoder(SamContextInternal* internal, const std::string& path,
+                                    SamLoadedModel* loaded_out = nullptr) {
+    SamLoadedModel loaded = load_session(internal, path);
+    SamEncoderModel model = encoder_model(internal, loaded.session.get());
+    model.mapping = loaded.mapping;
+    loaded.session.release();
+    if (loaded_out) *loaded_out = std::move(loaded);
+    return model;
+}
+
+// File size and quantization of an encoder. Quantized graphs carry QDQ
+// or integer op types in their node list, which protobuf serializes
+// ahead of the weights, so only the head of the file is scanned.
+static SamEncoderVariant describe_encoder(const std::string& name, const std::string& path) {
+    static const char* const quantized_ops[] = {"QuantizeLinear", "MatMulInteger", "ConvInteger", "QLinear"};
+    
+    SamEncoderVariant variant;
+    variant.name = name;
+    variant.path = path;
+    
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) return variant;
+    variant.file_bytes = static_cast<uint64_t>(file.tellg());
+    
+    std::vector<char> head(static_cast<size_t>(std::min<uint64_t>(variant.file_bytes, 8u << 20)));
+    file.seekg(0);
+    file.read(head.data(), static_cast<std::streamsize>(head.size()));
+    for (const char* op : quantized_ops) {
+        if (std::search(head.begin(), head.end(), op, op + std::strlen(op)) != head.end()) {
+            variant.quantized = true;
+            break;
+        }
+    }
+    return variant;
+}
+
+// Manifest lines are "encoder <name> <path>" and "decoder <path>"; the
+// first encoder is the accuracy reference (normally fp32). Relative
+// paths resolve against the manifest's directory, '#' starts a comment.
+static bool parse_manifest(const char* manifest_path, std::vector<SamEncoderVariant>& encoders,
+                           std::string& decoder_path) {
+    std::ifstream file(manifest_path);
+    if (!file) return false;
+    
+    std::string base(manifest_path);
+    size_t slash = base.find_last_of("/\\");
+    base = slash == std::string::npos ? std::string() : base.substr(0, slash + 1);
+    auto resolve = [&base](const std::string& path) {
+        bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\' || (path.size() > 1 && path[1] == ':'));
+        return absolute ? path : base + path;
+    };
+    
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        std::string kind, name, path;
+        if (!(fields >> kind)) continue;
+        
+        if (kind == "encoder" && fields >> name >> path) {
+            encoders.push_back(describe_encoder(name, resolve(path)));
+        } else if (kind == "decoder" && fields >> path) {
+            decoder_path = resolve(path);
+        } else {
+            return false;
+        }
+    }
+    return !encoders.empty() && !decoder_path.empty();
+}
+
+static bool run_encoder(SamContext* ctx, const float* preprocessed_image, SamEmbedding* embedding,
+                        const Ort::RunOptions& run_options);
+static bool run_decoder(SamContext* ctx, const SamEmbedding* embedding, const SamPointPrompt* prompt,
+                        SamMaskResult* result, const Ort::RunOptions& run_options, bool use_feedback);
+
+// One encoder and decoder pass on dummy inputs, so ORT's arenas and
+// kernel caches are sized before the first real image
+static void warm_up(SamContext* ctx, SamStartupStats& stats) {
+    std::vector<float> image(3 * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE, 0.0f);
+    std::vector<float> embedding_data(SAM_EMBEDDING_FLOATS);
+    std::vector<float> masks(SAM_NUM_MASKS * SAM_MASK_SIZE * SAM_MASK_SIZE);
+    float iou_scores[SAM_NUM_MASKS];
+    float coords[2] = {SAM_IMAGE_SIZE / 2.0f, SAM_IMAGE_SIZE / 2.0f};
+    int label = 1;
+    
+    SamEmbedding embedding = {embedding_data.data(), 1, SAM_EMBEDDING_DIM, SAM_EMBEDDING_SIZE, SAM_EMBEDDING_SIZE,
+                              SAM_DTYPE_FLOAT32, nullptr};
+    SamPointPrompt prompt = {coords, &label, 1};
+    SamMaskResult result = {masks.data(), iou_scores, 0};
+    
+    auto start = std::chrono::steady_clock::now();
+    run_encoder(ctx, image.data(), &embedding, Ort::RunOptions{nullptr});
+    stats.warm_up_encoder_ms = elapsed_ms(start);
+    
+    start = std::chrono::steady_clock::now();
+    run_decoder(ctx, &embedding, &prompt, &result, Ort::RunOptions{nullptr}, false);
+    stats.warm_up_decoder_ms = elapsed_ms(start);
+}
+
+// Build session options from internal->config, normalizing it to what
+// is actually applied
+static void apply_config(SamContextInternal* internal) {
+    SamConfig& config = internal->config;
+    if (config.intra_op_threads <= 0) config.intra_op_threads = SAM_DEFAULT_INTRA_OP_THREADS;
+    if (config.inter_op_threads <= 0) config.inter_op_threads = 1;
+    
+    if (config.execution_provider == SAM_PROVIDER_XNNPACK) {
+        auto providers = Ort::GetAvailableProviders();
+        if (std::find(providers.begin(), providers.end(), "XnnpackExecutionProvider") == providers.end()) {
+            config.execution_provider = SAM_PROVIDER_CPU;
+        }
+    } else {
+        config.execution_provider = SAM_PROVIDER_CPU;
+    }
+    
+    Ort::SessionOptions options;
+    options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
+    
+    if (config.execution_provider == SAM_PROVIDER_XNNPACK) {
+        // XNNPACK parallelizes inside its own pool; ORT's pool only runs
+        // the nodes XNNPACK does not take, and spinning would compete
+        options.AppendExecutionProvider("XNNPACK",
+            {{"intra_op_num_threads", std::to_string(config.intra_op_threads)}});
+        options.SetIntraOpNumThreads(1);
+        config.spin_wait = SAM_SPIN_DISABLED;
+        internal->intra_op_affinity.clear();
+    } else {
+        options.SetIntraOpNumThreads(config.intra_op_threads);
+    }
+    
+    if (config.inter_op_threads > 1) {
+        options.SetExecutionMode(ExecutionMode::ORT_PARALLEL);
+        options.SetInterOpNumThreads(config.inter_op_threads);
+    }
+    if (config.spin_wait == SAM_SPIN_ENABLED || config.spin_wait == SAM_SPIN_DISABLED) {
+        const char* spin = config.spin_wait == SAM_SPIN_ENABLED ? "1" : "0";
+        options.AddConfigEntry("session.intra_op.allow_spinning", spin);
+        options.AddConfigEntry("session.inter_op.allow_spinning", spin);
+    } else {
+        config.spin_wait = SAM_SPIN_DEFAULT;
+    }
+    if (!internal->intra_op_affinity.empty()) {
+        options.AddConfigEntry("session.intra_op_thread_affinities", internal->intra_op_affinity.c_str());
+    }
+    if (config.disable_memory_arena) options.DisableCpuMemArena();
+    if (config.disable_memory_pattern) options.DisableMemPattern();
+    if (!internal->profile_prefix.empty()) options.EnableProfiling(internal->profile_prefix.c_str());
+    
+    config.intra_op_affinity = internal->intra_op_affinity.empty() ? nullptr : internal->intra_op_affinity.c_str();
+    config.profile_prefix = internal->profile_prefix.empty() ? nullptr : internal->profile_prefix.c_str();
+    internal->session_options = std::move(options);
+}
+
+// Load the first encoder variant and the decoder into internal
+static void load_models(SamContextInternal* internal, const std::string& decoder_path) {
+    SamStartupStats& stats = internal->startup_stats;
+    
+    // Load encoder
+    SamLoadedModel encoder;
+    internal->encoder = load_encoder(internal, internal->encoder_variants[0].path, &encoder);
+    stats.encoder_map_ms = encoder.map_ms;
+    stats.encoder_session_ms = encoder.session_ms;
+    stats.encoder_from_cache = encoder.from_cache;
+    
+    // Load decoder
+    SamLoadedModel decoder = load_session(internal, decoder_path);
+    internal->decoder_session = decoder.session.release();
+    internal->decoder_mapping = decoder.mapping;
+    stats.decoder_map_ms = decoder.map_ms;
+    stats.decoder_session_ms = decoder.session_ms;
+    stats.decoder_from_cache = decoder.from_cache;
+    stats.memory_mapped = internal->memory_map;
+}
+
+static void unload_models(SamContextInternal* internal) {
+    internal->decoder_io.binding.reset();
+    if (!internal->sessions_owner) {
+        delete internal->encoder.session;
+        delete internal->decoder_session;
+    }
+    internal->encoder = SamEncoderModel();
+    internal->decoder_session = nullptr;
+    internal->decoder_mapping.reset();
+}
+
+static SamContext* create_context(std::vector<SamEncoderVariant> encoders, const std::string& decoder_path,
+                                  const SamConfig* config) {
+    auto init_start = std::chrono::steady_clock::now();
+    std::unique_ptr<SamContextInternal> internal;
+    try {
+        internal.reset(new SamContextInternal());
+        internal->encoder_variants = std::move(encoders);
+        if (config) {
+            internal->config = *config;
+            internal->intra_op_affinity = config->intra_op_affinity ? config->intra_op_affinity : "";
+            internal->profile_prefix = config->profile_prefix ? config->profile_prefix : "";
+            internal->model_cache_dir = config->startup.cache_dir ? config->startup.cache_dir : "";
+            internal->memory_map = !config->startup.disable_memory_map;
+        }
+        internal->config.startup.cache_dir = internal->model_cache_dir.empty() ? nullptr : internal->model_cache_dir.c_str();
+        apply_config(internal.get());
+        internal->pool.resize(internal->config.intra_op_threads);
+        
+        try {
+            load_models(internal.get(), decoder_path);
+        } catch (...) {
+            // ORT rejects affinity lists that do not match the thread count
+            unload_models(internal.get());
+            if (internal->intra_op_affinity.empty()) throw;
+            internal->intra_op_affinity.clear();
+            apply_config(internal.get());
+            load_models(internal.get(), decoder_path);
+        }
+        SamStartupStats& stats = internal->startup_stats;
+        internal->encode_batch_limit = internal->encoder.max_batch;
+        
+        // Decoders exported with a static batch of 1 cannot take stacked prompts
+        if (input_batch_dim(internal->decoder_session, internal->allocator, "point_coords") == 1) {
+            internal->decoder_batch = SAM_BATCH_UNSUPPORTED;
+        }
+        
+        // Outputs written in place into caller buffers via IoBinding
+        internal->masks_shape = static_output_shape(
+            internal->decoder_session, internal->allocator, "masks", SAM_NUM_MASKS * SAM_MASK_SIZE * SAM_MASK_SIZE);
+        internal->iou_shape = static_output_shape(
+            internal->decoder_session, internal->allocator, "iou_predictions", SAM_NUM_MASKS);
+        internal->decoder_embedding_type = tensor_element_type(
+            internal->decoder_session, internal->allocator, "image_embeddings", true);
+        internal->decoder_mask_input =
+            has_session_input(internal->decoder_session, internal->allocator, "mask_input") &&
+            has_session_input(internal->decoder_session, internal->allocator, "has_mask_input");
+        internal->decoder_io.binding.reset(new Ort::IoBinding(*internal->decoder_session));
+        
+        auto* ctx = new SamContext();
+        ctx->encoder_session = internal->encoder.session;
+        ctx->decoder_session = internal->decoder_session;
+        bool run_warm_up = internal->config.startup.warm_up;
+        ctx->env = internal.release();
+        ctx->initialized = true;
+        
+        if (run_warm_up) {
+            warm_up(ctx, stats);
+        }
+        stats.total_ms = elapsed_ms(init_start);
+        
+        return ctx;
+    } catch (...) {
+        if (internal) unload_models(internal.get());
+        return nullptr;
+    }
+}
+
+extern "C" SamContext* sam_init(const char* encoder_path, const char* decoder_path) {
+    return sam_init_with_config(encoder_path, decoder_path, nullptr);
+}
+
+extern "C" SamContext* sam_init_with_options(const char* encoder_path, const char* decoder_path,
+                                             const SamStartupOptions* options) {
+    SamConfig config = {};
+    if (options) config.startup = *options;
+    return sam_init_with_config(encoder_path, decoder_path, &config);
+}
+
+extern "C" SamContext* sam_init_with_config(const char* encoder_path, const char* decoder_path,
+                                            const SamConfig* config) {
+    if (!encoder_path || !decoder_path) return nullptr;
+    try {
+        return create_context({describe_encoder("default", encoder_path)}, decoder_path, config);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+extern "C" SamContext* sam_init_with_manifest(const char* manifest_path, const SamConfig* config) {
+    if (!manifest_path) return nullptr;
+    try {
+        std::vector<SamEncoderVariant> encoders;
+        std::string decoder_path;
+        if (!parse_manifest(manifest_path, encoders, decoder_path)) return nullptr;
+        return create_context(std::move(encoders), decoder_path, config);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+extern "C" bool sam_get_effective_config(SamContext* ctx, SamConfig* config) {
+    if (!ctx || !ctx->initialized || !config) return false;
+    *config = static_cast<SamContextInternal*>(ctx->env)->config;
+    return true;
+}
+
+extern "C" bool sam_get_startup_stats(SamContext* ctx, SamStartupStats* stats) {
+    if (!ctx || !ctx->initialized || !stats) return false;
+    *stats = static_cast<SamContextInternal*>(ctx->env)->startup_stats;
+    return true;
+}
+
+static void free_context(SamContext* ctx) {
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    stop_job_worker(internal);
+    unload_models(internal);
+    delete internal;
+    delete ctx;
+}
+
+extern "C" void sam_free(SamContext* ctx) {
+    // SamModel contexts belong to the model (sam_model_free)
+    if (ctx && !static_cast<SamContextInternal*>(ctx->env)->model) {
+        free_context(ctx);
+    }
+}
+
+// ============================================================
+// SHARED MODEL
+// ============================================================
+
+// Contexts are created on demand up to max_contexts and never freed
+// before the model; contexts[0] owns the sessions
+struct SamModel {
+    int max_contexts = 1;
+    int pool_threads = 1;
+    std::vector<SamContext*> contexts;
+    std::vector<SamContext*> idle;
+    std::mutex mutex;
+    std::condition_variable released;
+    uint64_t acquires = 0;
+    uint64_t waits = 0;
+    uint64_t timeouts = 0;
+};
+
+// A context on owner's sessions. Everything a call writes to is its
+// own: decoder binding, arena, cache, pool and job queue. ORT sessions
+// take concurrent Run calls, so sharing them needs no locking here.
+static SamContext* create_pooled_context(SamContext* owner, int pool_threads) {
+    auto* base = static_cast<SamContextInternal*>(owner->env);
+    std::unique_ptr<SamContextInternal> internal(new SamContextInternal());
+    internal->model = base->model;
+    internal->sessions_owner = base;
+    internal->encoder = base->encoder;
+    internal->decoder_session = base->decoder_session;
+    internal->decoder_mapping = base->decoder_mapping;
+    internal->encoder_variants = base->encoder_variants;
+    internal->active_encoder = base->active_encoder;
+    
+    internal->config = base->config;
+    internal->intra_op_affinity = base->intra_op_affinity;
+    internal->profile_prefix = base->profile_prefix;
+    internal->model_cache_dir = base->model_cache_dir;
+    internal->memory_map = base->memory_map;
+    internal->startup_stats = base->startup_stats;
+    internal->config.intra_op_affinity = internal->intra_op_affinity.empty() ? nullptr : internal->intra_op_affinity.c_str();
+    internal->config.startup.cache_dir = internal->model_cache_dir.empty() ? nullptr : internal->model_cache_dir.c_str();
+    internal->config.profile_prefix = internal->profile_prefix.empty() ? nullptr : internal->profile_prefix.c_str();
+    internal->cache.byte_budget = base->cache.byte_budget;
+    internal->cache.dtype = base->cache.dtype;
+    
+    internal->decoder_batch = base->decoder_batch.load();
+    internal->masks_shape = base->masks_shape;
+    internal->iou_shape = base->iou_shape;
+    internal->decoder_embedding_type = base->decoder_embedding_type;
+    internal->decoder_mask_input = base->decoder_mask_input;
+    internal->encode_budget = base->encode_budget.load();
+    internal->encode_image_bytes = base->encode_image_bytes.load();
+    internal->encode_batch_limit = base->encode_batch_limit.load();
+    internal->decoder_io.binding.reset(new Ort::IoBinding(*internal->decoder_session));
+    internal->pool.resize(pool_threads);
+    
+    auto* ctx = new SamContext();
+    ctx->encoder_session = internal->encoder.session;
+    ctx->decoder_session = internal->decoder_session;
+    ctx->env = internal.release();
+    ctx->initialized = true;
+    return ctx;
+}
+
+extern "C" SamModel* sam_model_create(
+    const char* encoder_path,
+    const char* decoder_path,
+    const SamConfig* config,
+    int max_contexts
+) {
+    if (!encoder_path || !decoder_path || max_contexts < 0) return nullptr;
+    SamContext* owner = nullptr;
+    try {
+        std::unique_ptr<SamModel> model(new SamModel());
+        model->max_contexts = max_contexts > 0 ? max_contexts
+                                               : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        owner = create_context({describe_encoder("default", encoder_path)}, decoder_path, config);
+        if (!owner) return nullptr;
+        
+        auto* internal = static_cast<SamContextInternal*>(owner->env);
+        internal->model = model.get();
+        model->pool_threads = std::max(1, internal->config.intra_op_threads / model->max_contexts);
+        internal->pool.resize(model->pool_threads);
+        model->contexts.push_back(owner);
+        model->idle.push_back(owner);
+        return model.release();
+    } catch (...) {
+        if (owner) free_context(owner);
+        return nullptr;
+    }
+}
+
+extern "C" SamContext* sam_model_acquire(SamModel* model, int timeout_ms) {
+    if (!model) return nullptr;
+    try {
+        std::unique_lock<std::mutex> lock(model->mutex);
+        auto available = [&] {
+            return !model->idle.empty() || static_cast<int>(model->contexts.size()) < model->max_contexts;
+        };
+        if (!available()) {
+            model->waits++;
+            bool ready = true;
+            if (timeout_ms < 0) {
+                model->released.wait(lock, available);
+            } else {
+                ready = model->released.wait_for(lock, std::chrono::milliseconds(timeout_ms), available);
+            }
+            if (!ready) {
+                model->timeouts++;
+                return nullptr;
+            }
+        }
+        
+        SamContext* ctx;
+        if (!model->idle.empty()) {
+            ctx = model->idle.back();
+            model->idle.pop_back();
+        } else {
+            // Reserve the slot first so others do not overshoot the limit
+            model->contexts.push_back(nullptr);
+            lock.unlock();
+            try {
+                ctx = create_pooled_context(model->contexts.front(), model->pool_threads);
+            } catch (...) {
+                lock.lock();
+                model->contexts.erase(std::find(model->contexts.begin(), model->contexts.end(), nullptr));
+                model->released.notify_one();
+                return nullptr;
+            }
+            lock.lock();
+            *std::find(model->contexts.begin(), model->contexts.end(), nullptr) = ctx;
+        }
+        model->acquires++;
+        return ctx;
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+extern "C" bool sam_model_release(SamModel* model, SamContext* ctx) {
+    if (!model || !ctx) return false;
+    try {
+        std::lock_guard<std::mutex> lock(model->mutex);
+        if (std::find(model->contexts.begin(), model->contexts.end(), ctx) == model->contexts.end()) return false;
+        if (std::find(model->idle.begin(), model->idle.end(), ctx) != model->idle.end()) return false;
+        model->idle.push_back(ctx);
+    } catch (...) {
+        return false;
+    }
+    model->released.notify_one();
+    return true;
+}
+
+extern "C" bool sam_model_get_stats(SamModel* model, SamModelStats* stats) {
+    if (!model || !stats) return false;
+    std::lock_guard<std::mutex> lock(model->mutex);
+    stats->max_contexts = model->max_contexts;
+    stats->contexts = static_cast<int>(model->contexts.size());
+    stats->in_use = static_cast<int>(model->contexts.size() - model->idle.size());
+    stats->acquires = model->acquires;
+    stats->waits = model->waits;
+    stats->timeouts = model->timeouts;
+    return true;
+}
+
+extern "C" void sam_model_free(SamModel* model) {
+    if (!model) return;
+    // Borrowers first: the owner deletes the sessions
+    for (auto it = model->contexts.rbegin(); it != model->contexts.rend(); ++it) {
+        if (*it) free_context(*it);
+    }
+    delete model;
+}
+
+// ============================================================
+// PREPROCESSING
+// ============================================================
+
+// Bilinear taps for one axis: source index pair and fractional weight
+struct SamResizeTaps {
+    int* i0;
+    int* i1;
+    float* w;
+    
+    void build(SamScratchArena& arena, int dst_size, int src_size, float scale, int stride) {
+        i0 = arena.alloc<int>(dst_size);
+        i1 = arena.alloc<int>(dst_size);
+        w = arena.alloc<float>(dst_size);
+        for (int d = 0; d < dst_size; d++) {
+            float src = d / scale;
+            int s0 = static_cast<int>(src);
+            int s1 = std::min(s0 + 1, src_size - 1);
+            i0[d] = s0 * stride;
+            i1[d] = s1 * stride;
+            w[d] = src - s0;
+        }
+    }
+};
+
+// out[i] = lerp(lerp(a, b, wx), lerp(c, d, wx), wy) * k + bias
+static void lerp2d_affine(
+    const float* a, const float* b, const float* c, const float* d,
+    const float* wx, float wy, float k, float bias,
+    float* out, int n
+) {
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256 vwy = _mm256_set1_ps(wy);
+    const __m256 vk = _mm256_set1_ps(k);
+    const __m256 vbias = _mm256_set1_ps(bias);
+    for (; i + 8 <= n; i += 8) {
+        __m256 va = _mm256_loadu_ps(a + i), vb = _mm256_loadu_ps(b + i);
+        __m256 vc = _mm256_loadu_ps(c + i), vd = _mm256_loadu_ps(d + i);
+        __m256 vwx = _mm256_loadu_ps(wx + i);
+#if defined(__FMA__)
+        __m256 top = _mm256_fmadd_ps(vwx, _mm256_sub_ps(vb, va), va);
+        __m256 bot = _mm256_fmadd_ps(vwx, _mm256_sub_ps(vd, vc), vc);
+        __m256 v = _mm256_fmadd_ps(vwy, _mm256_sub_ps(bot, top), top);
+        _mm256_storeu_ps(out + i, _mm256_fmadd_ps(v, vk, vbias));
+#else
+        __m256 top = _mm256_add_ps(va, _mm256_mul_ps(vwx, _mm256_sub_ps(vb, va)));
+        __m256 bot = _mm256_add_ps(vc, _mm256_mul_ps(vwx, _mm256_sub_ps(vd, vc)));
+        __m256 v = _mm256_add_ps(top, _mm256_mul_ps(vwy, _mm256_sub_ps(bot, top)));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(v, vk), vbias));
+#endif
+    }
+#elif defined(__SSE2__)
+    const __m128 vwy = _mm_set1_ps(wy);
+    const __m128 vk = _mm_set1_ps(k);
+    const __m128 vbias = _mm_set1_ps(bias);
+    for (; i + 4 <= n; i += 4) {
+        __m128 va = _mm_loadu_ps(a + i), vb = _mm_loadu_ps(b + i);
+        __m128 vc = _mm_loadu_ps(c + i), vd = _mm_loadu_ps(d + i);
+        __m128 vwx = _mm_loadu_ps(wx + i);
+        __m128 top = _mm_add_ps(va, _mm_mul_ps(vwx, _mm_sub_ps(vb, va)));
+        __m128 bot = _mm_add_ps(vc, _mm_mul_ps(vwx, _mm_sub_ps(vd, vc)));
+        __m128 v = _mm_add_ps(top, _mm_mul_ps(vwy, _mm_sub_ps(bot, top)));
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(v, vk), vbias));
+    }
+#elif defined(__ARM_NEON)
+    const float32x4_t vwy = vdupq_n_f32(wy);
+    const float32x4_t vk = vdupq_n_f32(k);
+    const float32x4_t vbias = vdupq_n_f32(bias);
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t va = vld1q_f32(a + i), vb = vld1q_f32(b + i);
+        float32x4_t vc = vld1q_f32(c + i), vd = vld1q_f32(d + i);
+        float32x4_t vwx = vld1q_f32(wx + i);
+        float32x4_t top = vmlaq_f32(va, vwx, vsubq_f32(vb, va));
+        float32x4_t bot = vmlaq_f32(vc, vwx, vsubq_f32(vd, vc));
+        float32x4_t v = vmlaq_f32(top, vwy, vsubq_f32(bot, top));
+        vst1q_f32(out + i, vmlaq_f32(vbias, v, vk));
+    }
+#endif
+    for (; i < n; i++) {
+        float top = a[i] + wx[i] * (b[i] - a[i]);
+        float bot = c[i] + wx[i] * (d[i] - c[i]);
+        float v = top + wy * (bot - top);
+        out[i] = v * k + bias;
+    }
+}
+
+// Packed 8-bit pixels (RGB, RGBA, BGRA) with a row stride. x taps are
+// built with a stride of BPP, so they are byte offsets into a row.
+template <int BPP, int R, int G, int B>
+struct SamPackedSampler {
+    static const int X_STRIDE = BPP;
+    const uint8_t* data;
+    size_t row_stride;
+    
+    void gather(int sy0, int sy1, const SamResizeTaps& x_taps, int n, float* const taps[3][4]) const {
+        const uint8_t* row0 = data + sy0 * row_stride;
+        const uint8_t* row1 = data + sy1 * row_stride;
+        const int channel[3] = {R, G, B};
+        for (int x = 0; x < n; x++) {
+            const uint8_t* p00 = row0 + x_taps.i0[x];
+            const uint8_t* p01 = row0 + x_taps.i1[x];
+            const uint8_t* p10 = row1 + x_taps.i0[x];
+            const uint8_t* p11 = row1 + x_taps.i1[x];
+            for (int c = 0; c < 3; c++) {
+                taps[c][0][x] = p00[channel[c]];
+                taps[c][1][x] = p01[channel[c]];
+                taps[c][2][x] = p10[channel[c]];
+                taps[c][3][x] = p11[channel[c]];
+            }
+        }
+    }
+};
+
+typedef SamPackedSampler<3, 0, 1, 2> SamRgbSampler;
+typedef SamPackedSampler<4, 0, 1, 2> SamRgbaSampler;
+typedef SamPackedSampler<4, 2, 1, 0> SamBgraSampler;
+
+// YUV 4:2:0 planes (I420, or NV21/NV12 through a chroma pixel stride
+// of 2). Each tap is converted to RGB (BT.601 full range, as camera
+// frames use) in 16.16 fixed point and rounded/clamped to 8 bits, so
+// the result matches an 8-bit RGB conversion of the frame (within one
+// level on rare rounding ties). x taps are pixel indices.
+struct SamYuvSampler {
+    static const int X_STRIDE = 1;
+    const uint8_t* y;
+    const uint8_t* u;
+    const uint8_t* v;
+    size_t y_stride;
+    size_t uv_stride;
+    int uv_pixel_stride;
+    
+    static uint8_t clamp_u8(int value) {
+        return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+    }
+    
+    static void to_rgb(int luma, int cb, int cr, float* r, float* g, float* b) {
+        cb -= 128;
+        cr -= 128;
+        *r = clamp_u8(luma + ((91881 * cr + 32768) >> 16));
+        *g = clamp_u8(luma + ((-22554 * cb - 46802 * cr + 32768) >> 16));
+        *b = clamp_u8(luma + ((116130 * cb + 32768) >> 16));
+    }
+    
+    void gather(int sy0, int sy1, const SamResizeTaps& x_taps, int n, float* const taps[3][4]) const {
+        const uint8_t* y_rows[2] = {y + sy0 * y_stride, y + sy1 * y_stride};
+        const uint8_t* u_rows[2] = {u + (sy0 >> 1) * uv_stride, u + (sy1 >> 1) * uv_stride};
+        const uint8_t* v_rows[2] = {v + (sy0 >> 1) * uv_stride, v + (sy1 >> 1) * uv_stride};
+        for (int x = 0; x < n; x++) {
+            const int xs[2] = {x_taps.i0[x], x_taps.i1[x]};
+            for (int t = 0; t < 4; t++) {
+                int row = t >> 1;
+                int sx = xs[t & 1];
+                int chroma = (sx >> 1) * uv_pixel_stride;
+                to_rgb(y_rows[row][sx], u_rows[row][chroma], v_rows[row][chroma],
+                       &taps[0][t][x], &taps[1][t][x], &taps[2][t][x]);
+            }
+        }
+    }
+};
+
+// Resize + normalize + NCHW pack for output rows [y_begin, y_end)
+// scratch holds 12 tap rows (4 taps x 3 channels) of tap_row_stride floats
+template <typename Sampler>
+static void preprocess_rows(
+    const Sampler& src,
+    const SamResizeTaps& x_taps,
+    const SamResizeTaps& y_taps,
+    int new_width,
+    int new_height,
+    int y_begin,
+    int y_end,
+    float* output,
+    float* scratch
+) {
+    const size_t plane = static_cast<size_t>(SAM_IMAGE_SIZE) * SAM_IMAGE_SIZE;
+    
+    // (x / 255 - mean) / std folded into x * k + bias
+    float k[3], bias[3];
+    for (int c = 0; c < 3; c++) {
+        k[c] = 1.0f / (255.0f * SAM_STD[c]);
+        bias[c] = -SAM_MEAN[c] / SAM_STD[c];
+    }
+    
+    float* taps[3][4];
+    for (int c = 0; c < 3; c++) {
+        for (int t = 0; t < 4; t++) {
+            taps[c][t] = scratch + (c * 4 + t) * tap_row_stride(new_width);
+        }
+    }
+    
+    for (int y = y_begin; y < y_end; y++) {
+        size_t row_offset = static_cast<size_t>(y) * SAM_IMAGE_SIZE;
+        
+        // Bottom padding: whole row is zero
+        if (y >= new_height) {
+            for (int c = 0; c < 3; c++) {
+                std::memset(output + c * plane + row_offset, 0, SAM_IMAGE_SIZE * sizeof(float));
+            }
+            continue;
+        }
+        
+        // Gather the 4 source taps of every output pixel (planar)
+        src.gather(y_taps.i0[y], y_taps.i1[y], x_taps, new_width, taps);
+        
+        // Interpolate, normalize and write straight into each plane
+        for (int c = 0; c < 3; c++) {
+            float* dst = output + c * plane + row_offset;
+            lerp2d_affine(taps[c][0], taps[c][1], taps[c][2], taps[c][3],
+                          x_taps.w, y_taps.w[y], k[c], bias[c], dst, new_width);
+            // Right padding
+            std::memset(dst + new_width, 0, (SAM_IMAGE_SIZE - new_width) * sizeof(float));
+        }
+    }
+}
+
+// Shared by the serial and pooled entry points (pool may be NULL).
+// Scratch comes from the context arena when given, else a local one.
+template <typename Sampler>
+static void preprocess_image(
+    SamThreadPool* pool,
+    SamScratchArena* arena,
+    const Sampler& src,
+    int width,
+    int height,
+    float* output,
+    float* scale_x,
+    float* scale_y
+) {
+    SamStageTimer timer(SAM_STAGE_PREPROCESS);
+    
+    // Calculate resize scale (longest side to 1024)
+    float scale = static_cast<float>(SAM_IMAGE_SIZE) / std::max(width, height);
+    int new_width = static_cast<int>(width * scale);
+    int new_height = static_cast<int>(height * scale);
+    
+    *scale_x = scale;
+    *scale_y = scale;
+    
+    int bands = pool ? pool->bands_for(SAM_IMAGE_SIZE) : 1;
+    std::unique_ptr<SamScratchArena> local;
+    if (!arena) {
+        local.reset(new SamScratchArena(preprocess_scratch_bytes(new_width, new_height, bands)));
+        arena = local.get();
+    }
+    SamScratchArena::Mark mark = arena->mark();
+    
+    // Precompute per-column and per-row source indices and weights
+    SamResizeTaps x_taps, y_taps;
+    x_taps.build(*arena, new_width, width, scale, Sampler::X_STRIDE);
+    y_taps.build(*arena, new_height, height, scale, 1);
+    float* scratch = arena->alloc<float>(12 * tap_row_stride(new_width) * bands);
+    
+    if (!pool) {
+        preprocess_rows(src, x_taps, y_taps, new_width, new_height,
+                        0, SAM_IMAGE_SIZE, output, scratch);
+    } else {
+        // One scratch slice per band; rows are disjoint so the result
+        // does not depend on the thread count
+        pool->parallel_for(0, SAM_IMAGE_SIZE, [&](int band, int y_begin, int y_end) {
+            preprocess_rows(src, x_taps, y_taps, new_width, new_height,
+                            y_begin, y_end, output, scratch + band * 12 * tap_row_stride(new_width));
+        });
+    }
+    arena->rewind(mark);
+}
+
+extern "C" void sam_preprocess_image(
+    const uint8_t* rgb_data,
+    int width,
+    int height,
+    float* output,
+    float* scale_x,
+    float* scale_y
+) {
+    SamRgbSampler src = {rgb_data, static_cast<size_t>(width) * 3};
+    preprocess_image(nullptr, nullptr, src, width, height, output, scale_x, scale_y);
+}
+
+extern "C" void sam_preprocess_image_parallel(
+    SamContext* ctx,
+    const uint8_t* rgb_data,
+    int width,
+    int height,
+    float* output,
+    float* scale_x,
+    float* scale_y
+) {
+    SamRgbSampler src = {rgb_data, static_cast<size_t>(width) * 3};
+    if (!ctx || !ctx->initialized) {
+        preprocess_image(nullptr, nullptr, src, width, height, output, scale_x, scale_y);
+        return;
+    }
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    preprocess_image(&internal->pool, &internal->arena, src, width, height, output, scale_x, scale_y);
+}
+
+// Dispatch a camera frame to the matching sampler
+static bool preprocess_frame(
+    SamThreadPool* pool,
+    SamScratchArena* arena,
+    const SamImage* image,
+    float* output,
+    float* scale_x,
+    float* scale_y
+) {
+    if (!image || !output || !scale_x || !scale_y || image->width <= 0 || image->height <= 0 || !image->planes[0]) {
+        return false;
+    }
+    int w = image->width;
+    int h = image->height;
+    auto stride = [image](int plane, size_t packed) {
+        return image->row_strides[plane] > 0 ? static_cast<size_t>(image->row_strides[plane]) : packed;
+    };
+    
+    switch (image->format) {
+        case SAM_PIXEL_RGB: {
+            SamRgbSampler src = {image->planes[0], stride(0, static_cast<size_t>(w) * 3)};
+            preprocess_image(pool, arena, src, w, h, output, scale_x, scale_y);
+            return true;
+        }
+        case SAM_PIXEL_RGBA: {
+            SamRgbaSampler src = {image->planes[0], stride(0, static_cast<size_t>(w) * 4)};
+            preprocess_image(pool, arena, src, w, h, output, scale_x, scale_y);
+            return true;
+        }
+        case SAM_PIXEL_BGRA: {
+            SamBgraSampler src = {image->planes[0], stride(0, static_cast<size_t>(w) * 4)};
+            preprocess_image(pool, arena, src, w, h, output, scale_x, scale_y);
+            return true;
+        }
+        case SAM_PIXEL_YUV420: {
+            if (!image->planes[1] || !image->planes[2]) return false;
+            int uv_pixel_stride = image->pixel_strides[1] > 0 ? image->pixel_strides[1] : 1;
+            SamYuvSampler src = {image->planes[0], image->planes[1], image->planes[2],
+                                 stride(0, w), stride(1, static_cast<size_t>((w + 1) / 2) * uv_pixel_stride),
+                                 uv_pixel_stride};
+            preprocess_image(pool, arena, src, w, h, output, scale_x, scale_y);
+            return true;
+        }
+        case SAM_PIXEL_NV21: {
+            if (!image->planes[1]) return false;
+            // Interleaved VU: V at even bytes, U at odd
+            size_t uv_stride = stride(1, static_cast<size_t>((w + 1) / 2) * 2);
+            SamYuvSampler src = {image->planes[0], image->planes[1] + 1, image->planes[1],
+                                 stride(0, w), uv_stride, 2};
+            preprocess_image(pool, arena, src, w, h, output, scale_x, scale_y);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+extern "C" bool sam_preprocess_frame(
+    const SamImage* image,
+    float* output,
+    float* scale_x,
+    float* scale_y
+) {
+    try {
+        return preprocess_frame(nullptr, nullptr, image, output, scale_x, scale_y);
+    } catch (...) {
+        return false;
+    }
+}
+
+extern "C" bool sam_preprocess_frame_parallel(
+    SamContext* ctx,
+    const SamImage* image,
+    float* output,
+    float* scale_x,
+    float* scale_y
+) {
+    try {
+        if (!ctx || !ctx->initialized) {
+            return preprocess_frame(nullptr, nullptr, image, output, scale_x, scale_y);
+        }
+        auto* internal = static_cast<SamContextInternal*>(ctx->env);
+        return preprocess_frame(&internal->pool, &internal->arena, image, output, scale_x, scale_y);
+    } catch (...) {
+        return false;
+    }
+}
+
+// ============================================================
+// ENCODER
+// ============================================================
+
+// Copy one encoder output (fp32, or fp16 when half_model) into the
+// embedding's storage, converting to its dtype
+static void store_embedding(const void* src, bool half_model, SamEmbedding* embedding) {
+    bool half_out = embedding->dtype == SAM_DTYPE_FLOAT16;
+    if (half_model) {
+        const uint16_t* half = static_cast<const uint16_t*>(src);
+        if (half_out) {
+            std::memcpy(embedding->half_data, half, embedding_bytes(SAM_DTYPE_FLOAT16));
+        } else {
+            convert_f16_to_f32(half, embedding->data, SAM_EMBEDDING_FLOATS);
+        }
+    } else {
+        const float* full = static_cast<const float*>(src);
+        if (half_out) {
+            convert_f32_to_f16(full, embedding->half_data, SAM_EMBEDDING_FLOATS);
+        } else {
+            std::memcpy(embedding->data, full, embedding_bytes(SAM_DTYPE_FLOAT32));
+        }
+    }
+}
+
+// Encoder run shared by the blocking and async entry points; a run can
+// be aborted from another thread through run_options.SetTerminate()
+// Encode with a specific encoder model (throws on ORT errors)
+static void encode_with_model(
+    const SamEncoderModel& model,
+    const float* preprocessed_image,
+    SamEmbedding* embedding,
+    const Ort::RunOptions& run_options
+) {
+    // Input tensor
+    std::array<int64_t, 4> input_shape = {1, 3, SAM_IMAGE_SIZE, SAM_IMAGE_SIZE};
+    auto memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+    
+    Ort::Value input_tensor = Ort::Value::CreateTensor<float>(
+        memory_info,
+        const_cast<float*>(preprocessed_image),
+        3 * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE,
+        input_shape.data(),
+        input_shape.size()
+    );
+    
+    Ort::IoBinding binding(*model.session);
+    binding.BindInput("image", input_tensor);
+    
+    // Encoder writes straight into the caller's embedding buffer when
+    // the stored dtype matches the model output
+    bool half_out = embedding->dtype == SAM_DTYPE_FLOAT16;
+    bool half_model = model.output_type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16;
+    bool direct = !model.embedding_shape.empty() && half_out == half_model;
+    if (direct) {
+        void* storage = half_out ? static_cast<void*>(embedding->half_data) : static_cast<void*>(embedding->data);
+        Ort::Value output_tensor = Ort::Value::CreateTensor(
+            memory_info,
+            storage,
+            embedding_bytes(embedding->dtype),
+            model.embedding_shape.data(),
+            model.embedding_shape.size(),
+            model.output_type
+        );
+        binding.BindOutput("image_embeddings", output_tensor);
+    } else {
+        binding.BindOutput("image_embeddings", memory_info);
+    }
+    
+    model.session->Run(run_options, binding);
+    
+    // ORT allocated the result: copy or convert it out
+    if (!direct) {
+        auto output_tensors = binding.GetOutputValues();
+        store_embedding(output_tensors[0].GetTensorMutableData<uint8_t>(), half_model, embedding);
+    }
+    
+    embedding->batch_size = 1;
+    embedding->channels = SAM_EMBEDDING_DIM;
+    embedding->height = SAM_EMBEDDING_SIZE;
+    embedding->width = SAM_EMBEDDING_SIZE;
+}
+
+// Stacked run over n images (throws on ORT errors). Returns false if
+// the encoder did not produce n embeddings: its batch dim is fixed
+// inside the graph.
+static bool encode_batch_with_model(
+    const SamEncoderModel& model,
+    const float* const* images,
+    int n,
+    SamEmbedding* embeddings,
+    std::vector<float>& staging
+) {
+    const size_t image_floats = 3 * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE;
+    const float* input = images[0];
+    for (int i = 1; i < n && input; i++) {
+        if (images[i] != images[0] + i * image_floats) input = nullptr;
+    }
+    if (!input) {
+        staging.resize(n * image_floats);
+        for (int i = 0; i < n; i++) {
+            std::memcpy(staging.data() + i * image_floats, images[i], image_floats * sizeof(float));
+        }
+        input = staging.data();
+    }
+    
+    std::array<int64_t, 4> input_shape = {n, 3, SAM_IMAGE_SIZE, SAM_IMAGE_SIZE};
+    auto memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+    Ort::Value input_tensor = Ort::Value::CreateTensor<float>(
+        memory_info,
+        const_cast<float*>(input),
+        n * image_floats,
+        input_shape.data(),
+        input_shape.size()
+    );
+    
+    const char* input_names[] = {"image"};
+    const char* output_names[] = {"image_embeddings"};
+    auto output_tensors = model.session->Run(Ort::RunOptions{nullptr}, input_names, &input_tensor, 1, output_names, 1);
+    if (output_tensors[0].GetTensorTypeAndShapeInfo().GetElementCount() != n * SAM_EMBEDDING_FLOATS) return false;
+    
+    // Embeddings are separate caller buffers: copy each one out
+    bool half_model = model.output_type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16;
+    const uint8_t* src = output_tensors[0].GetTensorMutableData<uint8_t>();
+    size_t stride = embedding_bytes(half_model ? SAM_DTYPE_FLOAT16 : SAM_DTYPE_FLOAT32);
+    for (int i = 0; i < n; i++) {
+        SamEmbedding* embedding = &embeddings[i];
+        store_embedding(src + i * stride, half_model, embedding);
+        embedding->batch_size = 1;
+        embedding->channels = SAM_EMBEDDING_DIM;
+        embedding->height = SAM_EMBEDDING_SIZE;
+        embedding->width = SAM_EMBEDDING_SIZE;
+    }
+    return true;
+}
+
+static bool run_encoder(
+    SamContext* ctx,
+    const float* preprocessed_image,
+    SamEmbedding* embedding,
+    const Ort::RunOptions& run_options
+) {
+    if (!ctx || !ctx->initialized) return false;
+    SamStageTimer timer(SAM_STAGE_ENCODE);
+    
+    try {
+        auto* internal = static_cast<SamContextInternal*>(ctx->env);
+        std::shared_lock<std::shared_mutex> lock(internal->encoder_mutex);
+        encode_with_model(internal->encoder, preprocessed_image, embedding, run_options);
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+extern "C" bool sam_encode_image(
+    SamContext* ctx,
+    const float* preprocessed_image,
+    SamEmbedding* embedding
+) {
+    return run_encoder(ctx, preprocessed_image, embedding, Ort::RunOptions{nullptr});
+}
+
+// Images per stacked run: the budget over the per-image peak, capped by
+// what the active encoder has managed
+static int encode_batch_size(SamContextInternal* internal) {
+    uint64_t per_budget = internal->encode_budget / std::max<uint64_t>(1, internal->encode_image_bytes);
+    int batch = static_cast<int>(std::min<uint64_t>(per_budget, SAM_MAX_ENCODE_BATCH));
+    return std::max(1, std::min(batch, internal->encode_batch_limit.load()));
+}
+
+// Lower the batch limit (never raise it: another thread may have
+// failed at a smaller size meanwhile)
+static void lower_encode_batch_limit(SamContextInternal* internal, int limit) {
+    int current = internal->encode_batch_limit.load();
+    while (limit < current && !internal->encode_batch_limit.compare_exchange_weak(current, limit)) {
+    }
+}
+
+extern "C" int sam_encode_images(
+    SamContext* ctx,
+    const float* const* preprocessed_images,
+    int num_images,
+    SamEmbedding* embeddings
+) {
+    if (!ctx || !ctx->initialized || !preprocessed_images || !embeddings || num_images <= 0) return -1;
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    
+    int done = 0;
+    try {
+        std::vector<float> staging;
+        std::shared_lock<std::shared_mutex> lock(internal->encoder_mutex);
+        int batch = encode_batch_size(internal);
+        while (done < num_images) {
+            int n = std::min(batch, num_images - done);
+            if (n == 1) {
+                SamStageTimer timer(SAM_STAGE_ENCODE);
+                encode_with_model(internal->encoder, preprocessed_images[done], &embeddings[done],
+                                  Ort::RunOptions{nullptr});
+                done++;
+                continue;
+            }
+            
+            bool stacked = false;
+            try {
+                SamStageTimer timer(SAM_STAGE_ENCODE);
+                stacked = encode_batch_with_model(internal->encoder, preprocessed_images + done, n,
+                                                  embeddings + done, staging);
+            } catch (...) {
+                // Out of memory, or a graph that rejects the stacked shape:
+                // retry these images at half the size
+                lower_encode_batch_limit(internal, n / 2);
+                batch = encode_batch_size(internal);
+                continue;
+            }
+            if (!stacked) {
+                lower_encode_batch_limit(internal, 1);
+                batch = 1;
+                continue;
+            }
+            done += n;
+        }
+    } catch (...) {
+    }
+    return done;
+}
+
+extern "C" bool sam_set_encode_budget(SamContext* ctx, uint64_t budget_bytes, uint64_t image_bytes) {
+    if (!ctx || !ctx->initialized) return false;
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    internal->encode_budget = budget_bytes > 0 ? budget_bytes : SAM_DEFAULT_ENCODE_BUDGET;
+    internal->encode_image_bytes = image_bytes > 0 ? image_bytes : SAM_ENCODE_IMAGE_BYTES;
+    return true;
+}
+
+extern "C" int sam_get_encode_batch_size(SamContext* ctx) {
+    if (!ctx || !ctx->initialized) return 0;
+    return encode_batch_size(static_cast<SamContextInternal*>(ctx->env));
+}
+
+// ============================================================
+// DECODER
+// ============================================================
+
+// image_embeddings tensor in the dtype the decoder declares. Stored
+// FLOAT16 embeddings are widened (or FLOAT32 narrowed) into context
+// buffers when the decoder wants the other type. Caller holds
+// decoder_mutex.
+static Ort::Value decoder_embedding_tensor(
+    SamContextInternal* internal,
+    const SamEmbedding* embedding,
+    const Ort::MemoryInfo& memory_info
+) {
+    SamDecoderBinding& io = internal->decoder_io;
+    bool half_in = embedding->dtype == SAM_DTYPE_FLOAT16;
+    bool half_model = internal->decoder_embedding_type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16;
+    
+    void* data;
+    if (half_in == half_model) {
+        data = half_in ? static_cast<void*>(embedding->half_data) : static_cast<void*>(embedding->data);
+    } else if (half_model) {
+        io.narrowed.resize(SAM_EMBEDDING_FLOATS);
+        convert_f32_to_f16(embedding->data, io.narrowed.data(), SAM_EMBEDDING_FLOATS);
+        data = io.narrowed.data();
+    } else {
+        io.widened.resize(SAM_EMBEDDING_FLOATS);
+        convert_f16_to_f32(embedding->half_data, io.widened.data(), SAM_EMBEDDING_FLOATS);
+        data = io.widened.data();
+    }
+    
+    return Ort::Value::CreateTensor(
+        memory_info,
+        data,
+        embedding_bytes(half_model ? SAM_DTYPE_FLOAT16 : SAM_DTYPE_FLOAT32),
+        SAM_EMBEDDING_SHAPE.data(),
+        SAM_EMBEDDING_SHAPE.size(),
+        internal->decoder_embedding_type
+    );
+}
+
+// Embeddings are told apart by content, as callers reuse buffers; the
+// first 16 KB (all of channel 0 at fp32) already differ between images
+static uint64_t embedding_fingerprint(const SamEmbedding* embedding) {
+    bool half = embedding->dtype == SAM_DTYPE_FLOAT16;
+    const void* data = half ? static_cast<const void*>(embedding->half_data) : static_cast<const void*>(embedding->data);
+    size_t bytes = std::min<size_t>(16384, embedding_bytes(embedding->dtype));
+    return hash_bytes(static_cast<const uint8_t*>(data), bytes, static_cast<uint64_t>(embedding->dtype));
+}
+
+// Previous mask of an embedding, moved to the front (NULL if none).
+// Caller holds decoder_mutex.
+static SamMaskFeedback* find_mask_feedback(SamContextInternal* internal, uint64_t key) {
+    std::list<SamMaskFeedback>& entries = internal->mask_feedback;
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+        if (it->key != key) continue;
+        entries.splice(entries.begin(), entries, it);
+        return &entries.front();
+    }
+    return nullptr;
+}
+
+// A corrective click: the previous points in the same order, plus more
+static bool extends_prompt(const SamMaskFeedback& feedback, const SamPointPrompt* prompt) {
+    size_t n = feedback.labels.size();
+    if (n == 0 || static_cast<size_t>(prompt->num_points) <= n) return false;
+    return std::equal(feedback.labels.begin(), feedback.labels.end(), prompt->labels) &&
+           std::memcmp(feedback.coords.data(), prompt->coords, 2 * n * sizeof(float)) == 0;
+}
+
+// Keep the best mask of a decode for the next prompt on this embedding.
+// Once full, the least recently used entry is overwritten in place.
+static void remember_mask(SamContextInternal* internal, SamMaskFeedback* entry, uint64_t key,
+                          const SamPointPrompt* prompt, const float* logits) {
+    std::list<SamMaskFeedback>& entries = internal->mask_feedback;
+    if (!entry) {
+        if (entries.size() >= SAM_MASK_FEEDBACK_ENTRIES) {
+            entries.splice(entries.begin(), entries, std::prev(entries.end()));
+        } else {
+            entries.emplace_front();
+        }
+        entry = &entries.front();
+        entry->key = key;
+    }
+    entry->coords.assign(prompt->coords, prompt->coords + 2 * prompt->num_points);
+    entry->labels.assign(prompt->labels, prompt->labels + prompt->num_points);
+    entry->logits.assign(logits, logits + SAM_MASK_SIZE * SAM_MASK_SIZE);
+}
+
+// use_feedback = false decodes from scratch and leaves the refinement
+// state (mask_feedback) untouched, for batches and probe decodes
+static bool run_decoder(
+    SamContext* ctx,
+    const SamEmbedding* embedding,
+    const SamPointPrompt* prompt,
+    SamMaskResult* result,
+    const Ort::RunOptions& run_options,
+    bool use_feedback
+) {
+    if (!ctx || !ctx->initialized) return false;
+    SamStageTimer timer(SAM_STAGE_DECODE);
+    
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    SamDecoderBinding& io = internal->decoder_io;
+    
+    // The binding is shared by the calling thread and the job worker
+    std::lock_guard<std::mutex> lock(internal->decoder_mutex);
+    
+    try {
+        auto* session = static_cast<Ort::Session*>(ctx->decoder_session);
+        auto memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+        Ort::IoBinding& binding = *io.binding;
+        
+        // Image embeddings stay bound while the same image is decoded.
+        // Matching dtypes are bound in place, so Run always reads the
+        // current contents. A converted copy is also keyed on content:
+        // the caller may refill the buffer, or another context encode
+        // into it, between calls.
+        bool half = embedding->dtype == SAM_DTYPE_FLOAT16;
+        const void* storage = half ? static_cast<const void*>(embedding->half_data)
+                                   : static_cast<const void*>(embedding->data);
+        bool converted = half != (internal->decoder_embedding_type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16);
+        uint64_t content = converted ? embedding_fingerprint(embedding) : 0;
+        if (io.embedding != storage || io.embedding_content != content) {
+            Ort::Value emb_tensor = decoder_embedding_tensor(internal, embedding, memory_info);
+            binding.BindInput("image_embeddings", emb_tensor);
+            io.embedding = storage;
+            io.embedding_content = content;
+        }
+        
+        // Point labels (convert int to int64 into a reused buffer)
+        if (io.labels_i64.size() < static_cast<size_t>(prompt->num_points)) {
+            io.labels_i64.resize(prompt->num_points);
+        }
+        for (int i = 0; i < prompt->num_points; i++) {
+            io.labels_i64[i] = prompt->labels[i];
+        }
+        
+        // Point coords tensor (caller memory, no copy)
+        if (io.coords != prompt->coords || io.num_points != prompt->num_points) {
+            std::array<int64_t, 3> coords_shape = {1, prompt->num_points, 2};
+            Ort::Value coords_tensor = Ort::Value::CreateTensor<float>(
+                memory_info,
+                const_cast<float*>(prompt->coords),
+                prompt->num_points * 2,
+                coords_shape.data(),
+                coords_shape.size()
+            );
+            binding.BindInput("point_coords", coords_tensor);
+            io.coords = prompt->coords;
+        }
+        
+        if (io.labels != io.labels_i64.data() || io.num_points != prompt->num_points) {
+            std::array<int64_t, 2> labels_shape = {1, prompt->num_points};
+            Ort::Value labels_tensor = Ort::Value::CreateTensor<int64_t>(
+                memory_info,
+                io.labels_i64.data(),
+                prompt->num_points,
+                labels_shape.data(),
+                labels_shape.size()
+            );
+            binding.BindInput("point_labels", labels_tensor);
+            io.labels = io.labels_i64.data();
+        }
+        io.num_points = prompt->num_points;
+        
+        // Previous mask of this embedding when the prompt extends the
+        // points that produced it
+        SamMaskFeedback* feedback = nullptr;
+        uint64_t feedback_key = 0;
+        if (internal->decoder_mask_input) {
+            if (!io.mask_input_bound) {
+                io.mask_input.assign(SAM_MASK_SIZE * SAM_MASK_SIZE, 0.0f);
+                std::array<int64_t, 4> mask_shape = {1, 1, SAM_MASK_SIZE, SAM_MASK_SIZE};
+                std::array<int64_t, 1> flag_shape = {1};
+                Ort::Value mask_tensor = Ort::Value::CreateTensor<float>(
+                    memory_info,
+                    io.mask_input.data(),
+                    io.mask_input.size(),
+                    mask_shape.data(),
+                    mask_shape.size()
+                );
+                Ort::Value flag_tensor = Ort::Value::CreateTensor<float>(
+                    memory_info,
+                    &io.has_mask_input,
+                    1,
+                    flag_shape.data(),
+                    flag_shape.size()
+                );
+                binding.BindInput("mask_input", mask_tensor);
+                binding.BindInput("has_mask_input", flag_tensor);
+                io.mask_input_bound = true;
+            }
+            bool refine = false;
+            if (use_feedback) {
+                feedback_key = converted ? content : embedding_fingerprint(embedding);
+                feedback = find_mask_feedback(internal, feedback_key);
+                refine = feedback && extends_prompt(*feedback, prompt);
+            }
+            if (refine) {
+                std::memcpy(io.mask_input.data(), feedback->logits.data(), io.mask_input.size() * sizeof(float));
+            }
+            io.has_mask_input = refine ? 1.0f : 0.0f;
+        }
+        
+        // Outputs written in place into the caller's result buffers
+        bool direct = !internal->masks_shape.empty() && !internal->iou_shape.empty();
+        if (direct && (io.masks != result->masks || io.iou_scores != result->iou_scores)) {
+            binding.ClearBoundOutputs();
+            Ort::Value masks_tensor = Ort::Value::CreateTensor<float>(
+                memory_info,
+                result->masks,
+                SAM_NUM_MASKS * SAM_MASK_SIZE * SAM_MASK_SIZE,
+                internal->masks_shape.data(),
+                internal->masks_shape.size()
+            );
+            Ort::Value iou_tensor = Ort::Value::CreateTensor<float>(
+                memory_info,
+                result->iou_scores,
+                SAM_NUM_MASKS,
+                internal->iou_shape.data(),
+                internal->iou_shape.size()
+            );
+            binding.BindOutput("masks", masks_tensor);
+            binding.BindOutput("iou_predictions", iou_tensor);
+            io.masks = result->masks;
+            io.iou_scores = result->iou_scores;
+        } else if (!direct && !io.ort_outputs) {
+            binding.BindOutput("masks", memory_info);
+            binding.BindOutput("iou_predictions", memory_info);
+            io.ort_outputs = true;
+        }
+        
+        session->Run(run_options, binding);
+        
+        // Dynamic output shapes: ORT allocated the results, copy them out
+        if (!direct) {
+            auto output_tensors = binding.GetOutputValues();
+            size_t masks_size = SAM_NUM_MASKS * SAM_MASK_SIZE * SAM_MASK_SIZE;
+            std::memcpy(result->masks, output_tensors[0].GetTensorMutableData<float>(), masks_size * sizeof(float));
+            std::memcpy(result->iou_scores, output_tensors[1].GetTensorMutableData<float>(), SAM_NUM_MASKS * sizeof(float));
+        }
+        
+        // Find best mask
+        const float* iou_data = result->iou_scores;
+        result->best_mask_idx = 0;
+        float best_iou = iou_data[0];
+        for (int i = 1; i < SAM_NUM_MASKS; i++) {
+            if (iou_data[i] > best_iou) {
+                best_iou = iou_data[i];
+                result->best_mask_idx = i;
+            }
+        }
+        
+        if (use_feedback && internal->decoder_mask_input && prompt->num_points > 0) {
+            remember_mask(internal, feedback, feedback_key, prompt,
+                          result->masks + result->best_mask_idx * SAM_MASK_SIZE * SAM_MASK_SIZE);
+        }
+        
+        return true;
+    } catch (...) {
+        // Force a full rebind on the next call
+        io.embedding = nullptr;
+        io.mask_input_bound = false;
+        io.coords = nullptr;
+        io.labels = nullptr;
+        io.masks = nullptr;
+        io.iou_scores = nullptr;
+        io.ort_outputs = false;
+        return false;
+    }
+}
+
+extern "C" bool sam_decode_mask(
+    SamContext* ctx,
+    const SamEmbedding* embedding,
+    const SamPointPrompt* prompt,
+    SamMaskResult* result
+) {
+    return run_decoder(ctx, embedding, prompt, result, Ort::RunOptions{nullptr}, true);
+}
+
+// One decoder call per prompt, from scratch like the batched path
+static bool decode_masks_sequential(
+    SamContext* ctx,
+    const SamEmbedding* embedding,
+    const SamPointPrompt* prompts,
+    int num_prompts,
+    SamMaskResult* results
+) {
+    for (int i = 0; i < num_prompts; i++) {
+        if (!run_decoder(ctx, embedding, &prompts[i], &results[i], Ort::RunOptions{nullptr}, false)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+extern "C" bool sam_decode_masks_batch(
+    SamContext* ctx,
+    const SamEmbedding* embedding,
+    const SamPointPrompt* prompts,
+    int num_prompts,
+    SamMaskResult* results
+) {
+    if (!ctx || !ctx->initialized || num_prompts <= 0) return false;
+    
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    if (num_prompts == 1 || internal->decoder_batch == SAM_BATCH_UNSUPPORTED) {
+        return decode_masks_sequential(ctx, embedding, prompts, num_prompts, results);
+    }
+    
+    int max_points = 0;
+    for (int i = 0; i < num_prompts; i++) {
+        max_points = std::max(max_points, prompts[i].num_points);
+    }
+    if (max_points == 0) return false;
+    SamStageTimer timer(SAM_STAGE_DECODE);
+    
+    try {
+        auto* session = static_cast<Ort::Session*>(ctx->decoder_session);
+        auto memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+        
+        // Image embeddings tensor (shared by every prompt in the batch)
+        std::unique_lock<std::mutex> lock(internal->decoder_mutex);
+        Ort::Value emb_tensor = decoder_embedding_tensor(internal, embedding, memory_info);
+        internal->decoder_io.embedding = nullptr;  // Staging may have been overwritten
+        
+        // Stack prompts into [B, N, 2] / [B, N], padding with label -1
+        std::vector<float> coords(static_cast<size_t>(num_prompts) * max_points * 2, 0.0f);
+        std::vector<int64_t> labels_i64(static_cast<size_t>(num_prompts) * max_points, -1);
+        for (int b = 0; b < num_prompts; b++) {
+            const SamPointPrompt& prompt = prompts[b];
+            std::memcpy(&coords[b * max_points * 2], prompt.coords, prompt.num_points * 2 * sizeof(float));
+            for (int i = 0; i < prompt.num_points; i++) {
+                labels_i64[b * max_points + i] = prompt.labels[i];
+            }
+        }
+        
+        std::array<int64_t, 3> coords_shape = {num_prompts, max_points, 2};
+        Ort::Value coords_tensor = Ort::Value::CreateTensor<float>(
+            memory_info,
+            coords.data(),
+            coords.size(),
+            coords_shape.data(),
+            coords_shape.size()
+        );
+        
+        std::array<int64_t, 2> labels_shape = {num_prompts, max_points};
+        Ort::Value labels_tensor = Ort::Value::CreateTensor<int64_t>(
+            memory_info,
+            labels_i64.data(),
+            labels_i64.size(),
+            labels_shape.data(),
+            labels_shape.size()
+        );
+        
+        const char* input_names[] = {"image_embeddings", "point_coords", "point_labels", "mask_input", "has_mask_input"};
+        const char* output_names[] = {"masks", "iou_predictions"};
+        
+        std::vector<Ort::Value> input_tensors;
+        input_tensors.push_back(std::move(emb_tensor));
+        input_tensors.push_back(std::move(coords_tensor));
+        input_tensors.push_back(std::move(labels_tensor));
+        
+        // Batched prompts are independent: no previous mask
+        std::vector<float> no_mask;
+        float has_mask_input = 0.0f;
+        if (internal->decoder_mask_input) {
+            no_mask.assign(SAM_MASK_SIZE * SAM_MASK_SIZE, 0.0f);
+            std::array<int64_t, 4> mask_shape = {1, 1, SAM_MASK_SIZE, SAM_MASK_SIZE};
+            std::array<int64_t, 1> flag_shape = {1};
+            input_tensors.push_back(Ort::Value::CreateTensor<float>(
+                memory_info, no_mask.data(), no_mask.size(), mask_shape.data(), mask_shape.size()));
+            input_tensors.push_back(Ort::Value::CreateTensor<float>(
+                memory_info, &has_mask_input, 1, flag_shape.data(), flag_shape.size()));
+        }
+        
+        auto output_tensors = session->Run(
+            Ort::RunOptions{nullptr},
+            input_names,
+            input_tensors.data(),
+            input_tensors.size(),
+            output_names,
+            2
+        );
+        
+        lock.unlock();
+        
+        size_t masks_size = SAM_NUM_MASKS * SAM_MASK_SIZE * SAM_MASK_SIZE;
+        if (output_tensors[0].GetTensorTypeAndShapeInfo().GetElementCount() != masks_size * num_prompts ||
+            output_tensors[1].GetTensorTypeAndShapeInfo().GetElementCount() != SAM_NUM_MASKS * static_cast<size_t>(num_prompts)) {
+            // Decoder collapsed the batch; remember and take the slow path
+            internal->decoder_batch = SAM_BATCH_UNSUPPORTED;
+            return decode_masks_sequential(ctx, embedding, prompts, num_prompts, results);
+        }
+        int probe = SAM_BATCH_UNKNOWN;
+        internal->decoder_batch.compare_exchange_strong(probe, SAM_BATCH_SUPPORTED);
+        
+        // Split masks and IoU scores per prompt
+        const float* masks_data = output_tensors[0].GetTensorMutableData<float>();
+        const float* iou_data = output_tensors[1].GetTensorMutableData<float>();
+        for (int b = 0; b < num_prompts; b++) {
+            SamMaskResult& result = results[b];
+            const float* iou = iou_data + b * SAM_NUM_MASKS;
+            std::memcpy(result.masks, masks_data + b * masks_size, masks_size * sizeof(float));
+            std::memcpy(result.iou_scores, iou, SAM_NUM_MASKS * sizeof(float));
+            
+            result.best_mask_idx = 0;
+            for (int i = 1; i < SAM_NUM_MASKS; i++) {
+                if (iou[i] > iou[result.best_mask_idx]) {
+                    result.best_mask_idx = i;
+                }
+            }
+        }
+        
+        return true;
+    } catch (...) {
+        // Static-batch decoders reject the stacked shape at Run time
+        // (another thread may have found that out first)
+        int probe = SAM_BATCH_UNKNOWN;
+        internal->decoder_batch.compare_exchange_strong(probe, SAM_BATCH_UNSUPPORTED);
+        if (internal->decoder_batch == SAM_BATCH_UNSUPPORTED) {
+            return decode_masks_sequential(ctx, embedding, prompts, num_prompts, results);
+        }
+        return false;
+    }
+}
+
+extern "C" bool sam_has_mask_input(SamContext* ctx) {
+    if (!ctx || !ctx->initialized) return false;
+    return static_cast<SamContextInternal*>(ctx->env)->decoder_mask_input;
+}
+
+extern "C" void sam_reset_mask_input(SamContext* ctx, const SamEmbedding* embedding) {
+    if (!ctx || !ctx->initialized) return;
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    std::lock_guard<std::mutex> lock(internal->decoder_mutex);
+    if (!embedding) {
+        internal->mask_feedback.clear();
+        return;
+    }
+    if (!(embedding->dtype == SAM_DTYPE_FLOAT16 ? static_cast<const void*>(embedding->half_data)
+                                                : static_cast<const void*>(embedding->data))) return;
+    uint64_t key = embedding_fingerprint(embedding);
+    internal->mask_feedback.remove_if([key](const SamMaskFeedback& entry) { return entry.key == key; });
+}
+
+// ============================================================
+// POSTPROCESSING
+// ============================================================
+
+// Bilinear sample of the 256x256 logits, thresholded. Both
+// postprocessing modes go through this so boundary pixels match the
+// dense path bit for bit.
+static inline uint8_t upsample_pixel(const float* mask, float src_x, float src_y, float threshold) {
+    int x0 = static_cast<int>(src_x);
+    int y0 = static_cast<int>(src_y);
+    int x1 = std::min(x0 + 1, SAM_MASK_SIZE - 1);
+    int y1 = std::min(y0 + 1, SAM_MASK_SIZE - 1);
+    
+    float wx = src_x - x0;
+    float wy = src_y - y0;
+    
+    float v = (1 - wx) * (1 - wy) * mask[y0 * SAM_MASK_SIZE + x0] +
+              wx * (1 - wy) * mask[y0 * SAM_MASK_SIZE + x1] +
+              (1 - wx) * wy * mask[y1 * SAM_MASK_SIZE + x0] +
+              wx * wy * mask[y1 * SAM_MASK_SIZE + x1];
+    
+    return (v > threshold) ? 255 : 0;
+}
+
+// Bilinear upsample + threshold for output rows [y_begin, y_end)
+static void postprocess_rows_dense(
+    const float* mask,
+    int output_width,
+    int output_height,
+    int y_begin,
+    int y_end,
+    uint8_t* output,
+    float threshold
+) {
+    // Bilinear resize from 256x256 to output size
+    float scale_x = static_cast<float>(SAM_MASK_SIZE) / output_width;
+    float scale_y = static_cast<float>(SAM_MASK_SIZE) / output_height;
+    
+    for (int y = y_begin; y < y_end; y++) {
+        for (int x = 0; x < output_width; x++) {
+            output[static_cast<size_t>(y) * output_width + x] =
+                upsample_pixel(mask, x * scale_x, y * scale_y, threshold);
+        }
+    }
+}
+
+enum SamCellClass : uint8_t {
+    SAM_CELL_OUTSIDE = 0,
+    SAM_CELL_INSIDE = 255,
+    SAM_CELL_BOUNDARY = 1
+};
+
+// A pixel interpolates the four corners of its low-res cell, so a cell
+// whose corners all clear the threshold thresholds uniformly. The
+// margin covers float rounding in the interpolation (< 16 ulp of the
+// largest corner); NaN corners fail both tests and stay on the exact path.
+static inline SamCellClass classify_cell(float a, float b, float c, float d, float threshold) {
+    float magnitude = std::max(std::max(std::fabs(a), std::fabs(b)), std::max(std::fabs(c), std::fabs(d)));
+    float margin = 1e-5f * (magnitude + std::fabs(threshold)) + 1e-30f;
+    float above = threshold + margin;
+    float below = threshold - margin;
+    if (a > above && b > above && c > above && d > above) return SAM_CELL_INSIDE;
+    if (a < below && b < below && c < below && d < below) return SAM_CELL_OUTSIDE;
+    return SAM_CELL_BOUNDARY;
+}
+
+// Row-by-row view of the upsampled, thresholded mask, same pixels as
+// postprocess_rows_dense. Runs of uniform cells are reported as spans;
+// only pixels in boundary cells are interpolated.
+class SamMaskUpsampler {
+public:
+    SamMaskUpsampler(const float* mask, int output_width, int output_height, float threshold)
+        : mask_(mask),
+          threshold_(threshold),
+          scale_x_(static_cast<float>(SAM_MASK_SIZE) / output_width),
+          scale_y_(static_cast<float>(SAM_MASK_SIZE) / output_height) {
+        // First output column of each low-res column (x * scale_x is
+        // monotonic, so every cell covers one contiguous span)
+        int cell = 0;
+        span_start_[0] = 0;
+        for (int x = 0; x < output_width; x++) {
+            int x0 = static_cast<int>(x * scale_x_);
+            while (cell < x0) span_start_[++cell] = x;
+        }
+        while (cell < SAM_MASK_SIZE) span_start_[++cell] = output_width;
+    }
+    
+    // fill(value, x_begin, x_end) for uniform spans, pixel(x, value) for
+    // interpolated pixels, left to right
+    template <typename Fill, typename Pixel>
+    void row(int y, Fill&& fill, Pixel&& pixel) {
+        float src_y = y * scale_y_;
+        int y0 = static_cast<int>(src_y);
+        if (y0 != cells_y0_) {
+            classify_row(y0);
+        }
+        
+        for (int cx = 0; cx < SAM_MASK_SIZE;) {
+            uint8_t cls = cells_[cx];
+            int run_end = cx + 1;
+            while (run_end < SAM_MASK_SIZE && cells_[run_end] == cls) run_end++;
+            
+            int x_begin = span_start_[cx];
+            int x_end = span_start_[run_end];
+            if (cls == SAM_CELL_BOUNDARY) {
+                for (int x = x_begin; x < x_end; x++) {
+                    pixel(x, upsample_pixel(mask_, x * scale_x_, src_y, threshold_));
+                }
+            } else if (x_end > x_begin) {
+                fill(cls, x_begin, x_end);
+            }
+            cx = run_end;
+        }
+    }
+    
+private:
+    void classify_row(int y0) {
+        const float* r0 = mask_ + y0 * SAM_MASK_SIZE;
+        const float* r1 = mask_ + std::min(y0 + 1, SAM_MASK_SIZE - 1) * SAM_MASK_SIZE;
+        for (int cx = 0; cx < SAM_MASK_SIZE; cx++) {
+            int cx1 = std::min(cx + 1, SAM_MASK_SIZE - 1);
+            cells_[cx] = classify_cell(r0[cx], r0[cx1], r1[cx], r1[cx1], threshold_);
+        }
+        cells_y0_ = y0;
+    }
+    
+    const float* mask_;
+    float threshold_;
+    float scale_x_;
+    float scale_y_;
+    std::array<int, SAM_MASK_SIZE + 1> span_start_;
+    std::array<uint8_t, SAM_MASK_SIZE> cells_;
+    int cells_y0_ = -1;
+};
+
+static void postprocess_rows(
+    const float* mask,
+    int output_width,
+    int output_height,
+    int y_begin,
+    int y_end,
+    uint8_t* output,
+    float threshold
+) {
+    SamMaskUpsampler upsampler(mask, output_width, output_height, threshold);
+    for (int y = y_begin; y < y_end; y++) {
+        uint8_t* out_row = output + static_cast<size_t>(y) * output_width;
+        upsampler.row(y,
+            [out_row](uint8_t value, int x_begin, int x_end) { std::memset(out_row + x_begin, value, x_end - x_begin); },
+            [out_row](int x, uint8_t value) { out_row[x] = value; });
+    }
+}
+
+extern "C" void sam_postprocess_mask(
+    const float* mask,
+    int output_width,
+    int output_height,
+    uint8_t* output,
+    float threshold
+) {
+    SamStageTimer timer(SAM_STAGE_POSTPROCESS);
+    postprocess_rows(mask, output_width, output_height, 0, output_height, output, threshold);
+}
+
+extern "C" void sam_postprocess_mask_dense(
+    const float* mask,
+    int output_width,
+    int output_height,
+    uint8_t* output,
+    float threshold
+) {
+    SamStageTimer timer(SAM_STAGE_POSTPROCESS);
+    postprocess_rows_dense(mask, output_width, output_height, 0, output_height, output, threshold);
+}
+
+extern "C" void sam_postprocess_mask_parallel(
+    SamContext* ctx,
+    const float* mask,
+    int output_width,
+    int output_height,
+    uint8_t* output,
+    float threshold
+) {
+    if (!ctx || !ctx->initialized) {
+        sam_postprocess_mask(mask, output_width, output_height, output, threshold);
+        return;
+    }
+    SamStageTimer timer(SAM_STAGE_POSTPROCESS);
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    internal->pool.parallel_for(0, output_height, [&](int, int y_begin, int y_end) {
+        postprocess_rows(mask, output_width, output_height, y_begin, y_end, output, threshold);
+    });
+}
+
+extern "C" float sam_mask_iou(const float* mask_a, const float* mask_b, int count, float threshold) {
+    if (!mask_a || !mask_b || count <= 0) return 0.0f;
+    
+    int64_t intersection = 0;
+    int64_t uni = 0;
+    for (int i = 0; i < count; i++) {
+        bool a = mask_a[i] > threshold;
+        bool b = mask_b[i] > threshold;
+        intersection += a && b;
+        uni += a || b;
+    }
+    return uni > 0 ? static_cast<float>(intersection) / static_cast<float>(uni) : 1.0f;
+}
+
+extern "C" void sam_transform_coords(
+    float orig_x, float orig_y,
+    int orig_width, int orig_height,
+    float* sam_x, float* sam_y
+) {
+    float scale = static_cast<float>(SAM_IMAGE_SIZE) / std::max(orig_width, orig_height);
+    *sam_x = orig_x * scale;
+    *sam_y = orig_y * scale;
+}
+
+// ============================================================
+// COMPACT MASKS
+// ============================================================
+
+// Row-major run lengths of the upsampled mask, alternating background /
+// foreground and starting with background
+struct SamRunWriter {
+    uint32_t* runs;
+    int capacity;
+    int count = 0;
+    bool foreground = false;
+    uint32_t length = 0;
+    int64_t area = 0;
+    
+    void add(bool value, int n) {
+        if (value != foreground) {
+            flush();
+            foreground = value;
+        }
+        length += n;
+        if (value) area += n;
+    }
+    
+    void flush() {
+        if (runs && count < capacity) runs[count] = length;
+        count++;
+        length = 0;
+    }
+};
+
+// Marching squares over the low-res logits. Like the upsampler, the last
+// row and column are repeated once (covering [255, 256]); the grid is
+// then padded by one background sample on every side so every contour
+// closes, with crossings against the padding on the mask border.
+class SamContourTracer {
+public:
+    static const int GRID = SAM_MASK_SIZE + 3;
+    static const int NUM_EDGES = 2 * GRID * GRID;
+    
+    static size_t scratch_bytes() {
+        return SamScratchArena::aligned(NUM_EDGES * 2 * sizeof(int32_t)) +
+               SamScratchArena::aligned(NUM_EDGES);
+    }
+    
+    SamContourTracer(const float* mask, float threshold, SamScratchArena& arena)
+        : mask_(mask),
+          threshold_(threshold),
+          links_(arena.alloc<int32_t>(NUM_EDGES * 2)),
+          visited_(arena.alloc<uint8_t>(NUM_EDGES)) {
+        std::fill(links_, links_ + NUM_EDGES * 2, -1);
+        std::memset(visited_, 0, NUM_EDGES);
+        build_links();
+    }
+    
+    // Loop with the largest enclosed area (the outer boundary of the
+    // largest component); returns its first edge and point count
+    int largest_loop(int* num_points) {
+        int best_start = -1;
+        double best_area = 0.0;
+        *num_points = 0;
+        for (int e = 0; e < NUM_EDGES; e++) {
+            if (links_[e * 2] < 0 || visited_[e]) continue;
+            int count = 0;
+            double area = 0.0;
+            float x0, y0, xp, yp;
+            point(e, &x0, &y0);
+            xp = x0;
+            yp = y0;
+            walk(e, [&](int edge) {
+                visited_[edge] = 1;
+                float x, y;
+                point(edge, &x, &y);
+                area += static_cast<double>(xp) * y - static_cast<double>(x) * yp;
+                xp = x;
+                yp = y;
+                count++;
+            });
+            area += static_cast<double>(xp) * y0 - static_cast<double>(x0) * yp;
+            if (std::abs(area) > best_area) {
+                best_area = std::abs(area);
+                best_start = e;
+                *num_points = count;
+            }
+        }
+        return best_start;
+    }
+    
+    // Points of the loop starting at start, in low-res mask coordinates.
+    // Both crossings of a corner cell land on the corner, so repeated
+    // points are dropped; returns the number written.
+    int trace(int start, float* points) {
+        int count = 0;
+        walk(start, [&](int edge) {
+            float* p = points + count * 2;
+            point(edge, p, p + 1);
+            if (count == 0 || p[0] != p[-2] || p[1] != p[-1]) count++;
+        });
+        if (count > 1 && points[0] == points[count * 2 - 2] && points[1] == points[count * 2 - 1]) count--;
+        return count;
+    }
+    
+private:
+    // Horizontal edge (px, py)-(px + 1, py), vertical edge (px, py)-(px, py + 1)
+    static int h_edge(int px, int py) { return py * GRID + px; }
+    static int v_edge(int px, int py) { return GRID * GRID + py * GRID + px; }
+    
+    float sample(int px, int py) const {
+        int gx = std::min(px - 1, SAM_MASK_SIZE - 1);
+        int gy = std::min(py - 1, SAM_MASK_SIZE - 1);
+        return mask_[gy * SAM_MASK_SIZE + gx];
+    }
+    
+    bool inside(int px, int py) const {
+        return px > 0 && py > 0 && px < GRID - 1 && py < GRID - 1 && sample(px, py) > threshold_;
+    }
+    
+    void link(int a, int b) {
+        links_[a * 2 + (links_[a * 2] >= 0)] = b;
+        links_[b * 2 + (links_[b * 2] >= 0)] = a;
+    }
+    
+    void build_links() {
+        for (int py = 0; py < GRID - 1; py++) {
+            for (int px = 0; px < GRID - 1; px++) {
+                int code = (inside(px, py) << 3) | (inside(px + 1, py) << 2) |
+                           (inside(px + 1, py + 1) << 1) | inside(px, py + 1);
+                if (code == 0 || code == 15) continue;
+                
+                int top = h_edge(px, py);
+                int bottom = h_edge(px, py + 1);
+                int left = v_edge(px, py);
+                int right = v_edge(px + 1, py);
+                switch (code) {
+                    case 1: case 14: link(left, bottom); break;
+                    case 2: case 13: link(bottom, right); break;
+                    case 3: case 12: link(left, right); break;
+                    case 4: case 11: link(top, right); break;
+                    case 6: case 9: link(top, bottom); break;
+                    case 7: case 8: link(top, left); break;
+                    case 5: case 10: {
+                        // Saddle: decide by the bilinear value at the cell
+                        // centre, as the upsampled mask does (both
+                        // diagonal corners are inside, so no padding here)
+                        float centre = 0.25f * (sample(px, py) + sample(px + 1, py) +
+                                                sample(px + 1, py + 1) + sample(px, py + 1));
+                        bool joined = centre > threshold_;
+                        if ((code == 5) == joined) {
+                            link(top, left);
+                            link(bottom, right);
+                        } else {
+                            link(top, right);
+                            link(left, bottom);
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    
+    // Threshold crossing between samples a (at 0) and b (at 1)
+    float crossing(float a, float b) const {
+        return (threshold_ - a) / (b - a);
+    }
+    
+    void point(int edge, float* x, float* y) const {
+        bool vertical = edge >= GRID * GRID;
+        int rem = vertical ? edge - GRID * GRID : edge;
+        int px = rem % GRID;
+        int py = rem / GRID;
+        if (!vertical) {
+            *y = static_cast<float>(py - 1);
+            if (px == 0) *x = 0.0f;
+            else if (px == GRID - 2) *x = static_cast<float>(SAM_MASK_SIZE);
+            else *x = (px - 1) + crossing(sample(px, py), sample(px + 1, py));
+        } else {
+            *x = static_cast<float>(px - 1);
+            if (py == 0) *y = 0.0f;
+            else if (py == GRID - 2) *y = static_cast<float>(SAM_MASK_SIZE);
+            else *y = (py - 1) + crossing(sample(px, py), sample(px, py + 1));
+        }
+    }
+    
+    template <typename Visit>
+    void walk(int start, Visit&& visit) const {
+        int prev = -1;
+        int edge = start;
+        do {
+            visit(edge);
+            int next = links_[edge * 2] != prev ? links_[edge * 2] : links_[edge * 2 + 1];
+            prev = edge;
+            edge = next;
+        } while (edge != start);
+    }
+    
+    const float* mask_;
+    float threshold_;
+    int32_t* links_;
+    uint8_t* visited_;
+};
+
+// Douglas-Peucker on a closed polygon: split at point 0 and the point
+// farthest from it, then simplify both halves. keep[i] marks survivors.
+static void simplify_closed(const float* points, int n, float epsilon, uint8_t* keep, int* stack) {
+    if (epsilon <= 0.0f || n <= 3) {
+        std::memset(keep, 1, n);
+        return;
+    }
+    std::memset(keep, 0, n);
+    
+    auto at = [&](int i, float* x, float* y) {
+        i %= n;
+        *x = points[i * 2];
+        *y = points[i * 2 + 1];
+    };
+    
+    int far = 0;
+    float far_d = -1.0f;
+    for (int i = 1; i < n; i++) {
+        float dx = points[i * 2] - points[0];
+        float dy = points[i * 2 + 1] - points[1];
+        float d = dx * dx + dy * dy;
+        if (d > far_d) {
+            far_d = d;
+            far = i;
+        }
+    }
+    keep[0] = 1;
+    keep[far] = 1;
+    
+    // Ranges [a, b] with indices taken modulo n
+    int top = 0;
+    stack[top++] = 0;
+    stack[top++] = far;
+    stack[top++] = far;
+    stack[top++] = n;
+    float eps2 = epsilon * epsilon;
+    while (top > 0) {
+        int b = stack[--top];
+        int a = stack[--top];
+        if (b - a < 2) continue;
+        
+        float ax, ay, bx, by;
+        at(a, &ax, &ay);
+        at(b, &bx, &by);
+        float dx = bx - ax;
+        float dy = by - ay;
+        float len2 = dx * dx + dy * dy;
+        
+        int split = -1;
+        float split_d = eps2;
+        for (int i = a + 1; i < b; i++) {
+            float x, y;
+            at(i, &x, &y);
+            float d;
+            if (len2 > 0.0f) {
+                float cross = dx * (y - ay) - dy * (x - ax);
+                d = cross * cross / len2;
+            } else {
+                d = (x - ax) * (x - ax) + (y - ay) * (y - ay);
+            }
+            if (d > split_d) {
+                split_d = d;
+                split = i;
+            }
+        }
+        if (split >= 0) {
+            keep[split % n] = 1;
+            stack[top++] = a;
+            stack[top++] = split;
+            stack[top++] = split;
+            stack[top++] = b;
+        }
+    }
+}
+
+// Runs, row by row through the same upsampler as sam_postprocess_mask
+static void compact_runs(const float* mask, int width, int height, float threshold, SamCompactMask* out) {
+    out->width = width;
+    out->height = height;
+    SamRunWriter writer{out->runs, out->run_capacity};
+    SamMaskUpsampler upsampler(mask, width, height, threshold);
+    for (int y = 0; y < height; y++) {
+        upsampler.row(y,
+            [&](uint8_t value, int x_begin, int x_end) { writer.add(value != 0, x_end - x_begin); },
+            [&](int, uint8_t value) { writer.add(value != 0, 1); });
+    }
+    writer.flush();
+    out->num_runs = writer.count;
+    out->area = writer.area;
+}
+
+// Fill a SamCompactMask from low-res logits; scratch comes from arena
+static bool compact_mask(
+    const float* mask,
+    int width,
+    int height,
+    float threshold,
+    float epsilon,
+    SamCompactMask* out,
+    SamScratchArena& arena
+) {
+    SamStageTimer timer(SAM_STAGE_POSTPROCESS);
+    compact_runs(mask, width, height, threshold, out);
+    
+    // Outline of the largest component
+    SamScratchArena::Mark mark = arena.mark();
+    SamContourTracer tracer(mask, threshold, arena);
+    int loop_points = 0;
+    int start = tracer.largest_loop(&loop_points);
+    int num_points = 0;
+    if (start >= 0) {
+        float* points = arena.alloc<float>(loop_points * 2);
+        uint8_t* keep = arena.alloc<uint8_t>(loop_points);
+        int* stack = arena.alloc<int>(loop_points * 4 + 8);
+        loop_points = tracer.trace(start, points);
+        
+        // Low-res sample g sits at output pixel g * size / 256, like
+        // the upsampler's src = x * 256 / size
+        float sx = static_cast<float>(width) / SAM_MASK_SIZE;
+        float sy = static_cast<float>(height) / SAM_MASK_SIZE;
+        for (int i = 0; i < loop_points; i++) {
+            points[i * 2] *= sx;
+            points[i * 2 + 1] *= sy;
+        }
+        double area = 0.0;
+        for (int i = 0; i < loop_points; i++) {
+            int j = (i + 1) % loop_points;
+            area += static_cast<double>(points[i * 2]) * points[j * 2 + 1] -
+                    static_cast<double>(points[j * 2]) * points[i * 2 + 1];
+        }
+        simplify_closed(points, loop_points, epsilon, keep, stack);
+        
+        // Emit clockwise on screen (positive area with y pointing down)
+        for (int k = 0; k < loop_points; k++) {
+            int i = area >= 0.0 ? k : (loop_points - k) % loop_points;
+            if (!keep[i]) continue;
+            if (out->contour && num_points < out->contour_capacity) {
+                out->contour[num_points * 2] = points[i * 2];
+                out->contour[num_points * 2 + 1] = points[i * 2 + 1];
+            }
+            num_points++;
+        }
+    }
+    arena.rewind(mark);
+    out->num_points = num_points;
+    
+    return (!out->runs || out->num_runs <= out->run_capacity) &&
+           (!out->contour || out->num_points <= out->contour_capacity);
+}
+
+extern "C" bool sam_mask_to_compact(
+    const float* mask,
+    int output_width,
+    int output_height,
+    float threshold,
+    float epsilon,
+    SamCompactMask* out
+) {
+    if (!mask || !out || output_width <= 0 || output_height <= 0) return false;
+    try {
+        SamScratchArena arena(SamContourTracer::scratch_bytes());
+        return compact_mask(mask, output_width, output_height, threshold, epsilon, out, arena);
+    } catch (...) {
+        return false;
+    }
+}
+
+extern "C" bool sam_mask_to_runs(
+    const float* mask,
+    int output_width,
+    int output_height,
+    float threshold,
+    SamCompactMask* out
+) {
+    if (!mask || !out || output_width <= 0 || output_height <= 0) return false;
+    SamStageTimer timer(SAM_STAGE_POSTPROCESS);
+    compact_runs(mask, output_width, output_height, threshold, out);
+    out->num_points = 0;
+    return !out->runs || out->num_runs <= out->run_capacity;
+}
+
+// ============================================================
+// ASYNC JOBS
+// ============================================================
+
+static bool job_finished(int status) {
+    return status == SAM_JOB_DONE || status == SAM_JOB_FAILED || status == SAM_JOB_CANCELLED;
+}
+
+static void job_worker_loop(SamContext* ctx) {
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    SamJobQueue& q = internal->jobs;
+    
+    for (;;) {
+        std::shared_ptr<SamJob> job;
+        bool run;
+        {
+            std::unique_lock<std::mutex> lock(q.mutex);
+            q.work.wait(lock, [&] { return q.stopping || !q.pending.empty(); });
+            // On shutdown every queued job is already cancelled; drain them
+            // so their callbacks still fire
+            if (q.pending.empty()) return;
+            job = q.pending.front();
+            q.pending.pop_front();
+            run = job->status == SAM_JOB_PENDING;
+            if (run) {
+                job->status = SAM_JOB_RUNNING;
+                q.running = job;
+            }
+        }
+        
+        // Jobs cancelled while queued only need their callback
+        int status = SAM_JOB_CANCELLED;
+        if (run) {
+            bool ok;
+            if (job->kind == SAM_JOB_ENCODE) {
+                ok = run_encoder(ctx, job->image, job->embedding, job->run_options);
+            } else {
+                SamPointPrompt prompt = {job->coords.data(), job->labels.data(),
+                                         static_cast<int>(job->labels.size())};
+                ok = run_decoder(ctx, job->source, &prompt, job->result, job->run_options, true);
+            }
+            
+            std::lock_guard<std::mutex> lock(q.mutex);
+            status = job->cancel_requested ? SAM_JOB_CANCELLED : (ok ? SAM_JOB_DONE : SAM_JOB_FAILED);
+            job->status = status;
+            q.running.reset();
+        }
+        q.done.notify_all();
+        
+        if (job->callback) {
+            job->callback(job->id, status, job->user_data);
+        }
+    }
+}
+
+// Marks a job cancelled; a running job's ORT Run is terminated
+static void cancel_job_locked(SamJob& job) {
+    if (job.status == SAM_JOB_PENDING) {
+        job.status = SAM_JOB_CANCELLED;
+    } else if (job.status == SAM_JOB_RUNNING && !job.cancel_requested) {
+        job.cancel_requested = true;
+        job.run_options.SetTerminate();
+    }
+}
+
+static int64_t submit_job(SamContext* ctx, std::shared_ptr<SamJob> job, bool supersede) {
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    SamJobQueue& q = internal->jobs;
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.stopping) return 0;
+        if (supersede) {
+            for (auto& pending : q.pending) {
+                if (pending->kind == job->kind) cancel_job_locked(*pending);
+            }
+            if (q.running && q.running->kind == job->kind) cancel_job_locked(*q.running);
+        }
+        if (!q.worker.joinable()) {
+            q.worker = std::thread(job_worker_loop, ctx);
+        }
+        job->id = q.next_id++;
+        q.jobs[job->id] = job;
+        q.pending.push_back(job);
+    }
+    q.work.notify_one();
+    return job->id;
+}
+
+static void stop_job_worker(SamContextInternal* internal) {
+    SamJobQueue& q = internal->jobs;
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.stopping = true;
+        for (auto& pending : q.pending) cancel_job_locked(*pending);
+        if (q.running) cancel_job_locked(*q.running);
+    }
+    q.work.notify_all();
+    if (q.worker.joinable()) q.worker.join();
+    q.done.notify_all();
+}
+
+extern "C" int64_t sam_encode_async(
+    SamContext* ctx,
+    const float* preprocessed_image,
+    SamEmbedding* embedding,
+    bool supersede,
+    SamJobCallback callback,
+    void* user_data
+) {
+    if (!ctx || !ctx->initialized || !preprocessed_image || !embedding) return 0;
+    
+    try {
+        auto job = std::make_shared<SamJob>();
+        job->kind = SAM_JOB_ENCODE;
+        job->image = preprocessed_image;
+        job->embedding = embedding;
+        job->callback = callback;
+        job->user_data = user_data;
+        return submit_job(ctx, std::move(job), supersede);
+    } catch (...) {
+        return 0;
+    }
+}
+
+extern "C" int64_t sam_decode_async(
+    SamContext* ctx,
+    const SamEmbedding* embedding,
+    const SamPointPrompt* prompt,
+    SamMaskResult* result,
+    SamJobCallback callback,
+    void* user_data
+) {
+    if (!ctx || !ctx->initialized || !embedding || !prompt || !result) return 0;
+    
+    try {
+        auto job = std::make_shared<SamJob>();
+        job->kind = SAM_JOB_DECODE;
+        job->source = embedding;
+        job->coords.assign(prompt->coords, prompt->coords + prompt->num_points * 2);
+        job->labels.assign(prompt->labels, prompt->labels + prompt->num_points);
+        job->result = result;
+        job->callback = callback;
+        job->user_data = user_data;
+        return submit_job(ctx, std::move(job), false);
+    } catch (...) {
+        return 0;
+    }
+}
+
+extern "C" int sam_job_poll(SamContext* ctx, int64_t job_id) {
+    return sam_job_wait(ctx, job_id, 0);
+}
+
+extern "C" int sam_job_wait(SamContext* ctx, int64_t job_id, int timeout_ms) {
+    if (!ctx || !ctx->initialized) return SAM_JOB_UNKNOWN;
+    SamJobQueue& q = static_cast<SamContextInternal*>(ctx->env)->jobs;
+    
+    std::unique_lock<std::mutex> lock(q.mutex);
+    auto it = q.jobs.find(job_id);
+    if (it == q.jobs.end()) return SAM_JOB_UNKNOWN;
+    std::shared_ptr<SamJob> job = it->second;
+    
+    auto finished = [&] { return job_finished(job->status) || q.stopping; };
+    if (timeout_ms < 0) {
+        q.done.wait(lock, finished);
+    } else if (timeout_ms > 0) {
+        q.done.wait_for(lock, std::chrono::milliseconds(timeout_ms), finished);
+    }
+    return job->status;
+}
+
+extern "C" bool sam_cancel(SamContext* ctx, int64_t job_id) {
+    if (!ctx || !ctx->initialized) return false;
+    SamJobQueue& q = static_cast<SamContextInternal*>(ctx->env)->jobs;
+    
+    std::lock_guard<std::mutex> lock(q.mutex);
+    auto it = q.jobs.find(job_id);
+    if (it == q.jobs.end() || job_finished(it->second->status)) return false;
+    cancel_job_locked(*it->second);
+    q.done.notify_all();
+    return true;
+}
+
+extern "C" void sam_job_release(SamContext* ctx, int64_t job_id) {
+    if (!ctx || !ctx->initialized) return;
+    SamJobQueue& q = static_cast<SamContextInternal*>(ctx->env)->jobs;
+    
+    std::lock_guard<std::mutex> lock(q.mutex);
+    auto it = q.jobs.find(job_id);
+    if (it != q.jobs.end() && job_finished(it->second->status)) {
+        q.jobs.erase(it);
+    }
+}
+
+// ============================================================
+// THREADING AND SCRATCH MEMORY
+// ============================================================
+
+extern "C" bool sam_set_num_threads(SamContext* ctx, int num_threads) {
+    if (!ctx || !ctx->initialized || num_threads < 0) return false;
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    internal->pool.resize(num_threads == 0 ? internal->config.intra_op_threads : num_threads);
+    return true;
+}
+
+extern "C" int sam_get_num_threads(SamContext* ctx) {
+    if (!ctx || !ctx->initialized) return 0;
+    return static_cast<SamContextInternal*>(ctx->env)->pool.size();
+}
+
+extern "C" bool sam_get_arena_stats(SamContext* ctx, SamArenaStats* stats) {
+    if (!ctx || !ctx->initialized || !stats) return false;
+    const SamScratchArena& arena = static_cast<SamContextInternal*>(ctx->env)->arena;
+    stats->capacity = arena.capacity();
+    stats->high_water = arena.high_water();
+    stats->overflow_count = arena.overflow_count();
+    return true;
+}
+
+// ============================================================
+// INSTRUMENTATION API
+// ============================================================
+
+// Percentile from the histogram, interpolated inside the bucket it
+// falls in and clamped to the observed range
+static float stats_percentile_ms(const SamStageStats& stage, double fraction) {
+    if (stage.count == 0) return 0.0f;
+    double rank = fraction * stage.count;
+    uint64_t seen = 0;
+    for (int b = 0; b < SAM_STATS_BUCKETS; b++) {
+        uint32_t n = stage.histogram[b];
+        if (n == 0 || seen + n < rank) {
+            seen += n;
+            continue;
+        }
+        double lo = b == 0 ? 0.0 : stats_bucket_start_us(b);
+        double hi = b + 1 < SAM_STATS_BUCKETS ? stats_bucket_start_us(b + 1) : static_cast<double>(stage.max_us);
+        double us = lo + (hi - lo) * (rank - seen) / n;
+        us = std::min(std::max(us, static_cast<double>(stage.min_us)), static_cast<double>(stage.max_us));
+        return static_cast<float>(us / 1000.0);
+    }
+    return stage.max_us / 1000.0f;
+}
+
+static int64_t system_now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static int trace_process_id() {
+#ifdef _WIN32
+    return static_cast<int>(GetCurrentProcessId());
+#else
+    return static_cast<int>(getpid());
+#endif
+}
+
+// Top-level objects of ORT's profile (a JSON array of events), with "ts"
+// shifted by shift_us. Events that start before the trace are dropped.
+static void append_ort_profile(const std::string& json, int64_t shift_us, std::string& out) {
+    size_t pos = json.find('[');
+    if (pos == std::string::npos) return;
+    while (true) {
+        size_t begin = json.find('{', pos);
+        if (begin == std::string::npos) return;
+        int depth = 0;
+        bool in_string = false;
+        size_t end = begin;
+        for (; end < json.size(); end++) {
+            char c = json[end];
+            if (in_string) {
+                if (c == '\\') end++;
+                else if (c == '"') in_string = false;
+            } else if (c == '"') {
+                in_string = true;
+            } else if (c == '{') {
+                depth++;
+            } else if (c == '}' && --depth == 0) {
+                break;
+            }
+        }
+        if (end >= json.size()) return;
+        pos = end + 1;
+        
+        std::string event = json.substr(begin, end + 1 - begin);
+        size_t key = event.find("\"ts\"");
+        if (key == std::string::npos) continue;
+        size_t value = event.find(':', key);
+        if (value == std::string::npos) continue;
+        value++;
+        while (value < event.size() && event[value] == ' ') value++;
+        size_t value_end = value;
+        while (value_end < event.size() && (std::isdigit(static_cast<unsigned char>(event[value_end])) || event[value_end] == '-')) {
+            value_end++;
+        }
+        if (value_end == value) continue;
+        int64_t ts = std::strtoll(event.c_str() + value, nullptr, 10) + shift_us;
+        if (ts < 0) continue;
+        event.replace(value, value_end - value, std::to_string(ts));
+        out += ",\n";
+        out += event;
+    }
+}
+
+// Ends ORT profiling on a session and merges its file into out
+static void merge_ort_session_profile(
+    Ort::Session* session,
+    Ort::AllocatorWithDefaultOptions& allocator,
+    int64_t steady_origin_us,
+    int64_t system_origin_us,
+    std::string& out
+) {
+    if (!session) return;
+    // ORT timestamps are relative to its profiling start, taken on
+    // high_resolution_clock: the system clock with libstdc++, a steady
+    // clock with libc++ / MSVC. Pick whichever one it is closest to.
+    int64_t start_us = static_cast<int64_t>(session->GetProfilingStartTimeNs() / 1000);
+    Ort::AllocatedStringPtr file = session->EndProfilingAllocated(allocator);
+    if (!file || !*file.get()) return;
+    
+    bool steady = std::llabs(steady_now_us() - start_us) < std::llabs(system_now_us() - start_us);
+    int64_t shift_us = start_us - (steady ? steady_origin_us : system_origin_us);
+    
+    std::ifstream in(file.get(), std::ios::binary);
+    if (in) {
+        std::stringstream json;
+        json << in.rdbuf();
+        append_ort_profile(json.str(), shift_us, out);
+    }
+    in.close();
+    std::remove(file.get());
+}
+
+extern "C" bool sam_get_stats(SamStats* stats) {
+    if (!stats) return false;
+    std::memset(stats, 0, sizeof(SamStats));
+    
+    for (int s = 0; s < SAM_STAGE_COUNT; s++) {
+        const SamStageCounters& counters = g_stage_counters[s];
+        SamStageStats& stage = stats->stages[s];
+        stage.count = counters.count.load(std::memory_order_relaxed);
+        stage.total_us = counters.total_us.load(std::memory_order_relaxed);
+        stage.max_us = counters.max_us.load(std::memory_order_relaxed);
+        stage.min_us = stage.count > 0 ? counters.min_us.load(std::memory_order_relaxed) : 0;
+        for (int b = 0; b < SAM_STATS_BUCKETS; b++) {
+            stage.histogram[b] = counters.histogram[b].load(std::memory_order_relaxed);
+        }
+        if (stage.count == 0) continue;
+        stage.mean_ms = static_cast<float>(stage.total_us / 1000.0 / stage.count);
+        stage.p50_ms = stats_percentile_ms(stage, 0.50);
+        stage.p90_ms = stats_percentile_ms(stage, 0.90);
+        stage.p99_ms = stats_percentile_ms(stage, 0.99);
+    }
+    
+    std::lock_guard<std::mutex> lock(g_trace.mutex);
+    stats->tracing = g_tracing.load();
+    stats->trace_events = g_trace.events.size();
+    stats->trace_dropped = g_trace.dropped;
+    return true;
+}
+
+extern "C" void sam_reset_stats(void) {
+    for (SamStageCounters& counters : g_stage_counters) {
+        counters.count.store(0, std::memory_order_relaxed);
+        counters.total_us.store(0, std::memory_order_relaxed);
+        counters.min_us.store(UINT64_MAX, std::memory_order_relaxed);
+        counters.max_us.store(0, std::memory_order_relaxed);
+        for (auto& bucket : counters.histogram) {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+extern "C" const char* sam_stage_name(int stage) {
+    if (stage < 0 || stage >= SAM_STAGE_COUNT) return nullptr;
+    return SAM_STAGE_NAMES[stage];
+}
+
+extern "C" int64_t sam_stats_now_us(void) {
+    return steady_now_us();
+}
+
+extern "C" void sam_stats_record(int stage, int64_t start_us, int64_t duration_us) {
+    stats_record(stage, start_us, duration_us);
+}
+
+extern "C" bool sam_trace_start(int max_events) {
+    if (max_events < 0) return false;
+    try {
+        std::lock_guard<std::mutex> lock(g_trace.mutex);
+        if (g_tracing.load()) return false;
+        g_trace.capacity = max_events > 0 ? max_events : SAM_DEFAULT_TRACE_EVENTS;
+        g_trace.events.clear();
+        g_trace.events.reserve(g_trace.capacity);
+        g_trace.dropped = 0;
+        g_trace.steady_origin_us = steady_now_us();
+        g_trace.system_origin_us = system_now_us();
+        g_tracing.store(true);
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+extern "C" bool sam_trace_stop(SamContext* ctx, const char* path) {
+    std::vector<SamTraceEvent> events;
+    int64_t steady_origin_us, system_origin_us;
+    {
+        std::lock_guard<std::mutex> lock(g_trace.mutex);
+        if (!g_tracing.load()) return false;
+        g_tracing.store(false);
+        events.swap(g_trace.events);
+        steady_origin_us = g_trace.steady_origin_us;
+        system_origin_us = g_trace.system_origin_us;
+    }
+    if (!path) return false;
+    
+    try {
+        int pid = trace_process_id();
+        std::string out = "{\"traceEvents\":[\n";
+        out += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + std::to_string(pid) +
+               ",\"tid\":0,\"args\":{\"name\":\"sam_inference\"}}";
+        char line[256];
+        for (const SamTraceEvent& e : events) {
+            std::snprintf(line, sizeof(line),
+                ",\n{\"name\":\"%s\",\"cat\":\"sam\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%u}",
+                SAM_STAGE_NAMES[e.stage],
+                static_cast<long long>(e.start_us - steady_origin_us),
+                static_cast<long long>(e.duration_us), pid, e.tid);
+            out += line;
+        }
+        
+        if (ctx && ctx->initialized) {
+            auto* internal = static_cast<SamContextInternal*>(ctx->env);
+            if (internal->sessions_owner) internal = internal->sessions_owner;
+            std::unique_lock<std::shared_mutex> encoder_lock(internal->encoder_mutex);
+            std::lock_guard<std::mutex> decoder_lock(internal->decoder_mutex);
+            if (!internal->profile_prefix.empty() && !internal->profiling_merged) {
+                internal->profiling_merged = true;
+                merge_ort_session_profile(internal->encoder.session, internal->allocator,
+                                          steady_origin_us, system_origin_us, out);
+                merge_ort_session_profile(internal->decoder_session, internal->allocator,
+                                          steady_origin_us, system_origin_us, out);
+            }
+        }
+        out += "\n],\n\"displayTimeUnit\":\"ms\"}\n";
+        
+        FILE* file = std::fopen(path, "wb");
+        if (!file) return false;
+        bool written = std::fwrite(out.data(), 1, out.size(), file) == out.size();
+        written = std::fclose(file) == 0 && written;
+        return written;
+    } catch (...) {
+        return false;
+    }
+}
+
+// ============================================================
+// EMBEDDING CACHE
+// ============================================================
+
+// XXH64-style hash: 4 independent 64-bit lanes keep it memory-bound
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read_u64(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t hash_bytes(const uint8_t* data, size_t len, uint64_t seed) {
+    const uint64_t P1 = 0x9E3779B185EBCA87ULL;
+    const uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+    const uint64_t P3 = 0x165667B19E3779F9ULL;
+    const uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+    const uint64_t P5 = 0x27D4EB2F165667C5ULL;
+    
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    uint64_t h;
+    
+    auto mix = [&](uint64_t acc, uint64_t lane) {
+        acc += lane * P2;
+        return rotl64(acc, 31) * P1;
+    };
+    
+    if (len >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = mix(v1, read_u64(p));
+            v2 = mix(v2, read_u64(p + 8));
+            v3 = mix(v3, read_u64(p + 16));
+            v4 = mix(v4, read_u64(p + 24));
+        }
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        for (uint64_t v : {v1, v2, v3, v4}) {
+            h = (h ^ mix(0, v)) * P1 + P4;
+        }
+    } else {
+        h = seed + P5;
+    }
+    h += len;
+    for (; p + 8 <= end; p += 8) {
+        h = rotl64(h ^ mix(0, read_u64(p)), 27) * P1 + P4;
+    }
+    for (; p < end; p++) {
+        h = rotl64(h ^ (*p * P5), 11) * P1;
+    }
+    h ^= h >> 33; h *= P2;
+    h ^= h >> 29; h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t hash_image(const uint8_t* data, int width, int height) {
+    uint64_t seed = (static_cast<uint64_t>(width) << 32) | static_cast<uint32_t>(height);
+    return hash_bytes(data, static_cast<size_t>(width) * height * 3, seed);
+}
+
+extern "C" void sam_set_cache_budget(SamContext* ctx, uint64_t max_bytes) {
+    if (!ctx || !ctx->initialized) return;
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    internal->cache.byte_budget = max_bytes;
+    internal->cache.evict_to(max_bytes);
+}
+
+extern "C" void sam_clear_cache(SamContext* ctx) {
+    if (!ctx || !ctx->initialized) return;
+    static_cast<SamContextInternal*>(ctx->env)->cache.clear();
+}
+
+extern "C" bool sam_set_cache_dtype(SamContext* ctx, int dtype) {
+    if (!ctx || !ctx->initialized) return false;
+    if (dtype != SAM_DTYPE_FLOAT32 && dtype != SAM_DTYPE_FLOAT16) return false;
+    SamEmbeddingCache& cache = static_cast<SamContextInternal*>(ctx->env)->cache;
+    cache.clear();
+    cache.dtype = dtype;
+    return true;
+}
+
+extern "C" bool sam_get_cache_stats(SamContext* ctx, SamCacheStats* stats) {
+    if (!ctx || !ctx->initialized || !stats) return false;
+    const SamEmbeddingCache& cache = static_cast<SamContextInternal*>(ctx->env)->cache;
+    stats->hits = cache.hits;
+    stats->misses = cache.misses;
+    stats->evictions = cache.evictions;
+    stats->entries = cache.entries.size();
+    stats->bytes_used = cache.bytes_used;
+    stats->byte_budget = cache.byte_budget;
+    return true;
+}
+
+extern "C" void sam_reset_cache_stats(SamContext* ctx) {
+    if (!ctx || !ctx->initialized) return;
+    SamEmbeddingCache& cache = static_cast<SamContextInternal*>(ctx->env)->cache;
+    cache.hits = 0;
+    cache.misses = 0;
+    cache.evictions = 0;
+}
+
 // ============================================================
-// INTERNAL STRUCTURES
+// EMBEDDING FILES
 // ============================================================
 
-struct SamContextInternal {
-    Ort::Env env;
-    Ort::Session* encoder_session;
-    Ort::Session* decoder_session;
-    Ort::AllocatorWithDefaultOptions allocator;
-    Ort::SessionOptions session_options;
-    
-    SamContextInternal() : env(ORT_LOGGING_LEVEL_WARNING, "SAM") {
-        session_options.SetIntraOpNumThreads(4);
-        session_options.SetGraphOptimizationLevel(GraphOptimizationLevel::ORT_ENABLE_ALL);
-    }
+static const char SAM_EMBEDDING_FILE_MAGIC[8] = {'S', 'A', 'M', 'E', 'M', 'B', 'E', 'D'};
+
+struct SamEmbeddingFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t channels;
+    uint32_t height;
+    uint32_t width;
+    int32_t image_width;
+    int32_t image_height;
+    float scale_x;
+    float scale_y;
+    uint32_t reserved;
+    uint64_t model_hash;
+    uint64_t checksum;  // Header bytes before it, then the tensor
 };
+static_assert(sizeof(SamEmbeddingFileHeader) == 64, "embedding file header must stay 64 bytes");
 
-// ============================================================
-// INITIALIZATION
-// ============================================================
+struct SamMappedEmbedding {
+    std::shared_ptr<SamMappedFile> file;
+};
 
-extern "C" SamContext* sam_init(const char* encoder_path, const char* decoder_path) {
-    try {
-        auto* internal = new SamContextInternal();
-        
-        // Load encoder
-        internal->encoder_session = new Ort::Session(
-            internal->env, 
-            encoder_path, 
-            internal->session_options
-        );
-        
-        // Load decoder
-        internal->decoder_session = new Ort::Session(
-            internal->env, 
-            decoder_path, 
-            internal->session_options
-        );
-        
-        auto* ctx = new SamContext();
-        ctx->encoder_session = internal->encoder_session;
-        ctx->decoder_session = internal->decoder_session;
-        ctx->env = internal;
-        ctx->initialized = true;
-        
-        return ctx;
-    } catch (...) {
-        return nullptr;
-    }
+static uint64_t embedding_file_checksum(const SamEmbeddingFileHeader& header, const void* tensor, size_t bytes) {
+    uint64_t seed = hash_bytes(reinterpret_cast<const uint8_t*>(&header), offsetof(SamEmbeddingFileHeader, checksum), 0);
+    return hash_bytes(static_cast<const uint8_t*>(tensor), bytes, seed);
 }
 
-extern "C" void sam_free(SamContext* ctx) {
-    if (ctx) {
-        auto* internal = static_cast<SamContextInternal*>(ctx->env);
-        delete static_cast<Ort::Session*>(ctx->encoder_session);
-        delete static_cast<Ort::Session*>(ctx->decoder_session);
-        delete internal;
-        delete ctx;
+extern "C" uint64_t sam_get_encoder_hash(SamContext* ctx) {
+    if (!ctx || !ctx->initialized) return 0;
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    if (internal->sessions_owner) internal = internal->sessions_owner;
+    
+    try {
+        std::shared_lock<std::shared_mutex> active_lock(internal->encoder_mutex);
+        SamEncoderVariant& variant = internal->encoder_variants[internal->active_encoder];
+        std::lock_guard<std::mutex> lock(internal->model_hash_mutex);
+        if (variant.model_hash == 0) {
+            auto file = SamMappedFile::open(variant.path);
+            if (!file) return 0;
+            variant.model_hash = hash_bytes(static_cast<const uint8_t*>(file->data()), file->size(), file->size());
+        }
+        return variant.model_hash;
+    } catch (...) {
+        return 0;
     }
 }
 
-// ============================================================
-// PREPROCESSING
-// ============================================================
-
-extern "C" void sam_preprocess_image(
-    const uint8_t* rgb_data,
-    int width,
-    int height,
-    float* output,
-    float* scale_x,
-    float* scale_y
+extern "C" bool sam_embedding_save(
+    SamContext* ctx,
+    const SamEmbedding* embedding,
+    int image_width,
+    int image_height,
+    const char* path
 ) {
-    // Calculate resize scale (longest side to 1024)
-    float scale = static_cast<float>(SAM_IMAGE_SIZE) / std::max(width, height);
-    int new_width = static_cast<int>(width * scale);
-    int new_height = static_cast<int>(height * scale);
-    
-    *scale_x = scale;
-    *scale_y = scale;
+    if (!embedding || !path || image_width <= 0 || image_height <= 0) return false;
+    bool half = embedding->dtype == SAM_DTYPE_FLOAT16;
+    const void* tensor = half ? static_cast<const void*>(embedding->half_data) : static_cast<const void*>(embedding->data);
+    if (!tensor || (!half && embedding->dtype != SAM_DTYPE_FLOAT32)) return false;
     
-    // Allocate resized buffer
-    std::vector<float> resized(new_width * new_height * 3);
-    
-    // Bilinear resize
-    for (int y = 0; y < new_height; y++) {
-        for (int x = 0; x < new_width; x++) {
-            float src_x = x / scale;
-            float src_y = y / scale;
-            
-            int x0 = static_cast<int>(src_x);
-            int y0 = static_cast<int>(src_y);
-            int x1 = std::min(x0 + 1, width - 1);
-            int y1 = std::min(y0 + 1, height - 1);
-            
-            float wx = src_x - x0;
-            float wy = src_y - y0;
-            
-            for (int c = 0; c < 3; c++) {
-                float v00 = rgb_data[(y0 * width + x0) * 3 + c];
-                float v01 = rgb_data[(y0 * width + x1) * 3 + c];
-                float v10 = rgb_data[(y1 * width + x0) * 3 + c];
-                float v11 = rgb_data[(y1 * width + x1) * 3 + c];
-                
-                float v = (1 - wx) * (1 - wy) * v00 +
-                          wx * (1 - wy) * v01 +
-                          (1 - wx) * wy * v10 +
-                          wx * wy * v11;
-                
-                resized[(y * new_width + x) * 3 + c] = v;
-            }
-        }
-    }
+    uint64_t model_hash = sam_get_encoder_hash(ctx);
+    if (model_hash == 0) return false;
     
-    // Normalize and copy to output (NCHW format with padding)
-    std::memset(output, 0, SAM_IMAGE_SIZE * SAM_IMAGE_SIZE * 3 * sizeof(float));
+    SamEmbeddingFileHeader header = {};
+    std::memcpy(header.magic, SAM_EMBEDDING_FILE_MAGIC, sizeof(header.magic));
+    header.version = SAM_EMBEDDING_FILE_VERSION;
+    header.dtype = static_cast<uint32_t>(embedding->dtype);
+    header.channels = SAM_EMBEDDING_DIM;
+    header.height = SAM_EMBEDDING_SIZE;
+    header.width = SAM_EMBEDDING_SIZE;
+    header.image_width = image_width;
+    header.image_height = image_height;
+    header.scale_x = header.scale_y = static_cast<float>(SAM_IMAGE_SIZE) / std::max(image_width, image_height);
+    header.model_hash = model_hash;
+    size_t bytes = embedding_bytes(embedding->dtype);
+    header.checksum = embedding_file_checksum(header, tensor, bytes);
     
-    for (int c = 0; c < 3; c++) {
-        for (int y = 0; y < new_height; y++) {
-            for (int x = 0; x < new_width; x++) {
-                float pixel = resized[(y * new_width + x) * 3 + c] / 255.0f;
-                pixel = (pixel - SAM_MEAN[c]) / SAM_STD[c];
-                output[c * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE + y * SAM_IMAGE_SIZE + x] = pixel;
-            }
-        }
+    // Publish under path only once complete
+    std::string pending = std::string(path) + ".tmp";
+    FILE* file = std::fopen(pending.c_str(), "wb");
+    if (!file) return false;
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   std::fwrite(tensor, 1, bytes, file) == bytes;
+    written = std::fclose(file) == 0 && written;
+#ifdef _WIN32
+    if (written) std::remove(path);  // rename does not replace on Windows
+#endif
+    if (!written || std::rename(pending.c_str(), path) != 0) {
+        std::remove(pending.c_str());
+        return false;
     }
+    return true;
 }
 
-// ============================================================
-// ENCODER
-// ============================================================
-
-extern "C" bool sam_encode_image(
+extern "C" SamMappedEmbedding* sam_embedding_map(
     SamContext* ctx,
-    const float* preprocessed_image,
-    SamEmbedding* embedding
+    const char* path,
+    SamEmbedding* embedding,
+    SamEmbeddingFileInfo* info
 ) {
-    if (!ctx || !ctx->initialized) return false;
+    if (info) std::memset(info, 0, sizeof(SamEmbeddingFileInfo));
+    if (!ctx || !ctx->initialized || !path || !embedding) return nullptr;
     
     try {
-        auto* session = static_cast<Ort::Session*>(ctx->encoder_session);
-        auto* internal = static_cast<SamContextInternal*>(ctx->env);
-        
-        // Input tensor
-        std::array<int64_t, 4> input_shape = {1, 3, SAM_IMAGE_SIZE, SAM_IMAGE_SIZE};
-        auto memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
-        
-        Ort::Value input_tensor = Ort::Value::CreateTensor<float>(
-            memory_info,
-            const_cast<float*>(preprocessed_image),
-            3 * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE,
-            input_shape.data(),
-            input_shape.size()
-        );
+        auto file = SamMappedFile::open(path);
+        if (!file || file->size() < sizeof(SamEmbeddingFileHeader)) return nullptr;
         
-        // Run inference
-        const char* input_names[] = {"image"};
-        const char* output_names[] = {"image_embeddings"};
-        
-        auto output_tensors = session->Run(
-            Ort::RunOptions{nullptr},
-            input_names,
-            &input_tensor,
-            1,
-            output_names,
-            1
-        );
+        const auto* base = static_cast<const uint8_t*>(file->data());
+        SamEmbeddingFileHeader header;
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, SAM_EMBEDDING_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.version != SAM_EMBEDDING_FILE_VERSION) {
+            return nullptr;
+        }
+        if (info) {
+            info->version = header.version;
+            info->dtype = static_cast<int>(header.dtype);
+            info->image_width = header.image_width;
+            info->image_height = header.image_height;
+            info->scale_x = header.scale_x;
+            info->scale_y = header.scale_y;
+            info->model_hash = header.model_hash;
+        }
         
-        // Copy output
-        float* output_data = output_tensors[0].GetTensorMutableData<float>();
-        size_t output_size = SAM_EMBEDDING_DIM * SAM_EMBEDDING_SIZE * SAM_EMBEDDING_SIZE;
-        std::memcpy(embedding->data, output_data, output_size * sizeof(float));
+        if (header.dtype != SAM_DTYPE_FLOAT32 && header.dtype != SAM_DTYPE_FLOAT16) return nullptr;
+        if (header.channels != SAM_EMBEDDING_DIM || header.height != SAM_EMBEDDING_SIZE ||
+            header.width != SAM_EMBEDDING_SIZE) {
+            return nullptr;
+        }
+        size_t bytes = embedding_bytes(static_cast<int>(header.dtype));
+        const uint8_t* tensor = base + sizeof(header);
+        if (file->size() != sizeof(header) + bytes) return nullptr;
+        if (header.checksum != embedding_file_checksum(header, tensor, bytes)) return nullptr;
+        if (header.model_hash != sam_get_encoder_hash(ctx)) return nullptr;
         
+        // The mapping is read-only; the decoder only reads its inputs
+        bool half = header.dtype == SAM_DTYPE_FLOAT16;
+        embedding->data = half ? nullptr : reinterpret_cast<float*>(const_cast<uint8_t*>(tensor));
+        embedding->half_data = half ? reinterpret_cast<uint16_t*>(const_cast<uint8_t*>(tensor)) : nullptr;
         embedding->batch_size = 1;
         embedding->channels = SAM_EMBEDDING_DIM;
         embedding->height = SAM_EMBEDDING_SIZE;
         embedding->width = SAM_EMBEDDING_SIZE;
+        embedding->dtype = static_cast<int>(header.dtype);
         
-        return true;
+        auto* mapped = new SamMappedEmbedding();
+        mapped->file = std::move(file);
+        return mapped;
     } catch (...) {
-        return false;
+        return nullptr;
     }
 }
 
+extern "C" void sam_embedding_unmap(SamMappedEmbedding* mapping) {
+    delete mapping;
+}
+
 // ============================================================
-// DECODER
+// ENCODER VARIANTS
 // ============================================================
 
-extern "C" bool sam_decode_mask(
+// Make `model` the active encoder and return the previous one. Cached
+// embeddings came from the old model, so the cache is dropped.
+static SamEncoderModel install_encoder(SamContext* ctx, SamEncoderModel model, int index) {
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    std::unique_lock<std::shared_mutex> lock(internal->encoder_mutex);
+    std::swap(internal->encoder, model);
+    internal->active_encoder = index;
+    internal->encode_batch_limit = internal->encoder.max_batch;
+    internal->cache.clear();
+    ctx->encoder_session = internal->encoder.session;
+    return model;
+}
+
+extern "C" int sam_get_encoder_variant_count(SamContext* ctx) {
+    if (!ctx || !ctx->initialized) return 0;
+    return static_cast<int>(static_cast<SamContextInternal*>(ctx->env)->encoder_variants.size());
+}
+
+extern "C" bool sam_get_encoder_variant(SamContext* ctx, int index, SamEncoderVariantInfo* info) {
+    if (!ctx || !ctx->initialized || !info) return false;
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    if (index < 0 || index >= static_cast<int>(internal->encoder_variants.size())) return false;
+    
+    const SamEncoderVariant& variant = internal->encoder_variants[index];
+    std::memset(info->name, 0, sizeof(info->name));
+    std::strncpy(info->name, variant.name.c_str(), sizeof(info->name) - 1);
+    info->file_bytes = variant.file_bytes;
+    info->quantized = variant.quantized;
+    info->active = index == internal->active_encoder;
+    info->latency_ms = variant.latency_ms;
+    info->min_iou = variant.min_iou;
+    return true;
+}
+
+extern "C" bool sam_set_encoder_variant(SamContext* ctx, int index) {
+    if (!ctx || !ctx->initialized) return false;
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    if (internal->model) return false;
+    if (index < 0 || index >= static_cast<int>(internal->encoder_variants.size())) return false;
+    if (index == internal->active_encoder) return true;
+    
+    try {
+        SamEncoderModel model = load_encoder(internal, internal->encoder_variants[index].path);
+        delete install_encoder(ctx, model, index).session;
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+extern "C" int sam_select_encoder(
     SamContext* ctx,
-    const SamEmbedding* embedding,
-    const SamPointPrompt* prompt,
-    SamMaskResult* result
+    const uint8_t* const* images,
+    const int* widths,
+    const int* heights,
+    const float* points_xy,
+    int num_images,
+    float min_iou
 ) {
-    if (!ctx || !ctx->initialized) return false;
+    if (!ctx || !ctx->initialized || !images || !widths || !heights || !points_xy || num_images <= 0) return -1;
+    
+    auto* internal = static_cast<SamContextInternal*>(ctx->env);
+    if (internal->model) return -1;
+    const int num_variants = static_cast<int>(internal->encoder_variants.size());
+    const size_t mask_floats = SAM_MASK_SIZE * SAM_MASK_SIZE;
     
     try {
-        auto* session = static_cast<Ort::Session*>(ctx->decoder_session);
-        auto memory_info = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+        std::vector<float> preprocessed(3 * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE);
+        std::vector<float> embedding_data(SAM_EMBEDDING_FLOATS);
+        std::vector<float> masks(SAM_NUM_MASKS * mask_floats);
+        std::vector<float> iou_scores(SAM_NUM_MASKS);
+        std::vector<float> reference(num_images * mask_floats);
+        std::vector<int> reference_idx(num_images);
+        std::vector<double> times_ms(num_images);
         
-        // Image embeddings tensor
-        std::array<int64_t, 4> emb_shape = {1, SAM_EMBEDDING_DIM, SAM_EMBEDDING_SIZE, SAM_EMBEDDING_SIZE};
-        Ort::Value emb_tensor = Ort::Value::CreateTensor<float>(
-            memory_info,
-            const_cast<float*>(embedding->data),
-            SAM_EMBEDDING_DIM * SAM_EMBEDDING_SIZE * SAM_EMBEDDING_SIZE,
-            emb_shape.data(),
-            emb_shape.size()
-        );
+        float coords[2];
+        int label = 1;
+        SamEmbedding embedding = {embedding_data.data(), 1, SAM_EMBEDDING_DIM, SAM_EMBEDDING_SIZE, SAM_EMBEDDING_SIZE,
+                                  SAM_DTYPE_FLOAT32, nullptr};
+        SamPointPrompt prompt = {coords, &label, 1};
+        SamMaskResult result = {masks.data(), iou_scores.data(), 0};
+        Ort::RunOptions run_options;
         
-        // Point coords tensor
-        std::array<int64_t, 3> coords_shape = {1, prompt->num_points, 2};
-        Ort::Value coords_tensor = Ort::Value::CreateTensor<float>(
-            memory_info,
-            const_cast<float*>(prompt->coords),
-            prompt->num_points * 2,
-            coords_shape.data(),
-            coords_shape.size()
-        );
+        // Variants are measured one at a time; only the active session and
+        // the fastest acceptable candidate so far stay loaded
+        std::shared_lock<std::shared_mutex> active_lock(internal->encoder_mutex);
+        // (sessions are declared after their models so they go first)
+        int best = -1;
+        float best_latency = 0.0f;
+        SamEncoderModel best_model;
+        std::unique_ptr<Ort::Session> best_session;
         
-        // Point labels tensor (convert int to int64)
-        std::vector<int64_t> labels_i64(prompt->num_points);
-        for (int i = 0; i < prompt->num_points; i++) {
-            labels_i64[i] = prompt->labels[i];
+        for (int v = 0; v < num_variants; v++) {
+            SamEncoderVariant& variant = internal->encoder_variants[v];
+            SamEncoderModel model;
+            std::unique_ptr<Ort::Session> loaded;
+            if (v == internal->active_encoder) {
+                model = internal->encoder;
+            } else {
+                model = load_encoder(internal, variant.path);
+                loaded.reset(model.session);
+            }
+            
+            float worst_iou = 1.0f;
+            for (int i = 0; i < num_images; i++) {
+                float scale_x, scale_y;
+                sam_preprocess_image_parallel(ctx, images[i], widths[i], heights[i], preprocessed.data(),
+                                              &scale_x, &scale_y);
+                
+                // First run pays for ORT's lazy allocations, keep it out of the timing
+                if (i == 0) encode_with_model(model, preprocessed.data(), &embedding, run_options);
+                auto start = std::chrono::steady_clock::now();
+                encode_with_model(model, preprocessed.data(), &embedding, run_options);
+                times_ms[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                
+                sam_transform_coords(points_xy[i*2], points_xy[i*2+1], widths[i], heights[i], &coords[0], &coords[1]);
+                if (!run_decoder(ctx, &embedding, &prompt, &result, run_options, false)) return -1;
+                
+                // Compare the mask the reference picked, so IoU reflects
+                // embedding fidelity rather than candidate ranking
+                float* ref_mask = &reference[i * mask_floats];
+                if (v == 0) {
+                    reference_idx[i] = result.best_mask_idx;
+                    std::memcpy(ref_mask, masks.data() + result.best_mask_idx * mask_floats, mask_floats * sizeof(float));
+                } else {
+                    float iou = sam_mask_iou(ref_mask, masks.data() + reference_idx[i] * mask_floats,
+                                             static_cast<int>(mask_floats), 0.0f);
+                    worst_iou = std::min(worst_iou, iou);
+                }
+            }
+            
+            std::nth_element(times_ms.begin(), times_ms.begin() + num_images / 2, times_ms.end());
+            variant.latency_ms = static_cast<float>(times_ms[num_images / 2]);
+            variant.min_iou = worst_iou;
+            
+            if (worst_iou >= min_iou && (best < 0 || variant.latency_ms < best_latency)) {
+                best = v;
+                best_latency = variant.latency_ms;
+                best_session = std::move(loaded);
+                best_model = model;
+            }
         }
-        std::array<int64_t, 2> labels_shape = {1, prompt->num_points};
-        Ort::Value labels_tensor = Ort::Value::CreateTensor<int64_t>(
-            memory_info,
-            labels_i64.data(),
-            prompt->num_points,
-            labels_shape.data(),
-            labels_shape.size()
-        );
-        
-        // Run inference
-        const char* input_names[] = {"image_embeddings", "point_coords", "point_labels"};
-        const char* output_names[] = {"masks", "iou_predictions"};
-        
-        std::vector<Ort::Value> input_tensors;
-        input_tensors.push_back(std::move(emb_tensor));
-        input_tensors.push_back(std::move(coords_tensor));
-        input_tensors.push_back(std::move(labels_tensor));
-        
-        auto output_tensors = session->Run(
-            Ort::RunOptions{nullptr},
-            input_names,
-            input_tensors.data(),
-            input_tensors.size(),
-            output_names,
-            2
-        );
         
-        // Copy masks
-        float* masks_data = output_tensors[0].GetTensorMutableData<float>();
-        size_t masks_size = SAM_NUM_MASKS * SAM_MASK_SIZE * SAM_MASK_SIZE;
-        std::memcpy(result->masks, masks_data, masks_size * sizeof(float));
-        
-        // Copy IoU scores and find best
-        float* iou_data = output_tensors[1].GetTensorMutableData<float>();
-        std::memcpy(result->iou_scores, iou_data, SAM_NUM_MASKS * sizeof(float));
-        
-        result->best_mask_idx = 0;
-        float best_iou = iou_data[0];
-        for (int i = 1; i < SAM_NUM_MASKS; i++) {
-            if (iou_data[i] > best_iou) {
-                best_iou = iou_data[i];
-                result->best_mask_idx = i;
-            }
+        active_lock.unlock();
+        {
+            // The scratch embedding is about to go away
+            std::lock_guard<std::mutex> lock(internal->decoder_mutex);
+            internal->decoder_io.embedding = nullptr;
         }
         
-        return true;
+        if (best >= 0 && best != internal->active_encoder) {
+            best_session.release();
+            delete install_encoder(ctx, best_model, best).session;
+        }
+        return best;
     } catch (...) {
-        return false;
+        return -1;
     }
 }
 
 // ============================================================
-// POSTPROCESSING
+// CONVENIENCE FUNCTION
 // ============================================================
 
-extern "C" void sam_postprocess_mask(
-    const float* mask,
-    int output_width,
-    int output_height,
-    uint8_t* output,
-    float threshold
+// Encode (or look up) the image and decode the prompt. On success the
+// best mask's logits are left in the context arena and its predicted
+// IoU (which may be negative) in *best_iou.
+static bool segment_best_mask(
+    SamContext* ctx,
+    const uint8_t* rgb_data,
+    int width,
+    int height,
+    const float* points_x,
+    const float* points_y,
+    const int* labels,
+    int num_points,
+    const float** best_mask,
+    float* best_iou
 ) {
-    // Bilinear resize from 256x256 to output size
-    float scale_x = static_cast<float>(SAM_MASK_SIZE) / output_width;
-    float scale_y = static_cast<float>(SAM_MASK_SIZE) / output_height;
+    if (!ctx || !ctx->initialized || num_points == 0) return false;
     
-    for (int y = 0; y < output_height; y++) {
-        for (int x = 0; x < output_width; x++) {
-            float src_x = x * scale_x;
-            float src_y = y * scale_y;
-            
-            int x0 = static_cast<int>(src_x);
-            int y0 = static_cast<int>(src_y);
-            int x1 = std::min(x0 + 1, SAM_MASK_SIZE - 1);
-            int y1 = std::min(y0 + 1, SAM_MASK_SIZE - 1);
-            
-            float wx = src_x - x0;
-            float wy = src_y - y0;
-            
-            float v = (1 - wx) * (1 - wy) * mask[y0 * SAM_MASK_SIZE + x0] +
-                      wx * (1 - wy) * mask[y0 * SAM_MASK_SIZE + x1] +
-                      (1 - wx) * wy * mask[y1 * SAM_MASK_SIZE + x0] +
-                      wx * wy * mask[y1 * SAM_MASK_SIZE + x1];
-            
-            output[y * output_width + x] = (v > threshold) ? 255 : 0;
+    try {
+        auto* internal = static_cast<SamContextInternal*>(ctx->env);
+        SamEmbeddingCache& cache = internal->cache;
+        SamScratchArena& arena = internal->arena;
+        
+        // Per-call buffers come from the context arena. Fixed-size buffers
+        // go first so their addresses (and the decoder binding) stay stable.
+        arena.reset();
+        float* masks = arena.alloc<float>(SAM_NUM_MASKS * SAM_MASK_SIZE * SAM_MASK_SIZE);
+        float* iou_scores = arena.alloc<float>(SAM_NUM_MASKS);
+        float* coords = arena.alloc<float>(2 * std::max(num_points, SAM_MAX_POINTS));
+        
+        // Look up embedding, encode on miss
+        uint64_t key = hash_image(rgb_data, width, height);
+        SamCacheEntry* entry = cache.find(key, width, height);
+        SamEmbedding embedding;
+        
+        if (entry) {
+            embedding = entry->view(cache.dtype);
+        } else {
+            float* preprocessed = arena.alloc<float>(3 * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE);
+            float scale_x, scale_y;
+            sam_preprocess_image_parallel(ctx, rgb_data, width, height, preprocessed, &scale_x, &scale_y);
+        
+            // Encode straight into a cache slot (or scratch when caching is off)
+            SamCacheEntry* slot = cache.admits() ? cache.prepare(key, width, height) : nullptr;
+            if (slot) {
+                embedding = slot->view(cache.dtype);
+            } else if (cache.dtype == SAM_DTYPE_FLOAT16) {
+                embedding = {nullptr, 1, SAM_EMBEDDING_DIM, SAM_EMBEDDING_SIZE, SAM_EMBEDDING_SIZE,
+                             SAM_DTYPE_FLOAT16, arena.alloc<uint16_t>(SAM_EMBEDDING_FLOATS)};
+            } else {
+                embedding = {arena.alloc<float>(SAM_EMBEDDING_FLOATS), 1, SAM_EMBEDDING_DIM, SAM_EMBEDDING_SIZE,
+                             SAM_EMBEDDING_SIZE, SAM_DTYPE_FLOAT32, nullptr};
+            }
+            if (!sam_encode_image(ctx, preprocessed, &embedding)) {
+                if (slot) cache.discard(slot);
+                return false;
+            }
+            if (slot) {
+                slot->scale_x = scale_x;
+                slot->scale_y = scale_y;
+            }
+        }
+        
+        // Transform coordinates
+        for (int i = 0; i < num_points; i++) {
+            sam_transform_coords(points_x[i], points_y[i], width, height, &coords[i*2], &coords[i*2+1]);
         }
+        
+        // Decode (labels are only read, no copy needed)
+        SamPointPrompt prompt = {coords, const_cast<int*>(labels), num_points};
+        SamMaskResult result = {masks, iou_scores, 0};
+        if (!sam_decode_mask(ctx, &embedding, &prompt, &result)) {
+            return false;
+        }
+        
+        *best_mask = masks + result.best_mask_idx * SAM_MASK_SIZE * SAM_MASK_SIZE;
+        *best_iou = iou_scores[result.best_mask_idx];
+        return true;
+    } catch (...) {
+        // bad_alloc growing the arena (num_points > SAM_MAX_POINTS) or a cache slot
+        return false;
     }
 }
 
-extern "C" void sam_transform_coords(
-    float orig_x, float orig_y,
-    int orig_width, int orig_height,
-    float* sam_x, float* sam_y
-) {
-    float scale = static_cast<float>(SAM_IMAGE_SIZE) / std::max(orig_width, orig_height);
-    *sam_x = orig_x * scale;
-    *sam_y = orig_y * scale;
-}
-
-// ============================================================
-// CONVENIENCE FUNCTION
-// ============================================================
-
 extern "C" float sam_segment(
     SamContext* ctx,
     const uint8_t* rgb_data,
@@ -354,41 +4152,43 @@ extern "C" float sam_segment(
     int num_points,
     uint8_t* output_mask
 ) {
-    if (!ctx || !ctx->initialized || num_points == 0) return -1.0f;
-    
-    // Allocate buffers
-    std::vector<float> preprocessed(3 * SAM_IMAGE_SIZE * SAM_IMAGE_SIZE);
-    std::vector<float> embedding_data(SAM_EMBEDDING_DIM * SAM_EMBEDDING_SIZE * SAM_EMBEDDING_SIZE);
-    std::vector<float> masks(SAM_NUM_MASKS * SAM_MASK_SIZE * SAM_MASK_SIZE);
-    std::vector<float> iou_scores(SAM_NUM_MASKS);
-    std::vector<float> coords(num_points * 2);
-    std::vector<int> labels_copy(labels, labels + num_points);
-    
-    // Preprocess
-    float scale_x, scale_y;
-    sam_preprocess_image(rgb_data, width, height, preprocessed.data(), &scale_x, &scale_y);
-    
-    // Transform coordinates
-    for (int i = 0; i < num_points; i++) {
-        sam_transform_coords(points_x[i], points_y[i], width, height, &coords[i*2], &coords[i*2+1]);
+    SamStageTimer timer(SAM_STAGE_SEGMENT);
+    const float* best_mask = nullptr;
+    float iou = 0.0f;
+    if (!segment_best_mask(ctx, rgb_data, width, height, points_x, points_y, labels, num_points, &best_mask, &iou)) {
+        return -1.0f;
     }
     
-    // Encode
-    SamEmbedding embedding = {embedding_data.data(), 1, SAM_EMBEDDING_DIM, SAM_EMBEDDING_SIZE, SAM_EMBEDDING_SIZE};
-    if (!sam_encode_image(ctx, preprocessed.data(), &embedding)) {
+    // Postprocess best mask
+    sam_postprocess_mask_parallel(ctx, best_mask, width, height, output_mask, 0.0f);
+    return iou;
+}
+
+extern "C" float sam_segment_compact(
+    SamContext* ctx,
+    const uint8_t* rgb_data,
+    int width,
+    int height,
+    const float* points_x,
+    const float* points_y,
+    const int* labels,
+    int num_points,
+    float epsilon,
+    SamCompactMask* out
+) {
+    if (!out) return -1.0f;
+    SamStageTimer timer(SAM_STAGE_SEGMENT);
+    const float* best_mask = nullptr;
+    float iou = 0.0f;
+    if (!segment_best_mask(ctx, rgb_data, width, height, points_x, points_y, labels, num_points, &best_mask, &iou)) {
         return -1.0f;
     }
     
-    // Decode
-    SamPointPrompt prompt = {coords.data(), labels_copy.data(), num_points};
-    SamMaskResult result = {masks.data(), iou_scores.data(), 0};
-    if (!sam_decode_mask(ctx, &embedding, &prompt, &result)) {
+    try {
+        auto* internal = static_cast<SamContextInternal*>(ctx->env);
+        if (!compact_mask(best_mask, width, height, 0.0f, epsilon, out, internal->arena)) return -1.0f;
+    } catch (...) {
         return -1.0f;
     }
-    
-    // Postprocess best mask
-    float* best_mask = masks.data() + result.best_mask_idx * SAM_MASK_SIZE * SAM_MASK_SIZE;
-    sam_postprocess_mask(best_mask, width, height, output_mask, 0.0f);
-    
-    return iou_scores[result.best_mask_idx];
-}
+    return iou;
+}
\ No newline at end of file
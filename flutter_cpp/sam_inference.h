@@ -29,6 +29,54 @@ extern "C" {
 #define SAM_MASK_SIZE 256
 #define SAM_NUM_MASKS 4
 
+// Embedding storage types (SamEmbedding::dtype)
+#define SAM_DTYPE_FLOAT32 0
+#define SAM_DTYPE_FLOAT16 1
+
+// Embedding cache default budget: 4 images (4 MB each)
+#define SAM_EMBEDDING_BYTES (SAM_EMBEDDING_DIM * SAM_EMBEDDING_SIZE * SAM_EMBEDDING_SIZE * 4)
+#define SAM_DEFAULT_CACHE_BUDGET (4 * SAM_EMBEDDING_BYTES)
+
+// Batched encoding (sam_encode_images): default memory budget per run,
+// peak memory of one image through the SAM ViT-B encoder (mostly its
+// 12 x 4096 x 4096 global attention maps) and the largest batch
+#define SAM_DEFAULT_ENCODE_BUDGET (4ULL << 30)
+#define SAM_ENCODE_IMAGE_BYTES (1ULL << 30)
+#define SAM_MAX_ENCODE_BATCH 16
+
+// CPU execution providers (SamConfig::execution_provider)
+#define SAM_PROVIDER_CPU 0
+#define SAM_PROVIDER_XNNPACK 1
+
+// Spin-wait policy for ONNX Runtime worker threads (SamConfig::spin_wait)
+#define SAM_SPIN_DEFAULT 0     // ONNX Runtime default (spins)
+#define SAM_SPIN_ENABLED 1     // Lowest latency, burns CPU between ops
+#define SAM_SPIN_DISABLED 2    // Threads sleep between ops (battery, shared machines)
+
+// Pixel formats for camera frames (SamImage::format)
+#define SAM_PIXEL_RGB 0        // Packed RGB888
+#define SAM_PIXEL_RGBA 1       // Packed RGBA8888
+#define SAM_PIXEL_BGRA 2       // Packed BGRA8888 (iOS camera)
+#define SAM_PIXEL_YUV420 3     // Y, U, V planes (Android YUV_420_888, I420, NV12 via pixel stride 2)
+#define SAM_PIXEL_NV21 4       // Y plane + interleaved VU plane
+
+// Instrumented stages (sam_get_stats, trace events)
+#define SAM_STAGE_PREPROCESS 0
+#define SAM_STAGE_ENCODE 1
+#define SAM_STAGE_DECODE 2
+#define SAM_STAGE_POSTPROCESS 3    // Full-size and compact masks
+#define SAM_STAGE_ARUCO 4          // L-board detection (single frames and tracker)
+#define SAM_STAGE_MEASURE 5        // Foot measurement
+#define SAM_STAGE_SEGMENT 6        // Whole sam_segment / sam_segment_compact call
+#define SAM_STAGE_COUNT 7
+
+// Latency histogram: 4 buckets per power of two microseconds; bucket
+// 4 * k + q starts at 2^k * (4 + q) / 4 us, the last one is open-ended
+#define SAM_STATS_BUCKETS 96
+
+// Embedding file format version (sam_embedding_save)
+#define SAM_EMBEDDING_FILE_VERSION 1
+
 // Normalization constants (ImageNet)
 static const float SAM_MEAN[3] = {0.485f, 0.456f, 0.406f};
 static const float SAM_STD[3] = {0.229f, 0.224f, 0.225f};
@@ -43,8 +91,20 @@ typedef struct {
     int channels;
     int height;
     int width;
+    int dtype;             // SAM_DTYPE_FLOAT32 (default) or SAM_DTYPE_FLOAT16
+    uint16_t* half_data;   // [1, 256, 64, 64] IEEE half values (2 MB), FLOAT16 only
 } SamEmbedding;
 
+// Camera frame for sam_preprocess_frame
+typedef struct {
+    int format;                // SAM_PIXEL_*
+    int width;
+    int height;
+    const uint8_t* planes[3];  // RGB/RGBA/BGRA: [0]; YUV420: Y, U, V; NV21: Y, VU
+    int row_strides[3];        // Bytes per row of each plane (0 = tightly packed)
+    int pixel_strides[3];      // YUV420 chroma: bytes between samples (1 = I420, 2 = semi-planar; 0 = 1)
+} SamImage;
+
 typedef struct {
     float* coords;         // [N, 2] - (x, y) in 1024x1024 space
     int* labels;           // [N] - 1=foreground, 0=background
@@ -57,6 +117,134 @@ typedef struct {
     int best_mask_idx;     // Index of highest IoU mask
 } SamMaskResult;
 
+// Compact mask (sam_segment_compact / sam_mask_to_compact). The caller
+// owns runs and contour; either may be NULL to skip that output.
+typedef struct {
+    uint32_t* runs;        // Row-major run lengths over [height, width], alternating
+                           // background/foreground, starting with background (may be 0)
+    int run_capacity;      // Entries available in runs
+    int num_runs;          // Written: runs produced (required size if above capacity)
+    float* contour;        // [N, 2] closed outline (x, y) in original image pixels,
+                           // clockwise on screen, first point not repeated
+    int contour_capacity;  // Points available in contour
+    int num_points;        // Written: points produced (required size if above capacity)
+    int width;             // Written: mask size the runs describe
+    int height;
+    uint64_t area;         // Written: foreground pixels
+} SamCompactMask;
+
+typedef struct {
+    uint64_t hits;         // sam_segment calls served from cache
+    uint64_t misses;       // sam_segment calls that ran the encoder
+    uint64_t evictions;    // Entries dropped to stay within budget
+    uint64_t entries;      // Embeddings currently cached
+    uint64_t bytes_used;   // Bytes held by cached embeddings
+    uint64_t byte_budget;  // Configured maximum (0 = cache disabled)
+} SamCacheStats;
+
+// Startup options (zero-initialized = defaults)
+typedef struct {
+    const char* cache_dir;     // Writable directory for optimized graphs (NULL = no caching)
+    bool disable_memory_map;   // Read model files instead of mapping them
+    bool warm_up;              // Run encoder and decoder once on dummy inputs during init
+} SamStartupOptions;
+
+// Startup phase timings (sam_get_startup_stats)
+typedef struct {
+    float encoder_map_ms;      // Mapping the model file(s)
+    float encoder_session_ms;  // Session creation (parse + optimize, or cached graph load)
+    float decoder_map_ms;
+    float decoder_session_ms;
+    float warm_up_encoder_ms;  // 0 when warm-up is off
+    float warm_up_decoder_ms;
+    float total_ms;            // Whole init call
+    bool encoder_from_cache;   // Optimized graph reused from cache_dir
+    bool decoder_from_cache;
+    bool memory_mapped;
+} SamStartupStats;
+
+// Session configuration (zero-initialized = defaults)
+typedef struct {
+    int intra_op_threads;          // Threads per operator (0 = 4); also sizes the pre/postprocessing pool
+    int inter_op_threads;          // >1 runs independent graph branches in parallel (0/1 = sequential)
+    int spin_wait;                 // SAM_SPIN_*
+    const char* intra_op_affinity; // ORT affinity list, one entry per thread after the first,
+                                   // e.g. "1;2;3" for 4 threads (NULL = leave to the OS)
+    bool disable_memory_arena;     // Release ORT buffers after each run instead of pooling them
+    bool disable_memory_pattern;   // Skip ORT's planned allocation pattern
+    int execution_provider;        // SAM_PROVIDER_*; unavailable providers fall back to CPU
+    SamStartupOptions startup;     // Optimized-graph cache, memory mapping, warm-up
+    const char* profile_prefix;    // ORT profiling file prefix, e.g. "<dir>/sam_ort" (NULL = off);
+                                   // sam_trace_stop merges the events into its trace
+} SamConfig;
+
+// Encoder variant listed in a model manifest (sam_get_encoder_variant)
+typedef struct {
+    char name[32];         // Manifest name, e.g. "fp32" or "int8"
+    uint64_t file_bytes;   // Model file size
+    bool quantized;        // Graph contains QDQ or integer (dynamic quantization) ops
+    bool active;           // Currently used by sam_encode_image / sam_segment
+    float latency_ms;      // Median encoder time from sam_select_encoder (0 = not measured)
+    float min_iou;         // Worst mask IoU vs the reference (-1 = not measured)
+} SamEncoderVariantInfo;
+
+// Header of an embedding file (sam_embedding_map)
+typedef struct {
+    uint32_t version;      // SAM_EMBEDDING_FILE_VERSION
+    int dtype;             // SAM_DTYPE_FLOAT32 or SAM_DTYPE_FLOAT16
+    int image_width;       // Original image size the embedding was computed from
+    int image_height;
+    float scale_x;         // Same values sam_preprocess_image returned
+    float scale_y;
+    uint64_t model_hash;   // Encoder that produced it (sam_get_encoder_hash)
+} SamEmbeddingFileInfo;
+
+// Embedding file mapped by sam_embedding_map (opaque)
+typedef struct SamMappedEmbedding SamMappedEmbedding;
+
+// Async job status (sam_job_poll / sam_job_wait / callbacks)
+typedef enum {
+    SAM_JOB_UNKNOWN = -1,    // Invalid or released job id
+    SAM_JOB_PENDING = 0,     // Queued
+    SAM_JOB_RUNNING = 1,
+    SAM_JOB_DONE = 2,
+    SAM_JOB_FAILED = 3,
+    SAM_JOB_CANCELLED = 4
+} SamJobStatus;
+
+/**
+ * Job completion callback, invoked on the context worker thread.
+ * From Dart, pass a NativeCallable<...>.listener function pointer.
+ */
+typedef void (*SamJobCallback)(int64_t job_id, int32_t status, void* user_data);
+
+// Latency of one stage since start or sam_reset_stats
+typedef struct {
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t min_us;
+    uint64_t max_us;
+    float mean_ms;
+    float p50_ms;             // Percentiles interpolated from the histogram
+    float p90_ms;
+    float p99_ms;
+    uint32_t histogram[SAM_STATS_BUCKETS];
+} SamStageStats;
+
+// Process-wide instrumentation (sam_get_stats)
+typedef struct {
+    SamStageStats stages[SAM_STAGE_COUNT];  // Indexed by SAM_STAGE_*
+    uint64_t trace_events;                  // Events buffered by the active trace
+    uint64_t trace_dropped;                 // Events lost because the trace buffer was full
+    bool tracing;
+} SamStats;
+
+typedef struct {
+    uint64_t capacity;        // Bytes reserved (sized at sam_init)
+    uint64_t high_water;      // Peak bytes used by a single call
+    uint64_t overflow_count;  // Requests that spilled to the heap
+} SamArenaStats;
+
 typedef struct {
     void* encoder_session;
     void* decoder_session;
@@ -64,6 +252,19 @@ typedef struct {
     bool initialized;
 } SamContext;
 
+// Model shared by a pool of contexts (sam_model_create, opaque)
+typedef struct SamModel SamModel;
+
+// Context pool occupancy (sam_model_get_stats)
+typedef struct {
+    int max_contexts;         // Pool limit
+    int contexts;             // Contexts created so far (created on demand)
+    int in_use;               // Contexts currently acquired
+    uint64_t acquires;        // Successful sam_model_acquire calls
+    uint64_t waits;           // Acquires that had to wait for a release
+    uint64_t timeouts;        // Acquires that gave up
+} SamModelStats;
+
 // ============================================================
 // API FUNCTIONS (Export these via FFI)
 // ============================================================
@@ -77,12 +278,82 @@ typedef struct {
 SamContext* sam_init(const char* encoder_path, const char* decoder_path);
 
 /**
- * Free SAM context
+ * Initialize SAM context with startup options
+ * With options->cache_dir set, the first launch saves each optimized
+ * graph (ORT format) there and later launches load it directly,
+ * skipping ONNX parsing and graph optimization. Cache files are keyed
+ * on the model path, size, mtime and ORT version; stale or damaged
+ * files are rebuilt.
+ * @param encoder_path Path to sam_encoder.onnx
+ * @param decoder_path Path to sam_decoder.onnx
+ * @param options Startup options (NULL = same as sam_init)
+ * @return SamContext pointer (NULL on failure)
+ */
+SamContext* sam_init_with_options(
+    const char* encoder_path,
+    const char* decoder_path,
+    const SamStartupOptions* options
+);
+
+/**
+ * Initialize SAM context with session configuration
+ * Settings ONNX Runtime rejects are dropped rather than failing init
+ * (an affinity list that does not match the thread count, a provider
+ * missing from this build); sam_get_effective_config reports what was
+ * applied. With XNNPACK the thread budget goes to the XNNPACK pool,
+ * ONNX Runtime's own pool runs single-threaded and does not spin.
+ * @param encoder_path Path to sam_encoder.onnx
+ * @param decoder_path Path to sam_decoder.onnx
+ * @param config Configuration (NULL = same as sam_init)
+ * @return SamContext pointer (NULL on failure)
+ */
+SamContext* sam_init_with_config(
+    const char* encoder_path,
+    const char* decoder_path,
+    const SamConfig* config
+);
+
+/**
+ * Report the configuration that took effect
+ * Defaults are filled in (e.g. intra_op_threads = 4); string pointers
+ * stay valid until sam_free.
+ * @return true on success
+ */
+bool sam_get_effective_config(SamContext* ctx, SamConfig* config);
+
+/**
+ * Initialize SAM context from a model manifest
+ * Text file listing encoder variants and the decoder, one per line:
+ *   encoder fp32 sam_encoder.onnx
+ *   encoder int8 sam_encoder_int8.onnx
+ *   decoder sam_decoder.onnx
+ * Relative paths resolve against the manifest's directory; '#' starts
+ * a comment. The first encoder is the accuracy reference for
+ * sam_select_encoder and is the one loaded initially.
+ * @param manifest_path Path to the manifest
+ * @param config Configuration (NULL = defaults)
+ * @return SamContext pointer (NULL on failure)
+ */
+SamContext* sam_init_with_manifest(const char* manifest_path, const SamConfig* config);
+
+/**
+ * Time spent in each init phase
+ * @return true on success
+ */
+bool sam_get_startup_stats(SamContext* ctx, SamStartupStats* stats);
+
+/**
+ * Free SAM context (contexts from sam_model_acquire are ignored; release them)
  */
 void sam_free(SamContext* ctx);
 
 /**
  * Preprocess image for SAM
+ * Single fused pass: bilinear resize, normalization and NCHW packing
+ * write straight into the output; only the padding is zeroed. Values
+ * match the textbook (bilinear / 255 - mean) / std formula within
+ * 1e-5 absolute (the interpolation is evaluated as lerps and the
+ * normalization as one multiply-add).
  * @param rgb_data Raw RGB bytes [H, W, 3]
  * @param width Original image width
  * @param height Original image height
@@ -99,8 +370,59 @@ void sam_preprocess_image(
     float* scale_y
 );
 
+/**
+ * Preprocess image using the context worker pool
+ * Same output as sam_preprocess_image; rows are split into bands
+ * across sam_get_num_threads() threads. Runs serially if ctx is NULL.
+ */
+void sam_preprocess_image_parallel(
+    SamContext* ctx,
+    const uint8_t* rgb_data,
+    int width,
+    int height,
+    float* output,
+    float* scale_x,
+    float* scale_y
+);
+
+/**
+ * Preprocess a camera frame for SAM
+ * Same fused resize / normalize / NCHW pass as sam_preprocess_image,
+ * reading the frame's planes directly: colour conversion happens per
+ * sampled pixel, so only the source pixels the 1024 grid samples are
+ * read and no RGB copy of the frame is made. YUV is converted as BT.601
+ * full range (Android camera frames) with 8-bit rounding, so the output
+ * matches converting to RGB888 first (to within one 8-bit level).
+ * @param image Frame planes, strides and format (SAM_PIXEL_*)
+ * @param output Preallocated buffer [1, 3, 1024, 1024]
+ * @param scale_x Output: x scale factor for coordinate mapping
+ * @param scale_y Output: y scale factor for coordinate mapping
+ * @return false for an unknown format or missing planes
+ */
+bool sam_preprocess_frame(
+    const SamImage* image,
+    float* output,
+    float* scale_x,
+    float* scale_y
+);
+
+/**
+ * Preprocess a camera frame using the context worker pool
+ * Same output as sam_preprocess_frame. Runs serially if ctx is NULL.
+ */
+bool sam_preprocess_frame_parallel(
+    SamContext* ctx,
+    const SamImage* image,
+    float* output,
+    float* scale_x,
+    float* scale_y
+);
+
 /**
  * Run Image Encoder (HEAVY - call once per image)
+ * The encoder writes directly into embedding->data (no output copy).
+ * With embedding->dtype = SAM_DTYPE_FLOAT16 the output is converted
+ * to half precision into embedding->half_data instead.
  * @param ctx SAM context
  * @param preprocessed_image [1, 3, 1024, 1024] normalized tensor
  * @param embedding Output embedding (preallocated)
@@ -112,8 +434,61 @@ bool sam_encode_image(
     SamEmbedding* embedding
 );
 
+/**
+ * Run Image Encoder on several images, several per encoder run
+ * Images go through in runs of sam_get_encode_batch_size (the tail
+ * run is shorter), which keeps wide CPUs busy where a single image
+ * leaves cores idle. Encoders exported with a static batch of 1, or
+ * that reject a stacked input when run, get one run per image; a
+ * stacked run that fails (e.g. out of memory) is retried at half the
+ * size and the smaller size is kept. Each embedding's dtype picks its
+ * storage as in sam_encode_image. A run counts as one encode call in
+ * sam_get_stats.
+ * @param ctx SAM context
+ * @param preprocessed_images Images [num_images], each [1, 3, 1024, 1024];
+ *        images already laid out back to back are not copied
+ * @param num_images Number of images
+ * @param embeddings Output embeddings [num_images] (preallocated)
+ * @return Images encoded, in order (less than num_images if a run
+ *         failed), -1 on invalid arguments
+ */
+int sam_encode_images(
+    SamContext* ctx,
+    const float* const* preprocessed_images,
+    int num_images,
+    SamEmbedding* embeddings
+);
+
+/**
+ * Set the memory sam_encode_images may use per encoder run
+ * Runs take budget_bytes / image_bytes images (1 to SAM_MAX_ENCODE_BATCH).
+ * For encoders other than SAM ViT-B, pass image_bytes as measured (peak
+ * memory of one sam_encode_image call).
+ * @param ctx SAM context
+ * @param budget_bytes Budget per run (0 = SAM_DEFAULT_ENCODE_BUDGET)
+ * @param image_bytes Peak memory of one image (0 = SAM_ENCODE_IMAGE_BYTES)
+ * @return true on success
+ */
+bool sam_set_encode_budget(SamContext* ctx, uint64_t budget_bytes, uint64_t image_bytes);
+
+/**
+ * Images per sam_encode_images run (1 when the encoder cannot batch)
+ */
+int sam_get_encode_batch_size(SamContext* ctx);
+
 /**
  * Run Mask Decoder (LIGHT - call per prompt)
+ * Inputs and outputs are bound by address and kept bound between
+ * calls: successive clicks on the same embedding with the same result
+ * buffers skip tensor creation and copies entirely. FLOAT16 embeddings
+ * are fed natively to fp16 decoders, otherwise widened once per
+ * embedding into a context buffer.
+ * Refinement: with a decoder exported with mask_input / has_mask_input
+ * (sam_has_mask_input), the context keeps the best low-res mask of the
+ * last decode per embedding. A follow-up prompt that repeats those
+ * points and adds more (a corrective click) gets it as mask_input, so
+ * the decoder refines the previous mask instead of starting over. Any
+ * other prompt decodes from scratch.
  * @param ctx SAM context
  * @param embedding Image embedding from encoder
  * @param prompt Point prompt
@@ -127,8 +502,49 @@ bool sam_decode_mask(
     SamMaskResult* result
 );
 
+/**
+ * Run Mask Decoder for several prompts in one batched decoder call
+ * Prompts may have different point counts; shorter ones are padded
+ * with (0, 0) points labelled -1, as SAM's own predictor does. Falls
+ * back to one decoder call per prompt when the decoder was exported
+ * with a static batch of 1. Either way prompts are decoded from scratch
+ * (no mask_input) and leave the refinement state alone.
+ * @param ctx SAM context
+ * @param embedding Image embedding shared by all prompts
+ * @param prompts Array of point prompts [num_prompts]
+ * @param num_prompts Number of prompts
+ * @param results Output masks, one per prompt (preallocated)
+ * @return true on success
+ */
+bool sam_decode_masks_batch(
+    SamContext* ctx,
+    const SamEmbedding* embedding,
+    const SamPointPrompt* prompts,
+    int num_prompts,
+    SamMaskResult* results
+);
+
+/**
+ * Whether the decoder takes mask_input / has_mask_input, i.e. whether
+ * follow-up decodes refine the previous mask
+ */
+bool sam_has_mask_input(SamContext* ctx);
+
+/**
+ * Forget previous masks, so the next decode starts from the points alone
+ * (e.g. when the user clears the clicks to outline another object)
+ * @param ctx SAM context
+ * @param embedding Embedding whose mask to forget (NULL = all)
+ */
+void sam_reset_mask_input(SamContext* ctx, const SamEmbedding* embedding);
+
 /**
  * Postprocess mask to original image size
+ * Low-res cells whose four corners are all clearly above or below the
+ * threshold are filled with memset; bilinear interpolation only runs
+ * in the boundary band. Output is bit-identical to
+ * sam_postprocess_mask_dense (checked by sam_bench verify/postprocess/...
+ * for smooth, noisy, denormal, plateau and NaN logits).
  * @param mask Low-res mask [256, 256]
  * @param output_width Target width
  * @param output_height Target height
@@ -143,6 +559,88 @@ void sam_postprocess_mask(
     float threshold
 );
 
+/**
+ * Postprocess mask interpolating every output pixel
+ * Reference for sam_postprocess_mask (same parameters and output).
+ */
+void sam_postprocess_mask_dense(
+    const float* mask,
+    int output_width,
+    int output_height,
+    uint8_t* output,
+    float threshold
+);
+
+/**
+ * Postprocess mask using the context worker pool
+ * Same output as sam_postprocess_mask; rows are split into bands
+ * across sam_get_num_threads() threads. Runs serially if ctx is NULL.
+ */
+void sam_postprocess_mask_parallel(
+    SamContext* ctx,
+    const float* mask,
+    int output_width,
+    int output_height,
+    uint8_t* output,
+    float threshold
+);
+
+/**
+ * IoU of two low-res masks after thresholding
+ * Used to compare masks from different embedding precisions or encoder
+ * variants against a float32 reference.
+ * @param mask_a First mask logits [count]
+ * @param mask_b Second mask logits [count]
+ * @param count Number of values (e.g. 256 * 256)
+ * @param threshold Binarization threshold (default 0.0)
+ * @return IoU in [0, 1] (1 when both masks are empty)
+ */
+float sam_mask_iou(const float* mask_a, const float* mask_b, int count, float threshold);
+
+/**
+ * Encode a low-res mask compactly instead of as a W*H byte buffer
+ * Runs describe exactly the pixels sam_postprocess_mask would set. The
+ * contour is the outline of the largest component, traced by marching
+ * squares on the logits with sub-pixel crossings and simplified with
+ * Douglas-Peucker (holes and smaller components are not outlined).
+ * @param mask Low-res mask [256, 256]
+ * @param output_width Original image width
+ * @param output_height Original image height
+ * @param threshold Binarization threshold (default 0.0)
+ * @param epsilon Simplification tolerance in original pixels (0 = keep every point)
+ * @param out Caller buffers; counts, size and area are written back
+ * @return false if a buffer was too small (num_runs / num_points then
+ *         hold the required sizes) or on invalid arguments
+ */
+bool sam_mask_to_compact(
+    const float* mask,
+    int output_width,
+    int output_height,
+    float threshold,
+    float epsilon,
+    SamCompactMask* out
+);
+
+/**
+ * Runs only: sam_mask_to_compact without the contour, so no outline is
+ * traced and no scratch memory is allocated (foot_measure_logits)
+ * @param mask Low-res mask [256, 256]
+ * @param output_width Original image width
+ * @param output_height Original image height
+ * @param threshold Binarization threshold (default 0.0)
+ * @param out Caller buffers; num_runs, size and area are written back,
+ *            num_points is set to 0 and contour is not touched
+ * @return false if runs was too small (num_runs then holds the required
+ *         size) or on invalid arguments
+ */
+bool sam_mask_to_runs(
+    const float* mask,
+    int output_width,
+    int output_height,
+    float threshold,
+    SamCompactMask* out
+);
+
 /**
  * Convert original image coordinates to SAM 1024x1024 space
  */
@@ -152,12 +650,384 @@ void sam_transform_coords(
     float* sam_x, float* sam_y
 );
 
+// ============================================================
+// ASYNC JOBS
+// ============================================================
+// Jobs run one at a time, in submission order, on a worker thread owned
+// by the context. Buffers passed in must stay valid until the job has
+// finished (prompts are copied). Finished jobs are kept until released.
+
+/**
+ * Queue an encoder run without blocking
+ * @param ctx SAM context
+ * @param preprocessed_image [1, 3, 1024, 1024] normalized tensor
+ * @param embedding Output embedding (preallocated)
+ * @param supersede Cancel every pending or running encode first
+ *                  (e.g. the user retook the photo)
+ * @param callback Completion callback (may be NULL)
+ * @param user_data Passed back to the callback
+ * @return Job id (0 on failure)
+ */
+int64_t sam_encode_async(
+    SamContext* ctx,
+    const float* preprocessed_image,
+    SamEmbedding* embedding,
+    bool supersede,
+    SamJobCallback callback,
+    void* user_data
+);
+
+/**
+ * Queue a decoder run without blocking
+ * @return Job id (0 on failure)
+ */
+int64_t sam_decode_async(
+    SamContext* ctx,
+    const SamEmbedding* embedding,
+    const SamPointPrompt* prompt,
+    SamMaskResult* result,
+    SamJobCallback callback,
+    void* user_data
+);
+
+/**
+ * Current job status (SamJobStatus), never blocks
+ */
+int sam_job_poll(SamContext* ctx, int64_t job_id);
+
+/**
+ * Wait for a job to finish
+ * @param timeout_ms Maximum wait (negative = forever)
+ * @return Job status (SamJobStatus) when the wait ended
+ */
+int sam_job_wait(SamContext* ctx, int64_t job_id, int timeout_ms);
+
+/**
+ * Cancel a job. Pending jobs are dropped; a running job's ONNX Runtime
+ * call is terminated (RunOptions::SetTerminate) and ends CANCELLED.
+ * @return true if the job was still pending or running
+ */
+bool sam_cancel(SamContext* ctx, int64_t job_id);
+
+/**
+ * Forget a finished job id
+ */
+void sam_job_release(SamContext* ctx, int64_t job_id);
+
+// ============================================================
+// SHARED MODEL
+// ============================================================
+// One SamModel per process loads the encoder and decoder once; its
+// contexts share those ONNX Runtime sessions (weights, prepacked
+// kernels, intra-op thread pools) and each add only what a call needs
+// to itself: decoder bindings, scratch arena, embedding cache, job
+// queue and pre/postprocessing pool. Acquire a context per thread of
+// work; N concurrent segmentations cost about one model's memory plus
+// N scratch arenas (~17 MB each).
+
+/**
+ * Load a model shared by a pool of contexts
+ * The intra-op thread budget (SamConfig::intra_op_threads) is split
+ * evenly across max_contexts for pre/postprocessing pools.
+ * @param encoder_path Path to sam_encoder.onnx
+ * @param decoder_path Path to sam_decoder.onnx
+ * @param config Configuration (NULL = defaults)
+ * @param max_contexts Pool limit (0 = hardware threads)
+ * @return SamModel pointer (NULL on failure)
+ */
+SamModel* sam_model_create(
+    const char* encoder_path,
+    const char* decoder_path,
+    const SamConfig* config,
+    int max_contexts
+);
+
+/**
+ * Check out a context for the calling thread
+ * Idle contexts are reused; new ones are created until max_contexts.
+ * A context is an ordinary SamContext for every sam_* call, except
+ * that encoder variants cannot be switched and sam_free ignores it.
+ * @param timeout_ms Wait for a release this long (-1 = forever, 0 = don't wait)
+ * @return Context (NULL on timeout or failure)
+ */
+SamContext* sam_model_acquire(SamModel* model, int timeout_ms);
+
+/**
+ * Return a context to the pool
+ * Its embedding cache is kept, so the next holder may hit it. Wait for
+ * or cancel its async jobs first.
+ * @return false if ctx is not an acquired context of this model
+ */
+bool sam_model_release(SamModel* model, SamContext* ctx);
+
+/**
+ * Read pool occupancy
+ * @return true on success
+ */
+bool sam_model_get_stats(SamModel* model, SamModelStats* stats);
+
+/**
+ * Free the model and all its contexts (none may still be in use)
+ */
+void sam_model_free(SamModel* model);
+
+// ============================================================
+// THREADING AND SCRATCH MEMORY
+// ============================================================
+
+/**
+ * Set the number of threads used for pre/postprocessing
+ * The pool only runs while ONNX Runtime's intra-op threads are idle,
+ * so by default it matches their count (SamConfig::intra_op_threads,
+ * 4 unless configured).
+ * @param ctx SAM context
+ * @param num_threads Thread count including the caller (0 = default)
+ * @return true on success
+ */
+bool sam_set_num_threads(SamContext* ctx, int num_threads);
+
+/**
+ * Get the number of pre/postprocessing threads
+ */
+int sam_get_num_threads(SamContext* ctx);
+
+/**
+ * Read scratch arena statistics
+ * sam_segment takes all per-call buffers from a 64-byte aligned arena
+ * sized at sam_init (~17 MB). A call that needs more spills to the
+ * heap once (overflow_count) and the arena then grows to high_water,
+ * so steady-state segmentation performs no heap allocations.
+ * @return true on success
+ */
+bool sam_get_arena_stats(SamContext* ctx, SamArenaStats* stats);
+
+// ============================================================
+// INSTRUMENTATION
+// ============================================================
+// Every stage call (SAM_STAGE_*) is timed on a monotonic clock into
+// process-wide counters: a few relaxed atomic adds per call, no locks.
+// While a trace is active each call is also buffered as a Chrome
+// trace event (chrome://tracing, ui.perfetto.dev).
+
+/**
+ * Read per-stage latency counters and histograms
+ * @return true on success
+ */
+bool sam_get_stats(SamStats* stats);
+
+/**
+ * Clear all stage counters (an active trace is not affected)
+ */
+void sam_reset_stats(void);
+
+/**
+ * Stage name used in traces ("preprocess", "encode", ...), NULL if invalid
+ */
+const char* sam_stage_name(int stage);
+
+/**
+ * Current time on the clock stages are timed with, in microseconds
+ */
+int64_t sam_stats_now_us(void);
+
+/**
+ * Record a stage timing measured outside this library's own calls
+ * (the ArUco and foot measurement modules use it; apps may add their
+ * own work, e.g. image decoding, under the closest stage)
+ * @param stage SAM_STAGE_*
+ * @param start_us Start time from sam_stats_now_us
+ * @param duration_us Duration in microseconds
+ */
+void sam_stats_record(int stage, int64_t start_us, int64_t duration_us);
+
+/**
+ * Start buffering trace events
+ * @param max_events Buffer size; later events are counted as dropped (0 = 1M, ~24 MB)
+ * @return false if a trace is already running
+ */
+bool sam_trace_start(int max_events);
+
+/**
+ * Stop the trace and write it as Chrome trace-event JSON
+ * If ctx was created with SamConfig::profile_prefix, ORT's profiling of
+ * the active encoder and the decoder is ended and its per-operator
+ * events are merged in on the same timeline (ORT cannot restart
+ * profiling on a live session, so only the first merge gets them).
+ * @param ctx Context whose ORT profiling to merge (NULL = library events only;
+ *            a SamModel context merges the model's shared sessions)
+ * @param path Output file
+ * @return false if no trace was running or the file could not be written
+ */
+bool sam_trace_stop(SamContext* ctx, const char* path);
+
+// ============================================================
+// EMBEDDING CACHE
+// ============================================================
+
+/**
+ * Set the embedding cache byte budget used by sam_segment
+ * Images are keyed by a hash of their RGB bytes and dimensions, so
+ * repeat segmentations of the same photo only run the decoder.
+ * Least recently used entries are evicted to fit the new budget.
+ * @param ctx SAM context
+ * @param max_bytes Budget in bytes (0 disables caching)
+ */
+void sam_set_cache_budget(SamContext* ctx, uint64_t max_bytes);
+
+/**
+ * Drop all cached embeddings (counters are kept)
+ */
+void sam_clear_cache(SamContext* ctx);
+
+/**
+ * Set how sam_segment stores cached embeddings
+ * SAM_DTYPE_FLOAT16 halves embedding memory (2 MB per image), so the
+ * same budget holds twice as many images. Clears the cache.
+ * Accuracy: sam_bench (verify/fp16_embedding/mask_iou) requires the
+ * best mask decoded from a FLOAT16 embedding to keep IoU >= 0.99 with
+ * the fp32 one. On its stand-in models fp16 moves mask logits by at
+ * most 6e-4 and the worst IoU measured is 0.9995; run it with
+ * --encoder / --decoder to measure the models you ship.
+ * @param ctx SAM context
+ * @param dtype SAM_DTYPE_FLOAT32 or SAM_DTYPE_FLOAT16
+ * @return true on success
+ */
+bool sam_set_cache_dtype(SamContext* ctx, int dtype);
+
+/**
+ * Read cache counters
+ * @param ctx SAM context
+ * @param stats Output statistics
+ * @return true on success
+ */
+bool sam_get_cache_stats(SamContext* ctx, SamCacheStats* stats);
+
+/**
+ * Reset hit/miss/eviction counters
+ */
+void sam_reset_cache_stats(SamContext* ctx);
+
+// ============================================================
+// EMBEDDING FILES
+// ============================================================
+// One embedding per file: a 64-byte header (magic, version, dtype,
+// shape, image size, scale factors, encoder hash, checksum) followed by
+// the raw tensor, little-endian. Reopening a saved session maps the
+// file instead of running the encoder; only decoder runs remain.
+
+/**
+ * Hash identifying the active encoder model (content hash of its file)
+ * Computed on first use (reads the model file once) and cached.
+ * @return Hash, 0 on failure
+ */
+uint64_t sam_get_encoder_hash(SamContext* ctx);
+
+/**
+ * Save an embedding to a file
+ * Written to a temporary file and renamed, so a crash never leaves a
+ * truncated file under path.
+ * @param ctx SAM context (its active encoder must have produced the embedding)
+ * @param embedding FLOAT32 or FLOAT16 embedding
+ * @param image_width Original image width
+ * @param image_height Original image height
+ * @param path Output file
+ * @return true on success
+ */
+bool sam_embedding_save(
+    SamContext* ctx,
+    const SamEmbedding* embedding,
+    int image_width,
+    int image_height,
+    const char* path
+);
+
+/**
+ * Map an embedding file and point embedding into it (no copy)
+ * The header and checksum are verified and the file must come from
+ * the active encoder (same sam_get_encoder_hash). The tensor is
+ * read-only: pass embedding to sam_decode_mask / sam_decode_masks_batch
+ * only, until sam_embedding_unmap.
+ * @param ctx SAM context
+ * @param path Embedding file
+ * @param embedding Output: data or half_data points into the mapping
+ * @param info Output header (may be NULL); filled whenever the header
+ *             is readable, so a model hash mismatch can be told apart
+ * @return Mapping handle, NULL if missing, corrupt or from another encoder
+ */
+SamMappedEmbedding* sam_embedding_map(
+    SamContext* ctx,
+    const char* path,
+    SamEmbedding* embedding,
+    SamEmbeddingFileInfo* info
+);
+
+/**
+ * Release a mapping from sam_embedding_map (embeddings into it become invalid)
+ */
+void sam_embedding_unmap(SamMappedEmbedding* mapping);
+
+// ============================================================
+// ENCODER VARIANTS
+// ============================================================
+// Only the active encoder stays loaded. Switching variants clears the
+// embedding cache; do not switch while sam_segment runs on another
+// thread.
+
+/**
+ * Number of encoder variants (1 for contexts created with sam_init)
+ */
+int sam_get_encoder_variant_count(SamContext* ctx);
+
+/**
+ * Describe an encoder variant
+ * @param ctx SAM context
+ * @param index Variant index in manifest order
+ * @param info Output info
+ * @return true on success
+ */
+bool sam_get_encoder_variant(SamContext* ctx, int index, SamEncoderVariantInfo* info);
+
+/**
+ * Load and activate an encoder variant (waits for running encodes)
+ * @return true on success (false on SamModel contexts, which share one encoder)
+ */
+bool sam_set_encoder_variant(SamContext* ctx, int index);
+
+/**
+ * Pick the fastest encoder variant meeting an accuracy threshold
+ * Every variant encodes each reference image (after one warm-up run)
+ * and the decoder runs one foreground click per image. Masks are
+ * compared against variant 0; a variant qualifies when its worst IoU is
+ * at least min_iou, and the qualifying variant with the lowest median
+ * encoder time on this CPU becomes active. Takes a few seconds per
+ * variant; results are kept in SamEncoderVariantInfo.
+ * @param ctx SAM context
+ * @param images RGB images [num_images] (HWC, uint8)
+ * @param widths Image widths [num_images]
+ * @param heights Image heights [num_images]
+ * @param points_xy Foreground click per image in original coordinates [num_images * 2]
+ * @param num_images Number of reference images
+ * @param min_iou Required worst-case IoU vs the reference (e.g. 0.9)
+ * @return Index of the selected variant, -1 on failure (or on a SamModel context)
+ */
+int sam_select_encoder(
+    SamContext* ctx,
+    const uint8_t* const* images,
+    const int* widths,
+    const int* heights,
+    const float* points_xy,
+    int num_images,
+    float min_iou
+);
+
 // ============================================================
 // CONVENIENCE FUNCTION (All-in-one)
 // ============================================================
 
 /**
  * Full inference pipeline
+ * The image embedding is looked up in the context cache first; the
+ * encoder only runs for images not seen before.
  * @param ctx SAM context
  * @param rgb_data RGB image bytes
  * @param width Image width
@@ -167,7 +1037,8 @@ void sam_transform_coords(
  * @param labels Point labels (1=fg, 0=bg)
  * @param num_points Number of points
  * @param output_mask Preallocated mask buffer [height, width]
- * @return IoU score of best mask
+ * @return IoU score of best mask (the model's prediction, which can be
+ *         negative), or exactly -1 on failure
  */
 float sam_segment(
     SamContext* ctx,
@@ -181,6 +1052,30 @@ float sam_segment(
     uint8_t* output_mask
 );
 
+/**
+ * Full inference pipeline with a compact result
+ * Same as sam_segment, but the best mask is returned as run lengths and
+ * a simplified outline (sam_mask_to_compact, threshold 0) - kilobytes
+ * instead of a width*height buffer. If a buffer is too small the
+ * required sizes are written and -1 is returned; the embedding stays
+ * cached, so retrying with larger buffers only reruns the decoder.
+ * @param epsilon Outline simplification tolerance in original pixels
+ * @param out Caller buffers for runs and contour
+ * @return IoU score of best mask, or -1 on failure
+ */
+float sam_segment_compact(
+    SamContext* ctx,
+    const uint8_t* rgb_data,
+    int width,
+    int height,
+    const float* points_x,
+    const float* points_y,
+    const int* labels,
+    int num_points,
+    float epsilon,
+    SamCompactMask* out
+);
+
 #ifdef __cplusplus
 }
 #endif